@@ -1,11 +1,16 @@
 
+#include <cstdlib>
+
+#include <sys/stat.h>
+
 #include "Poco/Util/ServerApplication.h"
 
-#include "Poco/PriorityNotificationQueue.h"
 #include "Poco/Thread.h"
 #include "Poco/Logger.h"
 #include "Poco/StringTokenizer.h"
+#include "Poco/String.h"
 #include "Poco/Glob.h"
+#include "Poco/File.h"
 
 #include <rsync/rsync_client.h>
 
@@ -22,223 +27,343 @@
 
 #include "SourceSync.h"
 #include "AcrosyncWorker.h"
+#include "Settings.h"
 
 #include "config.h"
 
 
 
-AcrosyncWorker::AcrosyncWorker ( const std::string &name, Poco::PriorityNotificationQueue *queue) : SyncWorker(name, queue), logger_(Poco::Logger::get("Acrosync")) 
-{ 
-    FUNCTIONTRACE;
+// queues a job the RateLimiter held back again once its bytes are reserved
+class AcrosyncWorker::Requeue : public RateLimiter::Ticket
+{
 
-    logger_.debug( "Creating " + name_ );
+    public:
+        Requeue( Queue &queue, SyncJob *job ) : queue_(queue), job_(job, true) {};
 
-    remote_ = new Poco::URI( Poco::Util::Application::instance().config().getString( CONFIG_DEST ) );
+        virtual void admitted()
+        {
+            // admitted at once, the worker carries on with the job
+            if ( waited() == false ) {
 
+                return;
+            }
 
-    std::string ignore = Poco::Util::Application::instance().config().getString( CONFIG_IGNORE, "" );
+            SyncJob *retry = new SyncJob( job_->kind(), job_->pathId(), job_->mapping(), job_->destination(), job_->flags() | SyncJob::ADMITTED );
 
-    if ( ignore.empty() == false ) {
+            retry->setJournal( job_->journal() );
 
-        Poco::StringTokenizer tok( ignore, " ", Poco::StringTokenizer::TOK_TRIM );
+            queue_.enqueue( retry, (JobScheduler::Priority) job_->priority() );
 
-        for ( int i = 0; i < tok.count(); i++ ) {
+            // outstanding until the retry is
+            queue_.finished( *job_ );
+        };
 
-            ignore_.push_back( new Poco::Glob( tok[i] ) );
-        }
+    private:
+        Queue &queue_;
+        Poco::AutoPtr<SyncJob> job_;
+};
 
-    }
+AcrosyncWorker::AcrosyncWorker ( const std::string &name, int index, Queue *owner ) : SyncWorker(name, index, owner), logger_(Poco::Logger::get("Acrosync")) 
+{ 
+    FUNCTIONTRACE;
 
+    LOG_DEBUG( logger_, "Creating " + name_ );
 
     initialize();
 }
 
+AcrosyncWorker::~AcrosyncWorker()
+{
+}
+
 void AcrosyncWorker::initialize()
 {
+    // sessions come from the Queue's SSHPool when a job needs one
+}
+
+
+// the exec channel does not give us the command's exit status, so the
+// command prints it after its own output
+#define EXIT_MARKER "\nsrcsync-exit "
+
+bool AcrosyncWorker::runRemote( const Mapping &mapping, const Destination &destination, const std::string &command, std::string *output )
+{
+    std::string remoteDir = "'" + Poco::replace( destination.remote().getPath(), "'", "'\\''" ) + "'";
+
+    std::string cmd = "cd " + remoteDir + " && " + command;
+
+    LOG_DEBUG( logger_, Poco::format("%s: %s", name_, cmd ) );
+
+    if ( Settings::current()->dryRun() ) {
+
+        return true;
+    }
 
-    const char * userC = NULL;
-    const char * passC = NULL;
-    const char * keyC = NULL;
+    // the status of the whole of COMMAND, whatever it chains
+    cmd = "cd " + remoteDir + " && ( " + command + " ); printf '" EXIT_MARKER "%d\\n' $?";
 
-    std::string auth = remote_->getUserInfo();
+    std::string out;
 
-    Poco::StringTokenizer tok( auth, ":", Poco::StringTokenizer::TOK_TRIM );
+    try {
 
-    std::string user = tok[ 0 ];
+        SSHPool::Lease sshio( owner_->sessions(), mapping, destination );
 
-    userC = user.c_str();
+        int cancel = 0;
 
-    std::string key = Poco::Util::Application::instance().config().getString(CONFIG_RSYNC_SSH_KEYFILE, "");
+        // a new exec channel on the session we already hold, nothing
+        // else needs to be negotiated.
+        sshio->createChannel( cmd.c_str(), &cancel );
 
-    std::string pass;
+        char buffer[512];
+        int n;
 
-    if ( tok.count() == 2  ) {
+        // drain output until the command completes
+        while ( ( n = sshio->read( buffer, sizeof(buffer) ) ) > 0 ) {
 
-        pass = tok[ 1 ];
+            out.append( buffer, n );
+        }
+
+        sshio->closeChannel();
+    }
+    catch ( Poco::Exception &ex ) {
 
-        passC = pass.c_str();
+        logger_.error( Poco::format("%s: %s: can not run %s: %s", name_, destination.remote().toString(), command, ex.displayText() ) );
+        return false;
     }
-    else if ( key.empty() == false ) {
 
-        keyC = key.c_str();
+    size_t marker = out.rfind( EXIT_MARKER );
 
+    // the connection went before the command finished
+    if ( marker == std::string::npos ) {
+
+        logger_.error( Poco::format("%s: %s: %s did not finish", name_, destination.remote().toString(), command ) );
+        return false;
     }
 
-    if ( keyC ) {
-        logger_.debug( Poco::format("%s: connecting as %s to %s using keyfile %s %s", name_, user, remote_->getHost(), key , pass) );
+    int status = std::atoi( out.c_str() + marker + sizeof(EXIT_MARKER) - 1 );
+
+    out.resize( marker );
+
+    if ( output ) {
+
+        output->swap( out );
     }
-    else {
-        logger_.debug( Poco::format("%s: connecting as %s to %s using password %s", name_, user, remote_->getHost(), pass ) );
+
+    if ( status != 0 ) {
+
+        logger_.error( Poco::format("%s: %s: %s exited with %d", name_, destination.remote().toString(), command, status ) );
+        return false;
     }
 
-    sshio_.connect(
-            remote_->getHost().c_str(), 
-            remote_->getPort(), 
-            userC, 
-            passC,
-            keyC, 
-            NULL);
+    return true;
 }
 
+bool AcrosyncWorker::admit( const Mapping &mapping, SyncJob *job )
+{
+    if ( ( job->flags() & SyncJob::ADMITTED ) || Settings::current()->dryRun() ) {
 
+        return true;
+    }
 
-void AcrosyncWorker::run()
+    // the library does not say what it sent, a file is reserved whole;
+    // what a directory sends is not known
+    Poco::Int64 estimate = 0;
+
+    struct stat st;
+
+    if ( job->kind() == SyncJob::FILE_SYNC && ::lstat( ( mapping.local().toString() + job->path() ).c_str(), &st ) == 0 && S_ISREG( st.st_mode ) ) {
+
+        estimate = st.st_size;
+    }
+
+    return owner_->bandwidth().admit( trafficClass( *job ), estimate, new Requeue( *owner_, job ) );
+}
+
+bool AcrosyncWorker::syncFile( const Mapping &mapping, Destination &destination, rsync::Client &client, const SyncJob &job )
 {
-    FUNCTIONTRACE;
+    const std::string &path = job.path();
 
-    Poco::AutoPtr<Poco::Notification> n( queue_->waitDequeueNotification() );
+    std::string localPath = mapping.local().toString() + path;
 
-    logger_.information( Poco::format("%s: dequeued", name_ ) );
+    std::string remotePath = destination.remote().getPath() + path;
 
-    int zero = 0;
+    if ( unchanged( mapping, destination, path ) ) {
 
-    while ( n ) {
+        LOG_DEBUG( logger_, Poco::format("%s: %s is unchanged on %s", name_, localPath, destination.remote().toString() ) );
 
-        SyncMessage *req = dynamic_cast<SyncMessage *>( n.get() );
+        destination.unchanged();
+        return true;
+    }
 
-        if ( req ) {
+    LOG_DEBUG( logger_, Poco::format("%s: syncing file %s to %s", name_, localPath, remotePath ) );
 
-            thisApp->jobStart();
+    std::set<std::string> files;
 
-            if ( sshio_.isConnected() == false ) {
+    files.insert( localPath );
 
-                initialize();
-            }
+    if ( Settings::current()->dryRun() == false ) {
 
-            logger_.debug( Poco::format("%s: Received message '%s' for %s", name_, req->type(), req->path()) );
+        if ( upload( client, localPath, remotePath, &files ) == false ) {
 
-            // \TODO
-            // filter out un-interesting file changes, i.e. editor backups etc.
+            destination.failed();
+            return false;
+        }
+    }
 
-            int protocol = Poco::Util::Application::instance().config().getInt( CONFIG_RSYNC_PROTOCOL_VERSION, 32 );
+    destination.synced();
+    transferred( mapping, destination, job );
 
-            rsync::Client client(&sshio_, "rsync", protocol, &zero);
+    LOG_DEBUG( logger_, Poco::format("%s: updated %s", name_, localPath) );
 
-            if ( req && req->type() == MSG_FILE_SYNC ) { 
+    return true;
+}
 
-                FileSyncMessage *msg = dynamic_cast<FileSyncMessage *>( n.get() );
+bool AcrosyncWorker::upload( rsync::Client &client, const std::string &localPath, const std::string &remotePath, std::set<std::string> *files )
+{
+    int numFiles;
 
-                if ( msg ) {
+    try {
 
-                    std::string localPath = msg->path();
+        numFiles = client.upload( localPath.c_str(), remotePath.c_str(), files );
+    }
+    catch ( Poco::Exception &ex ) {
 
-                    bool ignoreThisFile = false;
+        logger_.error( Poco::format("%s: Failed updating %s: %s", name_, localPath, ex.displayText() ) );
+        return false;
+    }
 
-                    if ( ignore_.size() > 0 ) {
+    if ( numFiles < 0 ) {
 
-                        for ( std::vector<Poco::Glob *>::iterator it = ignore_.begin(); it != ignore_.end() ; it++ ) {
+        logger_.error( Poco::format("%s: Failed updating %s", name_, localPath ) );
+        return false;
+    }
 
-                            if ( (*it)->match( localPath ) ) {
+    logger_.notice( Poco::format("Updated %d file(s) %s", numFiles, localPath) );
 
-                                ignoreThisFile = true;
+    return true;
+}
 
-                                break;
-                            }
-                        }
-                    }
+bool AcrosyncWorker::syncDir( const Mapping &mapping, Destination &destination, rsync::Client &client, const SyncJob &job )
+{
+    const std::string &path = job.path();
 
-                    if ( ignoreThisFile ) {
-                        logger_.notice( Poco::format("Ignoring %s", localPath) );
-                    }
-                    else {
-                        std::string remotePath = remote_->getPath();
+    std::string localPath = mapping.local().toString() + path;
 
-                        remotePath += msg->path();
+    std::string remotePath = destination.remote().getPath() + path;
 
-                        logger_.debug( Poco::format("%s: syncing file %s to %s", name_, localPath, remotePath ) );
-                        std::set<std::string> files;
+    LOG_DEBUG( logger_, Poco::format("%s: syncing dir %s to %s", name_, localPath, remotePath ) );
 
-                        files.insert( localPath );
+    if ( Settings::current()->dryRun() == false ) {
 
-                        if ( Poco::Util::Application::instance().config().getString( CONFIG_DRYRUN).empty() == false ) {
-                            int numFiles = client.upload( localPath.c_str(), remotePath.c_str(), &files );
+        if ( upload( client, localPath, remotePath ) == false ) {
 
-                            logger_.notice( Poco::format("Updated %d file(s) %s", numFiles, localPath) );
-                        }
+            destination.failed();
+            return false;
+        }
+    }
 
-                        logger_.debug( Poco::format("%s: updated %s", name_, localPath) );
-                    }
+    destination.synced();
+    transferred( mapping, destination, job );
 
-                }
+    LOG_DEBUG( logger_, Poco::format("%s: updated %s", name_, localPath) );
 
-            }
-            else if ( req->type() == MSG_DIR_SYNC ) { 
+    return true;
+}
 
-                DirSyncMessage *msg = dynamic_cast<DirSyncMessage *>( n.get() );
+void AcrosyncWorker::run()
+{
+    FUNCTIONTRACE;
 
-                if ( msg ) {
+    seedManifests();
 
-                    std::string localPath = msg->path();
+    Poco::AutoPtr<SyncJob> job( next() );
 
-                    bool ignoreThisFile = false;
+    LOG_INFORMATION( logger_, Poco::format("%s: dequeued", name_ ) );
 
-                    if ( ignore_.size() > 0 ) {
+    int zero = 0;
 
-                        for ( std::vector<Poco::Glob *>::iterator it = ignore_.begin(); it != ignore_.end() ; it++ ) {
+    while ( job ) {
 
-                            if ( (*it)->match( localPath ) ) {
+        TRACE_SCOPE_PATH( "transfer", "worker", job->pathId() );
 
-                                ignoreThisFile = true;
+        thisApp->jobStart();
+        owner_->jobStart();
 
-                                break;
-                            }
-                        }
-                    }
+        Mapping &mapping = *thisApp->mapping( job->mapping() );
+        Destination &destination = mapping.destination( job->destination() );
 
-                    if ( ignoreThisFile ) {
-                        logger_.notice( Poco::format("Ignoring %s", localPath) );
+        LOG_DEBUG( logger_, Poco::format("%s: Received %s job for %s:%s, queued %Ldms ago", name_, std::string( job->kindName() ), mapping.name(), job->path(), job->waited() / 1000 ) );
+
+        // over its class's budget the job waits in the limiter, not on
+        // this worker, so interactive jobs are still dequeued
+        bool held = false;
+
+        switch ( job->kind() ) {
+
+            case SyncJob::FILE_SYNC:
+            case SyncJob::DIR_SYNC:
+                if ( admit( mapping, job ) == false ) {
+
+                    held = true;
+                    break;
+                }
+
+                try {
+
+                    // held for this job only, the other workers share it afterwards
+                    SSHPool::Lease sshio( owner_->sessions(), mapping, destination );
+
+                    int protocol = Settings::current()->rsyncProtocol();
+
+                    rsync::Client client(sshio.get(), "rsync", protocol, &zero);
+
+                    if ( job->flags() & SyncJob::RECONCILE ) {
+
+                        verifyManifest( mapping, destination );
                     }
-                    else {
-                        std::string remotePath = remote_->getPath();
 
-                        remotePath += msg->path();
-                        logger_.debug( Poco::format("%s: syncing dir %s to %s", name_, localPath, remotePath ) );
+                    begin( mapping, *job );
 
-                        if ( Poco::Util::Application::instance().config().getString( CONFIG_DRYRUN).empty() == false ) {
-                            int numFiles = client.upload( localPath.c_str(), remotePath.c_str() );
+                    // a failed upload leaves the path outstanding in the journal
+                    if ( job->kind() == SyncJob::FILE_SYNC ) {
 
-                            logger_.notice( Poco::format("Updated %d file(s) %s", numFiles, localPath) );
-                        }
+                        completed( mapping, destination, *job, syncFile( mapping, destination, client, *job ) );
+                    }
+                    else {
 
-                        logger_.debug( Poco::format("%s: updated %s", name_, localPath) );
+                        completed( mapping, destination, *job, syncDir( mapping, destination, client, *job ) );
                     }
                 }
+                catch ( Poco::Exception &ex ) {
 
-            }
-            else {
+                    // the host is unreachable, or the session went; the
+                    // worker carries on with the next job
+                    logger_.error( Poco::format("%s: Failed updating %s:%s: %s", name_, mapping.name(), job->path(), ex.displayText() ) );
 
-                logger_.error("Unknown notification message type '" + req->type() + "'");
+                    destination.failed();
 
-            }
+                    completed( mapping, destination, *job, false );
+                }
+                break;
 
-            thisApp->jobEnd();
+            case SyncJob::DELETE_SYNC:
+                syncDeletes( mapping, destination );
+                break;
+        }
+
+        if ( held == false ) {
 
-            logger_.information( Poco::format("%s: %d task(s) remain to processed", name_, thisApp->jobCount() ) );
+            owner_->finished( *job );
         }
 
+        owner_->jobEnd();
+        thisApp->jobEnd();
+
+        TRACE_INSTANT( "complete", "worker", job->pathId() );
 
-        n = queue_->waitDequeueNotification();
+        LOG_INFORMATION( logger_, Poco::format("%s: %d task(s) remain to be processed for %s", name_, owner_->pending(), owner_->name() ) );
+
+        job = next();
     }
 
 }
-
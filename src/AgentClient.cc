@@ -0,0 +1,594 @@
+/**
+ * \file AgentClient.cc
+ *
+ * \brief - srcsync's end of the connection to a srcsync-agent
+ *
+ */
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <poll.h>
+#include <sys/wait.h>
+
+#include "Poco/Event.h"
+#include "Poco/Format.h"
+#include "Poco/Exception.h"
+
+#include "AgentClient.h"
+
+extern char **environ;
+
+#define AGENT_READ_SIZE ( 64 * 1024 )
+
+class AgentClient::Batch::Member : public AgentClient::Request
+{
+
+    public:
+        Member( Batch &batch ) : batch_(batch) {};
+
+        virtual void finished( bool ok, const std::string &error )
+        {
+            Poco::FastMutex::ScopedLock lock( batch_.mutex_ );
+
+            if ( ok == false && batch_.failed_++ == 0 ) {
+
+                batch_.error_ = error;
+            }
+
+            if ( --batch_.outstanding_ == 0 ) {
+
+                batch_.done_.broadcast();
+            }
+        };
+
+    private:
+        Batch &batch_;
+};
+
+AgentClient::Request *AgentClient::Batch::add()
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    outstanding_++;
+
+    return new Member( *this );
+}
+
+bool AgentClient::Batch::wait()
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    while ( outstanding_ > 0 ) {
+
+        done_.wait( mutex_ );
+    }
+
+    return failed_ == 0;
+}
+
+namespace {
+
+// the answer to a synchronous request
+class Answer : public AgentClient::Request
+{
+
+    public:
+        Answer( Poco::Event &done, bool &ok, std::string &error, std::vector<Agent::Entry> *entries ) :
+            done_(done), ok_(ok), error_(error), entries_(entries) {};
+
+        virtual void answered( Agent::Reader &args )
+        {
+            if ( entries_ ) {
+
+                Poco::UInt32 count = args.u32();
+
+                entries_->resize( count );
+
+                for ( Poco::UInt32 i = 0; i < count; i++ ) {
+
+                    args.entry( (*entries_)[i] );
+                }
+            }
+        };
+
+        virtual void finished( bool ok, const std::string &error )
+        {
+            ok_ = ok;
+            error_ = error;
+
+            done_.set();
+        };
+
+    private:
+        Poco::Event &done_;
+        bool &ok_;
+        std::string &error_;
+        std::vector<Agent::Entry> *entries_;
+};
+
+}
+
+AgentClient::AgentClient( const std::string &name, const std::string &command, const std::vector<std::string> &args ) :
+    name_(name),
+    command_(command),
+    args_(args),
+    pid_(0),
+    input_(-1),
+    output_(-1),
+    errors_(-1),
+    id_(0),
+    alive_(false),
+    reader_(*this),
+    thread_( name + "-agent" ),
+    logger_(Poco::Logger::get("AgentClient"))
+{
+}
+
+AgentClient::~AgentClient()
+{
+    // end of input is the agent's cue to exit
+    {
+        Poco::FastMutex::ScopedLock lock( writeMutex_ );
+
+        if ( input_ >= 0 ) {
+
+            ::close( input_ );
+            input_ = -1;
+        }
+    }
+
+    if ( thread_.isRunning() ) {
+
+        thread_.join();
+    }
+
+    if ( pid_ > 0 ) {
+
+        int status;
+
+        while ( ::waitpid( pid_, &status, 0 ) < 0 && errno == EINTR ) {
+        }
+    }
+
+    if ( output_ >= 0 ) ::close( output_ );
+    if ( errors_ >= 0 ) ::close( errors_ );
+}
+
+void AgentClient::start( long timeout )
+{
+    // a write to an agent that has gone must fail, not end srcsync
+    ::signal( SIGPIPE, SIG_IGN );
+
+    int in[2] = { -1, -1 };
+    int out[2] = { -1, -1 };
+    int err[2] = { -1, -1 };
+
+    int rc = -1;
+
+    if ( ::pipe( in ) == 0 && ::pipe( out ) == 0 && ::pipe( err ) == 0 ) {
+
+        for ( int i = 0; i < 2; i++ ) {
+
+            ::fcntl( in[i], F_SETFD, FD_CLOEXEC );
+            ::fcntl( out[i], F_SETFD, FD_CLOEXEC );
+            ::fcntl( err[i], F_SETFD, FD_CLOEXEC );
+        }
+
+        posix_spawn_file_actions_t actions;
+
+        ::posix_spawn_file_actions_init( &actions );
+        ::posix_spawn_file_actions_adddup2( &actions, in[0], 0 );
+        ::posix_spawn_file_actions_adddup2( &actions, out[1], 1 );
+        ::posix_spawn_file_actions_adddup2( &actions, err[1], 2 );
+
+        std::vector<char *> argv;
+
+        argv.push_back( const_cast<char *>( command_.c_str() ) );
+
+        for ( std::vector<std::string>::const_iterator it = args_.begin(); it != args_.end(); it++ ) {
+
+            argv.push_back( const_cast<char *>( it->c_str() ) );
+        }
+
+        argv.push_back( NULL );
+
+        rc = ::posix_spawnp( &pid_, command_.c_str(), &actions, NULL, &argv[0], environ );
+
+        ::posix_spawn_file_actions_destroy( &actions );
+    }
+
+    // the agent's ends
+    if ( in[0] >= 0 ) ::close( in[0] );
+    if ( out[1] >= 0 ) ::close( out[1] );
+    if ( err[1] >= 0 ) ::close( err[1] );
+
+    input_ = in[1];
+    output_ = out[0];
+    errors_ = err[0];
+
+    if ( rc != 0 ) {
+
+        pid_ = 0;
+
+        throw Poco::IOException( "Can not start " + command_, name_ );
+    }
+
+    alive_ = true;
+
+    thread_.start( reader_ );
+
+    Poco::Event done;
+    bool ok = false;
+    std::string error;
+
+    Poco::UInt32 id = nextId();
+
+    Agent::Writer hello( id, Agent::HELLO );
+
+    hello.u32( Agent::VERSION );
+
+    send( id, hello, new Answer( done, ok, error, NULL ) );
+
+    if ( done.tryWait( timeout ) == false ) {
+
+        // the reader thread sees the end of its output and fails the hello
+        ::kill( pid_, SIGTERM );
+
+        done.wait();
+
+        throw Poco::IOException( "No answer from " + command_, name_ );
+    }
+
+    if ( ok == false ) {
+
+        throw Poco::IOException( "Can not start " + command_, error );
+    }
+}
+
+bool AgentClient::alive()
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    return alive_;
+}
+
+size_t AgentClient::inflight()
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    return pending_.size();
+}
+
+Poco::UInt32 AgentClient::nextId()
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    return ++id_;
+}
+
+void AgentClient::send( Poco::UInt32 id, Agent::Writer &frame, Request *request )
+{
+    const std::string &data = frame.frame();
+
+    {
+        Poco::FastMutex::ScopedLock lock( mutex_ );
+
+        if ( alive_ == false ) {
+
+            if ( request ) {
+
+                request->finished( false, "agent not running" );
+                delete request;
+            }
+
+            return;
+        }
+
+        pending_[ id ] = request;
+    }
+
+    Poco::FastMutex::ScopedLock lock( writeMutex_ );
+
+    const char *p = data.data();
+    size_t remaining = data.size();
+
+    while ( remaining > 0 && input_ >= 0 ) {
+
+        ssize_t n = ::write( input_, p, remaining );
+
+        if ( n < 0 ) {
+
+            if ( errno == EINTR ) {
+
+                continue;
+            }
+
+            // the reader sees the agent go and fails what is pending
+            logger_.error( Poco::format("%s: can not write to the agent: %s", name_, std::string( strerror( errno ) ) ) );
+            break;
+        }
+
+        p += n;
+        remaining -= n;
+    }
+}
+
+void AgentClient::write( const std::string &path, const std::string &data, Poco::UInt32 mode, Poco::Int64 mtime, Request *request )
+{
+    Poco::UInt32 id = nextId();
+
+    Agent::Writer frame( id, Agent::WRITE );
+
+    frame.str( path ).u32( mode ).i64( mtime ).str( data );
+
+    send( id, frame, request );
+}
+
+void AgentClient::delta( const std::string &path, const Agent::Delta &delta, Poco::UInt32 mode, Poco::Int64 mtime, Request *request )
+{
+    Poco::UInt32 id = nextId();
+
+    Agent::Writer frame( id, Agent::DELTA );
+
+    frame.str( path ).u32( mode ).i64( mtime ).delta( delta );
+
+    send( id, frame, request );
+}
+
+void AgentClient::rename( const std::string &from, const std::string &to, Request *request )
+{
+    Poco::UInt32 id = nextId();
+
+    Agent::Writer frame( id, Agent::RENAME );
+
+    frame.str( from ).str( to );
+
+    send( id, frame, request );
+}
+
+void AgentClient::unlink( const std::string &path, Request *request )
+{
+    Poco::UInt32 id = nextId();
+
+    Agent::Writer frame( id, Agent::UNLINK );
+
+    frame.str( path );
+
+    send( id, frame, request );
+}
+
+void AgentClient::mkdir( const std::string &path, Poco::UInt32 mode, Request *request )
+{
+    Poco::UInt32 id = nextId();
+
+    Agent::Writer frame( id, Agent::MKDIR );
+
+    frame.str( path ).u32( mode );
+
+    send( id, frame, request );
+}
+
+void AgentClient::metadata( const std::string &path, Poco::UInt32 mode, Poco::Int64 mtime, Request *request )
+{
+    Poco::UInt32 id = nextId();
+
+    Agent::Writer frame( id, Agent::METADATA );
+
+    frame.str( path ).u32( mode ).i64( mtime );
+
+    send( id, frame, request );
+}
+
+bool AgentClient::list( const std::string &path, std::vector<Agent::Entry> &entries, std::string &error )
+{
+    Poco::Event done;
+    bool ok = false;
+
+    Poco::UInt32 id = nextId();
+
+    Agent::Writer frame( id, Agent::LIST );
+
+    frame.str( path );
+
+    send( id, frame, new Answer( done, ok, error, &entries ) );
+
+    done.wait();
+
+    return ok;
+}
+
+void AgentClient::answer( const char *frame, size_t length )
+{
+    Agent::Reader header( frame, length );
+
+    Poco::UInt32 id = header.u32();
+    Poco::UInt8 status = header.u8();
+
+    Request *request = NULL;
+
+    {
+        Poco::FastMutex::ScopedLock lock( mutex_ );
+
+        std::map<Poco::UInt32, Request *>::iterator it = pending_.find( id );
+
+        if ( it == pending_.end() ) {
+
+            throw Agent::ProtocolError( Poco::format( "answer to unknown request %u", id ) );
+        }
+
+        request = it->second;
+
+        pending_.erase( it );
+    }
+
+    if ( request == NULL ) {
+
+        return;
+    }
+
+    std::string error;
+    bool ok = ( status == Agent::OK );
+
+    try {
+
+        if ( ok ) {
+
+            request->answered( header );
+        }
+        else {
+
+            error = header.str();
+        }
+    }
+    catch ( Agent::ProtocolError &ex ) {
+
+        ok = false;
+        error = ex.what();
+    }
+
+    request->finished( ok, error );
+
+    delete request;
+}
+
+void AgentClient::lost( const std::string &why )
+{
+    std::map<Poco::UInt32, Request *> pending;
+
+    {
+        Poco::FastMutex::ScopedLock lock( mutex_ );
+
+        alive_ = false;
+
+        pending.swap( pending_ );
+    }
+
+    if ( pending.empty() == false ) {
+
+        logger_.error( Poco::format("%s: agent gone (%s), %z request(s) failed", name_, why, pending.size() ) );
+    }
+
+    for ( std::map<Poco::UInt32, Request *>::iterator it = pending.begin(); it != pending.end(); it++ ) {
+
+        if ( it->second ) {
+
+            it->second->finished( false, "agent gone: " + why );
+            delete it->second;
+        }
+    }
+}
+
+void AgentClient::read()
+{
+    std::string buffer;
+    std::string errorLine;
+
+    std::vector<char> chunk( AGENT_READ_SIZE );
+
+    struct pollfd fds[2];
+
+    fds[0].fd = output_;
+    fds[0].events = POLLIN;
+    fds[1].fd = errors_;
+    fds[1].events = POLLIN;
+
+    std::string why( "end of output" );
+
+    try {
+
+        while ( fds[0].fd >= 0 ) {
+
+            fds[0].revents = fds[1].revents = 0;
+
+            if ( ::poll( fds, fds[1].fd >= 0 ? 2 : 1, -1 ) < 0 ) {
+
+                if ( errno == EINTR ) {
+
+                    continue;
+                }
+
+                why = strerror( errno );
+                break;
+            }
+
+            // ssh and the agent report their problems here
+            if ( fds[1].fd >= 0 && fds[1].revents != 0 ) {
+
+                ssize_t n = ::read( errors_, &chunk[0], chunk.size() );
+
+                if ( n <= 0 ) {
+
+                    fds[1].fd = -1;
+                }
+                else {
+
+                    errorLine.append( &chunk[0], n );
+
+                    size_t eol;
+
+                    while ( ( eol = errorLine.find( '\n' ) ) != std::string::npos ) {
+
+                        logger_.warning( Poco::format("%s: %s", name_, errorLine.substr( 0, eol ) ) );
+                        errorLine.erase( 0, eol + 1 );
+                    }
+                }
+            }
+
+            if ( fds[0].revents == 0 ) {
+
+                continue;
+            }
+
+            ssize_t n = ::read( output_, &chunk[0], chunk.size() );
+
+            if ( n < 0 && errno == EINTR ) {
+
+                continue;
+            }
+
+            if ( n <= 0 ) {
+
+                break;
+            }
+
+            buffer.append( &chunk[0], n );
+
+            size_t used = 0;
+
+            while ( buffer.size() - used >= Agent::HEADER ) {
+
+                Poco::UInt32 length = Agent::frameLength( buffer.data() + used );
+
+                if ( length > Agent::MAX_FRAME || length < 5 ) {
+
+                    throw Agent::ProtocolError( "bad frame length" );
+                }
+
+                if ( buffer.size() - used - Agent::HEADER < length ) {
+
+                    break;
+                }
+
+                answer( buffer.data() + used + Agent::HEADER, length );
+
+                used += Agent::HEADER + length;
+            }
+
+            buffer.erase( 0, used );
+        }
+    }
+    catch ( Agent::ProtocolError &ex ) {
+
+        why = ex.what();
+
+        // nothing more it says can be trusted
+        ::kill( pid_, SIGTERM );
+    }
+
+    lost( why );
+}
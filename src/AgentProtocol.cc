@@ -0,0 +1,278 @@
+/**
+ * \file AgentProtocol.cc
+ *
+ * \brief - Frames exchanged between srcsync and srcsync-agent
+ *
+ */
+
+#include <cstring>
+
+#include "AgentProtocol.h"
+
+namespace Agent {
+
+void Delta::copy( uint64_t offset, uint32_t length )
+{
+    // adjacent blocks become one instruction
+    if ( instructions.empty() == false ) {
+
+        Instruction &last = instructions.back();
+
+        if ( last.data.empty() && last.length > 0 && last.offset + last.length == offset && (uint64_t) last.length + length <= 0xffffffffULL ) {
+
+            last.length += length;
+            return;
+        }
+    }
+
+    Instruction i;
+
+    i.offset = offset;
+    i.length = length;
+
+    instructions.push_back( i );
+}
+
+void Delta::literal( const char *data, size_t length )
+{
+    if ( length == 0 ) {
+
+        return;
+    }
+
+    if ( instructions.empty() == false && instructions.back().data.empty() == false ) {
+
+        instructions.back().data.append( data, length );
+        instructions.back().length = instructions.back().data.size();
+        return;
+    }
+
+    Instruction i;
+
+    i.offset = 0;
+    i.data.assign( data, length );
+    i.length = length;
+
+    instructions.push_back( i );
+}
+
+uint64_t Delta::size() const
+{
+    uint64_t size = 0;
+
+    for ( std::vector<Instruction>::const_iterator it = instructions.begin(); it != instructions.end(); it++ ) {
+
+        size += it->length;
+    }
+
+    return size;
+}
+
+Writer::Writer( uint32_t id, uint8_t op )
+{
+    buffer_.reserve( 64 );
+
+    u32( 0 );
+    u32( id );
+    u8( op );
+}
+
+Writer &Writer::u8( uint8_t v )
+{
+    buffer_.push_back( (char) v );
+
+    return *this;
+}
+
+Writer &Writer::u32( uint32_t v )
+{
+    char b[4] = { (char) ( v >> 24 ), (char) ( v >> 16 ), (char) ( v >> 8 ), (char) v };
+
+    buffer_.append( b, sizeof(b) );
+
+    return *this;
+}
+
+Writer &Writer::u64( uint64_t v )
+{
+    u32( (uint32_t) ( v >> 32 ) );
+
+    return u32( (uint32_t) v );
+}
+
+Writer &Writer::str( const std::string &v )
+{
+    return str( v.data(), v.size() );
+}
+
+Writer &Writer::str( const char *data, size_t length )
+{
+    u32( (uint32_t) length );
+
+    buffer_.append( data, length );
+
+    return *this;
+}
+
+Writer &Writer::delta( const Delta &v )
+{
+    u32( (uint32_t) v.instructions.size() );
+
+    for ( std::vector<Instruction>::const_iterator it = v.instructions.begin(); it != v.instructions.end(); it++ ) {
+
+        if ( it->data.empty() ) {
+
+            u8( 0 );
+            u64( it->offset );
+            u32( it->length );
+        }
+        else {
+
+            u8( 1 );
+            str( it->data );
+        }
+    }
+
+    return u64( v.checksum );
+}
+
+Writer &Writer::entry( const Entry &v )
+{
+    str( v.path );
+    u8( (uint8_t) v.type );
+    u64( v.size );
+
+    return i64( v.mtime );
+}
+
+const std::string &Writer::frame()
+{
+    uint32_t length = (uint32_t) ( buffer_.size() - HEADER );
+
+    buffer_[0] = (char) ( length >> 24 );
+    buffer_[1] = (char) ( length >> 16 );
+    buffer_[2] = (char) ( length >> 8 );
+    buffer_[3] = (char) length;
+
+    return buffer_;
+}
+
+void Reader::need( size_t length )
+{
+    if ( (size_t) ( end_ - data_ ) < length ) {
+
+        throw ProtocolError( "truncated frame" );
+    }
+}
+
+uint8_t Reader::u8()
+{
+    need( 1 );
+
+    return (uint8_t) *data_++;
+}
+
+uint32_t Reader::u32()
+{
+    need( 4 );
+
+    const unsigned char *p = (const unsigned char *) data_;
+
+    data_ += 4;
+
+    return ( (uint32_t) p[0] << 24 ) | ( (uint32_t) p[1] << 16 ) | ( (uint32_t) p[2] << 8 ) | p[3];
+}
+
+uint64_t Reader::u64()
+{
+    uint64_t high = u32();
+
+    return ( high << 32 ) | u32();
+}
+
+std::string Reader::str()
+{
+    uint32_t length = u32();
+
+    need( length );
+
+    std::string v( data_, length );
+
+    data_ += length;
+
+    return v;
+}
+
+void Reader::delta( Delta &v )
+{
+    uint32_t count = u32();
+
+    v.instructions.clear();
+
+    for ( uint32_t i = 0; i < count; i++ ) {
+
+        Instruction instruction;
+
+        if ( u8() == 0 ) {
+
+            instruction.offset = u64();
+            instruction.length = u32();
+        }
+        else {
+
+            instruction.offset = 0;
+            instruction.data = str();
+            instruction.length = (uint32_t) instruction.data.size();
+        }
+
+        v.instructions.push_back( instruction );
+    }
+
+    v.checksum = u64();
+}
+
+void Reader::entry( Entry &v )
+{
+    v.path = str();
+    v.type = (char) u8();
+    v.size = u64();
+    v.mtime = i64();
+}
+
+uint32_t frameLength( const char *header )
+{
+    const unsigned char *p = (const unsigned char *) header;
+
+    return ( (uint32_t) p[0] << 24 ) | ( (uint32_t) p[1] << 16 ) | ( (uint32_t) p[2] << 8 ) | p[3];
+}
+
+bool safePath( const std::string &path )
+{
+    if ( path.empty() || path[0] == '/' || path.find( '\0' ) != std::string::npos ) {
+
+        return false;
+    }
+
+    size_t start = 0;
+
+    while ( start <= path.size() ) {
+
+        size_t end = path.find( '/', start );
+
+        if ( end == std::string::npos ) {
+
+            end = path.size();
+        }
+
+        if ( path.compare( start, end - start, ".." ) == 0 ) {
+
+            return false;
+        }
+
+        start = end + 1;
+    }
+
+    return true;
+}
+
+}
@@ -0,0 +1,398 @@
+/**
+ * \file Checksum.cc
+ *
+ * \brief - The block checksums delta transfers are built from
+ *
+ */
+
+#include <cstring>
+#include <algorithm>
+
+#include "Checksum.h"
+
+#if ( defined(__x86_64__) || defined(__i386__) ) && ( defined(__GNUC__) || defined(__clang__) )
+#define CHECKSUM_X86 1
+#include <immintrin.h>
+#endif
+
+namespace Checksum {
+
+static const uint64_t PRIME1 = 11400714785074694791ULL;
+static const uint64_t PRIME2 = 14029467366897019727ULL;
+static const uint64_t PRIME3 = 1609587929392839161ULL;
+static const uint64_t PRIME4 = 9650029242287828579ULL;
+static const uint64_t PRIME5 = 2870177450012600261ULL;
+
+static inline uint64_t rotl( uint64_t v, int bits )
+{
+    return ( v << bits ) | ( v >> ( 64 - bits ) );
+}
+
+// little endian whatever the host, the compiler makes these single loads
+static inline uint64_t read64( const unsigned char *p )
+{
+    uint64_t v;
+
+    memcpy( &v, p, sizeof(v) );
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64( v );
+#endif
+
+    return v;
+}
+
+static inline uint32_t read32( const unsigned char *p )
+{
+    uint32_t v;
+
+    memcpy( &v, p, sizeof(v) );
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32( v );
+#endif
+
+    return v;
+}
+
+static inline uint64_t mix( uint64_t acc, uint64_t input )
+{
+    acc += input * PRIME2;
+    acc = rotl( acc, 31 );
+
+    return acc * PRIME1;
+}
+
+static inline uint64_t merge( uint64_t acc, uint64_t v )
+{
+    acc ^= mix( 0, v );
+
+    return acc * PRIME1 + PRIME4;
+}
+
+// the 32 byte stripes, returns the bytes used
+static size_t stripes( uint64_t v[4], const unsigned char *p, size_t length )
+{
+    const unsigned char *start = p;
+    const unsigned char *limit = p + length - length % 32;
+
+    while ( p < limit ) {
+
+        v[0] = mix( v[0], read64( p ) );
+        v[1] = mix( v[1], read64( p + 8 ) );
+        v[2] = mix( v[2], read64( p + 16 ) );
+        v[3] = mix( v[3], read64( p + 24 ) );
+
+        p += 32;
+    }
+
+    return p - start;
+}
+
+// the bytes after the last stripe, and the final mix
+static uint64_t finish( uint64_t h, const unsigned char *p, size_t length )
+{
+    while ( length >= 8 ) {
+
+        h ^= mix( 0, read64( p ) );
+        h = rotl( h, 27 ) * PRIME1 + PRIME4;
+
+        p += 8;
+        length -= 8;
+    }
+
+    if ( length >= 4 ) {
+
+        h ^= (uint64_t) read32( p ) * PRIME1;
+        h = rotl( h, 23 ) * PRIME2 + PRIME3;
+
+        p += 4;
+        length -= 4;
+    }
+
+    while ( length > 0 ) {
+
+        h ^= *p * PRIME5;
+        h = rotl( h, 11 ) * PRIME1;
+
+        p++;
+        length--;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+static inline uint64_t converge( const uint64_t v[4] )
+{
+    uint64_t h = rotl( v[0], 1 ) + rotl( v[1], 7 ) + rotl( v[2], 12 ) + rotl( v[3], 18 );
+
+    for ( int i = 0; i < 4; i++ ) {
+
+        h = merge( h, v[i] );
+    }
+
+    return h;
+}
+
+uint64_t xxh64( const void *data, size_t length, uint64_t seed )
+{
+    const unsigned char *p = (const unsigned char *) data;
+
+    uint64_t h;
+
+    if ( length >= 32 ) {
+
+        uint64_t v[4] = { seed + PRIME1 + PRIME2, seed + PRIME2, seed, seed - PRIME1 };
+
+        size_t used = stripes( v, p, length );
+
+        h = converge( v );
+
+        p += used;
+    }
+    else {
+
+        h = seed + PRIME5;
+    }
+
+    h += length;
+
+    return finish( h, p, length % 32 );
+}
+
+XXH64::XXH64( uint64_t seed ) : seed_(seed), total_(0), buffered_(0)
+{
+    v_[0] = seed + PRIME1 + PRIME2;
+    v_[1] = seed + PRIME2;
+    v_[2] = seed;
+    v_[3] = seed - PRIME1;
+}
+
+void XXH64::update( const void *data, size_t length )
+{
+    const unsigned char *p = (const unsigned char *) data;
+
+    total_ += length;
+
+    if ( buffered_ > 0 ) {
+
+        size_t n = std::min( length, sizeof(buffer_) - buffered_ );
+
+        memcpy( buffer_ + buffered_, p, n );
+
+        buffered_ += n;
+        p += n;
+        length -= n;
+
+        if ( buffered_ < sizeof(buffer_) ) {
+
+            return;
+        }
+
+        stripes( v_, buffer_, sizeof(buffer_) );
+        buffered_ = 0;
+    }
+
+    size_t used = stripes( v_, p, length );
+
+    memcpy( buffer_, p + used, length - used );
+    buffered_ = length - used;
+}
+
+uint64_t XXH64::digest() const
+{
+    uint64_t h = total_ >= 32 ? converge( v_ ) : seed_ + PRIME5;
+
+    h += total_;
+
+    return finish( h, buffer_, buffered_ );
+}
+
+// a is the sum of the bytes, b the sum of each times its distance from the end
+typedef void (*Sums)( const unsigned char *p, size_t length, uint32_t &a, uint32_t &b );
+
+static void sumsScalar( const unsigned char *p, size_t length, uint32_t &a, uint32_t &b )
+{
+    uint32_t s1 = 0;
+    uint32_t s2 = 0;
+
+    for ( size_t i = 0; i < length; i++ ) {
+
+        s1 += p[i];
+        s2 += s1;
+    }
+
+    a = s1;
+    b = s2;
+}
+
+#if CHECKSUM_X86
+
+// b = n * a - sum( i * x[i] ). Per chunk of the vector width, the bytes
+// are summed (sad) and weighted by their place in the chunk (maddubs);
+// the chunk's offset times its sum is accumulated separately. Everything
+// wraps modulo 2^32, as the scalar sums do.
+
+__attribute__((target("ssse3")))
+static void sumsSSSE3( const unsigned char *p, size_t length, uint32_t &a, uint32_t &b )
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16( 1 );
+    const __m128i weights = _mm_setr_epi8( 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 );
+
+    __m128i sum = zero;         // sum of the bytes, two 64 bit lanes
+    __m128i offsets = zero;     // chunk number times its sum
+    __m128i places = zero;      // place in the chunk times the byte, four 32 bit lanes
+
+    size_t chunks = length / 16;
+
+    for ( size_t c = 0; c < chunks; c++ ) {
+
+        __m128i x = _mm_loadu_si128( (const __m128i *) ( p + c * 16 ) );
+
+        __m128i s = _mm_sad_epu8( x, zero );
+
+        sum = _mm_add_epi64( sum, s );
+        offsets = _mm_add_epi64( offsets, _mm_mul_epu32( s, _mm_set1_epi32( (int) c ) ) );
+        places = _mm_add_epi32( places, _mm_madd_epi16( _mm_maddubs_epi16( x, weights ), ones ) );
+    }
+
+    uint64_t lanes[2];
+    uint32_t words[4];
+
+    _mm_storeu_si128( (__m128i *) lanes, sum );
+    uint32_t total = (uint32_t) ( lanes[0] + lanes[1] );
+
+    _mm_storeu_si128( (__m128i *) lanes, offsets );
+    uint32_t weighted = (uint32_t) ( lanes[0] + lanes[1] ) * 16;
+
+    _mm_storeu_si128( (__m128i *) words, places );
+    weighted += words[0] + words[1] + words[2] + words[3];
+
+    size_t done = chunks * 16;
+
+    for ( size_t i = done; i < length; i++ ) {
+
+        total += p[i];
+        weighted += (uint32_t) i * p[i];
+    }
+
+    a = total;
+    b = (uint32_t) length * total - weighted;
+}
+
+__attribute__((target("avx2")))
+static void sumsAVX2( const unsigned char *p, size_t length, uint32_t &a, uint32_t &b )
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi16( 1 );
+    const __m256i weights = _mm256_setr_epi8( 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+            16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31 );
+
+    __m256i sum = zero;
+    __m256i offsets = zero;
+    __m256i places = zero;
+
+    size_t chunks = length / 32;
+
+    for ( size_t c = 0; c < chunks; c++ ) {
+
+        __m256i x = _mm256_loadu_si256( (const __m256i *) ( p + c * 32 ) );
+
+        __m256i s = _mm256_sad_epu8( x, zero );
+
+        sum = _mm256_add_epi64( sum, s );
+        offsets = _mm256_add_epi64( offsets, _mm256_mul_epu32( s, _mm256_set1_epi32( (int) c ) ) );
+        places = _mm256_add_epi32( places, _mm256_madd_epi16( _mm256_maddubs_epi16( x, weights ), ones ) );
+    }
+
+    uint64_t lanes[4];
+    uint32_t words[8];
+
+    _mm256_storeu_si256( (__m256i *) lanes, sum );
+    uint32_t total = (uint32_t) ( lanes[0] + lanes[1] + lanes[2] + lanes[3] );
+
+    _mm256_storeu_si256( (__m256i *) lanes, offsets );
+    uint32_t weighted = (uint32_t) ( lanes[0] + lanes[1] + lanes[2] + lanes[3] ) * 32;
+
+    _mm256_storeu_si256( (__m256i *) words, places );
+
+    for ( int i = 0; i < 8; i++ ) {
+
+        weighted += words[i];
+    }
+
+    size_t done = chunks * 32;
+
+    for ( size_t i = done; i < length; i++ ) {
+
+        total += p[i];
+        weighted += (uint32_t) i * p[i];
+    }
+
+    a = total;
+    b = (uint32_t) length * total - weighted;
+}
+
+#endif
+
+static Sums choose( const char *&name )
+{
+#if CHECKSUM_X86
+    __builtin_cpu_init();
+
+    if ( __builtin_cpu_supports( "avx2" ) ) {
+
+        name = "avx2";
+        return sumsAVX2;
+    }
+
+    if ( __builtin_cpu_supports( "ssse3" ) ) {
+
+        name = "ssse3";
+        return sumsSSSE3;
+    }
+#endif
+
+    name = "scalar";
+    return sumsScalar;
+}
+
+static const char *sumsName = "scalar";
+
+// chosen the first time it is needed, not during static initialization
+static Sums sums()
+{
+    static const Sums chosen = choose( sumsName );
+
+    return chosen;
+}
+
+uint32_t weak( const char *data, size_t length )
+{
+    uint32_t a, b;
+
+    sums()( (const unsigned char *) data, length, a, b );
+
+    return ( a & 0xffff ) | ( b << 16 );
+}
+
+Rolling::Rolling( const char *data, size_t length ) : length_( (uint32_t) length )
+{
+    sums()( (const unsigned char *) data, length, a_, b_ );
+}
+
+const char *implementation()
+{
+    sums();
+
+    return sumsName;
+}
+
+}
@@ -0,0 +1,351 @@
+/**
+ * \file Debouncer.cc
+ *
+ * \brief - Holds back changed files until their writer has finished
+ *
+ */
+
+#include <sys/stat.h>
+
+#include <algorithm>
+
+#include "Poco/StringTokenizer.h"
+#include "Poco/Format.h"
+#include "Poco/Exception.h"
+
+#include "Debouncer.h"
+
+#include "SourceSync.h"
+
+#define DEBOUNCE_TICK       50          // ms per slot
+#define DEBOUNCE_SLOTS      256         // a lap of the wheel, 12.8s
+
+static Poco::Int64 ticks( long ms )
+{
+    Poco::Int64 count = ( ms + DEBOUNCE_TICK - 1 ) / DEBOUNCE_TICK;
+
+    return count > 0 ? count : 1;
+}
+
+Debouncer::Debouncer( Target &target, long quietMin, long quietMax, const std::string &temporary ) :
+    target_(target),
+    quietMin_(0),
+    quietMax_(0),
+    wheel_( DEBOUNCE_SLOTS ),
+    cursor_(0),
+    thread_("debounce"),
+    logger_( Poco::Logger::get("Debouncer") )
+{
+    configure( quietMin, quietMax, temporary );
+
+    thread_.start( *this );
+}
+
+void Debouncer::configure( long quietMin, long quietMax, const std::string &temporary )
+{
+    std::vector<Poco::SharedPtr<Poco::Glob> > globs;
+
+    Poco::StringTokenizer tok( temporary, " ", Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY );
+
+    for ( int i = 0; i < tok.count(); i++ ) {
+
+        globs.push_back( new Poco::Glob( tok[i] ) );
+    }
+
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    quietMin_ = ticks( quietMin );
+    quietMax_ = std::max( ticks( quietMax ), quietMin_ );
+
+    temporary_.swap( globs );
+}
+
+Debouncer::~Debouncer()
+{
+    stop_.set();
+    thread_.join();
+}
+
+Poco::Int64 Debouncer::now() const
+{
+    return started_.elapsed() / ( DEBOUNCE_TICK * 1000 );
+}
+
+Poco::Int64 Debouncer::quiet( const Entry &entry ) const
+{
+    // twice the usual gap, a writer that paused once is not finished
+    Poco::Int64 interval = entry.gap * 2;
+
+    if ( interval < quietMin_ ) {
+
+        return quietMin_;
+    }
+
+    return interval > quietMax_ ? quietMax_ : interval;
+}
+
+bool Debouncer::temporary( const std::string &path ) const
+{
+    std::string::size_type slash = path.rfind( '/' );
+    std::string name( slash == std::string::npos ? path : path.substr( slash + 1 ) );
+
+    for ( std::vector<Poco::SharedPtr<Poco::Glob> >::const_iterator it = temporary_.begin(); it != temporary_.end(); it++ ) {
+
+        if ( (*it)->match( name ) ) {
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool Debouncer::look( Entry &entry )
+{
+    struct stat st;
+
+    if ( ::lstat( entry.file.c_str(), &st ) != 0 ) {
+
+        bool moved = entry.exists;
+
+        entry.exists = false;
+
+        return moved;
+    }
+
+#ifdef __APPLE__
+    Poco::Int64 modified = (Poco::Int64) st.st_mtimespec.tv_sec * 1000000 + st.st_mtimespec.tv_nsec / 1000;
+#else
+    Poco::Int64 modified = (Poco::Int64) st.st_mtim.tv_sec * 1000000 + st.st_mtim.tv_nsec / 1000;
+#endif
+
+    bool moved = ( entry.exists == false || entry.size != st.st_size || entry.modified != modified );
+
+    entry.exists = true;
+    entry.size = st.st_size;
+    entry.modified = modified;
+
+    return moved;
+}
+
+void Debouncer::touch( Entry &entry, Poco::Int64 now )
+{
+    Poco::Int64 gap = now - entry.lastChange;
+
+    entry.gap = entry.gap == 0 ? gap : ( entry.gap * 3 + gap ) / 4;
+    entry.lastChange = now;
+    entry.dirty = true;
+}
+
+void Debouncer::schedule( const Key &key, Entry &entry, Poco::Int64 due )
+{
+    if ( due < cursor_ ) {
+
+        due = cursor_;
+    }
+
+    // already in that slot
+    if ( entry.due == due ) {
+
+        return;
+    }
+
+    entry.due = due;
+
+    wheel_[ due % DEBOUNCE_SLOTS ].push_back( key );
+}
+
+void Debouncer::changed( int mapping, const std::string &path, const std::string &file )
+{
+    Key key( mapping, path );
+
+    bool passOn = false;
+
+    {
+        Poco::FastMutex::ScopedLock lock( mutex_ );
+
+        Poco::Int64 tick = now();
+
+        std::map<Key, Entry>::iterator it = entries_.find( key );
+
+        if ( it == entries_.end() ) {
+
+            Entry entry;
+
+            entry.file = file;
+            entry.exists = false;
+            entry.lastChange = tick;
+            entry.gap = 0;
+            entry.due = -1;
+
+            look( entry );
+
+            if ( entry.exists == false ) {
+
+                return;
+            }
+
+            // quiet until now, most likely a single save: no delay
+            passOn = ( temporary( path ) == false );
+
+            entry.dirty = !passOn;
+            entry.sent = passOn;
+
+            it = entries_.insert( std::make_pair( key, entry ) ).first;
+        }
+        else if ( look( it->second ) ) {
+
+            touch( it->second, tick );
+        }
+        else {
+
+            // reported, but nothing we can see has moved (yet) - the next
+            // look will tell
+        }
+
+        schedule( key, it->second, tick + quiet( it->second ) );
+    }
+
+    if ( passOn ) {
+
+        target_.settled( mapping, path );
+    }
+}
+
+bool Debouncer::removed( int mapping, const std::string &path )
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    std::map<Key, Entry>::iterator it = entries_.find( Key( mapping, path ) );
+
+    if ( it == entries_.end() ) {
+
+        return false;
+    }
+
+    bool never = ( it->second.sent == false );
+
+    // its slot in the wheel goes stale, expire() skips it
+    entries_.erase( it );
+
+    return never;
+}
+
+size_t Debouncer::size()
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    return entries_.size();
+}
+
+void Debouncer::expire( Poco::Int64 tick, std::vector<Key> &settled )
+{
+    std::vector<Key> slot;
+
+    slot.swap( wheel_[ tick % DEBOUNCE_SLOTS ] );
+
+    for ( std::vector<Key>::iterator it = slot.begin(); it != slot.end(); it++ ) {
+
+        std::map<Key, Entry>::iterator jt = entries_.find( *it );
+
+        if ( jt == entries_.end() ) {
+
+            continue;
+        }
+
+        Entry &entry = jt->second;
+
+        if ( entry.due != tick ) {
+
+            // due a lap or more from now, its place is still this slot
+            if ( entry.due > tick && entry.due % DEBOUNCE_SLOTS == tick % DEBOUNCE_SLOTS ) {
+
+                wheel_[ tick % DEBOUNCE_SLOTS ].push_back( *it );
+            }
+
+            continue;
+        }
+
+        if ( look( entry ) ) {
+
+            if ( entry.exists == false ) {
+
+                if ( entry.sent == false ) {
+
+                    LOG_DEBUG( logger_, Poco::format( "%s gone before it settled", it->second ) );
+                }
+
+                entries_.erase( jt );
+                continue;
+            }
+
+            // still being written
+            touch( entry, tick );
+            schedule( *it, entry, tick + quiet( entry ) );
+            continue;
+        }
+
+        if ( entry.dirty ) {
+
+            if ( tick - entry.lastChange >= quiet( entry ) ) {
+
+                entry.dirty = false;
+                entry.sent = true;
+
+                settled.push_back( *it );
+
+                schedule( *it, entry, tick + quietMax_ );
+            }
+            else {
+
+                schedule( *it, entry, entry.lastChange + quiet( entry ) );
+            }
+
+            continue;
+        }
+
+        // settled and sent; remembered a while so that a writer coming back
+        // is held back rather than passed on at once again
+        if ( tick - entry.lastChange >= quietMax_ ) {
+
+            entries_.erase( jt );
+        }
+        else {
+
+            schedule( *it, entry, entry.lastChange + quietMax_ );
+        }
+    }
+}
+
+void Debouncer::run()
+{
+    while ( stop_.tryWait( DEBOUNCE_TICK ) == false ) {
+
+        std::vector<Key> settled;
+
+        {
+            Poco::FastMutex::ScopedLock lock( mutex_ );
+
+            Poco::Int64 until = now();
+
+            while ( cursor_ <= until ) {
+
+                expire( cursor_++, settled );
+            }
+        }
+
+        for ( std::vector<Key>::iterator it = settled.begin(); it != settled.end(); it++ ) {
+
+            LOG_DEBUG( logger_, Poco::format( "%s settled", it->second ) );
+
+            try {
+
+                target_.settled( it->first, it->second );
+            }
+            catch ( Poco::Exception &ex ) {
+
+                logger_.error( Poco::format( "Can not queue %s: %s", it->second, ex.displayText() ) );
+            }
+        }
+    }
+}
@@ -0,0 +1,204 @@
+/**
+ * \file DeltaEngine.cc
+ *
+ * \brief - Builds the delta from the copy of a file last sent to its new contents
+ *
+ */
+
+#include <algorithm>
+
+#include "Checksum.h"
+#include "DeltaEngine.h"
+
+#define DELTA_MIN_BLOCK ( 2 * 1024 )
+#define DELTA_MAX_BLOCK ( 128 * 1024 )
+
+static inline size_t bucket( uint32_t weak, size_t mask )
+{
+    return ( weak ^ ( weak >> 16 ) ) & mask;
+}
+
+uint32_t DeltaEngine::blockSize( uint64_t size )
+{
+    uint32_t size2 = DELTA_MIN_BLOCK;
+
+    while ( (uint64_t) size2 * size2 < size && size2 < DELTA_MAX_BLOCK ) {
+
+        size2 <<= 1;
+    }
+
+    return size2;
+}
+
+void DeltaEngine::sign( const char *data, size_t length, uint32_t blockSize, Signature &signature )
+{
+    size_t count = ( length + blockSize - 1 ) / blockSize;
+
+    signature.blockSize = blockSize;
+    signature.size = length;
+    signature.weak.resize( count );
+    signature.strong.resize( count );
+
+    for ( size_t i = 0; i < count; i++ ) {
+
+        const char *block = data + i * blockSize;
+        size_t size = std::min( (size_t) blockSize, length - i * blockSize );
+
+        signature.weak[i] = Checksum::weak( block, size );
+        signature.strong[i] = Checksum::xxh64( block, size );
+    }
+}
+
+uint64_t DeltaEngine::delta( const Signature &base, const Signature &target, const char *data, size_t length, Agent::Delta &delta )
+{
+    const unsigned char *bytes = (const unsigned char *) data;
+
+    delta.instructions.clear();
+    delta.checksum = Checksum::xxh64( data, length );
+
+    uint32_t size = base.blockSize;
+
+    // only whole blocks are searched for, a short last one is tried at the end
+    size_t blocks = size > 0 ? base.size / size : 0;
+
+    size_t mask = 1;
+
+    while ( mask < blocks * 2 ) {
+
+        mask <<= 1;
+    }
+
+    mask--;
+
+    // chained in ascending order, so the first copy of a repeated block wins
+    std::vector<int> heads( mask + 1, -1 );
+    std::vector<int> chain( blocks, -1 );
+
+    for ( size_t i = blocks; i-- > 0; ) {
+
+        size_t b = bucket( base.weak[i], mask );
+
+        chain[i] = heads[b];
+        heads[b] = (int) i;
+    }
+
+    // where the target's own signature can stand in for the window
+    bool aligned = ( target.blockSize == size );
+
+    size_t pos = 0;
+    size_t literal = 0;
+    uint64_t literals = 0;
+    size_t expected = 0;
+
+    Checksum::Rolling rolling( data, 0 );
+    size_t rolledTo = (size_t) -1;
+
+    while ( blocks > 0 && pos + size <= length ) {
+
+        uint32_t weak;
+        uint64_t strong = 0;
+        bool strongKnown = false;
+
+        if ( aligned && pos % size == 0 ) {
+
+            weak = target.weak[ pos / size ];
+            strong = target.strong[ pos / size ];
+            strongKnown = true;
+        }
+        else {
+
+            if ( rolledTo != pos ) {
+
+                rolling = Checksum::Rolling( data + pos, size );
+                rolledTo = pos;
+            }
+
+            weak = rolling.value();
+        }
+
+        int match = -1;
+
+        // the block after the last match is the likeliest, an edit rarely moves the rest
+        if ( expected < blocks && base.weak[ expected ] == weak ) {
+
+            if ( strongKnown == false ) {
+
+                strong = Checksum::xxh64( data + pos, size );
+                strongKnown = true;
+            }
+
+            if ( base.strong[ expected ] == strong ) {
+
+                match = (int) expected;
+            }
+        }
+
+        for ( int i = heads[ bucket( weak, mask ) ]; match < 0 && i >= 0; i = chain[i] ) {
+
+            if ( base.weak[i] != weak ) {
+
+                continue;
+            }
+
+            if ( strongKnown == false ) {
+
+                strong = Checksum::xxh64( data + pos, size );
+                strongKnown = true;
+            }
+
+            if ( base.strong[i] == strong ) {
+
+                match = i;
+            }
+        }
+
+        if ( match >= 0 ) {
+
+            delta.literal( data + literal, pos - literal );
+            literals += pos - literal;
+
+            delta.copy( (uint64_t) match * size, size );
+
+            pos += size;
+            literal = pos;
+            expected = match + 1;
+            continue;
+        }
+
+        // slide the window one byte
+        if ( pos + size < length ) {
+
+            if ( rolledTo != pos ) {
+
+                rolling = Checksum::Rolling( data + pos, size );
+            }
+
+            rolling.roll( bytes[ pos ], bytes[ pos + size ] );
+            rolledTo = pos + 1;
+        }
+
+        pos++;
+    }
+
+    // what is left is shorter than a block, it may be the old short last block
+    if ( pos < length && base.weak.size() > blocks ) {
+
+        size_t rest = length - pos;
+
+        if ( base.size - blocks * size == rest && base.weak[ blocks ] == Checksum::weak( data + pos, rest ) && base.strong[ blocks ] == Checksum::xxh64( data + pos, rest ) ) {
+
+            delta.literal( data + literal, pos - literal );
+            literals += pos - literal;
+
+            delta.copy( (uint64_t) blocks * size, (uint32_t) rest );
+
+            pos = length;
+            literal = pos;
+        }
+    }
+
+    delta.literal( data + literal, length - literal );
+    literals += length - literal;
+
+    return literals;
+}
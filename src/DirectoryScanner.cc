@@ -0,0 +1,386 @@
+/**
+ * \file DirectoryScanner.cc
+ *
+ * \brief - Walks a source tree with several threads into a Manifest
+ *
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "Poco/Thread.h"
+#include "Poco/Runnable.h"
+#include "Poco/Environment.h"
+#include "Poco/Exception.h"
+
+#include "DirectoryScanner.h"
+
+// more threads than cores - most of the time is spent waiting on the disk
+#define SCANNER_THREADS_PER_CPU 2
+#define SCANNER_MAX_THREADS     32
+
+#ifdef __linux__
+// getdents64 buffer, big enough for most directories in one call
+#define SCANNER_DENTS_SIZE      ( 64 * 1024 )
+
+struct linux_dirent64 {
+    ino64_t         d_ino;
+    off64_t         d_off;
+    unsigned short  d_reclen;
+    unsigned char   d_type;
+    char            d_name[];
+};
+#endif
+
+bool Manifest::isDirectory( size_t i ) const
+{
+    return S_ISDIR( entries_[i].mode );
+}
+
+bool Manifest::isLink( size_t i ) const
+{
+    return S_ISLNK( entries_[i].mode );
+}
+
+int Manifest::compare( const Entry &entry, const char *path, size_t length ) const
+{
+    int c = std::memcmp( names_.data() + entry.name, path, std::min<size_t>( entry.length, length ) );
+
+    if ( c != 0 ) {
+
+        return c;
+    }
+
+    return entry.length < length ? -1 : ( entry.length > length ? 1 : 0 );
+}
+
+long Manifest::find( const std::string &path ) const
+{
+    size_t lo = 0;
+    size_t hi = entries_.size();
+
+    while ( lo < hi ) {
+
+        size_t mid = lo + ( hi - lo ) / 2;
+
+        int c = compare( entries_[mid], path.data(), path.length() );
+
+        if ( c == 0 ) {
+
+            return mid;
+        }
+
+        if ( c < 0 ) {
+
+            lo = mid + 1;
+        }
+        else {
+
+            hi = mid;
+        }
+    }
+
+    return -1;
+}
+
+void Manifest::add( const std::string &path, Poco::UInt32 mode, Poco::UInt64 size, Poco::Int64 mtime )
+{
+    Entry e;
+
+    e.name = names_.size();
+    e.length = path.length();
+    e.mode = mode;
+    e.size = size;
+    e.mtime = mtime;
+
+    names_ += path;
+    entries_.push_back( e );
+}
+
+void Manifest::merge( Manifest &other )
+{
+    Poco::UInt32 offset = names_.size();
+
+    names_ += other.names_;
+
+    entries_.reserve( entries_.size() + other.entries_.size() );
+
+    for ( std::vector<Entry>::const_iterator it = other.entries_.begin(); it != other.entries_.end(); it++ ) {
+
+        entries_.push_back( *it );
+        entries_.back().name += offset;
+    }
+
+    other.clear();
+}
+
+namespace {
+
+    struct ByPath {
+        ByPath( const std::string &names ) : names_(names) {};
+
+        bool operator()( const Manifest::Entry &a, const Manifest::Entry &b ) const {
+
+            int c = std::memcmp( names_.data() + a.name, names_.data() + b.name, std::min( a.length, b.length ) );
+
+            return c < 0 || ( c == 0 && a.length < b.length );
+        };
+
+        const std::string &names_;
+    };
+}
+
+void Manifest::sort()
+{
+    std::sort( entries_.begin(), entries_.end(), ByPath( names_ ) );
+}
+
+void Manifest::clear()
+{
+    names_.clear();
+    entries_.clear();
+}
+
+// one per scanning thread, collects into its own Manifest
+class DirectoryScanner::Walker : public Poco::Runnable
+{
+
+    public:
+        Walker( DirectoryScanner &scanner ) : scanner_(scanner) {};
+
+        void run() {
+
+            std::string dir;
+            std::vector<std::string> found;
+
+            while ( scanner_.take( dir ) ) {
+
+                int fd = ::openat( scanner_.rootFd_, dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC );
+
+                if ( fd < 0 ) {
+
+                    // removed since its parent was read
+                    if ( errno != ENOENT ) {
+
+                        scanner_.errors_++;
+                    }
+                }
+                else {
+
+                    scanner_.walk( fd, dir, manifest, found );
+                }
+
+                scanner_.done( found );
+            }
+        };
+
+        Manifest manifest;
+
+    private:
+        DirectoryScanner &scanner_;
+};
+
+DirectoryScanner::DirectoryScanner( const std::string &root, const ScanFilter *filter, int threads ) : root_(root), filter_(filter), threads_(threads), rootFd_(-1), active_(0)
+{
+    if ( threads_ <= 0 ) {
+
+        threads_ = std::min<int>( Poco::Environment::processorCount() * SCANNER_THREADS_PER_CPU, SCANNER_MAX_THREADS );
+    }
+}
+
+void DirectoryScanner::scan( Manifest &manifest, const std::string &subdir )
+{
+    manifest.clear();
+    errors_ = 0;
+
+    rootFd_ = ::open( root_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+
+    if ( rootFd_ < 0 ) {
+
+        throw Poco::OpenFileException( "Can not scan", root_ );
+    }
+
+    pending_.clear();
+    pending_.push_back( subdir == "." ? "" : subdir );
+    active_ = 0;
+
+    std::vector<Walker *> walkers;
+    std::vector<Poco::Thread *> threads;
+
+    for ( int i = 0; i < threads_; i++ ) {
+
+        walkers.push_back( new Walker( *this ) );
+        threads.push_back( new Poco::Thread( "scanner" ) );
+
+        threads.back()->start( *walkers.back() );
+    }
+
+    for ( int i = 0; i < threads_; i++ ) {
+
+        threads[i]->join();
+
+        manifest.merge( walkers[i]->manifest );
+
+        delete threads[i];
+        delete walkers[i];
+    }
+
+    ::close( rootFd_ );
+    rootFd_ = -1;
+
+    manifest.sort();
+}
+
+bool DirectoryScanner::take( std::string &dir )
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    // nothing to do yet, but a busy walker may still find more
+    while ( pending_.empty() && active_ > 0 ) {
+
+        ready_.wait( mutex_ );
+    }
+
+    if ( pending_.empty() ) {
+
+        return false;
+    }
+
+    dir.swap( pending_.back() );
+    pending_.pop_back();
+
+    active_++;
+
+    return true;
+}
+
+void DirectoryScanner::done( std::vector<std::string> &found )
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    active_--;
+
+    bool wake = found.empty() == false || active_ == 0;
+
+    for ( std::vector<std::string>::iterator it = found.begin(); it != found.end(); it++ ) {
+
+        pending_.push_back( std::string() );
+        pending_.back().swap( *it );
+    }
+
+    found.clear();
+
+    if ( wake ) {
+
+        ready_.broadcast();
+    }
+}
+
+void DirectoryScanner::entry( int dirFd, const std::string &dir, const char *name, Manifest &manifest, std::vector<std::string> &found )
+{
+    if ( name[0] == '.' && ( name[1] == '\0' || ( name[1] == '.' && name[2] == '\0' ) ) ) {
+
+        return;
+    }
+
+    std::string path( dir );
+
+    if ( path.empty() == false ) {
+
+        path += '/';
+    }
+
+    path += name;
+
+    if ( filter_ && filter_->ignored( path ) ) {
+
+        return;
+    }
+
+    struct stat st;
+
+    if ( ::fstatat( dirFd, name, &st, AT_SYMLINK_NOFOLLOW ) != 0 ) {
+
+        if ( errno != ENOENT ) {
+
+            errors_++;
+        }
+
+        return;
+    }
+
+#ifdef __APPLE__
+    Poco::Int64 mtime = (Poco::Int64) st.st_mtimespec.tv_sec * 1000000 + st.st_mtimespec.tv_nsec / 1000;
+#else
+    Poco::Int64 mtime = (Poco::Int64) st.st_mtim.tv_sec * 1000000 + st.st_mtim.tv_nsec / 1000;
+#endif
+
+    manifest.add( path, st.st_mode, st.st_size, mtime );
+
+    if ( S_ISDIR( st.st_mode ) ) {
+
+        found.push_back( path );
+    }
+}
+
+void DirectoryScanner::walk( int dirFd, const std::string &dir, Manifest &manifest, std::vector<std::string> &found )
+{
+#ifdef __linux__
+    char buffer[ SCANNER_DENTS_SIZE ];
+
+    for ( ;; ) {
+
+        long n = ::syscall( SYS_getdents64, dirFd, buffer, sizeof(buffer) );
+
+        if ( n <= 0 ) {
+
+            if ( n < 0 ) {
+
+                errors_++;
+            }
+            break;
+        }
+
+        for ( long offset = 0; offset < n; ) {
+
+            struct linux_dirent64 *d = (struct linux_dirent64 *) ( buffer + offset );
+
+            entry( dirFd, dir, d->d_name, manifest, found );
+
+            offset += d->d_reclen;
+        }
+    }
+
+    ::close( dirFd );
+#else
+    // closedir() closes dirFd
+    DIR *d = ::fdopendir( dirFd );
+
+    if ( d == NULL ) {
+
+        errors_++;
+
+        ::close( dirFd );
+        return;
+    }
+
+    struct dirent *e;
+
+    while ( ( e = ::readdir( d ) ) != NULL ) {
+
+        entry( dirFd, dir, e->d_name, manifest, found );
+    }
+
+    ::closedir( d );
+#endif
+}
@@ -30,48 +30,34 @@
 #include "Poco/Notification.h"
 #include "Poco/NotificationQueue.h"
 
+#include "Poco/Util/Application.h"
+
 #include "libfswatch/c++/event.hpp"
 #include "libfswatch/c++/monitor.hpp"
 
 #include "FSWatchMonitorDirectory.h"
 
+#include "config.h"
+
 #include "Queue.h"
 
 #include "SourceSync.h"
 
 static void handleEventsBounce(const std::vector<fsw::event>& events, void *context);
 
-FSWatchMonitorDirectory::FSWatchMonitorDirectory( const std::string &path) : MonitorDirectory(path, "FSWatchDir"), start(this, &FSWatchMonitorDirectory::runImpl) 
+FSWatchMonitorDirectory::FSWatchMonitorDirectory( const std::vector<Mapping *> &mappings ) : MonitorDirectory("", "FSWatchDir"), start(this, &FSWatchMonitorDirectory::runImpl), mappings_(mappings)
 {
     FUNCTIONTRACE;
 
-    Poco::BasicEvent<std::string> pathChanged;
-
-    Poco::Path p(path);
-
-    // special case for "." - otherwise we get CWD/.
-    // and that breaks string substitution later.
-    if ( path == "." ) {
-
-        p = Poco::Path::current();
-    }
+    std::vector<std::string> paths;
 
-    if ( p.isAbsolute() ) {
+    for ( std::vector<Mapping *>::const_iterator it = mappings_.begin(); it != mappings_.end(); it++ ) {
 
-        base_ = p;
-    }
-    else {
+        LOG_DEBUG( logger_, Poco::format("Monitoring %s (%s)", (*it)->name(), (*it)->local().toString() ) );
 
-        // uses CWD
-        base_ = p.absolute();
+        paths.push_back( (*it)->local().toString() );
     }
 
-    logger_.debug( Poco::format("Monitoring %s (%s)",path, base_.toString() ) );
-
-    std::vector<std::string> paths;
-
-    paths.push_back( path );
-
     monitor_ = fsw::monitor_factory::create_monitor(fsw_monitor_type::system_default_monitor_type, // type - system specific default..
             paths,
             handleEventsBounce,
@@ -79,7 +65,8 @@ FSWatchMonitorDirectory::FSWatchMonitorDirectory( const std::string &path) : Mon
 
     // active_monitor->set_properties(monitor_properties);
     // active_monitor->set_allow_overflow(allow_overflow);
-    monitor_->set_latency( 1.0 );
+    // short, bursts of writes to one file are gathered by the Debouncer
+    monitor_->set_latency( Poco::Util::Application::instance().config().getDouble( CONFIG_MONITOR_LATENCY, 0.25 ) );
     // monitor_->set_fire_idle_event( true );
     monitor_->set_recursive( true );
 
@@ -90,57 +77,101 @@ FSWatchMonitorDirectory::FSWatchMonitorDirectory( const std::string &path) : Mon
     // active_monitor->set_watch_access(aflag);
 
 
-    // this triggers the initial synchronization of this directory
-    // make sure we create parent directories first by prioritizing those with shorter paths
-    // files will get prioritized by modified date.
-    logger_.debug( Poco::format("Adding %s at priority %Lu", path, (Poco::UInt64) path.length() ) );
-
-    std::string pathRelativeToBase( path );
+    // this triggers the initial synchronization of each mapping
+    for ( std::vector<Mapping *>::const_iterator it = mappings_.begin(); it != mappings_.end(); it++ ) {
 
-    Poco::replaceInPlace( pathRelativeToBase, base_.toString().c_str(), "" );
+        LOG_INFORMATION( logger_, Poco::format("Syncing (d) %s:%s...", (*it)->name(), std::string(".") ) );
+        LOG_DEBUG( logger_, Poco::format("Queuing directory %s as bulk", std::string(".") ) );
 
-    logger_.information( Poco::format("Syncing (d) %s...", pathRelativeToBase ) );
-    logger_.debug( Poco::format("Queuing directory %s at priority %d", std::string("."), 1 ) );
+        thisApp->queueDir( (*it)->id(), ".", JobScheduler::BULK );
+    }
 
-    thisApp->queue()->enqueueNotification( new DirSyncMessage( "." ), 1 );
-    logger_.information( Poco::format("%d task(s) in queue", thisApp->jobCount() ) );
+    LOG_INFORMATION( logger_, Poco::format("%d task(s) in queue", thisApp->jobCount() ) );
 
     // start monitoring in a new thread
     start();
 }
 
+Mapping *FSWatchMonitorDirectory::mappingFor( const std::string &path, std::string &pathRelativeToBase )
+{
+    Mapping *found = NULL;
+
+    // mappings may be nested, the deepest one wins
+    for ( std::vector<Mapping *>::const_iterator it = mappings_.begin(); it != mappings_.end(); it++ ) {
+
+        std::string relativePath;
+
+        if ( (*it)->relative( path, relativePath ) ) {
+
+            if ( found == NULL || (*it)->local().toString().length() > found->local().toString().length() ) {
+
+                found = *it;
+                pathRelativeToBase = relativePath;
+            }
+        }
+    }
+
+    return found;
+}
+
 void FSWatchMonitorDirectory::handleEvents(const std::vector<fsw::event>& events)
 {
+    TRACE_SCOPE( "monitor callback", "monitor" );
+
     for ( std::vector<fsw::event>::const_iterator it = events.begin(); it != events.end(); it++ ) {
 
         const fsw::event &ev = *it;
 
+        std::string pathRelativeToBase;
+
+        Mapping *mapping = mappingFor( ev.get_path(), pathRelativeToBase );
+
+        if ( mapping == NULL ) {
+
+            LOG_INFORMATION( logger_, Poco::format("Not syncing %s, outside all mappings...", ev.get_path() ) );
+            continue;
+        }
+
         std::vector<fsw_event_flag> flags = ev.get_flags();
 
+        // a touch or chmod, nothing was written
+        bool attributes = false;
+        bool written = false;
+
+        for ( std::vector<fsw_event_flag>::iterator jt = flags.begin(); jt != flags.end(); jt++ ) {
+
+            attributes |= ( *jt & ( AttributeModified | OwnerModified ) ) != 0;
+            written |= ( *jt & ( Created | Updated | Renamed | Removed | MovedFrom | MovedTo ) ) != 0;
+        }
+
         for ( std::vector<fsw_event_flag>::iterator jt = flags.begin(); jt != flags.end(); jt++ ) {
 
 
             if ( *jt & Removed ) {
 
-                // something has been removed - handle that by 
-                // sending a DirSync message for its PARENT directory
+                // something has been removed - queue an explicit delete of
+                // just that path, rather than syncing the whole of its
+                // parent directory. The periodic reconciliation in the Queue
+                // covers anything this misses.
 
-                Poco::Path path( ev.get_path() );
+                Poco::File f ( ev.get_path() );
 
-                std::string pathRelativeToBase( path.parent().toString() );
+                if ( f.exists() ) {
 
-                Poco::replaceInPlace( pathRelativeToBase, base_.toString().c_str(), "" );
+                    // replaced already (i.e. an editor's atomic save) the
+                    // Created/Updated flag for the same event will sync it
+                    continue;
+                }
 
-                if ( pathRelativeToBase.empty() ) {
+                if ( pathRelativeToBase == "." ) {
 
-                    pathRelativeToBase = ".";
+                    continue;
                 }
 
-                logger_.information( Poco::format("Syncing (d) %s %s %s %s...", ev.get_path(), path.toString(), path.parent().toString(), pathRelativeToBase ) );
-                logger_.debug( Poco::format("Queuing directory %s at priority %Lu", pathRelativeToBase, (Poco::UInt64) ev.get_time() ) );
+                LOG_INFORMATION( logger_, Poco::format("Deleting %s:%s...", mapping->name(), pathRelativeToBase ) );
+                LOG_DEBUG( logger_, Poco::format("Queuing delete %s", pathRelativeToBase ) );
 
-                thisApp->queue()->enqueueNotification( 
-                        new DirSyncMessage( pathRelativeToBase ),  ev.get_time()  );
+                thisApp->fileRemoved( mapping->id(), pathRelativeToBase );
 
             }
             else if ( *jt & IsFile ) {
@@ -149,19 +180,14 @@ void FSWatchMonitorDirectory::handleEvents(const std::vector<fsw::event>& events
 
                 if ( f.exists() ) {
 
-                    std::string pathRelativeToBase( ev.get_path() );
-
-                    Poco::replaceInPlace( pathRelativeToBase, base_.toString().c_str(), "" );
-
-                    logger_.information( Poco::format("Syncing (f) %s...", pathRelativeToBase ) );
-                    logger_.debug( Poco::format("Queuing file %s at priority %Lu", pathRelativeToBase, (Poco::UInt64) ev.get_time() ) );
+                    LOG_INFORMATION( logger_, Poco::format("Syncing (f) %s:%s...", mapping->name(), pathRelativeToBase ) );
+                    LOG_DEBUG( logger_, Poco::format("Queuing file %s", pathRelativeToBase ) );
 
-                    thisApp->queue()->enqueueNotification( 
-                            new FileSyncMessage( pathRelativeToBase ), ev.get_time() );
+                    thisApp->fileChanged( mapping->id(), pathRelativeToBase, attributes && !written );
                 }
                 else {
 
-                    logger_.information( Poco::format("Not syncing non-existant file %s...", f.path() ) );
+                    LOG_INFORMATION( logger_, Poco::format("Not syncing non-existant file %s...", f.path() ) );
                 }
 
             }
@@ -171,25 +197,20 @@ void FSWatchMonitorDirectory::handleEvents(const std::vector<fsw::event>& events
 
                 if ( f.exists() ) {
 
-                    std::string pathRelativeToBase( ev.get_path() );
-
-                    Poco::replaceInPlace( pathRelativeToBase, base_.toString().c_str(), "" );
-
-                    logger_.information( Poco::format("Syncing (d) %s...", pathRelativeToBase ) );
-                    logger_.debug( Poco::format("Queuing directory %s at priority %Lu", pathRelativeToBase, (Poco::UInt64) ev.get_time() ) );
+                    LOG_INFORMATION( logger_, Poco::format("Syncing (d) %s:%s...", mapping->name(), pathRelativeToBase ) );
+                    LOG_DEBUG( logger_, Poco::format("Queuing directory %s", pathRelativeToBase ) );
 
-                    thisApp->queue()->enqueueNotification( 
-                            new DirSyncMessage( pathRelativeToBase ),  ev.get_time()  );
+                    thisApp->queueDir( mapping->id(), pathRelativeToBase );
                 }
                 else {
 
-                    logger_.information( Poco::format("Not syncing non-existant directory %s...", f.path() ) );
+                    LOG_INFORMATION( logger_, Poco::format("Not syncing non-existant directory %s...", f.path() ) );
                 }
 
 
             }
             else {
-                logger_.information( Poco::format("%d task(s) in queue", thisApp->jobCount() ) );
+                LOG_INFORMATION( logger_, Poco::format("%d task(s) in queue", thisApp->jobCount() ) );
             }
         }
     }
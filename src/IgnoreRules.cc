@@ -0,0 +1,117 @@
+/**
+ * \file IgnoreRules.cc
+ *
+ * \brief - The rules of one .srcsyncignore file
+ *
+ */
+
+#include <fstream>
+#include <sstream>
+
+#include "Poco/String.h"
+
+#include "IgnoreRules.h"
+
+IgnoreRules::IgnoreRules( const std::string &rules )
+{
+    std::istringstream in( rules );
+    std::string line;
+
+    while ( std::getline( in, line ) ) {
+
+        line = Poco::trim( line );
+
+        if ( line.empty() || line[0] == '#' ) {
+
+            continue;
+        }
+
+        Rule rule;
+
+        rule.include = ( line[0] == '!' );
+
+        if ( rule.include ) {
+
+            line.erase( 0, 1 );
+        }
+
+        // "dir/" is the same as "dir", the walk does not go into either
+        while ( line.length() > 1 && line[ line.length() - 1 ] == '/' ) {
+
+            line.erase( line.length() - 1 );
+        }
+
+        rule.anchored = ( line.find( '/' ) != std::string::npos );
+
+        if ( line[0] == '/' ) {
+
+            line.erase( 0, 1 );
+        }
+
+        if ( line.empty() ) {
+
+            continue;
+        }
+
+        rule.glob = new Poco::Glob( line );
+
+        rules_.push_back( rule );
+    }
+}
+
+Poco::SharedPtr<IgnoreRules> IgnoreRules::load( const std::string &file )
+{
+    std::ifstream in( file.c_str() );
+
+    if ( !in ) {
+
+        return NULL;
+    }
+
+    std::ostringstream rules;
+
+    rules << in.rdbuf();
+
+    return new IgnoreRules( rules.str() );
+}
+
+IgnoreRules::Result IgnoreRules::match( const std::string &path ) const
+{
+    // last match wins, so walk the rules backwards and stop at the first
+    for ( std::vector<Rule>::const_reverse_iterator it = rules_.rbegin(); it != rules_.rend(); it++ ) {
+
+        std::string::size_type start = 0;
+
+        while ( true ) {
+
+            std::string::size_type slash = path.find( '/', start );
+
+            bool matched;
+
+            if ( it->anchored ) {
+
+                // the path, or a directory it is in
+                matched = it->glob->match( path.substr( 0, slash ) );
+            }
+            else {
+
+                // any name in the path
+                matched = it->glob->match( path.substr( start, slash == std::string::npos ? std::string::npos : slash - start ) );
+            }
+
+            if ( matched ) {
+
+                return it->include ? INCLUDE : IGNORE;
+            }
+
+            if ( slash == std::string::npos ) {
+
+                break;
+            }
+
+            start = slash + 1;
+        }
+    }
+
+    return NO_MATCH;
+}
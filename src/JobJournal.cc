@@ -0,0 +1,334 @@
+/**
+ * \file JobJournal.cc
+ *
+ * \brief - Changes queued for a destination that have not been sent yet
+ *
+ */
+
+#include <cstring>
+#include <fstream>
+
+#include "Poco/File.h"
+#include "Poco/Path.h"
+#include "Poco/Logger.h"
+#include "Poco/Format.h"
+#include "Poco/Exception.h"
+
+#include "JobJournal.h"
+
+#define JOURNAL_MAGIC           "SSJ1"
+#define JOURNAL_INITIAL_SIZE    ( 1024 * 1024 )
+#define JOURNAL_REPLAY_INTERVAL ( 60 * 1000000 )
+
+// each record is LENGTH (of the path, 0 marks the end), OP, KIND,
+// SEQUENCE then the path. LENGTH is written last so a record is only
+// seen once it is complete.
+#define JOURNAL_RECORD_HEADER   8
+
+JobJournal::JobJournal( const std::string &file ) : file_(file), size_(0), tail_(0), sequence_(0), failing_(false)
+{
+    if ( file_.empty() ) {
+
+        return;
+    }
+
+    try {
+
+        Poco::File( Poco::Path( file_ ).parent() ).createDirectories();
+
+        Poco::File f( file_ );
+
+        if ( f.exists() && f.getSize() > JOURNAL_RECORD_HEADER ) {
+
+            map( f.getSize() );
+            load();
+
+            // start with just what is outstanding
+            compact();
+        }
+        else {
+
+            map( JOURNAL_INITIAL_SIZE );
+
+            std::memcpy( memory_->begin(), JOURNAL_MAGIC, 4 );
+            tail_ = 4;
+        }
+    }
+    catch ( Poco::Exception &ex ) {
+
+        Poco::Logger::get("JobJournal").error( Poco::format("%s, queued changes will not survive a restart", ex.displayText() ) );
+
+        memory_ = 0;
+        file_.clear();
+    }
+}
+
+void JobJournal::map( size_t size )
+{
+    memory_ = 0;
+
+    Poco::File f( file_ );
+
+    if ( f.exists() == false ) {
+
+        f.createFile();
+    }
+
+    if ( f.getSize() != size ) {
+
+        f.setSize( size );
+    }
+
+    memory_ = new Poco::SharedMemory( f, Poco::SharedMemory::AM_WRITE );
+    size_ = size;
+}
+
+void JobJournal::load()
+{
+    const char *base = memory_->begin();
+
+    if ( std::memcmp( base, JOURNAL_MAGIC, 4 ) != 0 ) {
+
+        throw Poco::DataFormatException( "Not a journal", file_ );
+    }
+
+    size_t offset = 4;
+
+    while ( offset + JOURNAL_RECORD_HEADER <= size_ ) {
+
+        Poco::UInt16 length;
+        Poco::UInt32 sequence;
+
+        std::memcpy( &length, base + offset, sizeof(length) );
+
+        if ( length == 0 || offset + JOURNAL_RECORD_HEADER + length > size_ ) {
+
+            break;
+        }
+
+        std::memcpy( &sequence, base + offset + 4, sizeof(sequence) );
+
+        apply( (Op) base[ offset + 2 ], base[ offset + 3 ], sequence, std::string( base + offset + JOURNAL_RECORD_HEADER, length ) );
+
+        offset += JOURNAL_RECORD_HEADER + length;
+    }
+
+    tail_ = offset;
+}
+
+void JobJournal::apply( Op op, int kind, Sequence sequence, const std::string &path )
+{
+    if ( sequence > sequence_ ) {
+
+        sequence_ = sequence;
+    }
+
+    std::map<std::string, State>::iterator it = state_.find( path );
+
+    if ( op == PENDING ) {
+
+        if ( it == state_.end() ) {
+
+            State s = { sequence, 0, kind };
+
+            state_[ path ] = s;
+        }
+        else {
+
+            it->second.queued = sequence;
+            it->second.kind = kind;
+        }
+    }
+    else if ( it != state_.end() ) {
+
+        if ( sequence > it->second.completed ) {
+
+            it->second.completed = sequence;
+        }
+
+        // nothing queued since, forget it
+        if ( it->second.completed >= it->second.queued ) {
+
+            state_.erase( it );
+        }
+    }
+}
+
+void JobJournal::append( Op op, int kind, Sequence sequence, const std::string &path )
+{
+    apply( op, kind, sequence, path );
+
+    if ( !memory_ || path.length() > 0xffff ) {
+
+        return;
+    }
+
+    // room for the record and the 0 length that ends the journal
+    if ( tail_ + JOURNAL_RECORD_HEADER + path.length() + 2 > size_ ) {
+
+        // the record has already been applied, compact() writes it
+        try {
+
+            compact();
+        }
+        catch ( Poco::Exception &ex ) {
+
+            Poco::Logger::get("JobJournal").error( Poco::format("%s, queued changes will not survive a restart", ex.displayText() ) );
+
+            memory_ = 0;
+            file_.clear();
+        }
+
+        return;
+    }
+
+    char *p = memory_->begin() + tail_;
+
+    Poco::UInt16 length = path.length();
+
+    p[2] = (char) op;
+    p[3] = (char) kind;
+    std::memcpy( p + 4, &sequence, sizeof(sequence) );
+    std::memcpy( p + JOURNAL_RECORD_HEADER, path.data(), length );
+
+    std::memcpy( p, &length, sizeof(length) );
+
+    tail_ += JOURNAL_RECORD_HEADER + length;
+}
+
+void JobJournal::compact()
+{
+    if ( file_.empty() ) {
+
+        return;
+    }
+
+    size_t needed = 4 + 2;
+
+    for ( std::map<std::string, State>::const_iterator it = state_.begin(); it != state_.end(); it++ ) {
+
+        needed += JOURNAL_RECORD_HEADER + it->first.length();
+    }
+
+    size_t size = size_ > JOURNAL_INITIAL_SIZE ? size_ : JOURNAL_INITIAL_SIZE;
+
+    // leave at least as much room again for new records
+    while ( needed * 2 > size ) {
+
+        size *= 2;
+    }
+
+    // written aside then renamed, a crash leaves either the old journal
+    // or the new one
+    std::string tmp( file_ + ".tmp" );
+
+    size_t written = 4;
+
+    {
+        std::ofstream out( tmp.c_str(), std::ios::binary | std::ios::trunc );
+
+        out.write( JOURNAL_MAGIC, 4 );
+
+        for ( std::map<std::string, State>::const_iterator it = state_.begin(); it != state_.end(); it++ ) {
+
+            char header[ JOURNAL_RECORD_HEADER ];
+
+            Poco::UInt16 length = it->first.length();
+
+            std::memcpy( header, &length, sizeof(length) );
+            header[2] = (char) PENDING;
+            header[3] = (char) it->second.kind;
+            std::memcpy( header + 4, &it->second.queued, sizeof(it->second.queued) );
+
+            out.write( header, sizeof(header) );
+            out.write( it->first.data(), length );
+
+            written += sizeof(header) + length;
+        }
+
+        if ( !out ) {
+
+            throw Poco::WriteFileException( "Can not compact journal", tmp );
+        }
+    }
+
+    memory_ = 0;
+
+    Poco::File( tmp ).renameTo( file_ );
+
+    // grows (or shrinks) it, the new space reads as zeros
+    map( size );
+
+    tail_ = written;
+}
+
+JobJournal::Sequence JobJournal::pending( int kind, const std::string &path )
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    return record( kind, path );
+}
+
+JobJournal::Sequence JobJournal::record( int kind, const std::string &path )
+{
+    Sequence sequence = ++sequence_;
+
+    append( PENDING, kind, sequence, path );
+
+    return sequence;
+}
+
+void JobJournal::done( const std::string &path, Sequence sequence )
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    // nothing outstanding, no need to record it
+    if ( state_.find( path ) == state_.end() ) {
+
+        return;
+    }
+
+    append( DONE, 0, sequence, path );
+}
+
+JobJournal::Sequence JobJournal::last() const
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    return sequence_;
+}
+
+void JobJournal::outstanding( std::map<std::string, Outstanding> &paths ) const
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    for ( std::map<std::string, State>::const_iterator it = state_.begin(); it != state_.end(); it++ ) {
+
+        Outstanding &o = paths[ it->first ];
+
+        o.kind = it->second.kind;
+        o.sequence = it->second.queued;
+    }
+}
+
+void JobJournal::failed()
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    failing_ = true;
+}
+
+bool JobJournal::recovered()
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    if ( failing_ == false || replayed_.isElapsed( JOURNAL_REPLAY_INTERVAL ) == false ) {
+
+        return false;
+    }
+
+    failing_ = false;
+    replayed_.update();
+
+    return true;
+}
@@ -0,0 +1,383 @@
+/**
+ * \file JobScheduler.cc
+ *
+ * \brief - Hands SyncJobs from the monitor to a Queue's workers
+ *
+ */
+
+#include "Poco/Thread.h"
+
+#include "JobScheduler.h"
+
+// jobs moved from the ingress ring per drain, small enough that the
+// other workers soon have something to steal
+#define DRAIN_BATCH 32
+
+// attempts before a worker with nothing to do goes to sleep
+#define IDLE_SPINS 64
+
+// a sleeping worker re-checks this often (ms) even without a wakeup
+#define IDLE_WAIT 100
+
+static size_t roundUp( size_t n )
+{
+    size_t p = 2;
+
+    while ( p < n ) {
+
+        p <<= 1;
+    }
+
+    return p;
+}
+
+WorkDeque::WorkDeque( size_t capacity ) : top_(0), bottom_(0)
+{
+    size_t size = roundUp( capacity );
+
+    mask_ = size - 1;
+    jobs_ = new std::atomic<SyncJob *>[ size ];
+
+    for ( size_t i = 0; i < size; i++ ) {
+
+        jobs_[i].store( NULL, std::memory_order_relaxed );
+    }
+}
+
+WorkDeque::~WorkDeque()
+{
+    delete [] jobs_;
+}
+
+// Le, Pop, Cohen & Zappa Nardelli, "Correct and Efficient Work-Stealing
+// for Weak Memory Models", PPoPP 2013 - without the resizing
+
+bool WorkDeque::push( SyncJob *job )
+{
+    long b = bottom_.load( std::memory_order_relaxed );
+    long t = top_.load( std::memory_order_acquire );
+
+    if ( b - t > (long) mask_ ) {
+
+        return false;
+    }
+
+    jobs_[ b & mask_ ].store( job, std::memory_order_relaxed );
+
+    std::atomic_thread_fence( std::memory_order_release );
+
+    bottom_.store( b + 1, std::memory_order_relaxed );
+
+    return true;
+}
+
+SyncJob *WorkDeque::pop()
+{
+    long b = bottom_.load( std::memory_order_relaxed ) - 1;
+
+    bottom_.store( b, std::memory_order_relaxed );
+
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+
+    long t = top_.load( std::memory_order_relaxed );
+
+    if ( t > b ) {
+
+        // empty
+        bottom_.store( b + 1, std::memory_order_relaxed );
+        return NULL;
+    }
+
+    SyncJob *job = jobs_[ b & mask_ ].load( std::memory_order_relaxed );
+
+    if ( t == b ) {
+
+        // last one, race any thief for it
+        if ( top_.compare_exchange_strong( t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed ) == false ) {
+
+            job = NULL;
+        }
+
+        bottom_.store( b + 1, std::memory_order_relaxed );
+    }
+
+    return job;
+}
+
+SyncJob *WorkDeque::steal()
+{
+    long t = top_.load( std::memory_order_acquire );
+
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+
+    long b = bottom_.load( std::memory_order_acquire );
+
+    if ( t >= b ) {
+
+        return NULL;
+    }
+
+    SyncJob *job = jobs_[ t & mask_ ].load( std::memory_order_relaxed );
+
+    // lost to the owner or another thief, the caller just looks elsewhere
+    if ( top_.compare_exchange_strong( t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed ) == false ) {
+
+        return NULL;
+    }
+
+    return job;
+}
+
+size_t WorkDeque::room() const
+{
+    long used = bottom_.load( std::memory_order_relaxed ) - top_.load( std::memory_order_acquire );
+
+    return used > (long) mask_ ? 0 : mask_ + 1 - used;
+}
+
+bool WorkDeque::empty() const
+{
+    return bottom_.load( std::memory_order_acquire ) <= top_.load( std::memory_order_acquire );
+}
+
+JobScheduler::JobScheduler( int workers, size_t ingressCapacity, size_t dequeCapacity, Recorder *recorder ) :
+    draining_( false ),
+    recorder_( recorder ),
+    workers_( workers ),
+    pending_( 0 ),
+    sleepers_( 0 ),
+    stopped_( false )
+{
+    for ( int priority = 0; priority < PRIORITY_COUNT; priority++ ) {
+
+        ingress_[ priority ] = new MPSCRing<SyncJob *>( ingressCapacity );
+    }
+
+    for ( int i = 0; i < workers * PRIORITY_COUNT; i++ ) {
+
+        deques_.push_back( new WorkDeque( dequeCapacity ) );
+    }
+}
+
+JobScheduler::~JobScheduler()
+{
+    // drop the references to anything never run
+    SyncJob *job;
+
+    for ( int priority = 0; priority < PRIORITY_COUNT; priority++ ) {
+
+        while ( ingress_[ priority ]->pop( job ) ) {
+
+            job->release();
+        }
+
+        delete ingress_[ priority ];
+    }
+
+    for ( std::vector<WorkDeque *>::iterator it = deques_.begin(); it != deques_.end(); it++ ) {
+
+        while ( ( job = (*it)->pop() ) != NULL ) {
+
+            job->release();
+        }
+
+        delete *it;
+    }
+}
+
+void JobScheduler::push( SyncJob *job, Priority priority )
+{
+    pending_++;
+
+    int spins = 0;
+
+    while ( ingress_[ priority ]->push( job ) == false ) {
+
+        // full - make sure the workers are draining and back off
+        wake( true );
+
+        if ( ++spins < IDLE_SPINS ) {
+
+            Poco::Thread::yield();
+        }
+        else {
+
+            Poco::Thread::sleep( 1 );
+        }
+    }
+
+    // pairs with the fence in next(), either we see the sleeper or it sees the job
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+
+    if ( sleepers_.load( std::memory_order_relaxed ) > 0 ) {
+
+        wake( false );
+    }
+}
+
+void JobScheduler::drain( int worker )
+{
+    if ( draining_.exchange( true, std::memory_order_acquire ) ) {
+
+        return;
+    }
+
+    SyncJob *jobs[ DRAIN_BATCH ];
+    int priorities[ DRAIN_BATCH ];
+    size_t moved = 0;
+
+    // interactive jobs first, however many bulk ones were queued before
+    // them. A full deque leaves its jobs in the ring, for another
+    // worker's drain or this one's once it has room again.
+    for ( int priority = 0; priority < PRIORITY_COUNT && moved < DRAIN_BATCH; priority++ ) {
+
+        size_t room = deque( worker, priority ).room();
+
+        for ( ; room > 0 && moved < DRAIN_BATCH && ingress_[ priority ]->pop( jobs[ moved ] ); room-- ) {
+
+            priorities[ moved++ ] = priority;
+        }
+    }
+
+    if ( moved > 0 && recorder_ ) {
+
+        recorder_->drained( jobs, moved );
+    }
+
+    for ( size_t i = 0; i < moved; i++ ) {
+
+        deque( worker, priorities[ i ] ).push( jobs[ i ] );
+    }
+
+    draining_.store( false, std::memory_order_release );
+
+    // give the sleepers something to steal
+    if ( moved > 1 && sleepers_.load( std::memory_order_relaxed ) > 0 ) {
+
+        wake( true );
+    }
+}
+
+SyncJob *JobScheduler::take( int worker )
+{
+    SyncJob *job;
+
+    drain( worker );
+
+    for ( int priority = 0; priority < PRIORITY_COUNT; priority++ ) {
+
+        if ( ( job = deque( worker, priority ).pop() ) != NULL ) {
+
+            return job;
+        }
+
+        for ( int i = 1; i < workers_; i++ ) {
+
+            if ( ( job = deque( ( worker + i ) % workers_, priority ).steal() ) != NULL ) {
+
+                return job;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+bool JobScheduler::idle() const
+{
+    for ( int priority = 0; priority < PRIORITY_COUNT; priority++ ) {
+
+        if ( ingress_[ priority ]->empty() == false ) {
+
+            return false;
+        }
+    }
+
+    for ( std::vector<WorkDeque *>::const_iterator it = deques_.begin(); it != deques_.end(); it++ ) {
+
+        if ( (*it)->empty() == false ) {
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void JobScheduler::wake( bool all )
+{
+    Poco::FastMutex::ScopedLock lock( sleepMutex_ );
+
+    if ( all ) {
+
+        sleep_.broadcast();
+    }
+    else {
+
+        sleep_.signal();
+    }
+}
+
+SyncJob *JobScheduler::poll( int worker )
+{
+    if ( stopped_.load( std::memory_order_acquire ) ) {
+
+        return NULL;
+    }
+
+    SyncJob *job = take( worker );
+
+    if ( job ) {
+
+        pending_--;
+    }
+
+    return job;
+}
+
+SyncJob *JobScheduler::next( int worker )
+{
+    int spins = 0;
+
+    while ( stopped_.load( std::memory_order_acquire ) == false ) {
+
+        SyncJob *job = take( worker );
+
+        if ( job ) {
+
+            pending_--;
+            return job;
+        }
+
+        if ( ++spins < IDLE_SPINS ) {
+
+            Poco::Thread::yield();
+            continue;
+        }
+
+        spins = 0;
+
+        Poco::FastMutex::ScopedLock lock( sleepMutex_ );
+
+        sleepers_++;
+
+        // pairs with the fence in push()
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+
+        if ( idle() && stopped_.load( std::memory_order_acquire ) == false ) {
+
+            sleep_.tryWait( sleepMutex_, IDLE_WAIT );
+        }
+
+        sleepers_--;
+    }
+
+    return NULL;
+}
+
+void JobScheduler::stop()
+{
+    stopped_.store( true, std::memory_order_release );
+
+    wake( true );
+}
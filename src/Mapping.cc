@@ -0,0 +1,287 @@
+/**
+ * \file Mapping.cc
+ *
+ * \brief - A source directory and the destination URI(s) it is mirrored to
+ *
+ */
+
+#include "Poco/Util/Application.h"
+
+#include "Poco/StringTokenizer.h"
+#include "Poco/Format.h"
+#include "Poco/MD5Engine.h"
+
+#include "SourceSync.h"
+#include "Mapping.h"
+
+#include "config.h"
+
+Destination::Destination( int id, const std::string &uri, const std::string &manifest, const std::string &journal, const std::string &signatures ) : id_(id), queue_(NULL), manifest_( new RemoteManifest( manifest ) ), journal_( new JobJournal( journal ) ), signatures_( new SignatureCache( signatures ) )
+{
+    std::string d( uri );
+
+    // ensure we always have a destination ending with '/'
+    if ( d.empty() == false && d[ d.length() - 1 ] != '/' ) {
+
+        d += Poco::Path::separator();
+    }
+
+    remote_ = Poco::URI( d );
+
+    std::string auth = remote_.getUserInfo();
+
+    Poco::StringTokenizer tok( auth, ":", Poco::StringTokenizer::TOK_TRIM );
+
+    if ( tok.count() > 0 ) {
+
+        user_ = tok[ 0 ];
+    }
+
+    if ( tok.count() == 2  ) {
+
+        password_ = tok[ 1 ];
+    }
+}
+
+Destination::~Destination()
+{
+    delete manifest_;
+    delete journal_;
+    delete signatures_;
+}
+
+std::string Destination::hostKey() const
+{
+    return Poco::format( "%s://%s@%s:%hu", remote_.getScheme(), user_, remote_.getHost(), remote_.getPort() );
+}
+
+void Destination::deleted( int count )
+{
+    for ( int i = 0; i < count; i++ ) {
+
+        deleted_++;
+    }
+}
+
+void Destination::logStatistics( Poco::Logger &logger, const std::string &mapping ) const
+{
+    logger.notice( Poco::format( "%s: %s: %d synced, %d unchanged, %d failed, %d deleted",
+                mapping, remote_.toString(), synced_.value(), unchanged_.value(), failed_.value(), deleted_.value() ) );
+}
+
+Mapping::Mapping( int id, const std::string &name, const std::string &src, const std::string &dest, const std::string &ignore, const std::string &privateKey ) : id_(id), name_(name)
+{
+    FUNCTIONTRACE;
+
+    std::string s( src );
+
+    // ensure we always have src ending with '/'
+    if ( s.empty() == false && s[ s.length() - 1 ] != '/' ) {
+
+        s += Poco::Path::separator();
+    }
+
+    local_ = Poco::Path( s );
+
+    // special case for "." - otherwise we get CWD/.
+    if ( s == "./" ) {
+
+        local_ = Poco::Path::current();
+    }
+
+    local_.makeAbsolute();
+
+    Poco::StringTokenizer uris( dest, " ,", Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY );
+
+    Poco::Path stateDir( Poco::Util::Application::instance().config().getString( CONFIG_STATE_DIR, Poco::Path::home() + "." APPNAME ) );
+
+    stateDir.makeDirectory();
+
+    for ( int i = 0; i < uris.count(); i++ ) {
+
+        // named after the mapping and URI, so reordering a profile keeps them
+        Poco::MD5Engine md5;
+
+        md5.update( name_ + " " + uris[i] );
+
+        std::string base( Poco::DigestEngine::digestToHex( md5.digest() ) );
+
+        Poco::Path manifest( stateDir, base + ".manifest" );
+        Poco::Path journal( stateDir, base + ".journal" );
+        Poco::Path signatures( stateDir, base + ".signatures" );
+
+        destinations_.push_back( new Destination( i, uris[i], manifest.toString(), journal.toString(), signatures.toString() ) );
+
+        if ( destinations_.back()->manifest().load() ) {
+
+            LOG_DEBUG( Poco::Logger::get("Mapping"), Poco::format( "%s: %s: loaded %z path(s) from %s", name_, uris[i], destinations_.back()->manifest().size(), manifest.toString() ) );
+        }
+    }
+
+    configure( ignore, privateKey );
+}
+
+Mapping::~Mapping()
+{
+    for ( std::vector<Destination *>::iterator it = destinations_.begin(); it != destinations_.end() ; it++ ) {
+
+        delete *it;
+    }
+}
+
+bool Mapping::ignored( const std::string &path ) const
+{
+    TRACE_SCOPE( "ignore match", "monitor" );
+
+    bool ignore = false;
+
+    Poco::SharedPtr<const Globs> globs;
+
+    {
+        Poco::FastMutex::ScopedLock lock( mutex_ );
+
+        globs = ignore_;
+    }
+
+    for ( Globs::const_iterator it = globs->begin(); it != globs->end() ; it++ ) {
+
+        if ( (*it)->match( path ) ) {
+
+            ignore = true;
+            break;
+        }
+    }
+
+    if ( path == "." ) {
+
+        return ignore;
+    }
+
+    // the rules of each directory above PATH, from the top down, each
+    // overriding what was decided above it. PATH's own ignore file only
+    // covers what is below it.
+    std::string::size_type start = 0;
+    std::string::size_type slash;
+
+    do {
+
+        slash = path.find( '/', start );
+
+        Poco::SharedPtr<IgnoreRules> r = rules( start == 0 ? std::string() : path.substr( 0, start - 1 ) );
+
+        if ( r.isNull() == false ) {
+
+            IgnoreRules::Result result = r->match( path.substr( start ) );
+
+            if ( result != IgnoreRules::NO_MATCH ) {
+
+                ignore = ( result == IgnoreRules::IGNORE );
+            }
+        }
+
+        start = slash + 1;
+
+    } while ( slash != std::string::npos );
+
+    return ignore;
+}
+
+Poco::SharedPtr<IgnoreRules> Mapping::rules( const std::string &dir ) const
+{
+    {
+        Poco::FastMutex::ScopedLock lock( mutex_ );
+
+        std::map<std::string, Poco::SharedPtr<IgnoreRules> >::const_iterator it = rules_.find( dir );
+
+        if ( it != rules_.end() ) {
+
+            return it->second;
+        }
+    }
+
+    // read without the lock, the scanner's threads keep asking meanwhile
+    Poco::SharedPtr<IgnoreRules> r = IgnoreRules::load( local_.toString() + ( dir.empty() ? "" : dir + "/" ) + IGNORE_FILE );
+
+    if ( r.isNull() == false ) {
+
+        LOG_DEBUG( Poco::Logger::get("Mapping"), Poco::format( "%s: %z rule(s) in %s/" IGNORE_FILE, name_, r->size(), dir.empty() ? std::string(".") : dir ) );
+    }
+
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    rules_[ dir ] = r;
+
+    return r;
+}
+
+void Mapping::ignoreChanged( const std::string &dir )
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    rules_.erase( dir );
+}
+
+bool Mapping::configure( const std::string &ignore, const std::string &privateKey )
+{
+    Globs *globs = new Globs;
+
+    Poco::StringTokenizer tok( ignore, " ", Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY );
+
+    for ( int i = 0; i < tok.count(); i++ ) {
+
+        globs->push_back( new Poco::Glob( tok[i] ) );
+    }
+
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    bool changed = ( ignore_.isNull() == false && ignore != ignoreList_ );
+
+    ignoreList_ = ignore;
+    ignore_ = globs;
+
+    privateKey_ = privateKey;
+
+    return changed;
+}
+
+std::string Mapping::privateKey() const
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    return privateKey_;
+}
+
+bool Mapping::relative( const std::string &path, std::string &relativePath ) const
+{
+    const std::string base = local_.toString();
+
+    if ( path.compare( 0, base.length(), base ) == 0 ) {
+
+        relativePath = path.substr( base.length() );
+    }
+    else if ( path + Poco::Path::separator() == base ) {
+
+        relativePath = "";
+    }
+    else {
+
+        return false;
+    }
+
+    if ( relativePath.empty() ) {
+
+        relativePath = ".";
+    }
+
+    return true;
+}
+
+void Mapping::logStatistics( Poco::Logger &logger ) const
+{
+    logger.notice( Poco::format( "%s: %d ignored", name_, skipped_.value() ) );
+
+    for ( std::vector<Destination *>::const_iterator it = destinations_.begin(); it != destinations_.end() ; it++ ) {
+
+        (*it)->logStatistics( logger, name_ );
+    }
+}
@@ -0,0 +1,412 @@
+/**
+ * \file MerkleAudit.cc
+ *
+ * \brief - Background check that each destination still matches the source
+ *
+ */
+
+#include <fstream>
+#include <sstream>
+
+#include <sys/stat.h>
+
+#include "Poco/Util/Application.h"
+#include "Poco/MD5Engine.h"
+#include "Poco/Thread.h"
+#include "Poco/String.h"
+#include "Poco/Format.h"
+#include "Poco/Exception.h"
+
+#include "SourceSync.h"
+#include "Queue.h"
+#include "MerkleAudit.h"
+#include "AcrosyncWorker.h"
+#include "RsyncWorker.h"
+#include "Settings.h"
+
+#include "config.h"
+
+// files hashed between checks that the Queue is still idle
+#define AUDIT_HASH_BATCH 64
+
+// the hash of one directory, as defined in MerkleAudit.h
+#define AUDIT_TREE_HASH "find . -type f -print0 | LC_ALL=C sort -z | xargs -0 -r md5sum | md5sum | cut -c1-32"
+
+MerkleAudit::MerkleAudit( Queue *queue, long interval ) : queue_(queue), timer_( interval * 1000, interval * 1000 ), logger_(Poco::Logger::get("MerkleAudit"))
+{
+    Poco::Util::AbstractConfiguration &config = Poco::Util::Application::instance().config();
+
+    pace_ = config.getInt( CONFIG_QUEUE_AUDIT_PACE, 100 );
+
+    if ( config.getString( CONFIG_SYNC_METHOD ) == CONFIG_SYNC_METHOD_ACROSYNC ) {
+
+        worker_ = new AcrosyncWorker( "audit", -1, queue );
+    }
+    else {
+
+        worker_ = new RsyncWorker( "audit", -1, queue );
+    }
+
+    timer_.start( Poco::TimerCallback<MerkleAudit>( *this, &MerkleAudit::onAudit ) );
+}
+
+MerkleAudit::~MerkleAudit()
+{
+    timer_.stop();
+
+    for ( std::map<int, Tree *>::iterator it = trees_.begin(); it != trees_.end(); it++ ) {
+
+        delete it->second;
+    }
+}
+
+void MerkleAudit::onAudit( Poco::Timer &timer )
+{
+    // nothing was sent in a dry run, nothing to compare
+    if ( Settings::current()->dryRun() ) {
+
+        return;
+    }
+
+    const std::vector<Mapping *> &mappings = thisApp->mappings();
+
+    for ( std::vector<Mapping *>::const_iterator it = mappings.begin(); it != mappings.end(); it++ ) {
+
+        const std::vector<Destination *> &destinations = (*it)->destinations();
+
+        Tree *tree = NULL;
+
+        for ( std::vector<Destination *>::const_iterator jt = destinations.begin(); jt != destinations.end(); jt++ ) {
+
+            if ( (*jt)->queue() != queue_ ) {
+
+                continue;
+            }
+
+            try {
+
+                // the local side is shared by all of the mapping's destinations
+                if ( tree == NULL ) {
+
+                    Tree *&t = trees_[ (*it)->id() ];
+
+                    if ( t == NULL ) {
+
+                        t = new Tree;
+                    }
+
+                    tree = t;
+
+                    rehash( **it, *tree );
+                }
+
+                audit( **it, **jt, *tree );
+            }
+            catch ( Poco::Exception &ex ) {
+
+                logger_.error( Poco::format("%s: audit of %s failed: %s", (*it)->name(), (*jt)->remote().toString(), ex.displayText() ) );
+            }
+        }
+    }
+}
+
+std::string MerkleAudit::md5File( const std::string &path )
+{
+    std::ifstream in( path.c_str(), std::ios::binary );
+
+    if ( !in ) {
+
+        throw Poco::OpenFileException( path );
+    }
+
+    Poco::MD5Engine md5;
+
+    char buffer[ 64 * 1024 ];
+
+    while ( in.read( buffer, sizeof(buffer) ) || in.gcount() > 0 ) {
+
+        md5.update( buffer, in.gcount() );
+    }
+
+    return Poco::DigestEngine::digestToHex( md5.digest() );
+}
+
+void MerkleAudit::rehash( const Mapping &mapping, Tree &tree )
+{
+    // no ignore rules - directory syncs send ignored files too, so they
+    // are on the remote side
+    DirectoryScanner scanner( mapping.local().toString() );
+
+    scanner.scan( tree.manifest );
+
+    std::map<std::string, FileHash> files;
+    std::map<std::string, Poco::MD5Engine *> engines;
+
+    engines[ "" ] = new Poco::MD5Engine;
+
+    int hashed = 0;
+
+    for ( size_t i = 0; i < tree.manifest.size(); i++ ) {
+
+        const Manifest::Entry &e = tree.manifest.entry( i );
+        std::string path = tree.manifest.path( i );
+
+        // sorted, so a directory comes before anything in it
+        if ( S_ISDIR( e.mode ) ) {
+
+            engines[ path ] = new Poco::MD5Engine;
+            continue;
+        }
+
+        if ( S_ISREG( e.mode ) == false ) {
+
+            continue;
+        }
+
+        FileHash &h = files[ path ];
+
+        std::map<std::string, FileHash>::const_iterator old = tree.files.find( path );
+
+        if ( old != tree.files.end() && old->second.size == e.size && old->second.mtime == e.mtime ) {
+
+            h = old->second;
+        }
+        else {
+
+            if ( ++hashed % AUDIT_HASH_BATCH == 0 ) {
+
+                idle();
+            }
+
+            try {
+
+                h.md5 = md5File( mapping.local().toString() + path );
+            }
+            catch ( Poco::Exception & ) {
+
+                // removed since the scan
+                files.erase( path );
+                continue;
+            }
+
+            h.size = e.size;
+            h.mtime = e.mtime;
+        }
+
+        // the line md5sum would print for it in each directory above it
+        std::string::size_type slash = path.rfind( '/' );
+
+        for ( ;; ) {
+
+            std::string dir = ( slash == std::string::npos ) ? "" : path.substr( 0, slash );
+
+            Poco::MD5Engine *&md5 = engines[ dir ];
+
+            if ( md5 == NULL ) {
+
+                md5 = new Poco::MD5Engine;
+            }
+
+            md5->update( h.md5 + "  ./" + path.substr( dir.empty() ? 0 : dir.length() + 1 ) + "\n" );
+
+            if ( slash == std::string::npos || slash == 0 ) {
+
+                break;
+            }
+
+            slash = path.rfind( '/', slash - 1 );
+        }
+    }
+
+    tree.files.swap( files );
+    tree.dirs.clear();
+
+    for ( std::map<std::string, Poco::MD5Engine *>::iterator it = engines.begin(); it != engines.end(); it++ ) {
+
+        tree.dirs[ it->first ] = Poco::DigestEngine::digestToHex( it->second->digest() );
+
+        delete it->second;
+    }
+
+    LOG_DEBUG( logger_, Poco::format("%s: hashed %d of %z file(s)", mapping.name(), hashed, tree.files.size() ) );
+}
+
+bool MerkleAudit::remoteRoot( const Mapping &mapping, const Destination &destination, std::string &hash )
+{
+    std::string output;
+
+    if ( worker_->runRemote( mapping, destination, AUDIT_TREE_HASH, &output ) == false ) {
+
+        return false;
+    }
+
+    hash = Poco::trim( output );
+
+    return hash.length() == 32;
+}
+
+bool MerkleAudit::remoteListing( const Mapping &mapping, const Destination &destination, const std::string &dir, Listing &listing )
+{
+    std::string command;
+
+    if ( dir.empty() == false ) {
+
+        command = "cd '" + Poco::replace( dir, "'", "'\\''" ) + "' && ";
+    }
+
+    // "TYPE HASH NAME" for each file and directory, links are skipped as
+    // find -type f skips them
+    command += "for f in * .[!.]* ..?*; do "
+                   "if [ -L \"$f\" ]; then :; "
+                   "elif [ -d \"$f\" ]; then echo \"d $(cd \"$f\" && " AUDIT_TREE_HASH ") $f\"; "
+                   "elif [ -f \"$f\" ]; then echo \"f $(md5sum < \"$f\" | cut -c1-32) $f\"; "
+                   "fi; "
+               "done";
+
+    std::string output;
+
+    if ( worker_->runRemote( mapping, destination, command, &output ) == false ) {
+
+        return false;
+    }
+
+    std::istringstream in( output );
+    std::string line;
+
+    while ( std::getline( in, line ) ) {
+
+        // "t <32 hex> name"
+        if ( line.length() > 35 && line[1] == ' ' && line[34] == ' ' ) {
+
+            listing[ line.substr( 35 ) ] = std::make_pair( line[0], line.substr( 2, 32 ) );
+        }
+    }
+
+    return true;
+}
+
+void MerkleAudit::repair( const Mapping &mapping, Destination &destination, const std::string &path, bool isDir )
+{
+    LOG_INFORMATION( logger_, Poco::format("%s: %s differs on %s, queuing a repair", mapping.name(), path, destination.remote().toString() ) );
+
+    // the manifest said it was up to date, it was wrong
+    destination.manifest().removed( path );
+
+    queue_->enqueue( new SyncJob( isDir ? SyncJob::DIR_SYNC : SyncJob::FILE_SYNC, PathTable::Ref( path ), mapping.id(), destination.id() ), JobScheduler::BACKGROUND );
+}
+
+void MerkleAudit::compare( const Mapping &mapping, Destination &destination, const Tree &tree, const std::string &dir, int &repairs )
+{
+    idle();
+
+    Listing remote;
+
+    if ( remoteListing( mapping, destination, dir, remote ) == false ) {
+
+        logger_.warning( Poco::format("%s: could not list %s on %s", mapping.name(), dir, destination.remote().toString() ) );
+        return;
+    }
+
+    std::string prefix( dir.empty() ? "" : dir + "/" );
+
+    Listing local;
+
+    for ( std::map<std::string, FileHash>::const_iterator it = tree.files.lower_bound( prefix ); it != tree.files.end() && it->first.compare( 0, prefix.length(), prefix ) == 0; it++ ) {
+
+        if ( it->first.find( '/', prefix.length() ) == std::string::npos ) {
+
+            local[ it->first.substr( prefix.length() ) ] = std::make_pair( 'f', it->second.md5 );
+        }
+    }
+
+    for ( std::map<std::string, std::string>::const_iterator it = tree.dirs.lower_bound( prefix ); it != tree.dirs.end() && it->first.compare( 0, prefix.length(), prefix ) == 0; it++ ) {
+
+        if ( it->first.length() > prefix.length() && it->first.find( '/', prefix.length() ) == std::string::npos ) {
+
+            local[ it->first.substr( prefix.length() ) ] = std::make_pair( 'd', it->second );
+        }
+    }
+
+    // something on the remote side that is not here (or of another type),
+    // a directory sync removes it
+    bool extra = false;
+
+    for ( Listing::const_iterator it = local.begin(); it != local.end(); it++ ) {
+
+        Listing::const_iterator r = remote.find( it->first );
+
+        if ( r == remote.end() ) {
+
+            repair( mapping, destination, prefix + it->first, it->second.first == 'd' );
+            repairs++;
+        }
+        else if ( r->second.first != it->second.first ) {
+
+            extra = true;
+        }
+        else if ( r->second.second != it->second.second ) {
+
+            if ( it->second.first == 'd' ) {
+
+                compare( mapping, destination, tree, prefix + it->first, repairs );
+            }
+            else {
+
+                repair( mapping, destination, prefix + it->first, false );
+                repairs++;
+            }
+        }
+    }
+
+    for ( Listing::const_iterator it = remote.begin(); it != remote.end() && extra == false; it++ ) {
+
+        if ( local.find( it->first ) == local.end() ) {
+
+            extra = true;
+        }
+    }
+
+    if ( extra ) {
+
+        repair( mapping, destination, dir.empty() ? "." : dir, true );
+        repairs++;
+    }
+}
+
+void MerkleAudit::audit( const Mapping &mapping, Destination &destination, const Tree &tree )
+{
+    idle();
+
+    std::string hash;
+
+    if ( remoteRoot( mapping, destination, hash ) == false ) {
+
+        logger_.warning( Poco::format("%s: could not hash %s, is md5sum installed ?", mapping.name(), destination.remote().toString() ) );
+        return;
+    }
+
+    std::map<std::string, std::string>::const_iterator root = tree.dirs.find( "" );
+
+    if ( root != tree.dirs.end() && root->second == hash ) {
+
+        LOG_INFORMATION( logger_, Poco::format("%s: %s matches", mapping.name(), destination.remote().toString() ) );
+        return;
+    }
+
+    int repairs = 0;
+
+    compare( mapping, destination, tree, "", repairs );
+
+    logger_.notice( Poco::format("%s: %s had drifted, %d repair(s) queued", mapping.name(), destination.remote().toString(), repairs ) );
+}
+
+void MerkleAudit::idle()
+{
+    Poco::Thread::sleep( pace_ );
+
+    // interactive work always comes first
+    while ( queue_->jobCount() > 0 || queue_->pending() > 0 ) {
+
+        Poco::Thread::sleep( pace_ * 10 );
+    }
+}
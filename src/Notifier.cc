@@ -0,0 +1,224 @@
+/**
+ * \file Notifier.cc
+ *
+ * \brief - Desktop notifications, gathered and sent off the workers' threads
+ *
+ */
+
+#include "Poco/Format.h"
+#include "Poco/Exception.h"
+
+#include "Notifier.h"
+#include "Settings.h"
+
+#include "SourceSync.h"
+
+#include "config.h"
+
+// failed paths named in a notification, the rest are counted
+#define NOTIFY_FAILURES     5
+
+#if USE_GROWL
+static const char *notifications[] = {
+    "sync",
+};
+
+#define COUNT(a) sizeof(a)/sizeof(*a)
+#endif
+
+Notifier::Notifier( long window ) : window_( window ), stopped_(false), thread_("notify"), logger_( Poco::Logger::get("Notifier") )
+{
+    thread_.start( *this );
+}
+
+Notifier::~Notifier()
+{
+    {
+        Poco::FastMutex::ScopedLock lock( mutex_ );
+
+        stopped_ = true;
+    }
+
+    ready_.broadcast();
+
+    thread_.join();
+}
+
+void Notifier::updated( const std::string &path, bool directory )
+{
+    add( path, directory, true );
+}
+
+void Notifier::failed( const std::string &path, bool directory )
+{
+    add( path, directory, false );
+}
+
+void Notifier::add( const std::string &path, bool directory, bool ok )
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    bool first = ( batch_.files + batch_.directories + batch_.failed == 0 );
+
+    if ( ok == false ) {
+
+        batch_.failed++;
+
+        if ( batch_.failures.size() < NOTIFY_FAILURES ) {
+
+            batch_.failures.push_back( path );
+        }
+    }
+    else if ( directory ) {
+
+        batch_.directories++;
+    }
+    else {
+
+        batch_.files++;
+    }
+
+    if ( first ) {
+
+        batch_.path = path;
+        batch_.directory = directory;
+
+        // the rest of the burst is gathered without waking it again
+        ready_.signal();
+    }
+}
+
+void Notifier::run()
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    while ( true ) {
+
+        while ( batch_.files + batch_.directories + batch_.failed == 0 && stopped_ == false ) {
+
+            ready_.wait( mutex_ );
+        }
+
+        if ( batch_.files + batch_.directories + batch_.failed == 0 ) {
+
+            break;
+        }
+
+        // only stopping wakes it early
+        if ( stopped_ == false ) {
+
+            ready_.tryWait( mutex_, window_ );
+        }
+
+        Batch batch;
+
+        std::swap( batch, batch_ );
+
+        mutex_.unlock();
+
+        try {
+
+            send( batch );
+        }
+        catch ( Poco::Exception &ex ) {
+
+            logger_.warning( "Can not send notification: " + ex.displayText() );
+        }
+        catch ( std::exception &ex ) {
+
+            logger_.warning( std::string( "Can not send notification: " ) + ex.what() );
+        }
+
+        mutex_.lock();
+    }
+}
+
+static std::string plural( int count, const char *one, const char *many )
+{
+    return Poco::format( "%d %s", count, std::string( count == 1 ? one : many ) );
+}
+
+void Notifier::send( const Batch &batch )
+{
+    std::string title;
+    std::string message;
+
+    if ( batch.files + batch.directories + batch.failed == 1 ) {
+
+        // a single save reads as it always has
+        title = batch.path;
+
+        if ( batch.failed ) {
+
+            message = Poco::format( batch.directory ? "Failed to update directory\n  %s" : "Failed to update\n  %s", batch.path );
+        }
+        else {
+
+            message = Poco::format( batch.directory ? "Updated Directory\n  %s" : "Updated File\n  %s", batch.path );
+        }
+    }
+    else {
+
+        title = APPNAME;
+
+        std::string updated;
+
+        if ( batch.files > 0 ) {
+
+            updated = plural( batch.files, "file", "files" );
+        }
+
+        if ( batch.directories > 0 ) {
+
+            updated += ( updated.empty() ? "" : ", " ) + plural( batch.directories, "directory", "directories" );
+        }
+
+        if ( updated.empty() == false ) {
+
+            message = "Updated " + updated;
+
+            if ( batch.failed > 0 ) {
+
+                message += Poco::format( ", %d failed", batch.failed );
+            }
+        }
+        else {
+
+            message = "Failed to update " + plural( batch.failed, "path", "paths" );
+        }
+
+        for ( std::vector<std::string>::const_iterator it = batch.failures.begin(); it != batch.failures.end(); it++ ) {
+
+            message += "\n  " + *it;
+        }
+
+        if ( batch.failed > (int) batch.failures.size() ) {
+
+            message += "\n  ...";
+        }
+    }
+
+    LOG_DEBUG( logger_, Poco::format( "notifying: %s", message ) );
+
+#if USE_GROWL
+    if ( growl_.isNull() ) {
+
+        growl_ = new Growl( GROWL_TCP, 0, APPNAME, (const char **const) notifications, COUNT(notifications) );
+    }
+
+    const Settings *settings = Settings::current();
+
+    if ( settings->growlIcon().empty() == false ) {
+
+        growl_->Notify( "sync",
+                title.c_str(),
+                message.c_str(),
+                "http://whitequeen.gitlab.io/srcsync",
+                settings->growlIcon().c_str() );
+    }
+    else {
+
+        growl_->Notify( "sync", title.c_str(), message.c_str() );
+    }
+#endif
+}
@@ -38,13 +38,13 @@
 
 #include "SourceSync.h"
 
-PocoMonitorDirectory::PocoMonitorDirectory( const std::string &path) : MonitorDirectory(path, "PocoMonDir") 
+PocoMonitorDirectory::PocoMonitorDirectory( const std::string &path, int mapping ) : MonitorDirectory(path, "PocoMonDir"), mapping_(mapping)
 {
     FUNCTIONTRACE;
 
     Poco::BasicEvent<std::string> pathChanged;
 
-    logger_.debug( "Monitoring " + path );
+    LOG_DEBUG( logger_, "Monitoring " + path );
 
     watcher_ = new Poco::DirectoryWatcher( path );
 
@@ -59,41 +59,46 @@ PocoMonitorDirectory::PocoMonitorDirectory( const std::string &path) : MonitorDi
     paths.push_back( path );
 
     // this triggers the initial synchronization of this directory
-    // make sure we create parent directories first by prioritizing those with shorter paths
-    // files will get prioritized by modified date.
-    thisApp->queue()->enqueueNotification( new DirSyncMessage( path ), path.length() );
-    logger_.information( Poco::format("%d messages in queue", thisApp->queue()->size() ) );
-    logger_.debug( Poco::format("Added %s at priority %Lu", path, (Poco::UInt64) path.length() ) );
+    thisApp->queueDir( mapping_, relative( path ), JobScheduler::BULK );
+    LOG_INFORMATION( logger_, Poco::format("%d task(s) in progress", thisApp->jobCount() ) );
+    LOG_DEBUG( logger_, Poco::format("Added %s as bulk", path ) );
 }
 
-void PocoMonitorDirectory::onItemAdded(const Poco::DirectoryWatcher::DirectoryEvent& ev) 
+std::string PocoMonitorDirectory::relative( const std::string &path )
 {
-    FUNCTIONTRACE;
+    std::string pathRelativeToBase;
 
-    if ( ev.item.isDirectory() ) {
+    Poco::Path p( path );
 
-        logger_.debug("Directory Added " + ev.item.path() );
+    p.makeAbsolute();
 
-        PocoMonitorDirectory *d = new PocoMonitorDirectory( ev.item.path() ); 
+    if ( thisApp->mapping( mapping_ )->relative( p.toString(), pathRelativeToBase ) == false ) {
 
+        // shouldn't happen, watchers are only created inside the mapping
+        pathRelativeToBase = path;
     }
-    else if ( ev.item.isFile() ) {
 
-        logger_.debug("File Added " + ev.item.path() );
+    return pathRelativeToBase;
+}
+
+void PocoMonitorDirectory::onItemAdded(const Poco::DirectoryWatcher::DirectoryEvent& ev) 
+{
+    FUNCTIONTRACE;
+
+    if ( ev.item.isDirectory() ) {
 
-        Poco::File f( ev.item.path() );
+        LOG_DEBUG( logger_, "Directory Added " + ev.item.path() );
 
-        Poco::Timestamp t = f.getLastModified();
+        PocoMonitorDirectory *d = new PocoMonitorDirectory( ev.item.path(), mapping_ ); 
 
-        // 1293840000 is midnight Jan 1 2011 GMT
-        // 
-        Poco::UInt64 tdiff = t.epochTime() - 1293840000;
+    }
+    else if ( ev.item.isFile() ) {
 
-        int priority = (int) tdiff;
+        LOG_DEBUG( logger_, "File Added " + ev.item.path() );
 
-        thisApp->queue()->enqueueNotification( new FileSyncMessage( ev.item.path() ), priority );
-        logger_.debug( Poco::format("Added %s at priority %d", ev.item.path(), priority ) );
-        logger_.information( Poco::format("%d messages in queue", thisApp->queue()->size() ) );
+        thisApp->fileChanged( mapping_, relative( ev.item.path() ) );
+        LOG_DEBUG( logger_, Poco::format("Added %s", ev.item.path() ) );
+        LOG_INFORMATION( logger_, Poco::format("%d task(s) in progress", thisApp->jobCount() ) );
     }
 }
 
@@ -102,39 +107,31 @@ void PocoMonitorDirectory::onItemRemoved(const Poco::DirectoryWatcher::Directory
 
     if ( ev.item.isDirectory() ) {
 
-        logger_.debug("Directory Removed " + ev.item.path() );
+        LOG_DEBUG( logger_, "Directory Removed " + ev.item.path() );
 
     }
     else if ( ev.item.isFile() ) {
 
-        logger_.debug("File Removed " + ev.item.path() );
+        LOG_DEBUG( logger_, "File Removed " + ev.item.path() );
     }
 }
 
 void PocoMonitorDirectory::onItemModified(const Poco::DirectoryWatcher::DirectoryEvent& ev) {
 
+    TRACE_SCOPE( "monitor callback", "monitor" );
+
     if ( ev.item.isDirectory() ) {
 
-        logger_.debug("Directory Changed " + ev.item.path() );
+        LOG_DEBUG( logger_, "Directory Changed " + ev.item.path() );
 
     }
     else if ( ev.item.isFile() ) {
 
-        logger_.debug("File Changed " + ev.item.path() );
-
-        Poco::File f( ev.item.path() );
-
-        Poco::Timestamp t = f.getLastModified();
-
-        // 1293840000 is midnight Jan 1 2011 GMT
-        // 
-        Poco::UInt64 tdiff = t.epochTime() - 1293840000;
-
-        int priority = (int) tdiff;
+        LOG_DEBUG( logger_, "File Changed " + ev.item.path() );
 
-        thisApp->queue()->enqueueNotification( new FileSyncMessage( ev.item.path() ), priority );
-        logger_.debug( Poco::format("Added %s at priority %d", ev.item.path(), priority ) );
-        logger_.information( Poco::format("%d messages in queue", thisApp->queue()->size() ) );
+        thisApp->fileChanged( mapping_, relative( ev.item.path() ) );
+        LOG_DEBUG( logger_, Poco::format("Added %s", ev.item.path() ) );
+        LOG_INFORMATION( logger_, Poco::format("%d task(s) in progress", thisApp->jobCount() ) );
     }
 }
 
@@ -142,12 +139,12 @@ void PocoMonitorDirectory::onItemMovedFrom(const Poco::DirectoryWatcher::Directo
 
     if ( ev.item.isDirectory() ) {
 
-        logger_.debug("Directory Moved From " + ev.item.path() );
+        LOG_DEBUG( logger_, "Directory Moved From " + ev.item.path() );
 
     }
     else if ( ev.item.isFile() ) {
 
-        logger_.debug("File Moved From " + ev.item.path() );
+        LOG_DEBUG( logger_, "File Moved From " + ev.item.path() );
     }
 }
 
@@ -155,13 +152,13 @@ void PocoMonitorDirectory::onItemMovedTo(const Poco::DirectoryWatcher::Directory
 
     if ( ev.item.isDirectory() ) {
 
-        logger_.debug("Directory Moved To " + ev.item.path() );
+        LOG_DEBUG( logger_, "Directory Moved To " + ev.item.path() );
 
-        PocoMonitorDirectory *d = new PocoMonitorDirectory( ev.item.path() ); 
+        PocoMonitorDirectory *d = new PocoMonitorDirectory( ev.item.path(), mapping_ ); 
 
     }
     else if ( ev.item.isFile() ) {
 
-        logger_.debug("File Moved To " + ev.item.path() );
+        LOG_DEBUG( logger_, "File Moved To " + ev.item.path() );
     }
 }
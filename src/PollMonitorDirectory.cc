@@ -0,0 +1,490 @@
+/**
+ * \file PollMonitorDirectory.cc
+ *
+ * \brief - Monitors every mapping by polling a cache of stat() results
+ *
+ */
+
+#include <algorithm>
+#include <functional>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <cerrno>
+
+#include "Poco/Format.h"
+
+#include "PollMonitorDirectory.h"
+
+#include "SourceSync.h"
+
+#define POLL_SLICE      20          // ms of work in one round
+#define POLL_TICK       50          // ms, the shortest sleep between rounds
+
+PollMonitorDirectory::PollMonitorDirectory( const std::vector<Mapping *> &mappings, long pollMin, long pollMax, int budget ) :
+    MonitorDirectory("", "PollMonDir"),
+    mappings_(mappings),
+    pollMin_( std::max( pollMin, 1L ) ),
+    pollMax_( std::max( pollMax, pollMin ) ),
+    budget_( std::min( std::max( budget, 1 ), 100 ) ),
+    thread_("poll")
+{
+    FUNCTIONTRACE;
+
+    for ( std::vector<Mapping *>::const_iterator it = mappings_.begin(); it != mappings_.end(); it++ ) {
+
+        LOG_DEBUG( logger_, Poco::format("Polling %s (%s)", (*it)->name(), (*it)->local().toString() ) );
+
+        roots_.insert( (*it)->local().toString() );
+    }
+
+    // this triggers the initial synchronization of each mapping
+    for ( std::vector<Mapping *>::const_iterator it = mappings_.begin(); it != mappings_.end(); it++ ) {
+
+        LOG_INFORMATION( logger_, Poco::format("Syncing (d) %s:%s...", (*it)->name(), std::string(".") ) );
+        LOG_DEBUG( logger_, Poco::format("Queuing directory %s as bulk", std::string(".") ) );
+
+        thisApp->queueDir( (*it)->id(), ".", JobScheduler::BULK );
+    }
+
+    LOG_INFORMATION( logger_, Poco::format("%d task(s) in queue", thisApp->jobCount() ) );
+
+    thread_.start( *this );
+}
+
+PollMonitorDirectory::~PollMonitorDirectory()
+{
+    stop_.set();
+    thread_.join();
+}
+
+Poco::Int64 PollMonitorDirectory::now() const
+{
+    return started_.elapsed() / 1000;
+}
+
+std::string PollMonitorDirectory::absolute( int mapping, const std::string &dir ) const
+{
+    return thisApp->mapping( mapping )->local().toString() + dir;
+}
+
+std::string PollMonitorDirectory::join( const std::string &dir, const std::string &name )
+{
+    return dir.empty() ? name : dir + "/" + name;
+}
+
+bool PollMonitorDirectory::watched( int mapping, const std::string &path ) const
+{
+    if ( thisApp->mapping( mapping )->ignored( path ) ) {
+
+        return false;
+    }
+
+    // a nested mapping watches its own source
+    return roots_.count( absolute( mapping, path ) + "/" ) == 0;
+}
+
+void PollMonitorDirectory::fill( const struct stat &st, Entry &entry )
+{
+#ifdef __APPLE__
+    entry.modified = (Poco::Int64) st.st_mtimespec.tv_sec * 1000000 + st.st_mtimespec.tv_nsec / 1000;
+#else
+    entry.modified = (Poco::Int64) st.st_mtim.tv_sec * 1000000 + st.st_mtim.tv_nsec / 1000;
+#endif
+
+    entry.size = st.st_size;
+    entry.inode = st.st_ino;
+    entry.mode = st.st_mode;
+}
+
+void PollMonitorDirectory::schedule( const Key &key, Dir &dir, Poco::Int64 due )
+{
+    schedule_.erase( std::make_pair( dir.due, key ) );
+
+    dir.due = due;
+
+    schedule_.insert( std::make_pair( dir.due, key ) );
+}
+
+void PollMonitorDirectory::add( int mapping, const std::string &top, Poco::Int64 interval )
+{
+    std::vector<std::string> pending( 1, top );
+
+    while ( pending.empty() == false ) {
+
+        std::string dir( pending.back() );
+
+        pending.pop_back();
+
+        std::string path( absolute( mapping, dir ) );
+
+        DIR *d = ::opendir( path.c_str() );
+
+        if ( d == NULL ) {
+
+            continue;
+        }
+
+        struct stat st;
+
+        Key key( mapping, dir );
+        Dir &node = dirs_[ key ];
+
+        node.modified = 0;
+        node.entries.clear();
+        node.interval = interval;
+        node.due = -1;
+
+        if ( ::fstat( dirfd( d ), &st ) == 0 ) {
+
+            Entry self;
+
+            fill( st, self );
+
+            node.modified = self.modified;
+        }
+
+        struct dirent *de;
+
+        while ( ( de = ::readdir( d ) ) != NULL ) {
+
+            const char *name = de->d_name;
+
+            if ( name[0] == '.' && ( name[1] == '\0' || ( name[1] == '.' && name[2] == '\0' ) ) ) {
+
+                continue;
+            }
+
+            if ( ::fstatat( dirfd( d ), name, &st, AT_SYMLINK_NOFOLLOW ) != 0 ) {
+
+                continue;
+            }
+
+            Entry &entry = node.entries[ name ];
+
+            fill( st, entry );
+
+            entry.skipped = false;
+
+            if ( S_ISDIR( st.st_mode ) ) {
+
+                std::string sub( join( dir, name ) );
+
+                entry.skipped = ( watched( mapping, sub ) == false );
+
+                if ( entry.skipped == false ) {
+
+                    pending.push_back( sub );
+                }
+            }
+        }
+
+        ::closedir( d );
+
+        // spread over the interval so a large tree is not looked at all at once
+        schedule( key, node, now() + ( interval > pollMin_ ? (Poco::Int64) ( std::hash<std::string>()( dir ) % interval ) : interval ) );
+    }
+}
+
+void PollMonitorDirectory::forget( int mapping, const std::string &dir )
+{
+    std::map<Key, Dir>::iterator it = dirs_.find( Key( mapping, dir ) );
+
+    if ( it != dirs_.end() ) {
+
+        schedule_.erase( std::make_pair( it->second.due, it->first ) );
+        dirs_.erase( it );
+    }
+
+    // everything below sorts together, right after DIR + "/"
+    std::string prefix( dir + "/" );
+
+    it = dirs_.lower_bound( Key( mapping, prefix ) );
+
+    while ( it != dirs_.end() && it->first.first == mapping && it->first.second.compare( 0, prefix.length(), prefix ) == 0 ) {
+
+        schedule_.erase( std::make_pair( it->second.due, it->first ) );
+        dirs_.erase( it++ );
+    }
+}
+
+void PollMonitorDirectory::reportRemoved( int mapping, const std::string &path, const Entry &entry, Moves &removed )
+{
+    LOG_DEBUG( logger_, Poco::format("%s:%s removed", thisApp->mapping( mapping )->name(), path ) );
+
+    removed[ entry.inode ] = path;
+
+    if ( S_ISDIR( entry.mode ) ) {
+
+        forget( mapping, path );
+    }
+
+    thisApp->fileRemoved( mapping, path );
+}
+
+void PollMonitorDirectory::reportCreated( int mapping, const std::string &path, Entry &entry, Moves &created )
+{
+    LOG_DEBUG( logger_, Poco::format("%s:%s created", thisApp->mapping( mapping )->name(), path ) );
+
+    created[ entry.inode ] = path;
+
+    entry.skipped = false;
+
+    if ( S_ISDIR( entry.mode ) == false ) {
+
+        thisApp->fileChanged( mapping, path );
+        return;
+    }
+
+    if ( watched( mapping, path ) == false ) {
+
+        entry.skipped = true;
+        return;
+    }
+
+    // new directories are often filled straight after, look again soon
+    add( mapping, path, pollMin_ );
+
+    thisApp->queueDir( mapping, path );
+}
+
+bool PollMonitorDirectory::poll( const Key &key, Dir &dir, Moves &removed, Moves &created )
+{
+    TRACE_SCOPE( "monitor poll", "monitor" );
+
+    int mapping = key.first;
+
+    std::string path( absolute( mapping, key.second ) );
+
+    int fd = ::open( path.c_str(), O_RDONLY | O_DIRECTORY );
+
+    if ( fd < 0 ) {
+
+        // gone, its parent reports that once it is looked at
+        return false;
+    }
+
+    struct stat st;
+
+    bool changed = false;
+
+    Entry self;
+
+    if ( ::fstat( fd, &st ) == 0 ) {
+
+        fill( st, self );
+    }
+    else {
+
+        self.modified = dir.modified;
+    }
+
+    std::vector<std::string> stale;
+
+    if ( self.modified != dir.modified ) {
+
+        // something was created, removed or renamed in here: list it again
+        std::map<std::string, Entry> entries;
+
+        DIR *d = ::fdopendir( ::dup( fd ) );
+
+        if ( d != NULL ) {
+
+            struct dirent *de;
+
+            while ( ( de = ::readdir( d ) ) != NULL ) {
+
+                const char *name = de->d_name;
+
+                if ( name[0] == '.' && ( name[1] == '\0' || ( name[1] == '.' && name[2] == '\0' ) ) ) {
+
+                    continue;
+                }
+
+                if ( ::fstatat( fd, name, &st, AT_SYMLINK_NOFOLLOW ) == 0 ) {
+
+                    Entry &entry = entries[ name ];
+
+                    fill( st, entry );
+
+                    entry.skipped = false;
+                }
+            }
+
+            ::closedir( d );
+
+            dir.modified = self.modified;
+
+            for ( std::map<std::string, Entry>::iterator it = dir.entries.begin(); it != dir.entries.end(); it++ ) {
+
+                std::map<std::string, Entry>::iterator jt = entries.find( it->first );
+
+                // replaced by something of another type, or gone
+                if ( jt == entries.end() || ( jt->second.mode & S_IFMT ) != ( it->second.mode & S_IFMT ) ) {
+
+                    reportRemoved( mapping, join( key.second, it->first ), it->second, removed );
+                    changed = true;
+                }
+            }
+
+            for ( std::map<std::string, Entry>::iterator jt = entries.begin(); jt != entries.end(); jt++ ) {
+
+                std::map<std::string, Entry>::iterator it = dir.entries.find( jt->first );
+
+                if ( it == dir.entries.end() || ( jt->second.mode & S_IFMT ) != ( it->second.mode & S_IFMT ) ) {
+
+                    reportCreated( mapping, join( key.second, jt->first ), jt->second, created );
+                    changed = true;
+                }
+                else {
+
+                    // compared below, with the rest
+                    jt->second = it->second;
+                }
+            }
+
+            // add() and forget() above leave this directory's node alone
+            dir.entries.swap( entries );
+        }
+    }
+
+    for ( std::map<std::string, Entry>::iterator it = dir.entries.begin(); it != dir.entries.end(); it++ ) {
+
+        Entry &entry = it->second;
+
+        if ( S_ISDIR( entry.mode ) ) {
+
+            // looked at on its own, unless it was not being watched
+            if ( entry.skipped && watched( mapping, join( key.second, it->first ) ) ) {
+
+                reportCreated( mapping, join( key.second, it->first ), entry, created );
+                changed = true;
+            }
+
+            continue;
+        }
+
+        if ( ::fstatat( fd, it->first.c_str(), &st, AT_SYMLINK_NOFOLLOW ) != 0 ) {
+
+            // removed since this directory was listed, the next look lists it again
+            stale.push_back( it->first );
+            continue;
+        }
+
+        Entry now;
+
+        fill( st, now );
+
+        now.skipped = false;
+
+        if ( ( now.mode & S_IFMT ) != ( entry.mode & S_IFMT ) ) {
+
+            // replaced by a directory, the next listing sorts it out
+            dir.modified = 0;
+            continue;
+        }
+
+        if ( now.size != entry.size || now.modified != entry.modified ) {
+
+            thisApp->fileChanged( mapping, join( key.second, it->first ) );
+            changed = true;
+        }
+        else if ( now.mode != entry.mode ) {
+
+            // a chmod, nothing was written
+            thisApp->fileChanged( mapping, join( key.second, it->first ), true );
+            changed = true;
+        }
+
+        entry = now;
+    }
+
+    for ( std::vector<std::string>::iterator it = stale.begin(); it != stale.end(); it++ ) {
+
+        std::map<std::string, Entry>::iterator jt = dir.entries.find( *it );
+
+        reportRemoved( mapping, join( key.second, *it ), jt->second, removed );
+
+        dir.entries.erase( jt );
+        changed = true;
+    }
+
+    ::close( fd );
+
+    return changed;
+}
+
+void PollMonitorDirectory::run()
+{
+    Poco::Timestamp scan;
+
+    for ( std::vector<Mapping *>::const_iterator it = mappings_.begin(); it != mappings_.end(); it++ ) {
+
+        add( (*it)->id(), "", pollMax_ );
+    }
+
+    size_t files = 0;
+
+    for ( std::map<Key, Dir>::const_iterator it = dirs_.begin(); it != dirs_.end(); it++ ) {
+
+        files += it->second.entries.size();
+    }
+
+    logger_.information( Poco::format("Polling %z path(s) in %z directories, first scan took %Ldms", files, dirs_.size(), (Poco::Int64) ( scan.elapsed() / 1000 ) ) );
+
+    long sleep = POLL_TICK;
+
+    while ( stop_.tryWait( sleep ) == false ) {
+
+        Poco::Timestamp round;
+
+        Poco::Int64 tick = now();
+
+        Moves removed;
+        Moves created;
+
+        while ( schedule_.empty() == false && schedule_.begin()->first <= tick && round.elapsed() < POLL_SLICE * 1000 ) {
+
+            Key key( schedule_.begin()->second );
+
+            std::map<Key, Dir>::iterator it = dirs_.find( key );
+
+            if ( it == dirs_.end() ) {
+
+                schedule_.erase( schedule_.begin() );
+                continue;
+            }
+
+            Dir &dir = it->second;
+
+            try {
+
+                // a directory that changed is likely to change again soon
+                dir.interval = poll( key, dir, removed, created ) ? pollMin_ : std::min( dir.interval * 2, pollMax_ );
+            }
+            catch ( Poco::Exception &ex ) {
+
+                logger_.error( Poco::format("Can not poll %s: %s", absolute( key.first, key.second ), ex.displayText() ) );
+            }
+
+            schedule( key, dir, tick + dir.interval );
+        }
+
+        for ( Moves::const_iterator it = removed.begin(); it != removed.end(); it++ ) {
+
+            Moves::const_iterator jt = created.find( it->first );
+
+            if ( jt != created.end() ) {
+
+                LOG_DEBUG( logger_, Poco::format("%s moved to %s", it->second, jt->second ) );
+            }
+        }
+
+        // sleep long enough that the work stays within the budget
+        long used = round.elapsed() / 1000;
+
+        sleep = std::max( (long) POLL_TICK, used * ( 100 - budget_ ) / budget_ );
+    }
+}
@@ -1,10 +1,18 @@
 
 #include "Poco/ThreadPool.h"
-#include "Poco/PriorityNotificationQueue.h"
 
 #include "Poco/NestedDiagnosticContext.h"
 
 #include "Poco/Logger.h"
+#include "Poco/File.h"
+#include "Poco/Path.h"
+#include "Poco/String.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Util/Application.h"
+
+#include <fstream>
+
+#include <sys/stat.h>
 
 
 #include <rsync/rsync_log.h>
@@ -16,51 +24,714 @@
 #include "AcrosyncWorker.h"
 #include "RsyncWorker.h"
 
+#include "Checksum.h"
+#include "Settings.h"
+
 #include "config.h"
 
-Queue::Queue() : logger_(Poco::Logger::get("QueueMangr")) 
+// how long after an agent fails to start before it is tried again
+#define AGENT_RETRY_INTERVAL ( 60 * 1000000 )
+
+SyncWorker::SyncWorker( const std::string &name, int index, Queue *owner ) : name_(name), owner_( owner ), index_( index ), logger_(Poco::Logger::get("SyncWorker"))
 {
+}
 
-    FUNCTIONTRACE;
+SyncJob *SyncWorker::next()
+{
+    SyncJob *job = owner_->scheduler().next( index_ );
+
+    if ( job ) {
+
+        TRACE_SPAN( "queued", "queue", job->queued(), job->pathId() );
+    }
 
-    queue_ = new Poco::PriorityNotificationQueue;
+    return job;
+}
+
+SyncJob *SyncWorker::poll()
+{
+    SyncJob *job = owner_->scheduler().poll( index_ );
+
+    if ( job ) {
+
+        TRACE_SPAN( "queued", "queue", job->queued(), job->pathId() );
+    }
+
+    return job;
+}
+
+Queue::Queue( const std::string &name, Poco::ThreadPool &pool ) : name_(name), logger_(Poco::Logger::get("QueueMangr")) 
+{
+
+    FUNCTIONTRACE;
 
     std::string method = Poco::Util::Application::instance().config().getString( CONFIG_SYNC_METHOD );
 
-    for ( int i = 0; i < Poco::Util::Application::instance().config().getInt( CONFIG_QUEUE_WORKER_COUNT, 8 ); i++ ) {
+    int count = Poco::Util::Application::instance().config().getInt( CONFIG_QUEUE_WORKER_COUNT, 8 );
+
+    scheduler_ = new JobScheduler( count, Poco::Util::Application::instance().config().getInt( CONFIG_QUEUE_INGRESS, 65536 ), 4096, this );
+
+    bandwidth_ = new RateLimiter( name_, Settings::current()->rateLimit(), Settings::current()->rateInteractive() );
+
+    if ( method == CONFIG_SYNC_METHOD_ACROSYNC ) {
+
+        // nothing connects until the first job needs it
+        sessions_ = new SSHPool( name_,
+                Poco::Util::Application::instance().config().getInt( CONFIG_RSYNC_SSH_IDLE, 300 ),
+                Poco::Util::Application::instance().config().getInt( CONFIG_RSYNC_SSH_KEEPALIVE, 60 ) );
+    }
+
+    if ( method == CONFIG_SYNC_METHOD_RSYNC ) {
+
+        // the workers only start transfers, this bounds how many run at once
+        transfers_ = new TransferEngine( name_, Poco::Util::Application::instance().config().getInt( CONFIG_QUEUE_INFLIGHT, 64 ) );
+    }
+
+    for ( int i = 0; i < count; i++ ) {
 
         if ( method == CONFIG_SYNC_METHOD_ACROSYNC ) {
-            workers_.push_back( new AcrosyncWorker( Poco::format("worker-%d", i ) , queue_ ) );
+            workers_.push_back( new AcrosyncWorker( Poco::format("worker-%d", i ), i, this ) );
         }
 
         if ( method == CONFIG_SYNC_METHOD_RSYNC ) {
-            workers_.push_back( new RsyncWorker( Poco::format("worker-%d", i ) , queue_ ) );
+            workers_.push_back( new RsyncWorker( Poco::format("worker-%d", i ), i, this ) );
         }
 
     }
 
-    // create a Thread Pool.
-    pool_ = new Poco::ThreadPool(
-            Poco::Util::Application::instance().config().getInt( CONFIG_QUEUE_MIN_THREADS, 2),
-            Poco::Util::Application::instance().config().getInt( CONFIG_QUEUE_MAX_THREADS, 64),
-            Poco::Util::Application::instance().config().getInt( CONFIG_QUEUE_THREAD_IDLE, 120),
-            0
-            );
-
+    // workers for every host share the one thread pool
     for ( std::vector< SyncWorker *>::iterator it = workers_.begin() ; it != workers_.end() ; it++ ) {
         SyncWorker *w = *it;
-        pool_->start( *w );
+        pool.start( *w );
     }
 
-    if ( method == CONFIG_SYNC_METHOD_ACROSYNC ) {
+    static bool rsyncLogConnected = false;
+
+    if ( method == CONFIG_SYNC_METHOD_ACROSYNC && rsyncLogConnected == false ) {
         // acrosync logging is limited to a single Log object, so we can't push
-        // this down to the workers :-(
+        // this down to the workers (or even the queues) :-(
         rsync::Log::out.connect(this, &Queue::logCallback);
 
+        rsyncLogConnected = true;
+
+        rsync::Log::setLevel( (rsync::Log::Level) Settings::current()->rsyncLogLevel() );
+    }
+
+    long reconcile = Poco::Util::Application::instance().config().getInt( CONFIG_QUEUE_RECONCILE, 600 );
+
+    if ( reconcile > 0 ) {
+
+        reconcile_ = new Poco::Timer( reconcile * 1000, reconcile * 1000 );
+
+        reconcile_->start( Poco::TimerCallback<Queue>( *this, &Queue::onReconcile ) );
+    }
+
+    long audit = Poco::Util::Application::instance().config().getInt( CONFIG_QUEUE_AUDIT, 3600 );
+
+    if ( audit > 0 ) {
+
+        audit_ = new MerkleAudit( this, audit );
+    }
+}
+
+void Queue::enqueue( SyncJob *job, JobScheduler::Priority priority )
+{
+    TRACE_INSTANT( "enqueue", "queue", job->pathId() );
+
+    if ( job->kind() != SyncJob::DELETE_SYNC ) {
+
+        Poco::FastMutex::ScopedLock lock( outstandingMutex_ );
+
+        outstanding_[ Outstanding( std::make_pair( job->mapping(), job->destination() ), job->pathId() ) ]++;
+    }
+
+    job->setPriority( priority );
+
+    scheduler_->push( job, priority );
+}
+
+void Queue::drained( SyncJob **jobs, size_t count )
+{
+    // a replayed or retried job keeps its number
+    std::vector<bool> recorded( count );
+
+    for ( size_t i = 0; i < count; i++ ) {
+
+        recorded[ i ] = ( jobs[ i ]->kind() == SyncJob::DELETE_SYNC || jobs[ i ]->journal() != 0 );
+    }
+
+    for ( size_t i = 0; i < count; i++ ) {
+
+        if ( recorded[ i ] ) {
+
+            continue;
+        }
+
+        Destination &destination = thisApp->mapping( jobs[ i ]->mapping() )->destination( jobs[ i ]->destination() );
+
+        try {
+
+            JobJournal::Batch batch( destination.journal() );
+
+            // the rest of the batch for the same destination under the one lock
+            for ( size_t j = i; j < count; j++ ) {
+
+                if ( recorded[ j ] == false && jobs[ j ]->mapping() == jobs[ i ]->mapping() && jobs[ j ]->destination() == jobs[ i ]->destination() ) {
+
+                    jobs[ j ]->setJournal( batch.pending( jobs[ j ]->kind(), jobs[ j ]->path() ) );
+                    recorded[ j ] = true;
+                }
+            }
+        }
+        catch ( Poco::Exception &ex ) {
+
+            // the jobs still run, they are only not replayed after a crash
+            logger_.error( Poco::format("%s: can not record queued jobs: %s", name_, ex.displayText() ) );
+        }
+    }
+}
+
+void Queue::finished( const SyncJob &job )
+{
+    if ( job.kind() == SyncJob::DELETE_SYNC ) {
+
+        return;
+    }
+
+    Poco::FastMutex::ScopedLock lock( outstandingMutex_ );
+
+    // while JOB still holds its path, so the id is not yet reused
+    std::map<Outstanding, int>::iterator it = outstanding_.find( Outstanding( std::make_pair( job.mapping(), job.destination() ), job.pathId() ) );
+
+    if ( it != outstanding_.end() && --it->second <= 0 ) {
+
+        outstanding_.erase( it );
+    }
+}
+
+Poco::SharedPtr<AgentClient> Queue::agent( const Mapping &mapping, const Destination &destination, const std::string &command, const std::vector<std::string> &args )
+{
+    Poco::FastMutex::ScopedLock lock( agentMutex_ );
+
+    std::pair<int, int> key( mapping.id(), destination.id() );
+
+    std::map<std::pair<int, int>, Poco::SharedPtr<AgentClient> >::iterator it = agents_.find( key );
+
+    if ( it != agents_.end() ) {
+
+        if ( it->second->alive() ) {
+
+            return it->second;
+        }
+
+        // what was in flight has failed, and is retried like any failed transfer
+        logger_.warning( Poco::format("%s: the agent for %s has gone", name_, destination.remote().toString() ) );
+
+        agents_.erase( it );
+        agentFailed_[ key ].update();
+    }
+
+    std::map<std::pair<int, int>, Poco::Timestamp>::iterator ft = agentFailed_.find( key );
+
+    if ( ft != agentFailed_.end() && ft->second.isElapsed( AGENT_RETRY_INTERVAL ) == false ) {
+
+        return Poco::SharedPtr<AgentClient>();
+    }
+
+    Poco::SharedPtr<AgentClient> agent( new AgentClient( Poco::format("%s: %s", name_, destination.remote().toString() ), command, args ) );
+
+    try {
+
+        // the other workers for the destination wait rather than start their own
+        agent->start( 10000 );
+    }
+    catch ( Poco::Exception &ex ) {
+
+        logger_.error( Poco::format("%s: no agent for %s, using rsync: %s", name_, destination.remote().toString(), ex.displayText() ) );
+
+        agentFailed_[ key ].update();
+
+        return Poco::SharedPtr<AgentClient>();
+    }
+
+    LOG_INFORMATION( logger_, Poco::format("%s: agent started for %s", name_, destination.remote().toString() ) );
+
+    agents_[ key ] = agent;
+
+    return agent;
+}
+
+void Queue::queueDelete( int mapping, int destination, const std::string &path )
+{
+    thisApp->mapping( mapping )->destination( destination ).journal().pending( SyncJob::DELETE_SYNC, path );
+
+    bool first = false;
+
+    {
+        Poco::FastMutex::ScopedLock lock( deleteMutex_ );
+
+        std::set<std::string> &pending = deletes_[ std::make_pair( mapping, destination ) ];
+
+        first = pending.empty();
+
+        pending.insert( path );
+    }
+
+    // only the first delete needs a message, whichever worker picks
+    // it up takes everything that has accumulated by then.
+    if ( first ) {
+
+        enqueue( new SyncJob( SyncJob::DELETE_SYNC, PathTable::Ref( "." ), mapping, destination ), JobScheduler::INTERACTIVE );
+    }
+}
+
+bool Queue::takeDeletes( int mapping, int destination, std::set<std::string> &paths )
+{
+    Poco::FastMutex::ScopedLock lock( deleteMutex_ );
+
+    paths.clear();
+    paths.swap( deletes_[ std::make_pair( mapping, destination ) ] );
+
+    return paths.empty() == false;
+}
+
+size_t Queue::replay( const Mapping &mapping, Destination &destination )
+{
+    std::map<std::string, JobJournal::Outstanding> paths;
+
+    destination.journal().outstanding( paths );
+
+    size_t count = 0;
+
+    for ( std::map<std::string, JobJournal::Outstanding>::const_iterator it = paths.begin(); it != paths.end(); it++ ) {
+
+        if ( it->second.kind == SyncJob::DELETE_SYNC ) {
+
+            queueDelete( mapping.id(), destination.id(), it->first );
+            count++;
+            continue;
+        }
+
+        PathTable::Ref path( it->first );
+
+        {
+            Poco::FastMutex::ScopedLock lock( outstandingMutex_ );
+
+            // the job still waiting, or being sent, finishes it
+            if ( outstanding_.count( Outstanding( std::make_pair( mapping.id(), destination.id() ), path ) ) ) {
+
+                continue;
+            }
+        }
+
+        SyncJob *job = new SyncJob( (SyncJob::Kind) it->second.kind, path, mapping.id(), destination.id() );
+
+        job->setJournal( it->second.sequence );
+
+        enqueue( job, JobScheduler::BULK );
+        count++;
+    }
+
+    return count;
+}
+
+void Queue::onReconcile( Poco::Timer &timer )
+{
+    LOG_INFORMATION( logger_, "Queuing periodic reconciliation" );
+
+    const std::vector<Mapping *> &mappings = thisApp->mappings();
+
+    PathTable::Ref root( "." );
+
+    for ( std::vector<Mapping *>::const_iterator it = mappings.begin(); it != mappings.end(); it++ ) {
+
+        const std::vector<Destination *> &destinations = (*it)->destinations();
+
+        for ( std::vector<Destination *>::const_iterator jt = destinations.begin(); jt != destinations.end(); jt++ ) {
+
+            if ( (*jt)->queue() != this ) {
+
+                continue;
+            }
+
+            // lowest priority class - after anything the monitor has queued
+            enqueue( new SyncJob( SyncJob::DIR_SYNC, root, (*it)->id(), (*jt)->id(), SyncJob::RECONCILE ), JobScheduler::BACKGROUND );
+        }
+    }
+}
+
+bool SyncWorker::deleteRemote( const Mapping &mapping, const Destination &destination, const std::set<std::string> &paths )
+{
+    const Poco::Path &local = mapping.local();
+
+    std::vector<std::string> remove;
+    std::string previous;
+
+    for ( std::set<std::string>::const_iterator it = paths.begin(); it != paths.end(); it++ ) {
+
+        // the set is sorted, so anything inside a directory we are already
+        // removing follows it directly
+        if ( previous.empty() == false && it->compare( 0, previous.length() + 1, previous + "/" ) == 0 ) {
+
+            continue;
+        }
+
+        // it may have come back while the delete was waiting
+        if ( Poco::File( local.toString() + *it ).exists() ) {
+
+            LOG_DEBUG( logger_, Poco::format("%s: not deleting %s, it has been recreated", name_, *it ) );
+            continue;
+        }
+
+        previous = *it;
+
+        remove.push_back( *it );
+
+        // a file of the same name later is a new file, not a delta
+        destination.signatures().remove( *it );
+    }
+
+    if ( remove.empty() ) {
+
+        return true;
+    }
+
+    return removeRemote( mapping, destination, remove );
+}
+
+bool SyncWorker::removeRemote( const Mapping &mapping, const Destination &destination, const std::vector<std::string> &paths )
+{
+    size_t batch = Settings::current()->deleteBatch();
+
+    std::string command;
+    size_t count = 0;
+
+    bool success = true;
+
+    for ( std::vector<std::string>::const_iterator it = paths.begin(); it != paths.end(); it++ ) {
+
+        if ( command.empty() ) {
+
+            command = "rm -rf --";
+        }
+
+        command += " '" + Poco::replace( *it, "'", "'\\''" ) + "'";
+
+        if ( ++count >= batch ) {
+
+            success = runRemote( mapping, destination, command ) && success;
+
+            command.clear();
+            count = 0;
+        }
+    }
+
+    if ( command.empty() == false ) {
+
+        success = runRemote( mapping, destination, command ) && success;
+    }
+
+    return success;
+}
+
+void SyncWorker::seedManifests()
+{
+    // nothing is run remotely in a dry run, nothing to list
+    if ( Settings::current()->dryRun() ) {
+
+        return;
+    }
+
+    const std::vector<Mapping *> &mappings = thisApp->mappings();
+
+    for ( std::vector<Mapping *>::const_iterator it = mappings.begin(); it != mappings.end(); it++ ) {
+
+        const std::vector<Destination *> &destinations = (*it)->destinations();
+
+        for ( std::vector<Destination *>::const_iterator jt = destinations.begin(); jt != destinations.end(); jt++ ) {
+
+            if ( (*jt)->queue() == owner_ && (*jt)->manifest().claimSeed() ) {
+
+                verifyManifest( **it, **jt );
+            }
+        }
+    }
+}
+
+void SyncWorker::verifyManifest( const Mapping &mapping, Destination &destination )
+{
+    if ( Settings::current()->dryRun() ) {
+
+        return;
+    }
+
+    RemoteManifest &manifest = destination.manifest();
+
+    bool seeded = manifest.seeded();
+
+    std::string listing;
+
+    if ( runRemote( mapping, destination, RemoteManifest::listCommand(), &listing ) == false ) {
+
+        logger_.warning( Poco::format("%s: %s: could not list %s, every change will be transferred", name_, mapping.name(), destination.remote().toString() ) );
+        return;
+    }
+
+    int drift = manifest.seed( listing );
+
+    if ( seeded && drift > 0 ) {
+
+        logger_.warning( Poco::format("%s: %s: %d path(s) on %s changed behind our back", name_, mapping.name(), drift, destination.remote().toString() ) );
+    }
+
+    LOG_DEBUG( logger_, Poco::format("%s: %s: %z path(s) on %s", name_, mapping.name(), manifest.size(), destination.remote().toString() ) );
+
+    manifest.save();
+}
+
+void SyncWorker::begin( const Mapping &mapping, SyncJob &job )
+{
+    // before the stat, anything written after it is at least as new
+    Poco::Timestamp::TimeVal started = Poco::Timestamp().epochMicroseconds();
+
+    struct stat st;
+
+    if ( ::lstat( ( mapping.local().toString() + job.path() ).c_str(), &st ) != 0 ) {
+
+        job.setStarted( started, 0, 0 );
+        return;
+    }
+
+#ifdef __APPLE__
+    Poco::Timestamp::TimeVal modified = (Poco::Timestamp::TimeVal) st.st_mtimespec.tv_sec * 1000000 + st.st_mtimespec.tv_nsec / 1000;
+#else
+    Poco::Timestamp::TimeVal modified = (Poco::Timestamp::TimeVal) st.st_mtim.tv_sec * 1000000 + st.st_mtim.tv_nsec / 1000;
+#endif
+
+    job.setStarted( started, st.st_size, modified );
+}
+
+Poco::Int64 SyncWorker::settled( const SyncJob &job )
+{
+    // the manifest keeps whole seconds, a write in the second the job
+    // began would look the same as what was sent
+    if ( job.started() == 0 || job.modified() / 1000000 >= job.started() / 1000000 ) {
+
+        return RemoteManifest::UNKNOWN;
+    }
+
+    return job.modified() / 1000000;
+}
+
+bool SyncWorker::unchanged( const Mapping &mapping, Destination &destination, const std::string &path )
+{
+    Poco::File f( mapping.local().toString() + path );
+
+    try {
+
+        return f.isFile() && destination.manifest().current( path, f.getSize(), f.getLastModified().epochTime() );
+    }
+    catch ( Poco::FileNotFoundException & ) {
+
+        return false;
+    }
+}
+
+SyncWorker::Change SyncWorker::classify( const Mapping &mapping, Destination &destination, SyncJob &job )
+{
+    std::string localPath = mapping.local().toString() + job.path();
+
+    struct stat st;
+
+    // links, and files gone since, are left to the transfer
+    if ( ::lstat( localPath.c_str(), &st ) != 0 || S_ISREG( st.st_mode ) == false ) {
+
+        return CONTENT;
+    }
+
+    RemoteManifest::Entry entry;
+
+    if ( destination.manifest().find( job.path(), entry ) == false || entry.type != 'f' || entry.size != (Poco::UInt64) st.st_size ) {
+
+        return CONTENT;
+    }
+
+    bool attributes = ( job.flags() & SyncJob::METADATA ) != 0;
+
+    // sent while it was still being written, what arrived is not known
+    if ( entry.mtime == RemoteManifest::UNKNOWN ) {
+
+        return CONTENT;
+    }
+
+    if ( entry.mtime == st.st_mtime ) {
+
+        // the manifest has no modes, a chmod only shows in the event
+        return attributes ? PERMISSION : UNCHANGED;
+    }
+
+    // the same size and no write seen, a touch. Hashing every file of a
+    // make's touch storm would cost as much as sending them.
+    if ( attributes ) {
+
+        return TIMESTAMP;
+    }
+
+    return identical( mapping, destination, job ) ? TIMESTAMP : CONTENT;
+}
+
+bool SyncWorker::identical( const Mapping &mapping, Destination &destination, SyncJob &job )
+{
+    std::string localPath = mapping.local().toString() + job.path();
+
+    struct stat st;
+
+    if ( ::lstat( localPath.c_str(), &st ) != 0 || S_ISREG( st.st_mode ) == false || (Poco::UInt64) st.st_size > Settings::current()->hashMax() ) {
+
+        return false;
+    }
+
+    std::ifstream in( localPath.c_str(), std::ios::binary );
+
+    Checksum::XXH64 hash;
+    char buffer[ 64 * 1024 ];
+
+    while ( in.read( buffer, sizeof(buffer) ) || in.gcount() > 0 ) {
+
+        hash.update( buffer, in.gcount() );
+    }
+
+    if ( in.bad() ) {
+
+        return false;
+    }
+
+#ifdef __APPLE__
+    Poco::Timestamp::TimeVal modified = (Poco::Timestamp::TimeVal) st.st_mtimespec.tv_sec * 1000000 + st.st_mtimespec.tv_nsec / 1000;
+#else
+    Poco::Timestamp::TimeVal modified = (Poco::Timestamp::TimeVal) st.st_mtim.tv_sec * 1000000 + st.st_mtim.tv_nsec / 1000;
+#endif
+
+    Poco::UInt64 digest = hash.digest();
+
+    // only kept for the manifest if it is of the file the job began with
+    job.setHash( ( (Poco::UInt64) st.st_size == job.size() && modified == job.modified() ) ? digest : 0 );
+
+    return destination.manifest().sameContent( job.path(), st.st_size, digest );
+}
+
+void SyncWorker::transferred( const Mapping &mapping, Destination &destination, const SyncJob &job )
+{
+    if ( Settings::current()->dryRun() ) {
+
+        return;
+    }
+
+    const std::string &path = job.path();
+
+    if ( job.kind() == SyncJob::DIR_SYNC ) {
+
+        try {
+
+            // a small directory is not worth starting threads for, the root is
+            DirectoryScanner scanner( mapping.local().toString(), &mapping, path == "." ? 0 : 1 );
+            Manifest local;
+
+            scanner.scan( local, path == "." ? "" : path );
+
+            // what changed during the transfer may not have been sent
+            destination.manifest().replace( path, local, job.started() );
+
+            if ( path == "." ) {
+
+                destination.manifest().save();
+            }
+        }
+        catch ( Poco::Exception & ) {
+
+            // gone already, the monitor will have queued its removal
+            destination.manifest().removed( path );
+        }
+
+        return;
+    }
+
+    if ( job.modified() == 0 ) {
+
+        // there was nothing to send, the monitor will have queued its removal
+        destination.manifest().removed( path );
+        return;
+    }
+
+    Poco::Int64 mtime = settled( job );
+
+    // the hash is of the file the job began with, so only as good as its time
+    destination.manifest().updated( path, 'f', job.size(), mtime, mtime == RemoteManifest::UNKNOWN ? 0 : job.hash() );
+}
+
+void SyncWorker::completed( const Mapping &mapping, Destination &destination, const SyncJob &job, bool success )
+{
+    JobJournal &journal = destination.journal();
+
+    // a path removed since it was queued will never succeed, its delete
+    // is in the journal instead
+    if ( success == false && Poco::File( mapping.local().toString() + job.path() ).exists() ) {
+
+        journal.failed();
+        return;
+    }
+
+    journal.done( job.path(), job.journal() );
+
+    if ( success && journal.recovered() ) {
+
+        size_t count = owner_->replay( mapping, destination );
+
+        logger_.notice( Poco::format("%s: %s: %s is back, replayed %z outstanding path(s)", name_, mapping.name(), destination.remote().toString(), count ) );
+    }
+}
+
+RateLimiter::Class SyncWorker::trafficClass( const SyncJob &job )
+{
+    return job.priority() == JobScheduler::INTERACTIVE ? RateLimiter::INTERACTIVE : RateLimiter::BULK;
+}
+
+void SyncWorker::syncDeletes( const Mapping &mapping, Destination &destination )
+{
+    std::set<std::string> paths;
+
+    // everything taken below was journaled before this
+    JobJournal::Sequence sequence = destination.journal().last();
+
+    if ( owner_->takeDeletes( mapping.id(), destination.id(), paths ) == false ) {
+
+        return;
+    }
+
+    LOG_DEBUG( logger_, Poco::format("%s: deleting %z path(s)", name_, paths.size() ) );
+
+    if ( deleteRemote( mapping, destination, paths ) ) {
+
+        logger_.notice( Poco::format("%s: Deleted %z path(s)", name_, paths.size() ) );
+
+        for ( std::set<std::string>::const_iterator it = paths.begin(); it != paths.end(); it++ ) {
+
+            destination.manifest().removed( *it );
+
+            // unless it came back, and was not deleted
+            if ( Poco::File( mapping.local().toString() + *it ).exists() == false ) {
+
+                destination.journal().done( *it, sequence );
+            }
+        }
+
+        destination.deleted( (int) paths.size() );
+    }
+    else {
 
-        int rsyncLogLevel = Poco::Util::Application::instance().config().getInt( CONFIG_RSYNC_LOG_LEVEL, 3);
+        destination.journal().failed();
 
-        rsync::Log::setLevel( (rsync::Log::Level) rsyncLogLevel );
+        logger_.error( Poco::format("%s: Failed deleting %z path(s), will be fixed by the next reconciliation", name_, paths.size() ) );
     }
 }
 
@@ -75,15 +746,15 @@ void Queue::logCallback(const char *id, int level, const char *message)
 
     if ( level == rsync::Log::Debug ) {
 
-        logger_.debug(  std::string(id) + " " + message );
+        LOG_DEBUG( logger_, std::string(id) + " " + message );
     }
     else if ( level == rsync::Log::Trace ) {
 
-        logger_.trace(  std::string(id) + " " + message );
+        LOG_TRACE( logger_, std::string(id) + " " + message );
     }
     else if ( level == rsync::Log::Info ) {
 
-        logger_.information(  std::string(id) + " " + message );
+        LOG_INFORMATION( logger_, std::string(id) + " " + message );
     }
     else if ( level == rsync::Log::Warning ) {
 
@@ -106,7 +777,7 @@ void Queue::outputCallback(const char * path, bool isDir, int64_t size, int64_t
 {
     FUNCTIONTRACE;
 
-    logger_.debug( "OUT: " + Poco::format("%Ld %s %Ld", (Poco::Int64) time, std::string(path), (Poco::Int64) size) );
+    LOG_DEBUG( logger_, "OUT: " + Poco::format("%Ld %s %Ld", (Poco::Int64) time, std::string(path), (Poco::Int64) size) );
 }
 
 void Queue::statusCallback(const char * msg)
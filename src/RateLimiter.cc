@@ -0,0 +1,304 @@
+/**
+ * \file RateLimiter.cc
+ *
+ * \brief - Shares one host's bandwidth between interactive and bulk transfers
+ *
+ */
+
+#include <algorithm>
+
+#include "Poco/Format.h"
+#include "Poco/ScopedUnlock.h"
+#include "Poco/SharedPtr.h"
+
+#include "RateLimiter.h"
+
+// seconds of traffic a bucket can save up
+#define RATE_BURST 1.0
+
+// ms between checks while tickets wait for tokens
+#define RATE_WAIT_MIN 1
+#define RATE_WAIT_MAX 1000
+
+RateLimiter::RateLimiter( const std::string &name, long rate, int share ) :
+    name_(name),
+    rate_(0),
+    share_(0),
+    reserved_(0),
+    shared_(0),
+    stopped_(false),
+    thread_( name + "-rate" ),
+    logger_(Poco::Logger::get("RateLimiter"))
+{
+    configure( rate, share );
+
+    thread_.start( *this );
+}
+
+RateLimiter::~RateLimiter()
+{
+    {
+        Poco::FastMutex::ScopedLock lock( mutex_ );
+
+        stopped_ = true;
+
+        changed_.signal();
+    }
+
+    thread_.join();
+
+    for ( int cls = INTERACTIVE; cls <= BULK; cls++ ) {
+
+        for ( std::deque<Ticket *>::iterator it = waiting_[ cls ].begin(); it != waiting_[ cls ].end(); it++ ) {
+
+            delete *it;
+        }
+    }
+}
+
+void RateLimiter::configure( long rate, int share )
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    refill();
+
+    rate_ = std::max( rate, 0L ) * 1024.0;
+    share_ = std::min( std::max( share, 0 ), 100 ) / 100.0;
+
+    // debts carry over, a limit that was off starts with full buckets
+    reserved_ = std::min( reserved_, rate_ * share_ * RATE_BURST );
+    shared_ = std::min( shared_, rate_ * RATE_BURST );
+
+    if ( rate_ > 0 && reserved_ == 0 && shared_ == 0 ) {
+
+        reserved_ = rate_ * share_ * RATE_BURST;
+        shared_ = rate_ * ( 1 - share_ ) * RATE_BURST;
+    }
+
+    if ( rate_ > 0 ) {
+
+        logger_.notice( Poco::format("%s: bandwidth limited to %ld KB/s, %d%% reserved for interactive transfers", name_, rate, (int) ( share_ * 100 ) ) );
+    }
+    else {
+
+        logger_.notice( Poco::format("%s: bandwidth not limited", name_ ) );
+    }
+
+    changed_.broadcast();
+}
+
+long RateLimiter::rate()
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    return (long) ( rate_ / 1024 );
+}
+
+int RateLimiter::share()
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    return (int) ( share_ * 100 );
+}
+
+void RateLimiter::refill()
+{
+    Poco::Timestamp now;
+
+    double elapsed = ( now - refilled_ ) / 1000000.0;
+
+    refilled_ = now;
+
+    if ( rate_ <= 0 ) {
+
+        return;
+    }
+
+    double reservedRate = rate_ * share_;
+
+    reserved_ += reservedRate * elapsed;
+    shared_ += ( rate_ - reservedRate ) * elapsed;
+
+    // what interactive transfers did not use is there for bulk
+    if ( reserved_ > reservedRate * RATE_BURST ) {
+
+        shared_ += reserved_ - reservedRate * RATE_BURST;
+        reserved_ = reservedRate * RATE_BURST;
+    }
+
+    shared_ = std::min( shared_, rate_ * RATE_BURST );
+}
+
+bool RateLimiter::reserve( Reservation &reservation, double &wait )
+{
+    Poco::Int64 bytes = reservation.bytes;
+
+    double reservedRate = rate_ * share_;
+    double sharedRate = rate_ - reservedRate;
+
+    // a transfer larger than a bucket holds only needs a full one
+    double reservedNeed = std::min( (double) bytes, reservedRate * RATE_BURST );
+    double sharedNeed = std::min( (double) bytes, rate_ * RATE_BURST );
+
+    wait = RATE_WAIT_MAX / 1000.0;
+
+    if ( reservation.cls == INTERACTIVE && reservedRate > 0 ) {
+
+        if ( reserved_ >= reservedNeed ) {
+
+            reserved_ -= bytes;
+            reservation.shared = false;
+            return true;
+        }
+
+        wait = std::min( wait, ( reservedNeed - reserved_ ) / reservedRate );
+    }
+
+    if ( shared_ >= sharedNeed ) {
+
+        shared_ -= bytes;
+        reservation.shared = true;
+        return true;
+    }
+
+    if ( sharedRate > 0 ) {
+
+        wait = std::min( wait, ( sharedNeed - shared_ ) / sharedRate );
+    }
+
+    return false;
+}
+
+bool RateLimiter::admit( Class cls, Poco::Int64 bytes, Ticket *ticket )
+{
+    {
+        Poco::FastMutex::ScopedLock lock( mutex_ );
+
+        refill();
+
+        double wait;
+
+        ticket->reservation_.cls = cls;
+        ticket->reservation_.bytes = std::max( bytes, (Poco::Int64) 0 );
+
+        // nobody jumps the transfers already waiting, and bulk ones also
+        // wait behind interactive ones
+        bool ahead = waiting_[ cls ].empty() == false || ( cls == BULK && waiting_[ INTERACTIVE ].empty() == false );
+
+        if ( rate_ > 0 && ( ahead || reserve( ticket->reservation_, wait ) == false ) ) {
+
+            ticket->waited_ = true;
+
+            waiting_[ cls ].push_back( ticket );
+
+            changed_.signal();
+
+            return false;
+        }
+    }
+
+    // started without the lock, a ticket may block on a full TransferEngine
+    Poco::SharedPtr<Ticket> started( ticket );
+
+    started->admitted();
+
+    return true;
+}
+
+void RateLimiter::run()
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    while ( stopped_ == false ) {
+
+        refill();
+
+        double wait = RATE_WAIT_MAX / 1000.0;
+
+        Ticket *ticket = NULL;
+
+        // interactive tickets first, bulk ones only once none are left
+        for ( int cls = INTERACTIVE; cls <= BULK && ticket == NULL; cls++ ) {
+
+            if ( waiting_[ cls ].empty() ) {
+
+                continue;
+            }
+
+            Ticket *front = waiting_[ cls ].front();
+
+            // a limit switched off admits everything
+            if ( rate_ <= 0 || reserve( front->reservation_, wait ) ) {
+
+                ticket = front;
+                waiting_[ cls ].pop_front();
+            }
+            else {
+
+                break;
+            }
+        }
+
+        if ( ticket ) {
+
+            Poco::ScopedUnlock<Poco::FastMutex> unlock( mutex_ );
+
+            Poco::SharedPtr<Ticket> started( ticket );
+
+            try {
+
+                started->admitted();
+            }
+            catch ( Poco::Exception &ex ) {
+
+                logger_.error( Poco::format("%s: can not start a transfer: %s", name_, ex.displayText() ) );
+            }
+
+            continue;
+        }
+
+        changed_.tryWait( mutex_, std::max( (long) ( wait * 1000 ), (long) RATE_WAIT_MIN ) );
+    }
+}
+
+void RateLimiter::settle( const Reservation &reservation, Poco::Int64 sent )
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    if ( rate_ <= 0 || sent == reservation.bytes ) {
+
+        return;
+    }
+
+    refill();
+
+    // a debt on the reserved bucket is paid from its own refills, which
+    // would otherwise have overflowed to bulk; what was not sent goes back
+    // to where it came from
+    if ( reservation.shared ) {
+
+        shared_ -= sent - reservation.bytes;
+    }
+    else {
+
+        reserved_ -= sent - reservation.bytes;
+    }
+
+    changed_.signal();
+}
+
+long RateLimiter::limit( Class cls )
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    if ( rate_ <= 0 ) {
+
+        return 0;
+    }
+
+    // interactive transfers may borrow the whole link, bulk ones leave
+    // the reserved share free - a running rsync can not be slowed later
+    double limit = ( cls == INTERACTIVE ) ? rate_ : rate_ * ( 1 - share_ );
+
+    return std::max( (long) ( limit / 1024 ), 1L );
+}
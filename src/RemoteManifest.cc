@@ -0,0 +1,380 @@
+/**
+ * \file RemoteManifest.cc
+ *
+ * \brief - What srcsync believes is on a destination
+ *
+ */
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "Poco/File.h"
+#include "Poco/Path.h"
+#include "Poco/Exception.h"
+
+#include "DirectoryScanner.h"
+#include "RemoteManifest.h"
+
+// leads a saved model with hashes, older ones start with the first path
+#define MANIFEST_HEADER     "srcsync-manifest 2"
+
+const Poco::Int64 RemoteManifest::UNKNOWN;
+
+RemoteManifest::RemoteManifest( const std::string &file ) : file_(file), seeded_(false), seedClaimed_(false), dirty_(false)
+{
+}
+
+std::string RemoteManifest::listCommand()
+{
+    // NUL terminated so any file name survives
+    return "find . -mindepth 1 -printf '%y %s %T@ %P\\0'";
+}
+
+void RemoteManifest::parse( const std::string &listing, size_t start, bool hashed, std::map<std::string, Entry> &entries )
+{
+    while ( start < listing.length() ) {
+
+        size_t end = listing.find( '\0', start );
+
+        if ( end == std::string::npos ) {
+
+            // truncated
+            break;
+        }
+
+        // "TYPE SIZE MTIME PATH", or "TYPE SIZE MTIME HASH PATH"
+        const char *p = listing.c_str() + start;
+        char *next;
+
+        Entry e;
+
+        e.type = *p;
+
+        e.size = std::strtoull( p + 1, &next, 10 );
+        e.mtime = std::strtoll( next, &next, 10 );
+        e.hash = 0;
+
+        // skip the fraction of %T@
+        while ( *next && *next != ' ' ) {
+
+            next++;
+        }
+
+        if ( hashed && *next == ' ' ) {
+
+            e.hash = std::strtoull( next + 1, &next, 16 );
+        }
+
+        if ( *next == ' ' && next[1] != '\0' ) {
+
+            size_t name = next + 1 - listing.c_str();
+
+            entries[ listing.substr( name, end - name ) ] = e;
+        }
+
+        start = end + 1;
+    }
+}
+
+int RemoteManifest::seed( const std::string &listing )
+{
+    std::map<std::string, Entry> entries;
+
+    parse( listing, 0, false, entries );
+
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    int drift = 0;
+
+    if ( seeded_ ) {
+
+        std::map<std::string, Entry>::const_iterator a = entries_.begin();
+        std::map<std::string, Entry>::iterator b = entries.begin();
+
+        while ( a != entries_.end() || b != entries.end() ) {
+
+            if ( b == entries.end() || ( a != entries_.end() && a->first < b->first ) ) {
+
+                drift++; a++;
+            }
+            else if ( a == entries_.end() || b->first < a->first ) {
+
+                drift++; b++;
+            }
+            else {
+
+                // directory sizes and times change under us, only files count
+                if ( a->second.type != b->second.type || ( a->second.type == 'f' && ( a->second.size != b->second.size || a->second.mtime != b->second.mtime ) ) ) {
+
+                    drift++;
+                }
+                else {
+
+                    // the file we sent is still there
+                    b->second.hash = a->second.hash;
+                }
+
+                a++; b++;
+            }
+        }
+    }
+
+    entries_.swap( entries );
+
+    seeded_ = true;
+    dirty_ = true;
+
+    return drift;
+}
+
+bool RemoteManifest::claimSeed()
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    if ( seedClaimed_ ) {
+
+        return false;
+    }
+
+    seedClaimed_ = true;
+
+    return true;
+}
+
+bool RemoteManifest::seeded() const
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    return seeded_;
+}
+
+bool RemoteManifest::current( const std::string &path, Poco::UInt64 size, Poco::Int64 mtime ) const
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    if ( seeded_ == false ) {
+
+        return false;
+    }
+
+    std::map<std::string, Entry>::const_iterator it = entries_.find( path );
+
+    return it != entries_.end() && it->second.type == 'f' && it->second.size == size && it->second.mtime == mtime;
+}
+
+bool RemoteManifest::sameContent( const std::string &path, Poco::UInt64 size, Poco::UInt64 hash ) const
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    if ( seeded_ == false || hash == 0 ) {
+
+        return false;
+    }
+
+    std::map<std::string, Entry>::const_iterator it = entries_.find( path );
+
+    return it != entries_.end() && it->second.type == 'f' && it->second.size == size && it->second.hash == hash;
+}
+
+bool RemoteManifest::find( const std::string &path, Entry &entry ) const
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    if ( seeded_ == false ) {
+
+        return false;
+    }
+
+    std::map<std::string, Entry>::const_iterator it = entries_.find( path );
+
+    if ( it == entries_.end() ) {
+
+        return false;
+    }
+
+    entry = it->second;
+
+    return true;
+}
+
+void RemoteManifest::touched( const std::string &path, Poco::Int64 mtime )
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    std::map<std::string, Entry>::iterator it = entries_.find( path );
+
+    if ( it != entries_.end() ) {
+
+        it->second.mtime = mtime;
+
+        dirty_ = true;
+    }
+}
+
+void RemoteManifest::updated( const std::string &path, char type, Poco::UInt64 size, Poco::Int64 mtime, Poco::UInt64 hash )
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    Entry &e = entries_[ path ];
+
+    e.type = type;
+    e.size = size;
+    e.mtime = mtime;
+    e.hash = hash;
+
+    dirty_ = true;
+}
+
+void RemoteManifest::removeBelow( const std::string &dir )
+{
+    if ( dir.empty() ) {
+
+        entries_.clear();
+        return;
+    }
+
+    std::string prefix( dir + "/" );
+
+    std::map<std::string, Entry>::iterator it = entries_.lower_bound( prefix );
+
+    while ( it != entries_.end() && it->first.compare( 0, prefix.length(), prefix ) == 0 ) {
+
+        entries_.erase( it++ );
+    }
+}
+
+void RemoteManifest::removed( const std::string &path )
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    entries_.erase( path );
+
+    removeBelow( path );
+
+    dirty_ = true;
+}
+
+void RemoteManifest::replace( const std::string &dir, const Manifest &local, Poco::Int64 started )
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    std::vector<Entry> replaced( local.size() );
+
+    for ( size_t i = 0; i < local.size(); i++ ) {
+
+        const Manifest::Entry &l = local.entry( i );
+
+        Entry &e = replaced[i];
+
+        e.type = S_ISDIR( l.mode ) ? 'd' : ( S_ISLNK( l.mode ) ? 'l' : 'f' );
+        e.size = l.size;
+        e.mtime = ( l.mtime / 1000000 < started / 1000000 ) ? l.mtime / 1000000 : UNKNOWN;
+        e.hash = 0;
+
+        if ( e.mtime == UNKNOWN ) {
+
+            continue;
+        }
+
+        std::map<std::string, Entry>::const_iterator it = entries_.find( local.path( i ) );
+
+        // not touched by rsync, the hash of what we sent still holds
+        if ( it != entries_.end() && it->second.type == e.type && it->second.size == e.size && it->second.mtime == e.mtime ) {
+
+            e.hash = it->second.hash;
+        }
+    }
+
+    removeBelow( dir == "." ? "" : dir );
+
+    for ( size_t i = 0; i < local.size(); i++ ) {
+
+        entries_[ local.path( i ) ] = replaced[i];
+    }
+
+    dirty_ = true;
+}
+
+size_t RemoteManifest::size() const
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    return entries_.size();
+}
+
+bool RemoteManifest::load()
+{
+    if ( file_.empty() || Poco::File( file_ ).exists() == false ) {
+
+        return false;
+    }
+
+    std::ifstream in( file_.c_str(), std::ios::binary );
+    std::stringstream ss;
+
+    ss << in.rdbuf();
+
+    std::string saved( ss.str() );
+
+    std::map<std::string, Entry> entries;
+
+    // the header is a record of its own
+    bool hashed = ( saved.compare( 0, sizeof(MANIFEST_HEADER), MANIFEST_HEADER, sizeof(MANIFEST_HEADER) ) == 0 );
+
+    parse( saved, hashed ? sizeof(MANIFEST_HEADER) : 0, hashed, entries );
+
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    // only until the listing replaces it, but good enough to skip
+    // unchanged files straight away
+    entries_.swap( entries );
+
+    seeded_ = true;
+    dirty_ = false;
+
+    return true;
+}
+
+void RemoteManifest::save()
+{
+    if ( file_.empty() ) {
+
+        return;
+    }
+
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    if ( dirty_ == false ) {
+
+        return;
+    }
+
+    Poco::File( Poco::Path( file_ ).parent() ).createDirectories();
+
+    // written aside then renamed, a crash never leaves half a manifest
+    std::string tmp( file_ + ".tmp" );
+
+    {
+        std::ofstream out( tmp.c_str(), std::ios::binary | std::ios::trunc );
+
+        out << MANIFEST_HEADER << '\0';
+
+        for ( std::map<std::string, Entry>::const_iterator it = entries_.begin(); it != entries_.end(); it++ ) {
+
+            out << it->second.type << ' ' << it->second.size << ' ' << it->second.mtime << ' ' << std::hex << it->second.hash << std::dec << ' ' << it->first << '\0';
+        }
+
+        if ( !out ) {
+
+            throw Poco::WriteFileException( "Can not save manifest", tmp );
+        }
+    }
+
+    Poco::File( tmp ).renameTo( file_ );
+
+    dirty_ = false;
+}
@@ -0,0 +1,207 @@
+/**
+ * \file RingChannel.cc
+ *
+ * \brief - Hands log messages to a background thread for output
+ *
+ */
+
+#include "Poco/LoggingRegistry.h"
+#include "Poco/LoggingFactory.h"
+#include "Poco/Instantiator.h"
+#include "Poco/NumberParser.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/Format.h"
+#include "Poco/Exception.h"
+
+#include "RingChannel.h"
+
+#define RING_DEFAULT_CAPACITY 8192
+
+// the output thread re-checks this often (ms) even without a wakeup
+#define RING_IDLE_WAIT 250
+
+RingChannel::RingChannel() : ring_( new MPSCRing<Poco::Message *>( RING_DEFAULT_CAPACITY ) ), thread_("RingChannel"), running_(false), sleeping_(false), reported_(0)
+{
+}
+
+RingChannel::RingChannel( Poco::Channel *channel ) : channel_( channel, true ), ring_( new MPSCRing<Poco::Message *>( RING_DEFAULT_CAPACITY ) ), thread_("RingChannel"), running_(false), sleeping_(false), reported_(0)
+{
+}
+
+RingChannel::~RingChannel()
+{
+    try {
+
+        close();
+    }
+    catch ( ... ) {
+    }
+
+    delete ring_;
+}
+
+void RingChannel::registerChannel()
+{
+    Poco::LoggingFactory::defaultFactory().registerChannelClass( "RingChannel", new Poco::Instantiator<RingChannel, Poco::Channel> );
+}
+
+void RingChannel::setChannel( Poco::Channel *channel )
+{
+    channel_ = Poco::AutoPtr<Poco::Channel>( channel, true );
+}
+
+void RingChannel::open()
+{
+    if ( running_.load( std::memory_order_acquire ) ) {
+
+        return;
+    }
+
+    Poco::FastMutex::ScopedLock lock( threadMutex_ );
+
+    if ( running_.load( std::memory_order_relaxed ) == false ) {
+
+        running_.store( true, std::memory_order_release );
+
+        thread_.start( *this );
+    }
+}
+
+void RingChannel::close()
+{
+    {
+        Poco::FastMutex::ScopedLock lock( threadMutex_ );
+
+        if ( running_.load( std::memory_order_relaxed ) == false ) {
+
+            return;
+        }
+
+        running_.store( false, std::memory_order_release );
+    }
+
+    wakeup_.set();
+
+    thread_.join();
+
+    // anything logged while we were stopping
+    flush();
+}
+
+void RingChannel::log( const Poco::Message &msg )
+{
+    open();
+
+    Poco::Message *copy = new Poco::Message( msg );
+
+    if ( ring_->push( copy ) == false ) {
+
+        delete copy;
+
+        dropped_++;
+        return;
+    }
+
+    // pairs with the fence in run(), either we see it sleeping or it sees the message
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+
+    if ( sleeping_.load( std::memory_order_relaxed ) ) {
+
+        wakeup_.set();
+    }
+}
+
+bool RingChannel::flush()
+{
+    bool any = false;
+
+    Poco::Message *msg;
+
+    while ( ring_->pop( msg ) ) {
+
+        any = true;
+
+        if ( channel_ ) {
+
+            try {
+
+                channel_->log( *msg );
+            }
+            catch ( ... ) {
+                // nowhere to report it
+            }
+        }
+
+        delete msg;
+    }
+
+    int dropped = dropped_.value();
+
+    if ( dropped != reported_ && channel_ ) {
+
+        channel_->log( Poco::Message( "RingChannel",
+                    Poco::format( "%d log message(s) dropped, the output could not keep up", dropped - reported_ ),
+                    Poco::Message::PRIO_WARNING ) );
+
+        reported_ = dropped;
+    }
+
+    return any;
+}
+
+void RingChannel::run()
+{
+    while ( running_.load( std::memory_order_acquire ) ) {
+
+        if ( flush() ) {
+
+            continue;
+        }
+
+        sleeping_.store( true, std::memory_order_relaxed );
+
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+
+        // a message may have arrived before the flag was visible
+        if ( ring_->empty() && running_.load( std::memory_order_acquire ) ) {
+
+            wakeup_.tryWait( RING_IDLE_WAIT );
+        }
+
+        sleeping_.store( false, std::memory_order_relaxed );
+    }
+}
+
+void RingChannel::setProperty( const std::string &name, const std::string &value )
+{
+    if ( name == "channel" ) {
+
+        setChannel( Poco::LoggingRegistry::defaultRegistry().channelForName( value ) );
+    }
+    else if ( name == "capacity" ) {
+
+        Poco::FastMutex::ScopedLock lock( threadMutex_ );
+
+        if ( running_.load( std::memory_order_relaxed ) ) {
+
+            throw Poco::IllegalStateException( "RingChannel capacity can not be changed once logging has started" );
+        }
+
+        delete ring_;
+        ring_ = new MPSCRing<Poco::Message *>( Poco::NumberParser::parseUnsigned( value ) );
+    }
+    else {
+
+        Poco::Channel::setProperty( name, value );
+    }
+}
+
+std::string RingChannel::getProperty( const std::string &name ) const
+{
+    if ( name == "capacity" ) {
+
+        return Poco::NumberFormatter::format( (Poco::UInt64) ring_->capacity() );
+    }
+
+    return Poco::Channel::getProperty( name );
+}
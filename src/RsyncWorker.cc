@@ -1,121 +1,491 @@
 
 #include <sstream>
+#include <fstream>
+#include <cctype>
+#include <iterator>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <ctime>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "Poco/Util/ServerApplication.h"
 
-#include "Poco/PriorityNotificationQueue.h"
 #include "Poco/Thread.h"
 #include "Poco/Logger.h"
 #include "Poco/StringTokenizer.h"
+#include "Poco/String.h"
 #include "Poco/Glob.h"
 #include "Poco/Process.h"
-#include "Poco/Pipe.h"
-#include "Poco/PipeStream.h"
-#include "Poco/StreamCopier.h"
-#include "Poco/StringTokenizer.h"
+#include "Poco/File.h"
+#include "Poco/Path.h"
+#include "Poco/TemporaryFile.h"
 
 #include "SourceSync.h"
 #include "RsyncWorker.h"
-
-#if USE_GROWL
-#include "growl.hpp"
-#endif
+#include "DirectoryScanner.h"
+#include "Checksum.h"
+#include "Settings.h"
 
 #include "config.h"
 
-#if USE_GROWL
-static const char *notifications[] = {
-    "sync",
+// most files in one batch of time and mode updates
+#define METADATA_BATCH  256
+
+// printed by the batch's script for each file it could not update
+#define METADATA_FAILED "srcsync-failed "
+
+// one rsync process, run by the Queue's TransferEngine
+class RsyncWorker::RsyncTransfer : public TransferEngine::Transfer
+{
+
+    public:
+        RsyncTransfer( RsyncWorker &worker, SyncJob *job, const Poco::SharedPtr<Signature> &signature ) : worker_(worker), job_(job, true), sent_(0), signature_(signature) {};
+
+        // filled in by the SpawnTicket as it is admitted
+        RateLimiter::Reservation &reservation() { return reservation_; };
+
+        virtual void output( const std::string &line )
+        {
+            // --verbose ends with "sent 1,234 bytes  received 56 bytes ..."
+            if ( line.compare( 0, 5, "sent " ) == 0 ) {
+
+                for ( std::string::const_iterator it = line.begin() + 5; it != line.end() && ( isdigit( *it ) || *it == ',' ); it++ ) {
+
+                    if ( *it != ',' ) {
+
+                        sent_ = sent_ * 10 + ( *it - '0' );
+                    }
+                }
+            }
+
+            worker_.logOutput( line );
+        };
+
+        virtual void error( const std::string &line ) { worker_.logError( line ); };
+
+        virtual void finished( int status )
+        {
+            Mapping &mapping = *thisApp->mapping( job_->mapping() );
+
+            Destination &destination = mapping.destination( job_->destination() );
+
+            worker_.owner_->bandwidth().settle( reservation_, sent_ );
+
+            if ( signature_ ) {
+
+                worker_.keep( destination, job_->path(), status == 0 ? signature_.get() : NULL );
+            }
+
+            worker_.synced( mapping, destination, *job_, status == 0 );
+        };
+
+    private:
+        RsyncWorker &worker_;
+        Poco::AutoPtr<SyncJob> job_;
+
+        // what was taken from the RateLimiter as it started, and what rsync
+        // reported sending
+        RateLimiter::Reservation reservation_;
+        Poco::Int64 sent_;
+
+        Poco::SharedPtr<Signature> signature_;
 };
-#endif
 
-#define COUNT(a) sizeof(a)/sizeof(*a)
+// tar piped into ssh, unpacked on the remote side
+class RsyncWorker::PackTransfer : public TransferEngine::Transfer
+{
 
-RsyncWorker::RsyncWorker ( const std::string &name, Poco::PriorityNotificationQueue *queue) : SyncWorker(name, queue), logger_(Poco::Logger::get("RsyncWorker")), readStdOut(this, &RsyncWorker::readOutPipe), readStdErr(this, &RsyncWorker::readErrPipe)
-{ 
-    FUNCTIONTRACE;
+    public:
+        PackTransfer( RsyncWorker &worker, int mapping, int destination, Jobs &jobs, bool bootstrap, const Poco::SharedPtr<Poco::TemporaryFile> &list,
+                const Poco::SharedPtr<Poco::TemporaryFile> &index, const Poco::SharedPtr<Poco::TemporaryFile> &packed ) :
+            worker_(worker), mapping_(mapping), destination_(destination), bootstrap_(bootstrap), list_(list), index_(index), packed_(packed)
+        {
+            jobs_.swap( jobs );
+        };
+
+        virtual void output( const std::string &line ) { worker_.logOutput( line ); };
+        virtual void error( const std::string &line ) { worker_.logError( line ); };
 
-    logger_.debug( "Creating " + name_ );
+        virtual void finished( int status )
+        {
+            Mapping &mapping = *thisApp->mapping( mapping_ );
 
-    local_ = Poco::Path( Poco::Util::Application::instance().config().getString( CONFIG_SRC ) );
+            // STATUS is the remote tar's, the local one wrote its own
+            int local = -1;
 
-    local_.makeAbsolute();
+            std::ifstream in( packed_->path().c_str() );
 
-    remote_ = new Poco::URI( Poco::Util::Application::instance().config().getString( CONFIG_DEST ) );
+            if ( ( in >> local ).fail() ) {
 
-    std::string ignore = Poco::Util::Application::instance().config().getString( CONFIG_IGNORE, "" );
+                local = -1;
+            }
 
-    if ( ignore.empty() == false ) {
+            if ( local > 0 ) {
 
-        Poco::StringTokenizer tok( ignore, " ", Poco::StringTokenizer::TOK_TRIM );
+                worker_.logError( Poco::format("tar exited with %d", local ) );
+            }
 
-        for ( int i = 0; i < tok.count(); i++ ) {
+            if ( local == 0 || status != 0 || bootstrap_ ) {
 
-            ignore_.push_back( new Poco::Glob( tok[i] ) );
-        }
+                worker_.packSynced( mapping, mapping.destination( destination_ ), jobs_, bootstrap_, status == 0 && local == 0 );
+                return;
+            }
 
-    }
+            // a file tar could not read is left out of an archive that
+            // is otherwise whole, the rest of the jobs are done
+            std::set<std::string> archived;
+
+            std::ifstream index( index_->path().c_str() );
+            std::string line;
+
+            while ( std::getline( index, line ) ) {
+
+                // directories are listed with a /
+                if ( line.size() > 1 && line[ line.size() - 1 ] == '/' ) {
+
+                    line.resize( line.size() - 1 );
+                }
+
+                archived.insert( line );
+            }
+
+            worker_.packSynced( mapping, mapping.destination( destination_ ), jobs_, bootstrap_, true, &archived );
+        };
+
+    private:
+        RsyncWorker &worker_;
+        int mapping_;
+        int destination_;
+        Jobs jobs_;
+        bool bootstrap_;
+
+        // the paths tar reads, those it archived and its exit status,
+        // removed with the transfer
+        Poco::SharedPtr<Poco::TemporaryFile> list_;
+        Poco::SharedPtr<Poco::TemporaryFile> index_;
+        Poco::SharedPtr<Poco::TemporaryFile> packed_;
+};
+
+// one file written by the destination's agent, whole or as a DELTA
+class RsyncWorker::AgentTransfer : public AgentClient::Request
+{
+
+    public:
+        AgentTransfer( RsyncWorker &worker, SyncJob *job, const Poco::SharedPtr<Signature> &signature, bool delta ) :
+            worker_(worker), job_(job, true), signature_(signature), delta_(delta) {};
+
+        virtual void finished( bool ok, const std::string &error )
+        {
+            Mapping &mapping = *thisApp->mapping( job_->mapping() );
+            Destination &destination = mapping.destination( job_->destination() );
+
+            // the next delta is made from this, or the file goes whole
+            worker_.keep( destination, job_->path(), ok ? signature_.get() : NULL );
+
+            if ( ok == false && delta_ ) {
+
+                // the remote copy is not what was last sent, without the
+                // signature the job sends the whole file this time
+                LOG_DEBUG( worker_.logger_, Poco::format("%s: delta for %s refused (%s), sending it whole", worker_.name_, job_->path(), error ) );
+
+                SyncJob *retry = new SyncJob( SyncJob::FILE_SYNC, job_->pathId(), job_->mapping(), job_->destination(), job_->flags() );
+
+                retry->setJournal( job_->journal() );
+
+                worker_.owner_->enqueue( retry, (JobScheduler::Priority) job_->priority() );
+                worker_.jobEnd( *job_ );
+                return;
+            }
+
+            if ( ok == false ) {
+
+                worker_.logError( "agent: " + error );
+            }
+
+            worker_.synced( mapping, destination, *job_, ok );
+        };
+
+    private:
+        RsyncWorker &worker_;
+        Poco::AutoPtr<SyncJob> job_;
+
+        Poco::SharedPtr<Signature> signature_;
+        bool delta_;
+};
+
+// a process started by the TransferEngine once the RateLimiter admits it
+class RsyncWorker::SpawnTicket : public RateLimiter::Ticket
+{
+
+    public:
+        // the reservation is copied to RESERVATION, if given, before TRANSFER starts
+        SpawnTicket( TransferEngine &engine, const std::string &command, const Poco::Process::Args &args, TransferEngine::Transfer *transfer, RateLimiter::Reservation *reservation = NULL ) :
+            engine_(engine), command_(command), args_(args), transfer_(transfer), reservation_(reservation) {};
+
+        // dropped unstarted with the Queue
+        ~SpawnTicket() { delete transfer_; };
+
+        virtual void admitted()
+        {
+            TransferEngine::Transfer *transfer = transfer_;
+
+            transfer_ = NULL;
+
+            if ( reservation_ ) {
+
+                *reservation_ = reservation();
+            }
+
+            engine_.spawn( command_, args_, transfer );
+        };
+
+    private:
+        TransferEngine &engine_;
+        std::string command_;
+        Poco::Process::Args args_;
+        TransferEngine::Transfer *transfer_;
+        RateLimiter::Reservation *reservation_;
+};
+
+// a write or delta sent to the agent once the RateLimiter admits it
+class RsyncWorker::AgentTicket : public RateLimiter::Ticket
+{
+
+    public:
+        // takes DATA
+        AgentTicket( const Poco::SharedPtr<AgentClient> &client, const std::string &path, std::string &data, Poco::UInt32 mode, Poco::Int64 mtime, AgentClient::Request *request ) :
+            client_(client), path_(path), isDelta_(false), mode_(mode), mtime_(mtime), request_(request)
+        {
+            data_.swap( data );
+        };
+
+        // takes DELTA's instructions
+        AgentTicket( const Poco::SharedPtr<AgentClient> &client, const std::string &path, Agent::Delta &delta, Poco::UInt32 mode, Poco::Int64 mtime, AgentClient::Request *request ) :
+            client_(client), path_(path), isDelta_(true), mode_(mode), mtime_(mtime), request_(request)
+        {
+            delta_.instructions.swap( delta.instructions );
+            delta_.checksum = delta.checksum;
+        };
+
+        ~AgentTicket() { delete request_; };
+
+        virtual void admitted()
+        {
+            AgentClient::Request *request = request_;
+
+            request_ = NULL;
+
+            if ( isDelta_ ) {
+
+                client_->delta( path_, delta_, mode_, mtime_, request );
+            }
+            else {
+
+                client_->write( path_, data_, mode_, mtime_, request );
+            }
+        };
+
+    private:
+        Poco::SharedPtr<AgentClient> client_;
+        std::string path_;
+        std::string data_;
+        Agent::Delta delta_;
+        bool isDelta_;
+        Poco::UInt32 mode_;
+        Poco::Int64 mtime_;
+        AgentClient::Request *request_;
+};
+
+// the times and mode of a file whose contents are already there, set by the agent
+class RsyncWorker::MetadataTransfer : public AgentClient::Request
+{
+
+    public:
+        MetadataTransfer( RsyncWorker &worker, SyncJob *job ) : worker_(worker), job_(job, true) {};
+
+        virtual void finished( bool ok, const std::string &error )
+        {
+            Mapping &mapping = *thisApp->mapping( job_->mapping() );
+
+            if ( ok == false ) {
+
+                worker_.logError( "agent: " + error );
+            }
+
+            worker_.metadataSynced( mapping, mapping.destination( job_->destination() ), *job_, ok );
+        };
+
+    private:
+        RsyncWorker &worker_;
+        Poco::AutoPtr<SyncJob> job_;
+};
+
+RsyncWorker::RsyncWorker ( const std::string &name, int index, Queue *owner ) : SyncWorker(name, index, owner), logger_(Poco::Logger::get("RsyncWorker")), controlPersist_(0), packing_(false)
+{ 
+    FUNCTIONTRACE;
+
+    LOG_DEBUG( logger_, "Creating " + name_ );
 
     initialize();
 }
 
+// packing lists what it archived with --index-file, which bsdtar (the
+// one macOS ships) does not have
+static bool probeTar( TransferEngine &engine, Poco::Logger &logger )
+{
+    Poco::Process::Args args( 1, "--version" );
+    std::string output;
+
+    if ( engine.execute( "tar", args, output ) == 0 && output.find( "GNU tar" ) != std::string::npos ) {
+
+        return true;
+    }
+
+    logger.warning( "tar is not GNU tar, small files are not packed" );
+
+    return false;
+}
+
+// asked once for all workers
+static bool gnuTar( TransferEngine &engine, Poco::Logger &logger )
+{
+    static const bool gnu = probeTar( engine, logger );
+
+    return gnu;
+}
+
 void RsyncWorker::initialize()
 {
+    Poco::Util::AbstractConfiguration &config = Poco::Util::Application::instance().config();
+
+    if ( config.getBool( CONFIG_RSYNC_SSH_MULTIPLEX, true ) ) {
+
+        Poco::Path stateDir( config.getString( CONFIG_STATE_DIR, Poco::Path::home() + "." APPNAME ) );
+
+        stateDir.makeDirectory();
+
+        Poco::File( stateDir ).createDirectories();
+
+        // %C is a hash of host, port and user - one master per destination
+        controlPath_ = stateDir.toString() + "ssh-%C";
+        controlPersist_ = config.getInt( CONFIG_RSYNC_SSH_IDLE, 300 );
+    }
+
+    agentCommand_ = config.getString( CONFIG_AGENT_COMMAND, "" );
+
+    packing_ = gnuTar( owner_->transfers(), logger_ );
+
+    if ( index_ == 0 && agentCommand_.empty() == false ) {
+
+        LOG_DEBUG( logger_, Poco::format("%s: block checksums use %s", name_, std::string( Checksum::implementation() ) ) );
+    }
+
+    const std::vector<Mapping *> &mappings = thisApp->mappings();
 
-    std::string auth = remote_->getUserInfo();
+    for ( std::vector<Mapping *>::const_iterator it = mappings.begin(); it != mappings.end(); it++ ) {
 
-    Poco::StringTokenizer tok( auth, ":", Poco::StringTokenizer::TOK_TRIM );
+        const Mapping &m = **it;
 
-    user_ = tok[ 0 ];
+        for ( std::vector<Destination *>::const_iterator jt = m.destinations().begin(); jt != m.destinations().end(); jt++ ) {
 
-    private_key_ = Poco::Util::Application::instance().config().getString(CONFIG_RSYNC_SSH_KEYFILE, "");
+            const Destination &d = **jt;
 
-    if ( tok.count() == 2  ) {
+            if ( d.hostKey() != owner_->name() ) {
 
-        password_ = tok[ 1 ];
+                continue;
+            }
+
+            if ( m.privateKey().empty() == false  ) {
+                LOG_DEBUG( logger_, Poco::format("%s: %s: connecting as %s to %s using keyfile %s", name_, m.name(), d.user(), d.remote().getHost(), m.privateKey() ) );
+            }
+            else {
+                LOG_DEBUG( logger_, Poco::format("%s: %s: connecting as %s to %s using password %s", name_, m.name(), d.user(), d.remote().getHost(), d.password() ) );
+            }
+        }
+    }
+}
 
+void RsyncWorker::sshArgs( const Mapping &mapping, const Destination &destination, Poco::Process::Args &args )
+{
+    std::string privateKey( mapping.privateKey() );
+
+    if ( privateKey.empty() == false ) {
+        args.push_back( "-i" );
+        args.push_back( privateKey );
     }
 
-    if ( private_key_.empty() == false  ) {
-        logger_.debug( Poco::format("%s: connecting as %s to %s using keyfile %s", name_, user_, remote_->getHost(), private_key_ ) );
+    if ( destination.user().empty() == false ) {
+        args.push_back( "-l" );
+        args.push_back( destination.user() );
     }
-    else {
-        logger_.debug( Poco::format("%s: connecting as %s to %s using password %s", name_, user_, remote_->getHost(), password_ ) );
+
+    if ( destination.remote().getPort() != 0 && destination.remote().getPort() != 22 ) {
+        args.push_back( "-p" );
+        args.push_back( Poco::format("%hu", destination.remote().getPort()) );
     }
 
+    if ( controlPath_.empty() == false ) {
+
+        // every rsync and remote command for the destination becomes a
+        // channel on one connection, the first one to start sets it up
+        args.push_back( "-o" );
+        args.push_back( "ControlMaster=auto" );
+        args.push_back( "-o" );
+        args.push_back( "ControlPath=" + controlPath_ );
+        args.push_back( "-o" );
+        args.push_back( Poco::format("ControlPersist=%d", controlPersist_ ) );
+    }
 }
 
-bool RsyncWorker::runRsync( const std::string & from, const std::string &to )
+std::string RsyncWorker::quote( const std::string &arg, const std::string &escaped )
 {
+    return "'" + Poco::replace( arg, "'", escaped ) + "'";
+}
 
-    bool success = false;
-
+void RsyncWorker::startRsync( const Mapping &mapping, Destination &destination, SyncJob *job, const std::string & from, const std::string &to, const Poco::SharedPtr<Signature> &signature )
+{
     Poco::Process::Args args;
 
     args.push_back( "--archive" ); // permissions, times etc..
     args.push_back( "--delete" ); 
     args.push_back( "--verbose" ); 
 
-    if ( Poco::Util::Application::instance().config().getInt( CONFIG_VERBOSE) > Poco::Message::PRIO_INFORMATION ) {
+    if ( Settings::current()->verbose() > Poco::Message::PRIO_INFORMATION ) {
 
         args.push_back( "--verbose" ); 
     }
 
-    if ( remote_->getScheme() == "ssh" ) {
+    if ( destination.remote().getScheme() == "ssh" ) {
 
         std::string ssh("ssh");
 
-        if ( private_key_.empty() == false ) {
-            ssh += " -i " + private_key_;
-        }
+        Poco::Process::Args sshArgv;
+
+        sshArgs( mapping, destination, sshArgv );
 
-        if ( user_.empty() == false ) {
-            ssh += " -l " + user_;
+        // rsync splits --rsh on spaces but honours quotes, a doubled quote
+        // standing for one; backslashes are not special
+        for ( Poco::Process::Args::const_iterator it = sshArgv.begin(); it != sshArgv.end(); it++ ) {
+
+            ssh += " " + quote( *it, "''" );
         }
 
         args.push_back( Poco::format("--rsh=%s", ssh )  );
     }
 
+    RateLimiter::Class cls = trafficClass( *job );
+
+    long limit = owner_->bandwidth().limit( cls );
+
+    if ( limit > 0 ) {
+
+        args.push_back( Poco::format("--bwlimit=%ld", limit ) );
+    }
+
     args.push_back( from );
     args.push_back( to );
 
@@ -128,294 +498,941 @@ bool RsyncWorker::runRsync( const std::string & from, const std::string &to )
     }
 
 
-    logger_.debug( Poco::format("%s: %s", name_, launchCmd ) );
+    LOG_DEBUG( logger_, Poco::format("%s: %s", name_, launchCmd ) );
+
+    // nothing is run in a dry run
+    if ( Settings::current()->dryRun() ) {
+
+        synced( mapping, destination, *job, false );
+        return;
+    }
+
+    // a file is expected to go whole, what a directory sends is not known;
+    // the difference is settled with what rsync reports
+    Poco::Int64 estimate = job->kind() == SyncJob::FILE_SYNC ? job->size() : 0;
+
+    // over the limit the limiter starts it later, the worker goes on
+    RsyncTransfer *transfer = new RsyncTransfer( *this, job, signature );
+
+    owner_->bandwidth().admit( cls, estimate, new SpawnTicket( owner_->transfers(), "rsync", args, transfer, &transfer->reservation() ) );
+}
+
+bool RsyncWorker::runRemote( const Mapping &mapping, const Destination &destination, const std::string &command, std::string *output )
+{
+    bool success = false;
+
+    Poco::Process::Args args;
+
+    std::string launch( "sh" );
+
+    const Poco::URI &remote = destination.remote();
 
-    if ( Poco::Util::Application::instance().config().getString( CONFIG_DRYRUN).empty() == false ) {
+    std::string remoteDir = quote( remote.getPath() );
+
+    if ( remote.getScheme() == "ssh" ) {
+
+        launch = "ssh";
+
+        sshArgs( mapping, destination, args );
+
+        args.push_back( remote.getHost() );
+    }
+    else {
+
+        args.push_back( "-c" );
+    }
 
-        Poco::Pipe outPipe;
-        Poco::Pipe errPipe;
+    args.push_back( "cd " + remoteDir + " && " + command );
 
-        Poco::ProcessHandle handle = Poco::Process::launch( "rsync", args, 
-                NULL, // no stdin needed
-                &outPipe, 
-                &errPipe);
+    LOG_DEBUG( logger_, Poco::format("%s: %s %s", name_, launch, args.back() ) );
 
-        Poco::PipeInputStream outStream(outPipe);
-        Poco::PipeInputStream errStream(errPipe);
+    if ( Settings::current()->dryRun() == false ) {
 
-        // these run in an active method so we don't block
-        readOutPipe( outStream );
-        readErrPipe( errStream );
+        std::string out;
 
-        int ret = handle.wait();
+        success = ( owner_->transfers().execute( launch, args, out ) == 0 );
 
-        if ( ret == 0 ) {
+        if ( output ) {
 
-            success = true;
+            output->swap( out );
         }
-        else {
+        else if ( logger_.information() ) {
+
+            std::istringstream lines( out );
+            std::string line;
 
-            success = false;
+            while ( std::getline( lines, line ) ) {
+
+                logOutput( line );
+            }
         }
     }
 
     return success;
 }
 
-bool RsyncWorker::readOutPipe( Poco::PipeInputStream & stream )
+Poco::SharedPtr<AgentClient> RsyncWorker::agent( const Mapping &mapping, const Destination &destination )
 {
+    // nothing is run in a dry run
+    if ( agentCommand_.empty() || Settings::current()->dryRun() ) {
+
+        return Poco::SharedPtr<AgentClient>();
+    }
+
+    const Poco::URI &remote = destination.remote();
+
+    std::string command( agentCommand_ );
+    Poco::Process::Args args;
 
-    std::stringstream ss;
+    if ( remote.getScheme() == "ssh" ) {
 
-    Poco::StreamCopier::copyStream( stream, ss);
+        command = "ssh";
 
-    Poco::StringTokenizer tok( ss.str(), "\n");
+        sshArgs( mapping, destination, args );
 
-    for ( std::vector<std::string>::const_iterator it = tok.begin(); it != tok.end(); it++ ) {
+        args.push_back( remote.getHost() );
 
-        logger_.information( Poco::format("%s: rsync: %s", name_, *it ) );
+        // run by the remote shell
+        args.push_back( agentCommand_ + " " + quote( remote.getPath() ) );
     }
+    else {
 
-    return true;
+        args.push_back( remote.getPath() );
+    }
+
+    return owner_->agent( mapping, destination, command, args );
+}
+
+// a file opened for sendFile(), closed with it. A fifo does not block the open
+class OpenFile
+{
 
+    public:
+        explicit OpenFile( const std::string &path ) : fd_( ::open( path.c_str(), O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC ) ) {};
+        ~OpenFile() { if ( fd_ >= 0 ) ::close( fd_ ); };
+
+        int fd() const { return fd_; };
+
+    private:
+        OpenFile( const OpenFile & );
+        OpenFile &operator=( const OpenFile & );
+
+        int fd_;
+};
+
+// ST's modification time in epoch microseconds
+static Poco::Int64 modified( const struct stat &st )
+{
+#ifdef __APPLE__
+    return (Poco::Int64) st.st_mtimespec.tv_sec * 1000000 + st.st_mtimespec.tv_nsec / 1000;
+#else
+    return (Poco::Int64) st.st_mtim.tv_sec * 1000000 + st.st_mtim.tv_nsec / 1000;
+#endif
 }
 
-bool RsyncWorker::readErrPipe( Poco::PipeInputStream & stream )
+// the whole of the file open on FD, as ST found it. False if it was
+// shortened, grown or written while it was read, what was read would be
+// stamped with a size and time it does not have
+static bool readFile( int fd, const struct stat &st, std::string &data )
 {
+    data.resize( st.st_size );
+
+    size_t done = 0;
 
-    std::stringstream ss;
+    while ( done < data.size() ) {
 
-    Poco::StreamCopier::copyStream( stream, ss);
+        ssize_t n = ::read( fd, &data[ done ], data.size() - done );
 
-    Poco::StringTokenizer tok( ss.str(), "\n");
+        if ( n < 0 && errno == EINTR ) {
 
-    for ( std::vector<std::string>::const_iterator it = tok.begin(); it != tok.end(); it++ ) {
+            continue;
+        }
+
+        if ( n <= 0 ) {
+
+            return false;
+        }
 
-        logger_.error( Poco::format("%s: rsync: %s", name_, *it ) );
+        done += n;
     }
 
-    return true;
+    char more;
+    struct stat after;
+
+    if ( ::read( fd, &more, 1 ) != 0 || ::fstat( fd, &after ) != 0 ) {
+
+        return false;
+    }
+
+    return after.st_size == st.st_size && modified( after ) == modified( st );
 }
 
-void RsyncWorker::run()
+bool RsyncWorker::sendFile( const Mapping &mapping, Destination &destination, SyncJob *job, Poco::SharedPtr<Signature> &signature )
 {
-    FUNCTIONTRACE;
+    const std::string &path = job->path();
 
-    Poco::AutoPtr<Poco::Notification> n( queue_->waitDequeueNotification() );
+    std::string localPath = mapping.local().toString() + path;
 
-    int zero = 0;
+    // looked at and read through the one descriptor, so what is sent is
+    // what ST describes
+    OpenFile file( localPath );
 
-    while ( n ) {
+    struct stat st;
 
-        SyncMessage *req = dynamic_cast<SyncMessage *>( n.get() );
+    // links and the like are left to rsync
+    if ( file.fd() < 0 || ::fstat( file.fd(), &st ) != 0 || S_ISREG( st.st_mode ) == false ) {
 
-        if ( req ) {
+        return false;
+    }
 
-            thisApp->jobStart();
+    Poco::UInt64 size = st.st_size;
 
-            logger_.debug( Poco::format("%s: Received message '%s' for %s", name_, req->type(), req->path()) );
+    // one snapshot for the whole decision, a reload can not split it
+    const Settings *settings = Settings::current();
 
-            if ( req && req->type() == MSG_FILE_SYNC ) { 
+    Poco::UInt64 agentMaxSize = settings->agentMaxSize();
 
-                FileSyncMessage *msg = dynamic_cast<FileSyncMessage *>( n.get() );
+    bool signable = ( size >= DeltaEngine::MIN_SIZE && size <= settings->agentDeltaMax() );
 
-                if ( msg ) {
+    // the block checksums of what was sent last time
+    Signature base;
 
-                    std::string localPath = msg->path();
+    bool delta = signable && destination.signatures().get( path, base );
 
-                    bool ignoreThisFile = false;
+    if ( delta == false && size > agentMaxSize && signable == false ) {
 
-                    if ( ignore_.size() > 0 ) {
+        return false;
+    }
 
-                        for ( std::vector<Poco::Glob *>::iterator it = ignore_.begin(); it != ignore_.end() ; it++ ) {
+    Poco::SharedPtr<AgentClient> client = agent( mapping, destination );
 
-                            if ( (*it)->match( localPath ) ) {
+    if ( client.isNull() ) {
 
-                                ignoreThisFile = true;
+        return false;
+    }
 
-                                break;
-                            }
-                        }
-                    }
+    std::string data;
 
-                    if ( ignoreThisFile ) {
-                        logger_.notice( Poco::format("%s: Ignoring %s", name_, localPath) );
-                    }
-                    else {
-                        std::string remotePath = remote_->getHost() + ":" + remote_->getPath();
+    // still being written, rsync copes with that and what it sends is
+    // recorded as unsettled
+    if ( readFile( file.fd(), st, data ) == false ) {
 
-                        remotePath += msg->path();
+        LOG_DEBUG( logger_, Poco::format("%s: %s changed while it was read, leaving it to rsync", name_, localPath ) );
 
-                        localPath = local_.toString() + msg->path();
+        return false;
+    }
 
-                        logger_.debug( Poco::format("%s: syncing file %s to %s", name_, localPath, remotePath ) );
+    if ( signable ) {
 
-                        bool st = runRsync ( localPath, remotePath );
+        signature = new Signature;
 
-                        if ( st ) {
-                            logger_.notice( Poco::format("%s: Updated %s", name_, localPath) );
+        DeltaEngine::sign( data.data(), data.size(), delta ? base.blockSize : DeltaEngine::blockSize( size ), *signature );
+    }
 
-#if USE_GROWL
-                            std::auto_ptr<Growl> growl( new Growl(GROWL_TCP,0,APPNAME,(const char **const)notifications,COUNT(notifications)));
+    RateLimiter::Class cls = trafficClass( *job );
 
-                            if ( Poco::Util::Application::instance().config().getString( CONFIG_GROWL_ICON, "").empty() == false ) {
+    if ( delta ) {
 
-                                Poco::Path iconPath( Poco::Util::Application::instance().config().getString("application.dir") + Poco::Path::separator() );
+        Agent::Delta instructions;
 
-                                iconPath.append( Poco::Util::Application::instance().config().getString( CONFIG_GROWL_ICON) );
+        Poco::UInt64 literal = DeltaEngine::delta( base, *signature, data.data(), data.size(), instructions );
 
-                                growl->Notify("sync",
-                                        msg->path().c_str(),
-                                        Poco::format("Updated File\n  %s", msg->path()).c_str(), 
-                                        "http://whitequeen.gitlab.io/srcsync",
-                                        iconPath.toString().c_str() );
-                            }
-                            else {
-                                growl->Notify("sync",
-                                        msg->path().c_str(),
-                                        Poco::format("Updated File\n  %s", msg->path()).c_str() );
-                            }
-#endif
-                        }
-                        else {
-                            logger_.error( Poco::format("%s: Failed updating %s", name_, localPath) );
-#if USE_GROWL
-                            std::auto_ptr<Growl> growl( new Growl(GROWL_TCP,0,APPNAME,(const char **const)notifications,COUNT(notifications)));
-
-                            if ( Poco::Util::Application::instance().config().getString( CONFIG_GROWL_ICON, "").empty() == false ) {
-
-                                Poco::Path iconPath( Poco::Util::Application::instance().config().getString("application.dir") + Poco::Path::separator() );
-
-                                iconPath.append( Poco::Util::Application::instance().config().getString( CONFIG_GROWL_ICON) );
-
-                                growl->Notify("sync",
-                                        msg->path().c_str(),
-                                        Poco::format("Failed to update\n  %s", msg->path()).c_str(),
-                                        "http://whitequeen.gitlab.io/srcsync",
-                                        iconPath.toString().c_str() );
-                            }
-                            else {
-                                growl->Notify("sync",
-                                        msg->path().c_str(),
-                                        Poco::format("Failed to update\n  %s", msg->path()).c_str());
-                            }
-#endif
-                        }
-                    }
+        if ( literal <= agentMaxSize ) {
 
-                }
+            LOG_DEBUG( logger_, Poco::format("%s: sending %s to %s as a delta, %Lu of %Lu bytes", name_, localPath, destination.remote().toString(), literal, size ) );
 
-            }
-            else if ( req->type() == MSG_DIR_SYNC ) { 
+            owner_->bandwidth().admit( cls, literal, new AgentTicket( client, path, instructions, st.st_mode & 07777, st.st_mtime, new AgentTransfer( *this, job, signature, true ) ) );
+
+            return true;
+        }
+    }
 
-                DirSyncMessage *msg = dynamic_cast<DirSyncMessage *>( n.get() );
+    // rsync makes its own delta, the new signature goes with it
+    if ( size > agentMaxSize ) {
 
-                if ( msg ) {
+        return false;
+    }
 
-                    std::string localPath = msg->path();
+    LOG_DEBUG( logger_, Poco::format("%s: sending %s to %s with the agent", name_, localPath, destination.remote().toString() ) );
 
-                    bool ignoreThisFile = false;
+    owner_->bandwidth().admit( cls, size, new AgentTicket( client, path, data, st.st_mode & 07777, st.st_mtime, new AgentTransfer( *this, job, signature, false ) ) );
 
-                    if ( ignore_.size() > 0 ) {
+    return true;
+}
 
-                        for ( std::vector<Poco::Glob *>::iterator it = ignore_.begin(); it != ignore_.end() ; it++ ) {
+void RsyncWorker::keep( Destination &destination, const std::string &path, const Signature *signature )
+{
+    try {
 
-                            if ( (*it)->match( localPath ) ) {
+        if ( signature ) {
 
-                                ignoreThisFile = true;
+            destination.signatures().put( path, *signature );
+        }
+        else {
 
-                                break;
-                            }
-                        }
-                    }
+            destination.signatures().remove( path );
+        }
+    }
+    catch ( Poco::Exception &ex ) {
 
-                    if ( ignoreThisFile ) {
-                        logger_.notice( Poco::format("%s: Ignoring %s", name_, localPath) );
-                    }
-                    else {
-                        std::string remotePath = remote_->getHost() + ":" + remote_->getPath();
+        logger_.warning( Poco::format("%s: %s", name_, ex.displayText() ) );
+    }
+}
 
-                        remotePath += msg->path();
+bool RsyncWorker::sendMetadata( const Mapping &mapping, Destination &destination, SyncJob *job )
+{
+    Jobs &jobs = metadata_[ std::make_pair( mapping.id(), destination.id() ) ];
 
-                        localPath = local_.toString() + msg->path();
-                        
-                        logger_.debug( Poco::format("%s: syncing dir %s to %s", name_, localPath, remotePath ) );
+    jobs.push_back( Poco::AutoPtr<SyncJob>( job, true ) );
 
-                        bool st = runRsync ( localPath, remotePath );
+    if ( jobs.size() >= METADATA_BATCH ) {
 
-                        if ( st ) {
-                            logger_.notice( Poco::format("%s: Updated %s", name_, localPath) );
-#if USE_GROWL
-                            if ( Poco::Util::Application::instance().config().getBool( CONFIG_GROWL_UPDATE_DIR , false ) ) {
+        startMetadata( mapping, destination, jobs );
+    }
 
-                                std::auto_ptr<Growl> growl( new Growl(GROWL_TCP,0,APPNAME,(const char **const)notifications,COUNT(notifications)));
+    return true;
+}
 
-                                if ( Poco::Util::Application::instance().config().getString( CONFIG_GROWL_ICON, "").empty() == false ) {
+void RsyncWorker::flushMetadata()
+{
+    for ( std::map<std::pair<int, int>, Jobs>::iterator it = metadata_.begin(); it != metadata_.end(); it++ ) {
 
-                                    Poco::Path iconPath( Poco::Util::Application::instance().config().getString("application.dir") + Poco::Path::separator() );
+        if ( it->second.empty() == false ) {
 
-                                    iconPath.append( Poco::Util::Application::instance().config().getString( CONFIG_GROWL_ICON) );
+            Mapping &mapping = *thisApp->mapping( it->first.first );
 
-                                    growl->Notify("sync",
-                                            msg->path().c_str(),
-                                            Poco::format("Updated Directory\n  %s", msg->path()).c_str(), 
-                                            "http://whitequeen.gitlab.io/srcsync",
-                                            iconPath.toString().c_str() );
-                                }
-                                else {
-                                    growl->Notify("sync",
-                                            localPath.c_str(),
-                                            Poco::format("Updated Directory\n  %s", localPath).c_str());
-                                }
-                            }
-#endif
-                        }
-                        else {
-                            logger_.error( Poco::format("%s: Failed updating %s", name_, localPath) );
+            startMetadata( mapping, mapping.destination( it->first.second ), it->second );
+        }
+    }
+}
 
-#if USE_GROWL
-                            std::auto_ptr<Growl> growl( new Growl(GROWL_TCP,0, APPNAME,(const char **const)notifications,COUNT(notifications)));
+void RsyncWorker::startMetadata( const Mapping &mapping, Destination &destination, Jobs &jobs )
+{
+    Jobs batch;
 
-                            if ( Poco::Util::Application::instance().config().getBool( CONFIG_GROWL_UPDATE_DIR , false ) ) {
+    batch.swap( jobs );
 
-                                if ( Poco::Util::Application::instance().config().getString( CONFIG_GROWL_ICON, "").empty() == false ) {
+    LOG_DEBUG( logger_, Poco::format("%s: updating the times and modes of %z file(s) on %s", name_, batch.size(), destination.remote().toString() ) );
 
-                                    Poco::Path iconPath( Poco::Util::Application::instance().config().getString("application.dir") + Poco::Path::separator() );
+    Poco::SharedPtr<AgentClient> client = agent( mapping, destination );
 
-                                    iconPath.append( Poco::Util::Application::instance().config().getString( CONFIG_GROWL_ICON) );
+    std::string command;
+    Jobs scripted;
 
-                                    growl->Notify("sync",
-                                            msg->path().c_str(), // "Failed", 
-                                            Poco::format("Failed to update directory\n  %s", msg->path()).c_str(),
-                                            "http://whitequeen.gitlab.io/srcsync",
-                                            iconPath.toString().c_str() );
-                                }
-                                else {
-                                    growl->Notify("sync",
-                                            localPath.c_str(), // "Failed", 
-                                            Poco::format("Failed to update\n  %s", localPath).c_str());
-                                }
-                            }
-#endif
-                        }
-                    }
-                }
+    for ( Jobs::iterator it = batch.begin(); it != batch.end(); it++ ) {
 
-            }
-            else {
+        SyncJob *job = *it;
 
-                logger_.error("Unknown notification message type '" + req->type() + "'");
+        const std::string &path = job->path();
 
-            }
+        struct stat st;
 
-            thisApp->jobEnd();
+        if ( ::lstat( ( mapping.local().toString() + path ).c_str(), &st ) != 0 ) {
 
-            logger_.information( Poco::format("%s: %d task(s) remain to processed", name_, thisApp->jobCount() ) );
+            // removed since, its delete is queued
+            metadataSynced( mapping, destination, *job, false );
+            continue;
         }
 
+        if ( client.isNull() == false ) {
 
-        n = queue_->waitDequeueNotification();
-    }
+            // each is a frame of its own, all of them go before the first answer
+            client->metadata( path, st.st_mode & 07777, st.st_mtime, new MetadataTransfer( *this, job ) );
+            continue;
+        }
 
+        // touch -t is POSIX (-d @epoch is GNU only), given in UTC so the
+        // remote's time zone does not matter. ./ keeps a name starting
+        // with - from being taken as an option, and each file is updated
+        // on its own so one that fails is all that has to be sent
+        std::string file = quote( "./" + path );
+
+        struct tm utc;
+        char stamp[32];
+
+        ::gmtime_r( &st.st_mtime, &utc );
+        ::strftime( stamp, sizeof(stamp), "%Y%m%d%H%M.%S", &utc );
+
+        command += Poco::format( "chmod %o %s && TZ=UTC0 touch -m -t %s %s || echo " METADATA_FAILED "%z; ", (unsigned) ( st.st_mode & 07777 ), file, std::string( stamp ), file, scripted.size() );
+
+        scripted.push_back( *it );
+    }
+
+    if ( scripted.empty() ) {
+
+        return;
+    }
+
+    std::string output;
+
+    std::vector<bool> failed( scripted.size(), true );
+
+    // one remote shell for the lot, a lost connection fails them all
+    if ( runRemote( mapping, destination, "( " + command + ")", &output ) ) {
+
+        failed.assign( scripted.size(), false );
+
+        std::istringstream lines( output );
+        std::string line;
+
+        while ( std::getline( lines, line ) ) {
+
+            if ( line.compare( 0, sizeof(METADATA_FAILED) - 1, METADATA_FAILED ) != 0 ) {
+
+                continue;
+            }
+
+            size_t index = std::strtoul( line.c_str() + sizeof(METADATA_FAILED) - 1, NULL, 10 );
+
+            if ( index < failed.size() ) {
+
+                failed[ index ] = true;
+            }
+        }
+    }
+
+    size_t count = std::count( failed.begin(), failed.end(), true );
+
+    if ( count ) {
+
+        LOG_DEBUG( logger_, Poco::format("%s: could not update them in place, sending %z file(s) to %s", name_, count, destination.remote().toString() ) );
+    }
+
+    for ( size_t i = 0; i < scripted.size(); i++ ) {
+
+        SyncJob *job = scripted[ i ];
+
+        if ( failed[ i ] == false ) {
+
+            metadataSynced( mapping, destination, *job, true );
+            continue;
+        }
+
+        startRsync( mapping, destination, job, mapping.local().toString() + job->path(), destination.remote().getHost() + ":" + destination.remote().getPath() + job->path() );
+    }
 }
 
+void RsyncWorker::metadataSynced( const Mapping &mapping, Destination &destination, const SyncJob &job, bool success )
+{
+    std::string localPath = mapping.local().toString() + job.path();
+
+    if ( success ) {
+
+        LOG_INFORMATION( logger_, Poco::format("%s: Updated the time and mode of %s", name_, localPath) );
+
+        destination.synced();
+
+        // only once the contents were seen to be the same; a touch
+        // taken on the monitor's word leaves the manifest behind, so
+        // a write of the same size racing it is still sent
+        if ( job.hash() != 0 ) {
+
+            destination.manifest().touched( job.path(), settled( job ) );
+        }
+    }
+    else {
+
+        logger_.error( Poco::format("%s: Failed updating the time and mode of %s", name_, localPath) );
+
+        destination.failed();
+    }
+
+    completed( mapping, destination, job, success );
+    jobEnd( job );
+}
+
+bool RsyncWorker::removeRemote( const Mapping &mapping, const Destination &destination, const std::vector<std::string> &paths )
+{
+    Poco::SharedPtr<AgentClient> client = agent( mapping, destination );
+
+    if ( client.isNull() ) {
+
+        return SyncWorker::removeRemote( mapping, destination, paths );
+    }
+
+    AgentClient::Batch batch;
+
+    // all of them are sent before the first answer comes back
+    for ( std::vector<std::string>::const_iterator it = paths.begin(); it != paths.end(); it++ ) {
+
+        client->unlink( *it, batch.add() );
+    }
+
+    if ( batch.wait() == false ) {
+
+        logError( "agent: " + batch.error() );
+        return false;
+    }
+
+    return true;
+}
+
+void RsyncWorker::logOutput( const std::string &line )
+{
+    // no point building messages nobody sees
+    if ( logger_.information() ) {
+
+        logger_.information( Poco::format("%s: rsync: %s", name_, line ) );
+    }
+}
+
+void RsyncWorker::logError( const std::string &line )
+{
+    logger_.error( Poco::format("%s: rsync: %s", name_, line ) );
+}
+
+void RsyncWorker::syncFile( const Mapping &mapping, Destination &destination, SyncJob *job )
+{
+    const std::string &path = job->path();
+
+    std::string localPath = mapping.local().toString() + path;
+
+    std::string remotePath = destination.remote().getHost() + ":" + destination.remote().getPath();
+
+    remotePath += path;
+
+    Change change = classify( mapping, destination, *job );
+
+    if ( change == UNCHANGED ) {
+
+        LOG_DEBUG( logger_, Poco::format("%s: %s is unchanged on %s", name_, localPath, destination.remote().toString() ) );
+
+        destination.unchanged();
+
+        completed( mapping, destination, *job, true );
+        jobEnd( *job );
+        return;
+    }
+
+    // a touch, a chmod, or the same bytes as last sent (a formatter, a
+    // checkout of the same commit) - batched, without the contents
+    if ( change != CONTENT ) {
+
+        LOG_DEBUG( logger_, Poco::format("%s: only the %s of %s changed", name_, std::string( change == TIMESTAMP ? "time" : "mode" ), localPath ) );
+
+        if ( sendMetadata( mapping, destination, job ) ) {
+
+            return;
+        }
+    }
+
+    Poco::SharedPtr<Signature> signature;
+
+    // each write is one frame on the agent's connection, sent without
+    // waiting for the last, so a burst needs no packing
+    if ( agentCommand_.empty() == false && sendFile( mapping, destination, job, signature ) ) {
+
+        return;
+    }
+
+    Poco::UInt64 packSize = Settings::current()->packSize();
+
+    if ( packing_ && packSize > 0 ) {
+
+        Poco::File f( localPath );
+
+        try {
+
+            // waits for the rest of its burst, see run()
+            if ( f.isFile() && f.getSize() <= packSize ) {
+
+                pack( mapping, destination, job );
+                return;
+            }
+        }
+        catch ( Poco::Exception & ) {
+
+            // gone already, rsync reports it
+        }
+    }
+
+    LOG_DEBUG( logger_, Poco::format("%s: syncing file %s to %s", name_, localPath, remotePath ) );
+
+    startRsync( mapping, destination, job, localPath, remotePath, signature );
+}
+
+void RsyncWorker::pack( const Mapping &mapping, Destination &destination, SyncJob *job )
+{
+    Jobs &jobs = packs_[ std::make_pair( mapping.id(), destination.id() ) ];
+
+    jobs.push_back( Poco::AutoPtr<SyncJob>( job, true ) );
+
+    if ( jobs.size() >= Settings::current()->packCount() ) {
+
+        startPack( mapping, destination, jobs, false );
+    }
+}
+
+void RsyncWorker::flushPacks()
+{
+    for ( std::map<std::pair<int, int>, Jobs>::iterator it = packs_.begin(); it != packs_.end(); it++ ) {
+
+        Jobs &jobs = it->second;
+
+        if ( jobs.empty() ) {
+
+            continue;
+        }
+
+        Mapping &mapping = *thisApp->mapping( it->first.first );
+        Destination &destination = mapping.destination( it->first.second );
+
+        if ( jobs.size() > 1 ) {
+
+            startPack( mapping, destination, jobs, false );
+            continue;
+        }
+
+        // a single save is as quick with rsync, and gets its delta
+        SyncJob *job = jobs.front();
+
+        std::string localPath = mapping.local().toString() + job->path();
+        std::string remotePath = destination.remote().getHost() + ":" + destination.remote().getPath() + job->path();
+
+        LOG_DEBUG( logger_, Poco::format("%s: syncing file %s to %s", name_, localPath, remotePath ) );
+
+        startRsync( mapping, destination, job, localPath, remotePath );
+
+        jobs.clear();
+    }
+}
+
+void RsyncWorker::startPack( const Mapping &mapping, Destination &destination, Jobs &jobs, bool bootstrap )
+{
+    Poco::SharedPtr<Poco::TemporaryFile> list( new Poco::TemporaryFile );
+    Poco::Int64 bytes = 0;
+    size_t count = 0;
+
+    {
+        std::ofstream out( list->path().c_str(), std::ios::binary );
+
+        if ( bootstrap ) {
+
+            const std::string &path = jobs.front()->path();
+
+            DirectoryScanner scanner( mapping.local().toString(), &mapping );
+            Manifest local;
+
+            scanner.scan( local, path == "." ? "" : path );
+
+            // directories are listed too (tar does not recurse) so empty ones arrive
+            for ( size_t i = 0; i < local.size(); i++ ) {
+
+                out << local.path( i ) << '\0';
+
+                bytes += local.entry( i ).size;
+            }
+
+            count = local.size();
+        }
+        else {
+
+            for ( Jobs::const_iterator it = jobs.begin(); it != jobs.end(); it++ ) {
+
+                out << (*it)->path() << '\0';
+
+                try {
+
+                    bytes += Poco::File( mapping.local().toString() + (*it)->path() ).getSize();
+                }
+                catch ( Poco::Exception & ) {
+
+                    // removed since, tar skips it
+                }
+            }
+
+            count = jobs.size();
+        }
+
+        if ( out.fail() ) {
+
+            logger_.error( Poco::format("%s: can not write %s", name_, list->path() ) );
+
+            packSynced( mapping, destination, jobs, bootstrap, false );
+            jobs.clear();
+            return;
+        }
+    }
+
+    const Poco::URI &remote = destination.remote();
+
+    std::string unpack = "mkdir -p " + quote( remote.getPath() ) + " && cd " + quote( remote.getPath() ) + " && tar -xzpf -";
+
+    Poco::SharedPtr<Poco::TemporaryFile> index( new Poco::TemporaryFile );
+    Poco::SharedPtr<Poco::TemporaryFile> packed( new Poco::TemporaryFile );
+
+    // sh gives the pipeline the remote tar's status only, a local one
+    // that skipped an unreadable file still sends a valid archive. Its
+    // status and the members it wrote are kept apart.
+    std::string command = "{ tar -czf - -C " + quote( mapping.local().toString() ) + " --no-recursion --null -T " + quote( list->path() ) +
+        " --verbose --quoting-style=literal --index-file=" + quote( index->path() ) + "; echo $? > " + quote( packed->path() ) + "; } | ";
+
+    if ( remote.getScheme() == "ssh" ) {
+
+        Poco::Process::Args sshArgv;
+
+        sshArgs( mapping, destination, sshArgv );
+
+        command += "ssh";
+
+        for ( Poco::Process::Args::const_iterator it = sshArgv.begin(); it != sshArgv.end(); it++ ) {
+
+            command += " " + quote( *it );
+        }
+
+        command += " " + quote( remote.getHost() ) + " " + quote( unpack );
+    }
+    else {
+
+        command += "( " + unpack + " )";
+    }
+
+    LOG_DEBUG( logger_, Poco::format("%s: packing %z path(s) for %s: %s", name_, count, remote.toString(), command ) );
+
+    // nothing is run in a dry run
+    if ( Settings::current()->dryRun() ) {
+
+        packSynced( mapping, destination, jobs, bootstrap, false );
+        jobs.clear();
+        return;
+    }
+
+    Poco::Process::Args args;
+
+    args.push_back( "-c" );
+    args.push_back( command );
+
+    // the pipeline can not be given a --bwlimit; the archive is
+    // compressed, what it reserves is the most it can send
+    RateLimiter::Class cls = trafficClass( *jobs.front() );
+
+    owner_->bandwidth().admit( cls, bytes, new SpawnTicket( owner_->transfers(), "sh", args, new PackTransfer( *this, mapping.id(), destination.id(), jobs, bootstrap, list, index, packed ) ) );
+}
+
+void RsyncWorker::fileSynced( const Mapping &mapping, Destination &destination, const SyncJob &job, bool st )
+{
+    const std::string &path = job.path();
+
+    std::string localPath = mapping.local().toString() + path;
+
+    if ( st ) {
+        logger_.notice( Poco::format("%s: Updated %s", name_, localPath) );
+
+        destination.synced();
+        transferred( mapping, destination, job );
+
+        if ( thisApp->notifier() ) {
+
+            thisApp->notifier()->updated( path, false );
+        }
+    }
+    else {
+        logger_.error( Poco::format("%s: Failed updating %s", name_, localPath) );
+
+        destination.failed();
+
+        if ( thisApp->notifier() ) {
+
+            thisApp->notifier()->failed( path, false );
+        }
+    }
+
+}
+
+void RsyncWorker::syncDir( const Mapping &mapping, Destination &destination, SyncJob *job )
+{
+    const std::string &path = job->path();
+
+    std::string localPath = mapping.local().toString() + path;
+
+    std::string remotePath = destination.remote().getHost() + ":" + destination.remote().getPath();
+
+    remotePath += path;
+
+    // nothing there yet so there is no delta to gain, the whole tree
+    // goes as one archive
+    if ( packing_ && Settings::current()->packSize() > 0 && destination.manifest().seeded() && destination.manifest().size() == 0 ) {
+
+        LOG_DEBUG( logger_, Poco::format("%s: %s is empty, packing %s", name_, destination.remote().toString(), localPath ) );
+
+        Jobs jobs( 1, Poco::AutoPtr<SyncJob>( job, true ) );
+
+        startPack( mapping, destination, jobs, true );
+        return;
+    }
+
+    LOG_DEBUG( logger_, Poco::format("%s: syncing dir %s to %s", name_, localPath, remotePath ) );
+
+    startRsync( mapping, destination, job, localPath, remotePath );
+}
+
+void RsyncWorker::dirSynced( const Mapping &mapping, Destination &destination, const SyncJob &job, bool st )
+{
+    const std::string &path = job.path();
+
+    std::string localPath = mapping.local().toString() + path;
+
+    if ( st ) {
+        logger_.notice( Poco::format("%s: Updated %s", name_, localPath) );
+
+        destination.synced();
+        transferred( mapping, destination, job );
+
+        if ( thisApp->notifier() && Settings::current()->growlUpdateDir() ) {
+
+            thisApp->notifier()->updated( path, true );
+        }
+    }
+    else {
+        logger_.error( Poco::format("%s: Failed updating %s", name_, localPath) );
+
+        destination.failed();
+
+        if ( thisApp->notifier() && Settings::current()->growlUpdateDir() ) {
+
+            thisApp->notifier()->failed( path, true );
+        }
+    }
+
+}
+
+void RsyncWorker::synced( const Mapping &mapping, Destination &destination, const SyncJob &job, bool success )
+{
+    if ( job.kind() == SyncJob::DIR_SYNC ) {
+
+        dirSynced( mapping, destination, job, success );
+    }
+    else {
+
+        fileSynced( mapping, destination, job, success );
+    }
+
+    completed( mapping, destination, job, success );
+    jobEnd( job );
+}
+
+void RsyncWorker::packSynced( const Mapping &mapping, Destination &destination, const Jobs &jobs, bool bootstrap, bool success, const std::set<std::string> *archived )
+{
+    if ( bootstrap ) {
+
+        synced( mapping, destination, *jobs.front(), success );
+        return;
+    }
+
+    size_t updated = 0;
+
+    for ( Jobs::const_iterator it = jobs.begin(); it != jobs.end() && success; it++ ) {
+
+        if ( archived == NULL || archived->count( (*it)->path() ) ) {
+
+            updated++;
+        }
+    }
+
+    if ( updated ) {
+
+        logger_.notice( Poco::format("%s: Updated %z file(s) in %s as one archive", name_, updated, mapping.local().toString() ) );
+    }
+
+    if ( updated < jobs.size() ) {
+
+        logger_.error( Poco::format("%s: Failed updating %z packed file(s) in %s", name_, jobs.size() - updated, mapping.local().toString() ) );
+    }
+
+    for ( Jobs::const_iterator it = jobs.begin(); it != jobs.end(); it++ ) {
+
+        const SyncJob &job = **it;
+
+        bool sent = success && ( archived == NULL || archived->count( job.path() ) );
+
+        if ( sent ) {
+
+            destination.synced();
+            transferred( mapping, destination, job );
+        }
+        else {
+
+            destination.failed();
+        }
+
+        completed( mapping, destination, job, sent );
+        jobEnd( job );
+    }
+}
+
+void RsyncWorker::jobEnd( const SyncJob &job )
+{
+    owner_->finished( job );
+    owner_->jobEnd();
+    thisApp->jobEnd();
+
+    TRACE_INSTANT( "complete", "worker", job.pathId() );
+
+    LOG_INFORMATION( logger_, Poco::format("%s: %d task(s) remain to be processed for %s", name_, owner_->pending(), owner_->name() ) );
+}
+
+void RsyncWorker::run()
+{
+    FUNCTIONTRACE;
+
+    seedManifests();
+
+    Poco::AutoPtr<SyncJob> job( next() );
+
+    while ( job ) {
+
+        TRACE_SCOPE_PATH( "dispatch", "worker", job->pathId() );
+
+        thisApp->jobStart();
+        owner_->jobStart();
+
+        Mapping &mapping = *thisApp->mapping( job->mapping() );
+        Destination &destination = mapping.destination( job->destination() );
+
+        LOG_DEBUG( logger_, Poco::format("%s: Received %s job for %s:%s, queued %Ldms ago", name_, std::string( job->kindName() ), mapping.name(), job->path(), job->waited() / 1000 ) );
+
+        if ( job->kind() != SyncJob::DELETE_SYNC ) {
+
+            begin( mapping, *job );
+        }
+
+        // transfers only start here, they end on the TransferEngine's
+        // completion thread, so the worker moves straight on
+        switch ( job->kind() ) {
+
+            case SyncJob::FILE_SYNC:
+                syncFile( mapping, destination, job.get() );
+                break;
+
+            case SyncJob::DIR_SYNC:
+                if ( job->flags() & SyncJob::RECONCILE ) {
+
+                    verifyManifest( mapping, destination );
+                }
+
+                syncDir( mapping, destination, job.get() );
+                break;
+
+            case SyncJob::DELETE_SYNC:
+                syncDeletes( mapping, destination );
+                jobEnd( *job );
+                break;
+        }
+
+        // small files are packed for as long as more jobs are waiting,
+        // the packs go once the burst has been taken
+        job = poll();
+
+        if ( job.isNull() ) {
+
+            flushPacks();
+            flushMetadata();
+
+            job = next();
+        }
+    }
+
+    flushPacks();
+    flushMetadata();
+
+}
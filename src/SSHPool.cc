@@ -0,0 +1,274 @@
+/**
+ * \file SSHPool.cc
+ *
+ * \brief - Authenticated SSH sessions to one host, shared by its workers
+ *
+ */
+
+#include <vector>
+#include <algorithm>
+
+#include "Poco/Thread.h"
+#include "Poco/Format.h"
+#include "Poco/Exception.h"
+
+#include "SourceSync.h"
+#include "Mapping.h"
+#include "SSHPool.h"
+
+// milliseconds
+#define SSH_BACKOFF_MIN 1000
+#define SSH_BACKOFF_MAX 60000
+
+SSHPool::SSHPool( const std::string &name, long idle, long keepalive ) :
+    name_(name),
+    lent_(0),
+    idleTimeout_( (Poco::Timestamp::TimeDiff) idle * 1000000 ),
+    keepalive_( (Poco::Timestamp::TimeDiff) keepalive * 1000000 ),
+    backoff_(0),
+    timer_( keepalive * 1000, keepalive * 1000 ),
+    logger_(Poco::Logger::get("SSHPool"))
+{
+    if ( keepalive > 0 ) {
+
+        timer_.start( Poco::TimerCallback<SSHPool>( *this, &SSHPool::onHousekeeping ) );
+    }
+}
+
+SSHPool::~SSHPool()
+{
+    timer_.stop();
+
+    for ( std::deque<Idle>::iterator it = idle_.begin(); it != idle_.end(); it++ ) {
+
+        delete it->sshio;
+    }
+}
+
+rsync::SSHIO *SSHPool::borrow( const Mapping &mapping, const Destination &destination )
+{
+    Poco::Timestamp::TimeDiff wait = 0;
+
+    {
+        Poco::FastMutex::ScopedLock lock( mutex_ );
+
+        while ( idle_.empty() == false ) {
+
+            rsync::SSHIO *sshio = idle_.back().sshio;
+
+            idle_.pop_back();
+
+            if ( sshio->isConnected() ) {
+
+                lent_++;
+                return sshio;
+            }
+
+            delete sshio;
+        }
+
+        if ( backoff_ > 0 ) {
+
+            wait = retry_ - Poco::Timestamp();
+        }
+    }
+
+    // the others are connecting in parallel, only this one waits
+    if ( wait > 0 ) {
+
+        Poco::Thread::sleep( (long) ( wait / 1000 ) );
+    }
+
+    return connect( mapping, destination );
+}
+
+rsync::SSHIO *SSHPool::connect( const Mapping &mapping, const Destination &destination )
+{
+    const char *passC = NULL;
+    const char *keyC = NULL;
+
+    // a reload may replace the mapping's key file meanwhile
+    std::string privateKey( mapping.privateKey() );
+
+    if ( destination.password().empty() == false ) {
+
+        passC = destination.password().c_str();
+    }
+    else if ( privateKey.empty() == false ) {
+
+        keyC = privateKey.c_str();
+    }
+
+    if ( keyC ) {
+        LOG_DEBUG( logger_, Poco::format("%s: connecting as %s to %s using keyfile %s", name_, destination.user(), destination.remote().getHost(), privateKey ) );
+    }
+    else {
+        LOG_DEBUG( logger_, Poco::format("%s: connecting as %s to %s using a password", name_, destination.user(), destination.remote().getHost() ) );
+    }
+
+    rsync::SSHIO *sshio = new rsync::SSHIO;
+
+    try {
+
+        sshio->connect(
+                destination.remote().getHost().c_str(),
+                destination.remote().getPort(),
+                destination.user().c_str(),
+                passC,
+                keyC,
+                NULL);
+    }
+    catch ( Poco::Exception & ) {
+
+        delete sshio;
+
+        failed();
+        throw;
+    }
+
+    if ( sshio->isConnected() == false ) {
+
+        delete sshio;
+
+        failed();
+        throw Poco::IOException( "Can not connect", name_ );
+    }
+
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    backoff_ = 0;
+    lent_++;
+
+    LOG_DEBUG( logger_, Poco::format("%s: %z session(s) open", name_, lent_ + idle_.size() ) );
+
+    return sshio;
+}
+
+void SSHPool::failed()
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    backoff_ = backoff_ == 0 ? SSH_BACKOFF_MIN : std::min( backoff_ * 2, (long) SSH_BACKOFF_MAX );
+
+    retry_ = Poco::Timestamp() + (Poco::Timestamp::TimeDiff) backoff_ * 1000;
+
+    logger_.warning( Poco::format("%s: connection failed, retrying in %lds", name_, backoff_ / 1000 ) );
+}
+
+void SSHPool::giveBack( rsync::SSHIO *sshio )
+{
+    if ( sshio == NULL ) {
+
+        return;
+    }
+
+    bool connected = sshio->isConnected();
+
+    {
+        Poco::FastMutex::ScopedLock lock( mutex_ );
+
+        lent_--;
+
+        if ( connected ) {
+
+            Idle i;
+
+            i.sshio = sshio;
+
+            idle_.push_back( i );
+            return;
+        }
+    }
+
+    delete sshio;
+}
+
+size_t SSHPool::size()
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    return lent_ + idle_.size();
+}
+
+bool SSHPool::alive( rsync::SSHIO *sshio )
+{
+    try {
+
+        int cancel = 0;
+
+        sshio->createChannel( "true", &cancel );
+
+        char buffer[64];
+
+        while ( sshio->read( buffer, sizeof(buffer) ) > 0 ) {
+        }
+
+        sshio->closeChannel();
+
+        return sshio->isConnected();
+    }
+    catch ( Poco::Exception & ) {
+
+        return false;
+    }
+}
+
+void SSHPool::onHousekeeping( Poco::Timer &timer )
+{
+    std::vector<rsync::SSHIO *> expired;
+    std::vector<Idle> check;
+
+    {
+        Poco::FastMutex::ScopedLock lock( mutex_ );
+
+        std::deque<Idle>::iterator it = idle_.begin();
+
+        // nobody can borrow what is being checked
+        while ( it != idle_.end() ) {
+
+            if ( it->since.isElapsed( idleTimeout_ ) ) {
+
+                expired.push_back( it->sshio );
+                it = idle_.erase( it );
+            }
+            else if ( it->checked.isElapsed( keepalive_ ) ) {
+
+                check.push_back( *it );
+                it = idle_.erase( it );
+            }
+            else {
+
+                it++;
+            }
+        }
+    }
+
+    // disconnecting and the keepalives wait on the network, not under the lock
+    for ( std::vector<rsync::SSHIO *>::iterator it = expired.begin(); it != expired.end(); it++ ) {
+
+        delete *it;
+    }
+
+    for ( std::vector<Idle>::iterator it = check.begin(); it != check.end(); it++ ) {
+
+        if ( alive( it->sshio ) == false ) {
+
+            logger_.warning( Poco::format("%s: idle session dropped, it will be reconnected when needed", name_ ) );
+
+            delete it->sshio;
+            continue;
+        }
+
+        it->checked.update();
+
+        Poco::FastMutex::ScopedLock lock( mutex_ );
+
+        // they have been idle longest
+        idle_.push_front( *it );
+    }
+
+    if ( expired.empty() == false ) {
+
+        LOG_DEBUG( logger_, Poco::format("%s: closed %z idle session(s)", name_, expired.size() ) );
+    }
+}
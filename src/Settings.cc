@@ -0,0 +1,98 @@
+/**
+ * \file Settings.cc
+ *
+ * \brief - The settings the workers use, as one snapshot that can be replaced
+ *
+ */
+
+#include <algorithm>
+
+#include "Poco/Path.h"
+#include "Poco/Util/Application.h"
+
+#include "Settings.h"
+#include "AgentProtocol.h"
+
+#include "config.h"
+
+// how long (microseconds) a replaced Settings is kept for whoever still
+// has it, and how many are kept at most
+#define SETTINGS_GRACE  ( (Poco::Timestamp::TimeDiff) 60 * 1000000 )
+#define SETTINGS_KEPT   16
+
+std::atomic<const Settings *> Settings::current_( NULL );
+
+Poco::FastMutex Settings::mutex_;
+std::deque<Settings::Generation> Settings::generations_;
+
+Settings::Settings( const Poco::Util::AbstractConfiguration &config )
+{
+    // --dry-run empties the flag
+    dryRun_ = config.getString( CONFIG_DRYRUN, "-false-" ).empty();
+    verbose_ = config.getInt( CONFIG_VERBOSE, 0 );
+
+    rateLimit_ = config.getInt( CONFIG_RATE_LIMIT, 0 );
+    rateInteractive_ = config.getInt( CONFIG_RATE_INTERACTIVE, 25 );
+
+    deleteBatch_ = std::max( config.getInt( CONFIG_QUEUE_DELETE_BATCH, 256 ), 1 );
+    hashMax_ = config.getInt( CONFIG_QUEUE_HASH_MAX, 64 * 1024 * 1024 );
+
+    packSize_ = config.getInt( CONFIG_RSYNC_PACK_SIZE, 8192 );
+    packCount_ = std::max( config.getInt( CONFIG_RSYNC_PACK_COUNT, 5000 ), 2 );
+    agentMaxSize_ = std::min( config.getInt( CONFIG_AGENT_MAX_SIZE, 4 * 1024 * 1024 ), (int) Agent::MAX_FRAME - 4096 );
+    agentDeltaMax_ = config.getInt( CONFIG_AGENT_DELTA_MAX, 256 * 1024 * 1024 );
+
+    rsyncProtocol_ = config.getInt( CONFIG_RSYNC_PROTOCOL_VERSION, 32 );
+    rsyncLogLevel_ = config.getInt( CONFIG_RSYNC_LOG_LEVEL, 3 );
+
+    if ( config.getString( CONFIG_GROWL_ICON, "" ).empty() == false ) {
+
+        Poco::Path iconPath( config.getString( "application.dir", "" ) + Poco::Path::separator() );
+
+        iconPath.append( config.getString( CONFIG_GROWL_ICON ) );
+
+        growlIcon_ = iconPath.toString();
+    }
+
+    growlUpdateDir_ = config.getBool( CONFIG_GROWL_UPDATE_DIR, false );
+}
+
+const Settings *Settings::current()
+{
+    const Settings *settings = current_.load( std::memory_order_acquire );
+
+    if ( settings ) {
+
+        return settings;
+    }
+
+    return reload();
+}
+
+const Settings *Settings::reload()
+{
+    // read outside the lock, jobs keep using the old settings meanwhile
+    Poco::SharedPtr<const Settings> settings( new Settings( Poco::Util::Application::instance().config() ) );
+
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    if ( generations_.empty() == false ) {
+
+        generations_.back().replaced.update();
+    }
+
+    Generation generation;
+
+    generation.settings = settings;
+
+    generations_.push_back( generation );
+
+    current_.store( settings.get(), std::memory_order_release );
+
+    while ( generations_.size() > 1 && ( generations_.size() > SETTINGS_KEPT + 1 || generations_.front().replaced.isElapsed( SETTINGS_GRACE ) ) ) {
+
+        generations_.pop_front();
+    }
+
+    return settings.get();
+}
@@ -0,0 +1,138 @@
+/**
+ * \file SignatureCache.cc
+ *
+ * \brief - The Signature of each file as it was last sent to a destination
+ *
+ */
+
+#include <fstream>
+
+#include "Poco/File.h"
+#include "Poco/Format.h"
+#include "Poco/Exception.h"
+
+#include "Checksum.h"
+#include "SignatureCache.h"
+
+#define SIGNATURE_MAGIC     0x53534947      // "SSIG"
+#define SIGNATURE_VERSION   1
+
+// precedes the path, then the weak and strong checksums
+struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t blockSize;
+    uint32_t count;
+    uint64_t size;
+    uint32_t pathLength;
+    uint32_t unused;
+};
+
+SignatureCache::SignatureCache( const std::string &dir ) : dir_(dir), created_(false)
+{
+    if ( dir_.empty() == false && dir_[ dir_.length() - 1 ] != '/' ) {
+
+        dir_ += '/';
+    }
+}
+
+std::string SignatureCache::file( const std::string &path ) const
+{
+    return dir_ + Poco::format( "%016Lx", (Poco::UInt64) Checksum::xxh64( path.data(), path.size() ) );
+}
+
+bool SignatureCache::get( const std::string &path, Signature &signature )
+{
+    std::ifstream in( file( path ).c_str(), std::ios::binary );
+
+    if ( !in ) {
+
+        return false;
+    }
+
+    Header header;
+
+    if ( !in.read( (char *) &header, sizeof(header) ) || header.magic != SIGNATURE_MAGIC || header.version != SIGNATURE_VERSION || header.pathLength != path.size() ) {
+
+        return false;
+    }
+
+    std::string stored( header.pathLength, '\0' );
+
+    // another path with the same hash
+    if ( !in.read( &stored[0], stored.size() ) || stored != path ) {
+
+        return false;
+    }
+
+    if ( header.blockSize == 0 || header.count != ( header.size + header.blockSize - 1 ) / header.blockSize ) {
+
+        return false;
+    }
+
+    signature.blockSize = header.blockSize;
+    signature.size = header.size;
+    signature.weak.resize( header.count );
+    signature.strong.resize( header.count );
+
+    if ( header.count > 0 ) {
+
+        in.read( (char *) &signature.weak[0], header.count * sizeof(uint32_t) );
+        in.read( (char *) &signature.strong[0], header.count * sizeof(uint64_t) );
+    }
+
+    return (bool) in;
+}
+
+void SignatureCache::put( const std::string &path, const Signature &signature )
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    if ( created_ == false ) {
+
+        Poco::File( dir_ ).createDirectories();
+        created_ = true;
+    }
+
+    std::string name( file( path ) );
+
+    // written aside then renamed, a crash never leaves half a signature
+    std::string tmp( name + ".tmp" );
+
+    {
+        std::ofstream out( tmp.c_str(), std::ios::binary | std::ios::trunc );
+
+        Header header = { SIGNATURE_MAGIC, SIGNATURE_VERSION, signature.blockSize, (uint32_t) signature.weak.size(), signature.size, (uint32_t) path.size(), 0 };
+
+        out.write( (const char *) &header, sizeof(header) );
+        out.write( path.data(), path.size() );
+
+        if ( signature.weak.empty() == false ) {
+
+            out.write( (const char *) &signature.weak[0], signature.weak.size() * sizeof(uint32_t) );
+            out.write( (const char *) &signature.strong[0], signature.strong.size() * sizeof(uint64_t) );
+        }
+
+        if ( !out ) {
+
+            throw Poco::WriteFileException( "Can not save signature", tmp );
+        }
+    }
+
+    Poco::File( tmp ).renameTo( name );
+}
+
+void SignatureCache::remove( const std::string &path )
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    try {
+
+        Poco::File( file( path ) ).remove();
+    }
+    catch ( Poco::Exception & ) {
+
+        // never kept, or already gone. One left behind only costs a
+        // refused delta.
+    }
+}
@@ -33,14 +33,17 @@
 #include <cstdlib>
 #include <cstring>
 #include <sstream>
+#include <algorithm>
+#include <set>
+#include <csignal>
 
-#include "Poco/NestedDiagnosticContext.h"
 
 #include "Poco/Util/ServerApplication.h"
 #include "Poco/Util/HelpFormatter.h"
 
 #include "Poco/NumberParser.h"
 #include "Poco/SharedPtr.h"
+#include "Poco/AutoPtr.h"
 
 #include "Poco/Logger.h"
 #include "Poco/Util/LoggingConfigurator.h"
@@ -59,11 +62,14 @@
 #include "Poco/NotificationQueue.h"
 
 #include <rsync/rsync_socketutil.h>
+#include <rsync/rsync_log.h>
 #include <libssh2.h>
 
 #include "config.h"
 
 #include "Queue.h"
+#include "RingChannel.h"
+#include "Settings.h"
 
 #ifdef USE_LIB_FSWATCH
 #include "FSWatchMonitorDirectory.h"
@@ -71,6 +77,7 @@
 #ifdef USE_POCO_DIRECTORY_WATCHER
 #include "PocoMonitorDirectory.h"
 #endif
+#include "PollMonitorDirectory.h"
 
 #include "SourceSync.h"
 
@@ -100,6 +107,9 @@ void SourceSync::initialize( Poco::Util::Application &self )
 
     Poco::File logConfigFile(logConfigPath);
 
+    // available to the .logger file as well as the defaults
+    RingChannel::registerChannel();
+
     if ( logConfigFile.exists() ) {
 
         Poco::AutoPtr<Poco::Util::PropertyFileConfiguration> logProperties = new Poco::Util::PropertyFileConfiguration(logConfigPath);
@@ -111,7 +121,10 @@ void SourceSync::initialize( Poco::Util::Application &self )
 
         logger().information( "Log configuration file '" + logConfigPath + "' not found, using defaults");
 
-        config().setString("logging.loggers.root.channel", "c1");
+        // console output is formatted and written on the ring's own thread
+        config().setString("logging.loggers.root.channel", "ring");
+        config().setString("logging.channels.ring.class", "RingChannel");
+        config().setString("logging.channels.ring.channel", "c1");
         config().setString("logging.formatters.f1.class", "PatternFormatter");
         config().setString("logging.formatters.f1.pattern", "%L%H:%M:%S [%q] %t"); // %L converts to local time
         config().setString("logging.channels.c1.class", "ConsoleChannel");
@@ -185,9 +198,9 @@ void SourceSync::defineOptions( Poco::Util::OptionSet &options )
             .binding( CONFIG_RSYNC_LOG_LEVEL ) );
 
 
-    // a profile is really a config file that is specific for a remote host...
+    // a profile is a config file that can define any number of mappings
     options.addOption(
-            Poco::Util::Option( "profile", "", "Load profile from FILE (not yet implmented)" )
+            Poco::Util::Option( "profile", "", "Load profile (source to destination mappings) from FILE" )
             .required( false )
             .repeatable( false )
             .argument( "FILE" )
@@ -215,7 +228,7 @@ void SourceSync::defineOptions( Poco::Util::OptionSet &options )
             .binding( CONFIG_SRC ) );
 
     options.addOption(
-            Poco::Util::Option( "dest", "d", "Mirror to URI ( destination )" )
+            Poco::Util::Option( "dest", "d", "Mirror to URI ( destination, space separated list for several )" )
             .required( false )
             .repeatable( false )
             .argument( "URI" )
@@ -254,6 +267,15 @@ void SourceSync::defineOptions( Poco::Util::OptionSet &options )
             .repeatable( false )
             .binding( CONFIG_DRYRUN ) );
 
+#ifdef USE_TRACE
+    options.addOption(
+            Poco::Util::Option( "trace", "", "Write a Chrome trace to FILE on exit and on SIGUSR1" )
+            .required( false )
+            .repeatable( false )
+            .argument( "FILE" )
+            .binding( CONFIG_TRACE ) );
+#endif
+
     config().setString( CONFIG_HELP, "-false-");
     config().setString( CONFIG_VERSION, "-false-");
     config().setString( CONFIG_SRC, "");
@@ -296,6 +318,415 @@ void SourceSync::handleVerbose(const std::string &name, const std::string &value
     logger().setLevel("", config().getInt( CONFIG_VERBOSE ));
 }
 
+void SourceSync::loadMappings()
+{
+    FUNCTIONTRACE;
+
+    std::string ignore = config().getString( CONFIG_IGNORE, "" );
+    std::string keyfile = config().getString( CONFIG_RSYNC_SSH_KEYFILE, "" );
+
+    // command line mapping is always first
+    if ( config().getString( CONFIG_SRC, "").empty() == false || config().getString( CONFIG_DEST, "").empty() == false ) {
+
+        if ( config().getString( CONFIG_SRC, "").empty() ) {
+
+            throw Poco::Exception( "No source argument specified" );
+        }
+        if ( config().getString( CONFIG_DEST, "").empty() ) {
+
+            throw Poco::Exception( "No destination argument specified" );
+        }
+
+        mappings_.push_back( new Mapping( mappings_.size(), "default", 
+                    config().getString( CONFIG_SRC ), 
+                    config().getString( CONFIG_DEST ),
+                    ignore,
+                    keyfile ) );
+    }
+
+    Poco::Util::AbstractConfiguration::Keys names;
+
+    config().keys( CONFIG_MAPPING, names );
+
+    for ( Poco::Util::AbstractConfiguration::Keys::iterator it = names.begin(); it != names.end(); it++ ) {
+
+        std::string prefix = std::string( CONFIG_MAPPING ) + "." + *it + ".";
+
+        std::string src = config().getString( prefix + CONFIG_MAPPING_SRC, "" );
+        std::string dest = config().getString( prefix + CONFIG_MAPPING_DEST, "" );
+
+        if ( src.empty() || dest.empty() ) {
+
+            throw Poco::Exception( Poco::format( "Mapping '%s' needs both %s and %s", *it, std::string(CONFIG_MAPPING_SRC), std::string(CONFIG_MAPPING_DEST) ) );
+        }
+
+        mappings_.push_back( new Mapping( mappings_.size(), *it, 
+                    src,
+                    dest,
+                    config().getString( prefix + CONFIG_MAPPING_IGNORE, ignore ),
+                    config().getString( prefix + CONFIG_MAPPING_KEYFILE, keyfile ) ) );
+    }
+
+    if ( mappings_.empty() ) {
+
+        throw Poco::Exception( "No source argument specified" );
+    }
+}
+
+void SourceSync::createQueues()
+{
+    FUNCTIONTRACE;
+
+    std::set<std::string> hosts;
+
+    for ( std::vector<Mapping *>::iterator it = mappings_.begin(); it != mappings_.end(); it++ ) {
+
+        const std::vector<Destination *> &destinations = (*it)->destinations();
+
+        for ( std::vector<Destination *>::const_iterator jt = destinations.begin(); jt != destinations.end(); jt++ ) {
+
+            hosts.insert( (*jt)->hostKey() );
+        }
+    }
+
+    int workers = hosts.size() * config().getInt( CONFIG_QUEUE_WORKER_COUNT, 8 );
+
+    // a single Thread Pool for every host's workers
+    pool_ = new Poco::ThreadPool(
+            config().getInt( CONFIG_QUEUE_MIN_THREADS, 2),
+            std::max( workers, config().getInt( CONFIG_QUEUE_MAX_THREADS, 64) ),
+            config().getInt( CONFIG_QUEUE_THREAD_IDLE, 120),
+            0
+            );
+
+    for ( std::vector<Mapping *>::iterator it = mappings_.begin(); it != mappings_.end(); it++ ) {
+
+        const std::vector<Destination *> &destinations = (*it)->destinations();
+
+        for ( std::vector<Destination *>::const_iterator jt = destinations.begin(); jt != destinations.end(); jt++ ) {
+
+            Queue *&queue = queues_[ (*jt)->hostKey() ];
+
+            if ( queue == NULL ) {
+
+                logger().debug( "Creating queue for " + (*jt)->hostKey() );
+
+                queue = new Queue( (*jt)->hostKey(), *pool_ );
+            }
+
+            (*jt)->setQueue( queue );
+        }
+    }
+}
+
+static volatile std::sig_atomic_t reloadRequested = 0;
+
+static void onReloadSignal( int )
+{
+    reloadRequested = 1;
+}
+
+void SourceSync::onSignals( Poco::Timer &timer )
+{
+    bool changed = false;
+
+    if ( config().getString( CONFIG_PROFILE, "" ).empty() == false ) {
+
+        try {
+
+            changed = ( Poco::File( config().getString( CONFIG_PROFILE ) ).getLastModified() != profileModified_ );
+        }
+        catch ( Poco::Exception & ) {
+
+            // being replaced, the next tick will see the new one
+        }
+    }
+
+    if ( reloadRequested || changed ) {
+
+        reloadRequested = 0;
+
+        reload();
+    }
+}
+
+// what a reload applies, everything else is only read at start
+static const char *reloadable[] = {
+    CONFIG_VERBOSE,
+    CONFIG_IGNORE,
+    CONFIG_RSYNC_SSH_KEYFILE,
+    CONFIG_RATE_LIMIT,
+    CONFIG_RATE_INTERACTIVE,
+    CONFIG_QUEUE_DELETE_BATCH,
+    CONFIG_QUEUE_HASH_MAX,
+    CONFIG_RSYNC_PACK_SIZE,
+    CONFIG_RSYNC_PACK_COUNT,
+    CONFIG_RSYNC_PROTOCOL_VERSION,
+    CONFIG_RSYNC_LOG_LEVEL,
+    CONFIG_AGENT_MAX_SIZE,
+    CONFIG_AGENT_DELTA_MAX,
+    CONFIG_GROWL_ICON,
+    CONFIG_GROWL_UPDATE_DIR,
+    CONFIG_MONITOR_QUIET,
+    CONFIG_MONITOR_QUIET_MAX,
+    CONFIG_MONITOR_TEMPORARY,
+};
+
+static const char *restartOnly[] = {
+    CONFIG_SYNC_METHOD,
+    CONFIG_STATE_DIR,
+    CONFIG_QUEUE_WORKER_COUNT,
+    CONFIG_QUEUE_INGRESS,
+    CONFIG_QUEUE_INFLIGHT,
+    CONFIG_QUEUE_RECONCILE,
+    CONFIG_QUEUE_AUDIT,
+    CONFIG_RSYNC_SSH_MULTIPLEX,
+    CONFIG_AGENT_COMMAND,
+    CONFIG_MONITOR_LATENCY,
+    CONFIG_MONITOR_POLL,
+    CONFIG_MONITOR_POLL_MIN,
+    CONFIG_MONITOR_POLL_MAX,
+    CONFIG_MONITOR_POLL_BUDGET,
+};
+
+void SourceSync::reload()
+{
+    const Settings *before = Settings::current();
+
+    if ( config().getString( CONFIG_PROFILE, "" ).empty() == false ) {
+
+        try {
+
+            std::string path( config().getString( CONFIG_PROFILE ) );
+
+            profileModified_ = Poco::File( path ).getLastModified();
+
+            Poco::AutoPtr<Poco::Util::PropertyFileConfiguration> profile( new Poco::Util::PropertyFileConfiguration( path ) );
+
+            // set over the profile as loaded at start, so a key taken out
+            // keeps its last value
+            for ( size_t i = 0; i < sizeof( reloadable ) / sizeof( reloadable[0] ); i++ ) {
+
+                if ( profile->hasProperty( reloadable[i] ) ) {
+
+                    config().setString( reloadable[i], profile->getString( reloadable[i] ) );
+                }
+            }
+
+            for ( std::vector<Mapping *>::iterator it = mappings_.begin(); it != mappings_.end(); it++ ) {
+
+                std::string prefix = std::string( CONFIG_MAPPING ) + "." + (*it)->name() + ".";
+
+                if ( profile->hasProperty( prefix + CONFIG_MAPPING_IGNORE ) ) {
+
+                    config().setString( prefix + CONFIG_MAPPING_IGNORE, profile->getString( prefix + CONFIG_MAPPING_IGNORE ) );
+                }
+
+                if ( profile->hasProperty( prefix + CONFIG_MAPPING_KEYFILE ) ) {
+
+                    config().setString( prefix + CONFIG_MAPPING_KEYFILE, profile->getString( prefix + CONFIG_MAPPING_KEYFILE ) );
+                }
+            }
+
+            for ( size_t i = 0; i < sizeof( restartOnly ) / sizeof( restartOnly[0] ); i++ ) {
+
+                if ( profile->hasProperty( restartOnly[i] ) && profile->getString( restartOnly[i] ) != config().getString( restartOnly[i], "" ) ) {
+
+                    logger().warning( Poco::format( "%s changed, restart srcsync for it to take effect", std::string( restartOnly[i] ) ) );
+                }
+            }
+        }
+        catch ( Poco::Exception &ex ) {
+
+            logger().error( "Can not reload " + config().getString( CONFIG_PROFILE ) + ": " + ex.displayText() );
+            return;
+        }
+    }
+
+    // jobs already running finish with the settings they started with
+    const Settings *settings = Settings::reload();
+
+    if ( settings->verbose() != before->verbose() ) {
+
+        logger().setLevel( "", settings->verbose() );
+    }
+
+    if ( settings->rsyncLogLevel() != before->rsyncLogLevel() && config().getString( CONFIG_SYNC_METHOD ) == CONFIG_SYNC_METHOD_ACROSYNC ) {
+
+        rsync::Log::setLevel( (rsync::Log::Level) settings->rsyncLogLevel() );
+    }
+
+    for ( std::map<std::string, Queue *>::iterator it = queues_.begin(); it != queues_.end(); it++ ) {
+
+        it->second->bandwidth().configure( settings->rateLimit(), settings->rateInteractive() );
+    }
+
+    std::string ignore = config().getString( CONFIG_IGNORE, "" );
+    std::string keyfile = config().getString( CONFIG_RSYNC_SSH_KEYFILE, "" );
+
+    for ( std::vector<Mapping *>::iterator it = mappings_.begin(); it != mappings_.end(); it++ ) {
+
+        Mapping *m = *it;
+
+        std::string prefix = std::string( CONFIG_MAPPING ) + "." + m->name() + ".";
+
+        bool changed = m->configure( config().getString( prefix + CONFIG_MAPPING_IGNORE, ignore ), config().getString( prefix + CONFIG_MAPPING_KEYFILE, keyfile ) );
+
+        // files no longer ignored are sent, nothing else is
+        if ( changed ) {
+
+            logger().notice( Poco::format( "%s: ignore list changed, checking the tree again", m->name() ) );
+
+            queueDir( m->id(), ".", JobScheduler::BULK );
+        }
+    }
+
+    if ( debouncer_.isNull() == false ) {
+
+        debouncer_->configure( config().getInt( CONFIG_MONITOR_QUIET, 300 ),
+                config().getInt( CONFIG_MONITOR_QUIET_MAX, 5000 ),
+                config().getString( CONFIG_MONITOR_TEMPORARY, MONITOR_TEMPORARY_DEFAULT ) );
+    }
+
+    logger().notice( "Configuration reloaded" );
+}
+
+// settled files are queued as any other change
+class QueueSettled : public Debouncer::Target
+{
+    public:
+        virtual void settled( int mapping, const std::string &path ) { thisApp->queueFile( mapping, path ); };
+};
+
+static QueueSettled queueSettled;
+
+void SourceSync::ignoreFileChanged( int mapping, const std::string &path )
+{
+    std::string::size_type slash = path.rfind( '/' );
+
+    if ( path.compare( slash == std::string::npos ? 0 : slash + 1, std::string::npos, IGNORE_FILE ) != 0 ) {
+
+        return;
+    }
+
+    std::string dir( slash == std::string::npos ? "" : path.substr( 0, slash ) );
+
+    logger().information( Poco::format("%s: %s changed, checking %s again", mappings_[ mapping ]->name(), path, dir.empty() ? std::string(".") : dir ) );
+
+    mappings_[ mapping ]->ignoreChanged( dir );
+
+    queueDir( mapping, dir.empty() ? "." : dir, JobScheduler::BULK );
+}
+
+void SourceSync::fileChanged( int mapping, const std::string &path, bool attributes )
+{
+    ignoreFileChanged( mapping, path );
+
+    // nothing is being written, there is nothing to wait for
+    if ( attributes ) {
+
+        queueFile( mapping, path, JobScheduler::INTERACTIVE, SyncJob::METADATA );
+        return;
+    }
+
+    if ( debouncer_.isNull() ) {
+
+        queueFile( mapping, path );
+        return;
+    }
+
+    debouncer_->changed( mapping, path, mappings_[ mapping ]->local().toString() + path );
+}
+
+void SourceSync::fileRemoved( int mapping, const std::string &path )
+{
+    ignoreFileChanged( mapping, path );
+
+    if ( debouncer_.isNull() || debouncer_->removed( mapping, path ) == false ) {
+
+        queueDelete( mapping, path );
+        return;
+    }
+
+    Mapping *m = mappings_[ mapping ];
+
+    const std::vector<Destination *> &destinations = m->destinations();
+
+    // never sent by us, but it may have been there since before (from the
+    // initial sync, or held as a temporary file): only a destination whose
+    // listing does not have it is spared the delete
+    for ( std::vector<Destination *>::const_iterator it = destinations.begin(); it != destinations.end(); it++ ) {
+
+        RemoteManifest::Entry entry;
+
+        if ( (*it)->manifest().seeded() && (*it)->manifest().find( path, entry ) == false ) {
+
+            LOG_DEBUG( logger(), Poco::format("%s: %s was gone before it settled, %s does not have it", m->name(), path, (*it)->remote().toString() ) );
+            continue;
+        }
+
+        (*it)->queue()->queueDelete( mapping, (*it)->id(), path );
+    }
+}
+
+void SourceSync::queueFile( int mapping, const std::string &path, JobScheduler::Priority priority, int flags )
+{
+    Mapping *m = mappings_[ mapping ];
+
+    // ignore rules are checked once, not once per destination
+    if ( m->ignored( path ) ) {
+
+        logger().notice( Poco::format("%s: Ignoring %s", m->name(), path) );
+
+        m->skipped();
+        return;
+    }
+
+    const std::vector<Destination *> &destinations = m->destinations();
+
+    // every destination shares the one copy of the path
+    PathTable::Ref id( path );
+
+    for ( std::vector<Destination *>::const_iterator it = destinations.begin(); it != destinations.end(); it++ ) {
+
+        (*it)->queue()->enqueue( new SyncJob( SyncJob::FILE_SYNC, id, mapping, (*it)->id(), flags ), priority );
+    }
+}
+
+void SourceSync::queueDir( int mapping, const std::string &path, JobScheduler::Priority priority )
+{
+    Mapping *m = mappings_[ mapping ];
+
+    if ( path != "." && m->ignored( path ) ) {
+
+        logger().notice( Poco::format("%s: Ignoring %s", m->name(), path) );
+
+        m->skipped();
+        return;
+    }
+
+    const std::vector<Destination *> &destinations = m->destinations();
+
+    PathTable::Ref id( path );
+
+    for ( std::vector<Destination *>::const_iterator it = destinations.begin(); it != destinations.end(); it++ ) {
+
+        (*it)->queue()->enqueue( new SyncJob( SyncJob::DIR_SYNC, id, mapping, (*it)->id() ), priority );
+    }
+}
+
+void SourceSync::queueDelete( int mapping, const std::string &path )
+{
+    Mapping *m = mappings_[ mapping ];
+
+    const std::vector<Destination *> &destinations = m->destinations();
+
+    for ( std::vector<Destination *>::const_iterator it = destinations.begin(); it != destinations.end(); it++ ) {
+
+        (*it)->queue()->queueDelete( mapping, (*it)->id(), path );
+    }
+}
+
 int SourceSync::main( const std::vector<std::string> &args ) {
 
     FUNCTIONTRACE;
@@ -325,28 +756,37 @@ int SourceSync::main( const std::vector<std::string> &args ) {
             throw Poco::Exception( "Unknown argument " + args[1] );
         }
 
-        if ( config().getString( CONFIG_SRC, "").empty() ) {
+        if ( config().getString( CONFIG_PROFILE, "").empty() == false ) {
 
-            throw Poco::Exception( "No source argument specified" );
-        }
-        if ( config().getString( CONFIG_DEST, "").empty() ) {
+            loadConfiguration( config().getString( CONFIG_PROFILE ) );
 
-            throw Poco::Exception( "No destination argument specified" );
+            profileModified_ = Poco::File( config().getString( CONFIG_PROFILE ) ).getLastModified();
         }
 
-        // ensure we always have src and destination ending with '/'
-        if ( config().getString( CONFIG_SRC).back() != '/' ) {
+        // what the workers read, replaced as a whole by reload()
+        Settings::reload();
 
-            config().setString( CONFIG_SRC, config().getString( CONFIG_SRC) + Poco::Path::separator() );
-        }
-        if ( config().getString( CONFIG_DEST).back() != '/' ) {
+        loadMappings();
+
+#ifdef USE_TRACE
+        if ( config().getString( CONFIG_TRACE, "" ).empty() == false ) {
 
-            config().setString( CONFIG_DEST, config().getString( CONFIG_DEST) + Poco::Path::separator() );
+            Trace::start( config().getString( CONFIG_TRACE ) );
         }
+#endif
+
+        for ( std::vector<Mapping *>::iterator it = mappings_.begin(); it != mappings_.end(); it++ ) {
 
-        logger().notice( Poco::format( "Syncing from %s to %s", 
-                    config().getString( CONFIG_SRC ) ,
-                    config().getString( CONFIG_DEST, "" )  ) );
+            const std::vector<Destination *> &destinations = (*it)->destinations();
+
+            for ( std::vector<Destination *>::const_iterator jt = destinations.begin(); jt != destinations.end(); jt++ ) {
+
+                logger().notice( Poco::format( "%s: Syncing from %s to %s", 
+                            (*it)->name(),
+                            (*it)->local().toString(),
+                            (*jt)->remote().toString() ) );
+            }
+        }
 
         if ( config().getString( CONFIG_SYNC_METHOD ) == CONFIG_SYNC_METHOD_ACROSYNC ) {
             rsync::SocketUtil::startup();
@@ -359,31 +799,106 @@ int SourceSync::main( const std::vector<std::string> &args ) {
             }
         }
 
-        // create the Queue for managing workers
-        queue_ = new Queue;
+#if USE_GROWL
+        // before the workers, which report to it
+        notifier_ = new Notifier( config().getInt( CONFIG_GROWL_WINDOW, 1000 ) );
+#endif
+
+        // create the Queues for managing workers
+        createQueues();
+
+        // SIGHUP (or saving the profile) reloads the settings, the handler
+        // only sets a flag
+        std::signal( SIGHUP, onReloadSignal );
+
+        signals_ = new Poco::Timer( 1000, 1000 );
+        signals_->start( Poco::TimerCallback<SourceSync>( *this, &SourceSync::onSignals ) );
+
+        // whatever was queued but not sent when we last stopped
+        for ( std::vector<Mapping *>::iterator it = mappings_.begin(); it != mappings_.end(); it++ ) {
+
+            const std::vector<Destination *> &destinations = (*it)->destinations();
+
+            for ( std::vector<Destination *>::const_iterator jt = destinations.begin(); jt != destinations.end(); jt++ ) {
+
+                size_t count = (*jt)->queue()->replay( **it, **jt );
+
+                if ( count > 0 ) {
+
+                    logger().notice( Poco::format("%s: %s: replaying %z path(s) from the journal", (*it)->name(), (*jt)->remote().toString(), count ) );
+                }
+            }
+        }
+
+        // changed files wait for their writer to finish, 0 queues them as reported
+        if ( config().getInt( CONFIG_MONITOR_QUIET, 300 ) > 0 ) {
+
+            debouncer_ = new Debouncer( queueSettled,
+                    config().getInt( CONFIG_MONITOR_QUIET, 300 ),
+                    config().getInt( CONFIG_MONITOR_QUIET_MAX, 5000 ),
+                    config().getString( CONFIG_MONITOR_TEMPORARY, MONITOR_TEMPORARY_DEFAULT ) );
+        }
 
         logger().notice("Processing initial synchronization");
 
+        if ( config().getBool( CONFIG_MONITOR_POLL, false ) ) {
+
+            // for sources the kernel never reports changes on
+            PollMonitorDirectory *d = new PollMonitorDirectory( mappings_,
+                    config().getInt( CONFIG_MONITOR_POLL_MIN, 500 ),
+                    config().getInt( CONFIG_MONITOR_POLL_MAX, 10000 ),
+                    config().getInt( CONFIG_MONITOR_POLL_BUDGET, 3 ) );
+        }
+        else {
+
 #ifdef USE_LIB_FSWATCH        
-        FSWatchMonitorDirectory *d = new FSWatchMonitorDirectory( config().getString( CONFIG_SRC )  ); 
+            // a single monitor watches every mapping
+            FSWatchMonitorDirectory *d = new FSWatchMonitorDirectory( mappings_ ); 
 #endif
 
 #ifdef USE_POCO_DIRECTORY_WATCHER
-        PocoMonitorDirectory *d = new PocoMonitorDirectory( config().getString( CONFIG_SRC )  ); 
+            for ( std::vector<Mapping *>::iterator it = mappings_.begin(); it != mappings_.end(); it++ ) {
+
+                PocoMonitorDirectory *d = new PocoMonitorDirectory( (*it)->local().toString(), (*it)->id() ); 
+            }
 #endif        
+        }
 
         // get enough queued so that queue size isn't zero before checking...
         Poco::Thread::sleep(5000);
         while ( jobCount_.value() != 0 ) {
 
             Poco::Thread::sleep(15000);
-            logger().debug( Poco::format("jobCount=%d", jobCount_.value()) );
+            LOG_DEBUG( logger(), Poco::format("jobCount=%d", jobCount_.value()) );
         }
 
         logger().notice("Initial synchronization complete");
 
+        for ( std::vector<Mapping *>::iterator it = mappings_.begin(); it != mappings_.end(); it++ ) {
+
+            (*it)->logStatistics( logger() );
+        }
+
         waitForTerminationRequest();
 
+        signals_->stop();
+
+        for ( std::vector<Mapping *>::iterator it = mappings_.begin(); it != mappings_.end(); it++ ) {
+
+            (*it)->logStatistics( logger() );
+
+            const std::vector<Destination *> &destinations = (*it)->destinations();
+
+            for ( std::vector<Destination *>::const_iterator jt = destinations.begin(); jt != destinations.end(); jt++ ) {
+
+                (*jt)->manifest().save();
+            }
+        }
+
+#ifdef USE_TRACE
+        Trace::stop();
+#endif
+
         return Poco::Util::Application::EXIT_OK;
 
     }
@@ -391,7 +906,9 @@ int SourceSync::main( const std::vector<std::string> &args ) {
 
         logger().error( "D47E5398-1BAE-4C8B-B3FF-18A298858D78 : " + ex.displayText() );
 
-        Poco::NDC::current().dump(std::cerr);
+#ifdef USE_TRACE
+        Trace::stop();
+#endif
 
         return Poco::Util::Application::EXIT_USAGE;
     }
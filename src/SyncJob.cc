@@ -0,0 +1,215 @@
+/**
+ * \file SyncJob.cc
+ *
+ * \brief - The unit of work passed from the monitor to the workers
+ *
+ */
+
+#include "Poco/MemoryPool.h"
+#include "Poco/Exception.h"
+#include "Poco/Format.h"
+
+#include "SyncJob.h"
+
+// blocks are recycled, never returned to the heap, so the pool only
+// grows to the deepest backlog seen
+static Poco::MemoryPool jobPool( sizeof(SyncJob), 1024 );
+
+PathTable::PathTable() : next_(0)
+{
+    for ( int i = 0; i < CHUNK_COUNT; i++ ) {
+
+        chunks_[i].store( NULL, std::memory_order_relaxed );
+    }
+}
+
+PathTable &PathTable::instance()
+{
+    static PathTable table;
+
+    return table;
+}
+
+PathTable::Id PathTable::intern( const std::string &path )
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    std::unordered_map<std::string, Id>::const_iterator it = ids_.find( path );
+
+    if ( it != ids_.end() ) {
+
+        // release() checks the count again under the lock, so this can
+        // not race with the entry being freed
+        slot( it->second ).refs.fetch_add( 1, std::memory_order_relaxed );
+
+        return it->second;
+    }
+
+    Id id;
+
+    if ( free_.empty() == false ) {
+
+        id = free_.back();
+        free_.pop_back();
+    }
+    else {
+
+        if ( ( next_ >> CHUNK_BITS ) >= CHUNK_COUNT ) {
+
+            throw Poco::RuntimeException( Poco::format( "More than %d paths queued", (int) CHUNK_COUNT * CHUNK_SIZE ) );
+        }
+
+        id = next_++;
+
+        if ( ( id & ( CHUNK_SIZE - 1 ) ) == 0 ) {
+
+            Slot *chunk = new Slot[ CHUNK_SIZE ];
+
+            for ( int i = 0; i < CHUNK_SIZE; i++ ) {
+
+                chunk[i].path.store( NULL, std::memory_order_relaxed );
+                chunk[i].refs.store( 0, std::memory_order_relaxed );
+            }
+
+            chunks_[ id >> CHUNK_BITS ].store( chunk, std::memory_order_release );
+        }
+    }
+
+    Slot &s = slot( id );
+
+    s.refs.store( 1, std::memory_order_relaxed );
+    s.path.store( new std::string( path ), std::memory_order_release );
+
+    ids_[ path ] = id;
+
+    return id;
+}
+
+void PathTable::retain( Id id )
+{
+    slot( id ).refs.fetch_add( 1, std::memory_order_relaxed );
+}
+
+void PathTable::release( Id id )
+{
+    if ( slot( id ).refs.fetch_sub( 1, std::memory_order_acq_rel ) != 1 ) {
+
+        return;
+    }
+
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    Slot &s = slot( id );
+
+    const std::string *path = s.path.load( std::memory_order_relaxed );
+
+    // interned again meanwhile, or already freed by whoever released it
+    // after that
+    if ( s.refs.load( std::memory_order_acquire ) != 0 || path == NULL ) {
+
+        return;
+    }
+
+    ids_.erase( *path );
+
+    s.path.store( NULL, std::memory_order_relaxed );
+    free_.push_back( id );
+
+    delete path;
+}
+
+const std::string &PathTable::path( Id id ) const
+{
+    Slot *chunk = ( id >> CHUNK_BITS ) < CHUNK_COUNT ? chunks_[ id >> CHUNK_BITS ].load( std::memory_order_acquire ) : NULL;
+
+    const std::string *path = chunk ? chunk[ id & ( CHUNK_SIZE - 1 ) ].path.load( std::memory_order_acquire ) : NULL;
+
+    if ( path == NULL ) {
+
+        throw Poco::NotFoundException( Poco::format( "No interned path %u", id ) );
+    }
+
+    return *path;
+}
+
+bool PathTable::lookup( Id id, std::string &path )
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    if ( id >= next_ ) {
+
+        return false;
+    }
+
+    const std::string *p = slot( id ).path.load( std::memory_order_relaxed );
+
+    if ( p == NULL ) {
+
+        return false;
+    }
+
+    path = *p;
+
+    return true;
+}
+
+size_t PathTable::size()
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    return ids_.size();
+}
+
+SyncJob::SyncJob( Kind kind, PathTable::Id path, int mapping, int destination, int flags ) :
+    kind_( (Poco::UInt8) kind ),
+    flags_( (Poco::UInt8) flags ),
+    mapping_( (Poco::UInt16) mapping ),
+    destination_( (Poco::UInt16) destination ),
+    priority_( 0 ),
+    path_( path ),
+    journal_( 0 ),
+    queued_( Poco::Timestamp().epochMicroseconds() ),
+    hash_( 0 ),
+    started_( 0 ),
+    size_( 0 ),
+    modified_( 0 )
+{
+    PathTable::instance().retain( path_ );
+}
+
+SyncJob::~SyncJob()
+{
+    PathTable::instance().release( path_ );
+}
+
+const char *SyncJob::kindName() const
+{
+    switch ( kind() ) {
+
+        case FILE_SYNC:
+            return "file";
+
+        case DIR_SYNC:
+            return "dir";
+
+        case DELETE_SYNC:
+            return "delete";
+    }
+
+    return "unknown";
+}
+
+void *SyncJob::operator new( size_t size )
+{
+    poco_assert( size == sizeof(SyncJob) );
+
+    return jobPool.get();
+}
+
+void SyncJob::operator delete( void *p )
+{
+    if ( p ) {
+
+        jobPool.release( p );
+    }
+}
@@ -0,0 +1,270 @@
+/**
+ * \file Trace.cc
+ *
+ * \brief - Timestamped spans for following a change through srcsync
+ *
+ */
+
+#include <algorithm>
+#include <csignal>
+#include <fstream>
+
+#include "Poco/Thread.h"
+#include "Poco/Runnable.h"
+#include "Poco/Event.h"
+#include "Poco/Format.h"
+#include "Poco/Exception.h"
+#include "Poco/Logger.h"
+
+#include "SyncJob.h"
+#include "Trace.h"
+
+// events kept per thread before the oldest are overwritten
+#define TRACE_EVENTS 16384
+
+// how often (ms) the dump thread checks for SIGUSR1
+#define TRACE_POLL 500
+
+Poco::FastMutex Trace::mutex_;
+std::vector<Trace::Buffer *> Trace::buffers_;
+
+thread_local Trace::Buffer *Trace::current_ = 0;
+
+static volatile std::sig_atomic_t dumpRequested = 0;
+
+static void onDumpSignal( int )
+{
+    dumpRequested = 1;
+}
+
+// writes the trace when asked to by SIGUSR1
+class TraceDumper : public Poco::Runnable
+{
+
+    public:
+        TraceDumper() : thread_("TraceDumper") {};
+
+        void start( const std::string &file ) {
+
+            file_ = file;
+
+            std::signal( SIGUSR1, onDumpSignal );
+
+            thread_.start( *this );
+        };
+
+        void stop() {
+
+            if ( thread_.isRunning() ) {
+
+                stop_.set();
+                thread_.join();
+            }
+
+            if ( file_.empty() == false ) {
+
+                dump();
+            }
+        };
+
+        void run() {
+
+            while ( stop_.tryWait( TRACE_POLL ) == false ) {
+
+                if ( dumpRequested ) {
+
+                    dumpRequested = 0;
+
+                    dump();
+                }
+            }
+        };
+
+    private:
+        void dump() {
+
+            try {
+
+                Trace::write( file_ );
+
+                Poco::Logger::get("Trace").notice( "Trace written to " + file_ );
+            }
+            catch ( Poco::Exception &ex ) {
+
+                Poco::Logger::get("Trace").error( ex.displayText() );
+            }
+        };
+
+        std::string file_;
+        Poco::Thread thread_;
+        Poco::Event stop_;
+};
+
+static TraceDumper dumper;
+
+Trace::Buffer::Buffer( int id, const std::string &name ) : id(id), name(name), events( TRACE_EVENTS ), count(0)
+{
+}
+
+Trace::Buffer &Trace::buffer()
+{
+    if ( current_ == 0 ) {
+
+        Poco::Thread *thread = Poco::Thread::current();
+
+        Poco::FastMutex::ScopedLock lock( mutex_ );
+
+        // never freed, the thread may log again after a dump
+        current_ = new Buffer( buffers_.size(), thread ? thread->getName() : "main" );
+
+        buffers_.push_back( current_ );
+    }
+
+    return *current_;
+}
+
+void Trace::record( const char *name, const char *category, Poco::Int64 begin, Poco::Int64 duration, Poco::UInt32 path )
+{
+    Buffer &b = buffer();
+
+    Poco::UInt64 n = b.count.load( std::memory_order_relaxed );
+
+    Event &e = b.events[ n % b.events.size() ];
+
+    e.name = name;
+    e.category = category;
+    e.begin = begin;
+    e.duration = duration;
+    e.path = path;
+
+    b.count.store( n + 1, std::memory_order_release );
+}
+
+void Trace::span( const char *name, const char *category, Poco::Int64 begin, Poco::Int64 end, Poco::UInt32 path )
+{
+    record( name, category, begin, end - begin, path );
+}
+
+void Trace::instant( const char *name, const char *category, Poco::UInt32 path )
+{
+    record( name, category, now(), -1, path );
+}
+
+static std::string quote( const std::string &s )
+{
+    std::string q("\"");
+
+    for ( std::string::const_iterator it = s.begin(); it != s.end(); it++ ) {
+
+        switch ( *it ) {
+
+            case '"':   q += "\\\""; break;
+            case '\\':  q += "\\\\"; break;
+            case '\n':  q += "\\n"; break;
+            case '\t':  q += "\\t"; break;
+
+            default:
+                if ( (unsigned char) *it < 0x20 ) {
+
+                    q += Poco::format( "\\u%04x", (int) (unsigned char) *it );
+                }
+                else {
+
+                    q += *it;
+                }
+        }
+    }
+
+    return q + "\"";
+}
+
+void Trace::write( std::ostream &out )
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+    bool first = true;
+
+    for ( std::vector<Buffer *>::const_iterator it = buffers_.begin(); it != buffers_.end(); it++ ) {
+
+        Buffer &b = **it;
+        Poco::UInt64 size = b.events.size();
+
+        out << ( first ? "" : "," ) << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << b.id
+            << ",\"args\":{\"name\":" << quote( b.name ) << "}}";
+
+        first = false;
+
+        // the thread keeps recording while we copy (we do not stop it), so
+        // copy what is there, then drop anything it overwrote meanwhile
+        Poco::UInt64 end = b.count.load( std::memory_order_acquire );
+        Poco::UInt64 begin = end > size ? end - size : 0;
+
+        std::vector<Event> events;
+
+        for ( Poco::UInt64 i = begin; i < end; i++ ) {
+
+            events.push_back( b.events[ i % size ] );
+        }
+
+        Poco::UInt64 now = b.count.load( std::memory_order_acquire );
+
+        if ( now > size && now - size > begin ) {
+
+            events.erase( events.begin(), events.begin() + std::min<Poco::UInt64>( now - size - begin, events.size() ) );
+        }
+
+        for ( std::vector<Event>::const_iterator jt = events.begin(); jt != events.end(); jt++ ) {
+
+            out << ",\n{\"name\":" << quote( jt->name ) << ",\"cat\":" << quote( jt->category )
+                << ",\"pid\":1,\"tid\":" << b.id << ",\"ts\":" << jt->begin;
+
+            if ( jt->duration < 0 ) {
+
+                out << ",\"ph\":\"i\",\"s\":\"t\"";
+            }
+            else {
+
+                out << ",\"ph\":\"X\",\"dur\":" << jt->duration;
+            }
+
+            if ( jt->path != NO_PATH ) {
+
+                std::string path;
+
+                // the id may have been freed, or reused, since the event
+                if ( PathTable::instance().lookup( jt->path, path ) ) {
+
+                    out << ",\"args\":{\"path\":" << quote( path ) << "}";
+                }
+            }
+
+            out << "}";
+        }
+    }
+
+    out << "\n]}\n";
+}
+
+void Trace::write( const std::string &file )
+{
+    std::ofstream out( file.c_str() );
+
+    if ( !out ) {
+
+        throw Poco::CreateFileException( "Can not write trace", file );
+    }
+
+    write( out );
+}
+
+void Trace::start( const std::string &file )
+{
+    dumper.start( file );
+}
+
+void Trace::stop()
+{
+    dumper.stop();
+}
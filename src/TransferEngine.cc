@@ -0,0 +1,553 @@
+/**
+ * \file TransferEngine.cc
+ *
+ * \brief - Runs many transfer processes from a couple of threads
+ *
+ */
+
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+#include "Poco/Event.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Format.h"
+#include "Poco/Exception.h"
+
+#include "Trace.h"
+#include "TransferEngine.h"
+
+extern char **environ;
+
+// read buffer, most transfers print less than this in total
+#define ENGINE_READ_SIZE    ( 16 * 1024 )
+
+// ms between checks for processes that have closed their pipes but not exited
+#define ENGINE_REAP_POLL    20
+
+// the descriptors the I/O thread waits on
+class TransferEngine::Poller
+{
+
+    public:
+        Poller()
+        {
+#ifdef __linux__
+            epoll_ = ::epoll_create1( EPOLL_CLOEXEC );
+
+            if ( epoll_ < 0 ) {
+
+                throw Poco::SystemException( "epoll_create1" );
+            }
+#endif
+        }
+
+        ~Poller()
+        {
+#ifdef __linux__
+            ::close( epoll_ );
+#endif
+        }
+
+        void add( int fd )
+        {
+#ifdef __linux__
+            struct epoll_event ev;
+
+            ev.events = EPOLLIN;
+            ev.data.fd = fd;
+
+            ::epoll_ctl( epoll_, EPOLL_CTL_ADD, fd, &ev );
+#else
+            struct pollfd p;
+
+            p.fd = fd;
+            p.events = POLLIN;
+            p.revents = 0;
+
+            fds_.push_back( p );
+#endif
+        }
+
+        // before FD is closed
+        void remove( int fd )
+        {
+#ifdef __linux__
+            ::epoll_ctl( epoll_, EPOLL_CTL_DEL, fd, NULL );
+#else
+            for ( std::vector<struct pollfd>::iterator it = fds_.begin(); it != fds_.end(); it++ ) {
+
+                if ( it->fd == fd ) {
+
+                    fds_.erase( it );
+                    break;
+                }
+            }
+#endif
+        }
+
+        // READY gets the descriptors with data (or EOF), TIMEOUT in ms, -1 waits
+        void wait( std::vector<int> &ready, int timeout )
+        {
+            ready.clear();
+
+#ifdef __linux__
+            struct epoll_event events[ 256 ];
+
+            int n = ::epoll_wait( epoll_, events, 256, timeout );
+
+            for ( int i = 0; i < n; i++ ) {
+
+                ready.push_back( events[i].data.fd );
+            }
+#else
+            int n = ::poll( &fds_[0], fds_.size(), timeout );
+
+            for ( size_t i = 0; n > 0 && i < fds_.size(); i++ ) {
+
+                if ( fds_[i].revents != 0 ) {
+
+                    ready.push_back( fds_[i].fd );
+                    n--;
+                }
+            }
+#endif
+        }
+
+    private:
+#ifdef __linux__
+        int epoll_;
+#else
+        std::vector<struct pollfd> fds_;
+#endif
+};
+
+TransferEngine::TransferEngine( const std::string &name, int limit ) :
+    name_(name),
+    slots_( limit, limit ),
+    running_(0),
+    stopping_(false),
+    ioLoop_(*this),
+    completionLoop_(*this),
+    ioThread_( name + "-io" ),
+    completionThread_( name + "-done" ),
+    logger_(Poco::Logger::get("TransferEngine"))
+{
+    int wake[2];
+
+    if ( ::pipe( wake ) != 0 ) {
+
+        throw Poco::SystemException( "Can not create the engine's wake pipe" );
+    }
+
+    wakeRead_ = wake[0];
+    wakeWrite_ = wake[1];
+
+    ::fcntl( wakeRead_, F_SETFD, FD_CLOEXEC );
+    ::fcntl( wakeWrite_, F_SETFD, FD_CLOEXEC );
+    ::fcntl( wakeRead_, F_SETFL, O_NONBLOCK );
+    ::fcntl( wakeWrite_, F_SETFL, O_NONBLOCK );
+
+    ioThread_.start( ioLoop_ );
+    completionThread_.start( completionLoop_ );
+}
+
+TransferEngine::~TransferEngine()
+{
+    {
+        Poco::FastMutex::ScopedLock lock( mutex_ );
+        Poco::FastMutex::ScopedLock completionLock( completionMutex_ );
+
+        stopping_ = true;
+    }
+
+    wake();
+    completionReady_.broadcast();
+
+    ioThread_.join();
+    completionThread_.join();
+
+    ::close( wakeRead_ );
+    ::close( wakeWrite_ );
+}
+
+void TransferEngine::wake()
+{
+    char c = 0;
+
+    // full means a wake up is already pending
+    while ( ::write( wakeWrite_, &c, 1 ) < 0 && errno == EINTR ) {
+    }
+}
+
+void TransferEngine::spawn( const std::string &command, const std::vector<std::string> &args, Transfer *transfer )
+{
+    slots_.wait();
+
+    {
+        Poco::FastMutex::ScopedLock lock( mutex_ );
+
+        running_++;
+    }
+
+    int out[2] = { -1, -1 };
+    int err[2] = { -1, -1 };
+
+    int rc = -1;
+    pid_t pid = 0;
+
+    if ( ::pipe( out ) == 0 && ::pipe( err ) == 0 ) {
+
+        // nothing else we start inherits them, dup2 clears it for the child's 1 and 2
+        ::fcntl( out[0], F_SETFD, FD_CLOEXEC );
+        ::fcntl( out[1], F_SETFD, FD_CLOEXEC );
+        ::fcntl( err[0], F_SETFD, FD_CLOEXEC );
+        ::fcntl( err[1], F_SETFD, FD_CLOEXEC );
+
+        ::fcntl( out[0], F_SETFL, O_NONBLOCK );
+        ::fcntl( err[0], F_SETFL, O_NONBLOCK );
+
+        posix_spawn_file_actions_t actions;
+
+        ::posix_spawn_file_actions_init( &actions );
+        ::posix_spawn_file_actions_addopen( &actions, 0, "/dev/null", O_RDONLY, 0 );
+        ::posix_spawn_file_actions_adddup2( &actions, out[1], 1 );
+        ::posix_spawn_file_actions_adddup2( &actions, err[1], 2 );
+
+        std::vector<char *> argv;
+
+        argv.push_back( const_cast<char *>( command.c_str() ) );
+
+        for ( std::vector<std::string>::const_iterator it = args.begin(); it != args.end(); it++ ) {
+
+            argv.push_back( const_cast<char *>( it->c_str() ) );
+        }
+
+        argv.push_back( NULL );
+
+        rc = ::posix_spawnp( &pid, command.c_str(), &actions, NULL, &argv[0], environ );
+
+        ::posix_spawn_file_actions_destroy( &actions );
+    }
+
+    // the child's ends
+    if ( out[1] >= 0 ) ::close( out[1] );
+    if ( err[1] >= 0 ) ::close( err[1] );
+
+    if ( rc != 0 ) {
+
+        if ( out[0] >= 0 ) ::close( out[0] );
+        if ( err[0] >= 0 ) ::close( err[0] );
+
+        logger_.error( Poco::format("%s: can not start %s", name_, command ) );
+
+        Poco::FastMutex::ScopedLock lock( completionMutex_ );
+
+        completions_.push_back( std::make_pair( -1, transfer ) );
+        completionReady_.signal();
+
+        return;
+    }
+
+    Process *p = new Process;
+
+    p->pid = pid;
+    p->out = out[0];
+    p->err = err[0];
+    p->transfer = transfer;
+    p->started = Poco::Timestamp().epochMicroseconds();
+
+    {
+        Poco::FastMutex::ScopedLock lock( mutex_ );
+
+        starting_.push_back( p );
+    }
+
+    wake();
+}
+
+namespace {
+
+    // the output of execute()
+    class Capture : public TransferEngine::Transfer
+    {
+
+        public:
+            Capture( std::string &output, int &status, Poco::Event &done, Poco::Logger &logger, const std::string &name ) :
+                output_(output), status_(status), done_(done), logger_(logger), name_(name) {};
+
+            virtual bool lines() const { return false; };
+
+            virtual void output( const std::string &data ) { output_ += data; };
+
+            virtual void error( const std::string &line ) { logger_.error( Poco::format("%s: %s", name_, line ) ); };
+
+            virtual void finished( int status ) { status_ = status; done_.set(); };
+
+        private:
+            std::string &output_;
+            int &status_;
+            Poco::Event &done_;
+            Poco::Logger &logger_;
+            std::string name_;
+    };
+}
+
+int TransferEngine::execute( const std::string &command, const std::vector<std::string> &args, std::string &output )
+{
+    int status = -1;
+    Poco::Event done;
+
+    spawn( command, args, new Capture( output, status, done, logger_, name_ ) );
+
+    done.wait();
+
+    return status;
+}
+
+int TransferEngine::running()
+{
+    Poco::FastMutex::ScopedLock lock( mutex_ );
+
+    return running_;
+}
+
+bool TransferEngine::drain( int fd, std::string &line, Transfer *transfer, bool error )
+{
+    char buffer[ ENGINE_READ_SIZE ];
+
+    bool lines = error || transfer->lines();
+
+    for ( ;; ) {
+
+        ssize_t n = ::read( fd, buffer, sizeof(buffer) );
+
+        if ( n > 0 ) {
+
+            if ( lines == false ) {
+
+                transfer->output( std::string( buffer, n ) );
+                continue;
+            }
+
+            ssize_t start = 0;
+
+            for ( ssize_t i = 0; i < n; i++ ) {
+
+                if ( buffer[i] == '\n' ) {
+
+                    line.append( buffer + start, i - start );
+
+                    if ( error ) {
+
+                        transfer->error( line );
+                    }
+                    else {
+
+                        transfer->output( line );
+                    }
+
+                    line.clear();
+                    start = i + 1;
+                }
+            }
+
+            line.append( buffer + start, n - start );
+            continue;
+        }
+
+        if ( n < 0 && errno == EINTR ) {
+
+            continue;
+        }
+
+        if ( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ) {
+
+            return true;
+        }
+
+        // EOF (or an error, which ends it the same way)
+        if ( line.empty() == false ) {
+
+            if ( error ) {
+
+                transfer->error( line );
+            }
+            else {
+
+                transfer->output( line );
+            }
+
+            line.clear();
+        }
+
+        return false;
+    }
+}
+
+void TransferEngine::reap()
+{
+    std::vector<Process *>::iterator it = exiting_.begin();
+
+    while ( it != exiting_.end() ) {
+
+        Process *p = *it;
+
+        int status = 0;
+
+        pid_t r = ::waitpid( p->pid, &status, WNOHANG );
+
+        if ( r == 0 || ( r < 0 && errno == EINTR ) ) {
+
+            // closed its output but still running
+            it++;
+            continue;
+        }
+
+        int code = ( r > 0 && WIFEXITED( status ) ) ? WEXITSTATUS( status ) : -1;
+
+        TRACE_SPAN( "process", "engine", p->started, Trace::NO_PATH );
+
+        {
+            Poco::FastMutex::ScopedLock lock( completionMutex_ );
+
+            completions_.push_back( std::make_pair( code, p->transfer ) );
+            completionReady_.signal();
+        }
+
+        delete p;
+
+        it = exiting_.erase( it );
+    }
+}
+
+void TransferEngine::ioLoop()
+{
+    Poller poller;
+
+    poller.add( wakeRead_ );
+
+    std::vector<int> ready;
+
+    for ( ;; ) {
+
+        {
+            Poco::FastMutex::ScopedLock lock( mutex_ );
+
+            if ( stopping_ ) {
+
+                break;
+            }
+
+            for ( std::vector<Process *>::iterator it = starting_.begin(); it != starting_.end(); it++ ) {
+
+                fds_[ (*it)->out ] = *it;
+                fds_[ (*it)->err ] = *it;
+
+                poller.add( (*it)->out );
+                poller.add( (*it)->err );
+            }
+
+            starting_.clear();
+        }
+
+        // only poll for exits while something has closed its pipes
+        poller.wait( ready, exiting_.empty() ? -1 : ENGINE_REAP_POLL );
+
+        for ( std::vector<int>::const_iterator it = ready.begin(); it != ready.end(); it++ ) {
+
+            if ( *it == wakeRead_ ) {
+
+                char buffer[64];
+
+                while ( ::read( wakeRead_, buffer, sizeof(buffer) ) > 0 ) {
+                }
+
+                continue;
+            }
+
+            std::map<int, Process *>::iterator f = fds_.find( *it );
+
+            if ( f == fds_.end() ) {
+
+                continue;
+            }
+
+            Process *p = f->second;
+
+            bool error = ( *it == p->err );
+
+            if ( drain( *it, error ? p->errLine : p->outLine, p->transfer, error ) ) {
+
+                continue;
+            }
+
+            poller.remove( *it );
+            ::close( *it );
+
+            fds_.erase( f );
+
+            ( error ? p->err : p->out ) = -1;
+
+            if ( p->out == -1 && p->err == -1 ) {
+
+                exiting_.push_back( p );
+            }
+        }
+
+        reap();
+    }
+}
+
+void TransferEngine::completionLoop()
+{
+    for ( ;; ) {
+
+        std::pair<int, Transfer *> c;
+
+        {
+            Poco::FastMutex::ScopedLock lock( completionMutex_ );
+
+            while ( completions_.empty() ) {
+
+                if ( stopping_ ) {
+
+                    return;
+                }
+
+                completionReady_.wait( completionMutex_ );
+            }
+
+            c = completions_.front();
+            completions_.pop_front();
+        }
+
+        try {
+
+            c.second->finished( c.first );
+        }
+        catch ( Poco::Exception &ex ) {
+
+            logger_.error( Poco::format("%s: %s", name_, ex.displayText() ) );
+        }
+
+        delete c.second;
+
+        {
+            Poco::FastMutex::ScopedLock lock( mutex_ );
+
+            running_--;
+        }
+
+        slots_.set();
+    }
+}
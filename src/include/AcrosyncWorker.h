@@ -2,7 +2,6 @@
 #ifndef ACROSYNCWORKER_H
 #define ACROSYNCWORKER_H
 
-#include "Poco/PriorityNotificationQueue.h"
 
 #include <rsync/rsync_client.h>
 #include <rsync/rsync_sshio.h>
@@ -14,15 +13,30 @@ class AcrosyncWorker : public SyncWorker
 {
 
     public:
-        AcrosyncWorker( const std::string &name, Poco::PriorityNotificationQueue *queue);
+        AcrosyncWorker( const std::string &name, int index, Queue *owner );
+        ~AcrosyncWorker();
 
         virtual void run();
 
         virtual void initialize();
 
+        virtual bool runRemote( const Mapping &mapping, const Destination &destination, const std::string &command, std::string *output = NULL );
+
     private:
 
-        rsync::SSHIO  sshio_;
+        // JOB's path is relative to the mapping's source, false if the transfer failed
+        class Requeue;
+
+        // reserves JOB's bytes with our host's RateLimiter. False if it
+        // has to wait for them, it is queued again once they are reserved.
+        bool admit( const Mapping &mapping, SyncJob *job );
+
+        bool syncFile( const Mapping &mapping, Destination &destination, rsync::Client &client, const SyncJob &job );
+        bool syncDir( const Mapping &mapping, Destination &destination, rsync::Client &client, const SyncJob &job );
+
+        // LOCALPATH (only FILES of it, if given) to REMOTEPATH, false if the
+        // library failed or threw
+        bool upload( rsync::Client &client, const std::string &localPath, const std::string &remotePath, std::set<std::string> *files = NULL );
 
         Poco::Logger &logger_;
 
@@ -0,0 +1,161 @@
+/**
+ * \file AgentClient.h
+ *
+ * \brief - srcsync's end of the connection to a srcsync-agent
+ *
+ * \details
+ * Every rsync run repeats the whole protocol (file list, checksums,
+ * several round trips) for what is often one small file, and a delete
+ * is a remote shell command. An agent stays running for the life of the
+ * destination and takes single operations, which are sent as soon as
+ * they are asked for without waiting for the answers to earlier ones.
+ * An edit costs about one round trip however many are in flight.
+ *
+ * The agent is started with COMMAND and ARGS - ssh with the remote
+ * command for a real destination, the agent itself for a local one (and
+ * in the tests). Its answers are read by a thread of the client, which
+ * tells each Request.
+ *
+ */
+
+#ifndef AGENTCLIENT_H
+#define AGENTCLIENT_H
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include <sys/types.h>
+
+#include "Poco/Runnable.h"
+#include "Poco/Thread.h"
+#include "Poco/Mutex.h"
+#include "Poco/Condition.h"
+#include "Poco/Logger.h"
+#include "Poco/Types.h"
+
+#include "AgentProtocol.h"
+
+class AgentClient
+{
+
+    public:
+        // told about one operation, deleted once finished() returns
+        class Request
+        {
+
+            public:
+                virtual ~Request() {};
+
+                // what the op returns, before finished(). Called on the
+                // client's reader thread, as is finished().
+                virtual void answered( Agent::Reader &args ) {};
+
+                // OK is false with the agent's ERROR, or if the agent went away
+                virtual void finished( bool ok, const std::string &error ) = 0;
+        };
+
+        // waits for a group of requests
+        class Batch
+        {
+
+            public:
+                Batch() : outstanding_(0), failed_(0) {};
+
+                // a Request to pass to one of the operations
+                Request *add();
+
+                // blocks until every added request has finished, false if any failed
+                bool wait();
+
+                // the first error
+                const std::string &error() const { return error_; };
+
+            private:
+                class Member;
+
+                Poco::FastMutex mutex_;
+                Poco::Condition done_;
+                int outstanding_;
+                int failed_;
+                std::string error_;
+        };
+
+        // NAME identifies the agent in the log
+        AgentClient( const std::string &name, const std::string &command, const std::vector<std::string> &args );
+
+        // ends the agent's input, waits for it to exit
+        ~AgentClient();
+
+        // starts the agent and waits up to TIMEOUT ms for its hello,
+        // throws Poco::IOException if it does not answer
+        void start( long timeout );
+
+        // false once the agent has gone
+        bool alive();
+
+        // requests waiting for an answer
+        size_t inflight();
+
+        // PATH is relative to the agent's root, MTIME in seconds since the
+        // epoch. REQUEST may be NULL.
+        void write( const std::string &path, const std::string &data, Poco::UInt32 mode, Poco::Int64 mtime, Request *request );
+        void delta( const std::string &path, const Agent::Delta &delta, Poco::UInt32 mode, Poco::Int64 mtime, Request *request );
+        void rename( const std::string &from, const std::string &to, Request *request );
+        void unlink( const std::string &path, Request *request );
+        void mkdir( const std::string &path, Poco::UInt32 mode, Request *request );
+
+        // MODE 0 and MTIME -1 are left as they are
+        void metadata( const std::string &path, Poco::UInt32 mode, Poco::Int64 mtime, Request *request );
+
+        // everything below PATH ("." for the root), waits for the answer
+        bool list( const std::string &path, std::vector<Agent::Entry> &entries, std::string &error );
+
+    private:
+        class Reader : public Poco::Runnable
+        {
+            public:
+                Reader( AgentClient &client ) : client_(client) {};
+                virtual void run() { client_.read(); };
+            private:
+                AgentClient &client_;
+        };
+
+        Poco::UInt32 nextId();
+
+        // writes FRAME (built for ID) to the agent, REQUEST is told of the answer
+        void send( Poco::UInt32 id, Agent::Writer &frame, Request *request );
+
+        // the reader thread
+        void read();
+        void answer( const char *frame, size_t length );
+
+        // the agent has gone, fails everything still waiting
+        void lost( const std::string &why );
+
+    // data
+    private:
+        std::string name_;
+        std::string command_;
+        std::vector<std::string> args_;
+
+        pid_t pid_;
+        int input_;         // the agent's standard input
+        int output_;        // and output
+        int errors_;        // and error, logged
+
+        // one frame at a time on the agent's input
+        Poco::FastMutex writeMutex_;
+
+        Poco::FastMutex mutex_;
+        std::map<Poco::UInt32, Request *> pending_;
+        Poco::UInt32 id_;
+        bool alive_;
+
+        Reader reader_;
+        Poco::Thread thread_;
+
+        Poco::Logger &logger_;
+};
+
+#endif // AGENTCLIENT_H
@@ -0,0 +1,148 @@
+/**
+ * \file AgentProtocol.h
+ *
+ * \brief - Frames exchanged between srcsync and srcsync-agent
+ *
+ * \details
+ * srcsync-agent runs on the remote host (started over the destination's
+ * ssh connection) with the destination directory as its root, reading
+ * requests on its standard input and answering on its standard output.
+ *
+ * Every frame is a 32 bit length (of what follows), a 32 bit id and an
+ * 8 bit op or status, then the op's arguments. Integers are big endian,
+ * strings are a 32 bit length and the bytes. Requests do not wait for
+ * the answer to the one before, the agent answers them in order, so a
+ * burst of changes costs one round trip rather than one each.
+ *
+ * The agent is built without Poco, so it can be copied to a host that
+ * has nothing else installed; this header and AgentProtocol.cc only use
+ * the standard library.
+ *
+ */
+
+#ifndef AGENTPROTOCOL_H
+#define AGENTPROTOCOL_H
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include <stdint.h>
+
+namespace Agent {
+
+    const uint32_t VERSION = 2;
+
+    // frames larger than this are refused, files above it go by rsync
+    const uint32_t MAX_FRAME = 64 * 1024 * 1024;
+
+    enum Op {
+        HELLO = 1,          // version -> version
+        WRITE,              // path, mode, mtime (-1 for now), data
+        DELTA,              // path, mode, mtime (-1 for now), Delta (see below)
+        RENAME,             // from, to
+        UNLINK,             // path, a directory goes with everything in it
+        MKDIR,              // path, mode - parents are made as needed
+        METADATA,           // path, mode (0 leaves it), mtime (-1 leaves it)
+        LIST                // path -> count, then path, type, size, mtime each
+    };
+
+    enum Status {
+        OK = 0,
+        FAILED              // followed by the error message
+    };
+
+    // how a DELTA rebuilds a file from its current remote copy
+    struct Instruction {
+        uint64_t offset;    // in the remote copy, unused for data
+        uint32_t length;
+        std::string data;   // empty - copy LENGTH bytes from OFFSET
+    };
+
+    struct Delta {
+        Delta() : checksum(0) {};
+
+        std::vector<Instruction> instructions;
+
+        // XXH64 of the file the instructions produce, the agent keeps the
+        // result only if it matches
+        uint64_t checksum;
+
+        void copy( uint64_t offset, uint32_t length );
+        void literal( const char *data, size_t length );
+
+        // bytes the instructions produce
+        uint64_t size() const;
+    };
+
+    // an entry of a LIST answer, paths are relative to the agent's root
+    struct Entry {
+        std::string path;
+        char type;          // 'f', 'd' or 'l', as RemoteManifest
+        uint64_t size;
+        int64_t mtime;      // seconds since the epoch
+    };
+
+    // thrown for a truncated or malformed frame
+    class ProtocolError : public std::runtime_error
+    {
+        public:
+            ProtocolError( const std::string &what ) : std::runtime_error( what ) {};
+    };
+
+    // builds one frame
+    class Writer
+    {
+
+        public:
+            Writer( uint32_t id, uint8_t op );
+
+            Writer &u8( uint8_t v );
+            Writer &u32( uint32_t v );
+            Writer &u64( uint64_t v );
+            Writer &i64( int64_t v ) { return u64( (uint64_t) v ); };
+            Writer &str( const std::string &v );
+            Writer &str( const char *data, size_t length );
+            Writer &delta( const Delta &v );
+            Writer &entry( const Entry &v );
+
+            // the frame, with its length filled in
+            const std::string &frame();
+
+        private:
+            std::string buffer_;
+    };
+
+    // reads the arguments of one frame (without the length)
+    class Reader
+    {
+
+        public:
+            Reader( const char *data, size_t length ) : data_(data), end_(data + length) {};
+
+            uint8_t u8();
+            uint32_t u32();
+            uint64_t u64();
+            int64_t i64() { return (int64_t) u64(); };
+            std::string str();
+            void delta( Delta &v );
+            void entry( Entry &v );
+
+            bool empty() const { return data_ == end_; };
+
+        private:
+            void need( size_t length );
+
+            const char *data_;
+            const char *end_;
+    };
+
+    // the length at the start of a frame, HEADER bytes
+    const size_t HEADER = 4;
+    uint32_t frameLength( const char *header );
+
+    // PATH is relative and stays below the root (no "..", not absolute)
+    bool safePath( const std::string &path );
+}
+
+#endif // AGENTPROTOCOL_H
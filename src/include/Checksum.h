@@ -0,0 +1,81 @@
+/**
+ * \file Checksum.h
+ *
+ * \brief - The block checksums delta transfers are built from
+ *
+ * \details
+ * A weak checksum in the style of rsync's, cheap to roll along a file one
+ * byte at a time, and XXH64 as the strong hash that confirms a weak
+ * match (and checks a rebuilt file as a whole).
+ *
+ * The weak checksum of a whole block is computed with SSSE3 or AVX2 where
+ * the CPU has them, chosen at run time, so nothing needs building with
+ * special flags.
+ *
+ * Like AgentProtocol.h only the standard library is used, srcsync-agent
+ * checks what it rebuilds with XXH64 too.
+ *
+ */
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <cstddef>
+
+#include <stdint.h>
+
+namespace Checksum {
+
+    // XXH64 of LENGTH bytes at DATA
+    uint64_t xxh64( const void *data, size_t length, uint64_t seed = 0 );
+
+    // XXH64 of data given in pieces
+    class XXH64
+    {
+
+        public:
+            XXH64( uint64_t seed = 0 );
+
+            void update( const void *data, size_t length );
+
+            uint64_t digest() const;
+
+        private:
+            uint64_t v_[4];
+            uint64_t seed_;
+            uint64_t total_;
+            unsigned char buffer_[32];
+            size_t buffered_;
+    };
+
+    // the weak checksum of LENGTH bytes at DATA
+    uint32_t weak( const char *data, size_t length );
+
+    // the weak checksum of a window moving along a file
+    class Rolling
+    {
+
+        public:
+            // starts with the LENGTH bytes at DATA
+            Rolling( const char *data, size_t length );
+
+            uint32_t value() const { return ( a_ & 0xffff ) | ( b_ << 16 ); };
+
+            // drops OUT from the front of the window and appends IN
+            void roll( unsigned char out, unsigned char in )
+            {
+                a_ += in - out;
+                b_ += a_ - length_ * out;
+            };
+
+        private:
+            uint32_t a_;
+            uint32_t b_;
+            uint32_t length_;
+    };
+
+    // the instructions weak() uses, for the log
+    const char *implementation();
+}
+
+#endif // CHECKSUM_H
@@ -0,0 +1,143 @@
+/**
+ * \file Debouncer.h
+ *
+ * \brief - Holds back changed files until their writer has finished
+ *
+ * \details
+ * The monitor reports a file as soon as it changes, but a compiler or a
+ * download writes a file in many pieces, and each report used to be a
+ * transfer of whatever was there at the time. Editors that save by
+ * writing a temporary file and renaming it over the original add paths
+ * that are gone again before a worker gets to them.
+ *
+ * A path nothing has been heard of for a while is passed on at once, so
+ * a single save costs no extra delay. From then on it is watched: each
+ * further change, or a size or modification time that moved since the
+ * last look, holds it back until both have stood still for the quiet
+ * interval, and it is passed on once, as it was left. The interval
+ * follows how often the path has been changing, from QUIETMIN for an
+ * editor's save up to QUIETMAX for a slow download. A path that is gone
+ * before it settles was never passed on; its delete is not either where
+ * the destination is known not to have it (it may predate the debouncer).
+ * Names matching the temporary patterns (an editor's swap or backup
+ * files) are never passed on at once.
+ *
+ * The deadlines are kept in a timer wheel, a ring of slots one TICK wide
+ * visited by a single thread, so thousands of paths being written cost
+ * one vector entry each and no timers.
+ *
+ */
+
+#ifndef DEBOUNCER_H
+#define DEBOUNCER_H
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "Poco/Runnable.h"
+#include "Poco/Thread.h"
+#include "Poco/Event.h"
+#include "Poco/Mutex.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Glob.h"
+#include "Poco/SharedPtr.h"
+#include "Poco/Logger.h"
+
+class Debouncer : public Poco::Runnable
+{
+
+    public:
+        // told about each path once it has settled, on the wheel's thread
+        // (or the caller's, for a path passed on at once)
+        class Target
+        {
+            public:
+                virtual ~Target() {};
+                virtual void settled( int mapping, const std::string &path ) = 0;
+        };
+
+        // QUIETMIN and QUIETMAX in milliseconds. TEMPORARY is a space
+        // separated list of globs, matched against the file name.
+        Debouncer( Target &target, long quietMin, long quietMax, const std::string &temporary );
+
+        ~Debouncer();
+
+        // new settings (a reload), paths already waiting keep their
+        // deadline
+        void configure( long quietMin, long quietMax, const std::string &temporary );
+
+        // PATH (relative to MAPPING's source, FILE the same path absolute)
+        // was reported as changed
+        void changed( int mapping, const std::string &path, const std::string &file );
+
+        // PATH was reported as removed. True when it was never passed on,
+        // a destination may still have it from before
+        bool removed( int mapping, const std::string &path );
+
+        // paths being watched
+        size_t size();
+
+        virtual void run();
+
+    private:
+        typedef std::pair<int, std::string> Key;
+
+        struct Entry {
+            std::string file;
+
+            Poco::Int64 size;
+            Poco::Int64 modified;       // microseconds
+            bool exists;
+
+            Poco::Int64 lastChange;     // ticks
+            Poco::Int64 gap;            // ticks between changes, averaged
+            Poco::Int64 due;            // tick of the next look
+
+            bool dirty;                 // changed since last passed on
+            bool sent;                  // passed on at least once
+        };
+
+        // ticks since the wheel started
+        Poco::Int64 now() const;
+
+        // the quiet interval ENTRY has to reach, in ticks
+        Poco::Int64 quiet( const Entry &entry ) const;
+
+        bool temporary( const std::string &path ) const;
+
+        // reads FILE's size and time into ENTRY, true if they moved
+        static bool look( Entry &entry );
+
+        // a change seen at tick NOW
+        void touch( Entry &entry, Poco::Int64 now );
+
+        void schedule( const Key &key, Entry &entry, Poco::Int64 due );
+
+        // the paths due at TICK, those that settled are added to SETTLED
+        void expire( Poco::Int64 tick, std::vector<Key> &settled );
+
+    // data
+    private:
+        Target &target_;
+
+        Poco::Int64 quietMin_;
+        Poco::Int64 quietMax_;
+
+        std::vector<Poco::SharedPtr<Poco::Glob> > temporary_;
+
+        Poco::FastMutex mutex_;
+
+        std::map<Key, Entry> entries_;
+        std::vector<std::vector<Key> > wheel_;
+
+        Poco::Timestamp started_;
+        Poco::Int64 cursor_;        // the next tick to expire
+
+        Poco::Event stop_;
+        Poco::Thread thread_;
+
+        Poco::Logger &logger_;
+};
+
+#endif // DEBOUNCER_H
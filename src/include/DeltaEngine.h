@@ -0,0 +1,63 @@
+/**
+ * \file DeltaEngine.h
+ *
+ * \brief - Builds the delta from the copy of a file last sent to its new contents
+ *
+ * \details
+ * rsync (and acrosync) read the remote copy to learn its block checksums
+ * every time a file is sent. srcsync knows what it sent last, so it keeps
+ * those checksums (a Signature, see SignatureCache) and finds the blocks
+ * that are still the same without asking the remote side anything. The
+ * result is an Agent::Delta - copies from the remote copy and the bytes
+ * that are new - which srcsync-agent applies, checking the result against
+ * the checksum of the whole file.
+ *
+ * The new contents are signed first (that is what is kept for next time);
+ * where a block is unchanged in place that signature already matches, so
+ * only changed regions are searched byte by byte with the rolling
+ * checksum.
+ *
+ */
+
+#ifndef DELTAENGINE_H
+#define DELTAENGINE_H
+
+#include <vector>
+
+#include <stdint.h>
+
+#include "AgentProtocol.h"
+
+// the block checksums of a file, as it was sent
+struct Signature {
+    Signature() : blockSize(0), size(0) {};
+
+    uint32_t blockSize;
+    uint64_t size;
+
+    // one of each per block, the last may be short
+    std::vector<uint32_t> weak;
+    std::vector<uint64_t> strong;
+};
+
+class DeltaEngine
+{
+
+    public:
+        // smaller files are sent whole, a delta would save next to nothing
+        static const uint64_t MIN_SIZE = 64 * 1024;
+
+        // about the square root of SIZE, as rsync, a power of two from 2KB to 128KB
+        static uint32_t blockSize( uint64_t size );
+
+        // the signature of the LENGTH bytes at DATA, in blocks of BLOCKSIZE
+        static void sign( const char *data, size_t length, uint32_t blockSize, Signature &signature );
+
+        // fills DELTA with the instructions rebuilding the LENGTH bytes at
+        // DATA from the file BASE was made from. TARGET is DATA's own
+        // signature in BASE's block size. Returns the bytes that have to
+        // be sent as they are.
+        static uint64_t delta( const Signature &base, const Signature &target, const char *data, size_t length, Agent::Delta &delta );
+};
+
+#endif // DELTAENGINE_H
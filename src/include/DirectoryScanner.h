@@ -0,0 +1,128 @@
+/**
+ * \file DirectoryScanner.h
+ *
+ * \brief - Walks a source tree with several threads into a Manifest
+ *
+ * \details
+ * Each thread takes a directory off a shared stack, reads it (getdents64
+ * on Linux, readdir elsewhere) and stats the entries with fstatat()
+ * relative to the directory's fd, so no full paths are resolved by the
+ * kernel. Subdirectories go back on the stack for any thread to pick up.
+ * Ignored entries (ScanFilter) are dropped during the walk - an ignored
+ * directory is never opened.
+ *
+ * Symbolic links are recorded, not followed.
+ *
+ * Used for startup diffing, rescans after the monitor overflows and
+ * audits - anything that needs the whole tree rather than one event.
+ *
+ */
+
+#ifndef DIRECTORYSCANNER_H
+#define DIRECTORYSCANNER_H
+
+#include <string>
+#include <vector>
+
+#include "Poco/Types.h"
+#include "Poco/Mutex.h"
+#include "Poco/Condition.h"
+#include "Poco/AtomicCounter.h"
+
+// decides which paths (relative to the scanned root) are left out
+class ScanFilter
+{
+
+    public:
+        virtual ~ScanFilter() {};
+
+        virtual bool ignored( const std::string &path ) const = 0;
+};
+
+// every path below a root with its type, size and modification time,
+// sorted by path. Paths are relative to the root, '/' separated and
+// packed into one string.
+class Manifest
+{
+
+    public:
+        struct Entry {
+            Poco::UInt32 name;      // offset into names_
+            Poco::UInt32 length;
+            Poco::UInt32 mode;      // st_mode
+            Poco::UInt64 size;
+            Poco::Int64 mtime;      // microseconds since the epoch
+        };
+
+        size_t size() const { return entries_.size(); };
+        bool empty() const { return entries_.empty(); };
+
+        const Entry &entry( size_t i ) const { return entries_[i]; };
+        std::string path( size_t i ) const { return names_.substr( entries_[i].name, entries_[i].length ); };
+
+        bool isDirectory( size_t i ) const;
+        bool isLink( size_t i ) const;
+
+        // index of PATH, or -1 (must be sorted)
+        long find( const std::string &path ) const;
+
+        void add( const std::string &path, Poco::UInt32 mode, Poco::UInt64 size, Poco::Int64 mtime );
+
+        // moves OTHER's entries into this one, OTHER is left empty
+        void merge( Manifest &other );
+
+        void sort();
+
+        void clear();
+
+    private:
+        int compare( const Entry &entry, const char *path, size_t length ) const;
+
+        std::string names_;
+        std::vector<Entry> entries_;
+};
+
+class DirectoryScanner
+{
+
+    public:
+        // THREADS 0 picks a count from the number of processors
+        DirectoryScanner( const std::string &root, const ScanFilter *filter = 0, int threads = 0 );
+
+        // replaces MANIFEST with everything below SUBDIR (relative to the
+        // root, "" for all of it), sorted
+        void scan( Manifest &manifest, const std::string &subdir = "" );
+
+        // entries that could not be read or stat'ed in the last scan
+        int errors() const { return errors_.value(); };
+
+        const std::string &root() const { return root_; };
+        int threads() const { return threads_; };
+
+    private:
+        class Walker;
+
+        // hands out directories to walk, false when the walk is finished
+        bool take( std::string &dir );
+        void done( std::vector<std::string> &found );
+
+        void walk( int dirFd, const std::string &dir, Manifest &manifest, std::vector<std::string> &found );
+        void entry( int dirFd, const std::string &dir, const char *name, Manifest &manifest, std::vector<std::string> &found );
+
+    // data
+    private:
+        std::string root_;
+        const ScanFilter *filter_;
+        int threads_;
+
+        int rootFd_;
+
+        Poco::FastMutex mutex_;
+        Poco::Condition ready_;
+        std::vector<std::string> pending_;
+        int active_;
+
+        Poco::AtomicCounter errors_;
+};
+
+#endif // DIRECTORYSCANNER_H
@@ -9,6 +9,7 @@
 #include "Poco/Path.h"
 
 #include "MonitorDirectory.h"
+#include "Mapping.h"
 
 #include "libfswatch/c++/event.hpp"
 #include "libfswatch/c++/monitor.hpp"
@@ -17,7 +18,7 @@ class FSWatchMonitorDirectory : public MonitorDirectory
 {
     public:
 
-        FSWatchMonitorDirectory( const std::string &path);
+        FSWatchMonitorDirectory( const std::vector<Mapping *> &mappings );
 
 
         void handleEvents(const std::vector<fsw::event>& events);
@@ -33,8 +34,11 @@ class FSWatchMonitorDirectory : public MonitorDirectory
 
     private:
 
-        // fswatch delivers changed paths as absolute
-        Poco::Path base_;
+        // fswatch delivers changed paths as absolute, find the mapping
+        // that contains PATH and the path relative to its source
+        Mapping *mappingFor( const std::string &path, std::string &pathRelativeToBase );
+
+        std::vector<Mapping *> mappings_;
 
         fsw::monitor *monitor_;
 
@@ -0,0 +1,64 @@
+/**
+ * \file IgnoreRules.h
+ *
+ * \brief - The rules of one .srcsyncignore file
+ *
+ * \details
+ * Any directory of a mapping's source can hold a .srcsyncignore, one
+ * glob per line, applying to that directory and everything below it.
+ * A glob without a '/' is matched against each name in the path, so
+ * "build" ignores a build directory wherever it is; one with a '/' (a
+ * leading one only anchors it) is matched against the path from the
+ * rule's directory. A line starting with '!' includes what it matches,
+ * even if the mapping's ignore list or a rule further up excluded it.
+ * Blank lines and lines starting with '#' are skipped.
+ *
+ * The rule that decides is the last one that matches, the directories
+ * taken from the top down, so a sub-project's rules override those of
+ * the tree it is in.
+ *
+ */
+
+#ifndef IGNORERULES_H
+#define IGNORERULES_H
+
+#include <string>
+#include <vector>
+
+#include "Poco/Glob.h"
+#include "Poco/SharedPtr.h"
+
+#define IGNORE_FILE ".srcsyncignore"
+
+class IgnoreRules
+{
+
+    public:
+        // RULES is the contents of an ignore file
+        IgnoreRules( const std::string &rules );
+
+        // the rules in FILE, NULL if there is no such file
+        static Poco::SharedPtr<IgnoreRules> load( const std::string &file );
+
+        enum Result {
+            NO_MATCH,
+            IGNORE,
+            INCLUDE
+        };
+
+        // PATH is relative to the directory the rules came from
+        Result match( const std::string &path ) const;
+
+        size_t size() const { return rules_.size(); };
+
+    private:
+        struct Rule {
+            Poco::SharedPtr<Poco::Glob> glob;
+            bool include;
+            bool anchored;      // matched against the path, not each name
+        };
+
+        std::vector<Rule> rules_;
+};
+
+#endif // IGNORERULES_H
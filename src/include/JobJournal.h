@@ -0,0 +1,127 @@
+/**
+ * \file JobJournal.h
+ *
+ * \brief - Changes queued for a destination that have not been sent yet
+ *
+ * \details
+ * A memory mapped, append-only log in the state directory, one per
+ * destination. A queued change appends a PENDING record and a completed
+ * job appends a DONE record. Both are a memcpy into the mapping, the
+ * kernel writes them back. PENDING records are appended a batch at a
+ * time, as a worker drains the Queue's ingress rings, so the monitor
+ * never waits on the journal; what is still in a ring at a crash is
+ * found again by the initial sync. Records carry a sequence number, so a path
+ * is outstanding while it has been queued more recently than it was
+ * last completed.
+ *
+ * When srcsync starts, after a crash or restart, the outstanding paths
+ * are replayed, one job per path. They are replayed again once a
+ * destination that has been failing succeeds again (i.e. after the
+ * network comes back), so nothing queued while it was unreachable is
+ * lost.
+ *
+ * When the file fills up it is compacted to one record per outstanding
+ * path, and grown if that is still more than half of it.
+ *
+ */
+
+#ifndef JOBJOURNAL_H
+#define JOBJOURNAL_H
+
+#include <string>
+#include <map>
+
+#include "Poco/Types.h"
+#include "Poco/Mutex.h"
+#include "Poco/SharedMemory.h"
+#include "Poco/SharedPtr.h"
+#include "Poco/Timestamp.h"
+
+class JobJournal
+{
+
+    public:
+        typedef Poco::UInt32 Sequence;
+
+        // FILE is created if needed, "" keeps the journal in memory only
+        JobJournal( const std::string &file );
+
+        // KIND is a SyncJob::Kind, returns the sequence number to hand to done()
+        Sequence pending( int kind, const std::string &path );
+
+        // records a batch of pending() calls under one lock
+        class Batch
+        {
+
+            public:
+                explicit Batch( JobJournal &journal ) : journal_(journal), lock_(journal.mutex_) {};
+
+                Sequence pending( int kind, const std::string &path ) { return journal_.record( kind, path ); };
+
+            private:
+                JobJournal &journal_;
+                Poco::FastMutex::ScopedLock lock_;
+        };
+
+        // the job queued as SEQUENCE (or anything older) for PATH has completed
+        void done( const std::string &path, Sequence sequence );
+
+        // the most recent sequence number handed out
+        Sequence last() const;
+
+        // the paths still outstanding, each with its SyncJob::Kind and sequence
+        struct Outstanding {
+            int kind;
+            Sequence sequence;
+        };
+
+        void outstanding( std::map<std::string, Outstanding> &paths ) const;
+
+        // a transfer to the destination failed
+        void failed();
+
+        // a transfer succeeded, true the first time after failures - the
+        // outstanding paths should be replayed. At most once a minute, a
+        // path that always fails would otherwise be replayed endlessly.
+        bool recovered();
+
+    private:
+        enum Op { PENDING = 1, DONE = 2 };
+
+        struct State {
+            Sequence queued;        // most recent PENDING
+            Sequence completed;     // most recent DONE
+            int kind;
+        };
+
+        void map( size_t size );
+        void load();
+
+        // pending(), caller holds mutex_
+        Sequence record( int kind, const std::string &path );
+
+        void append( Op op, int kind, Sequence sequence, const std::string &path );
+        void apply( Op op, int kind, Sequence sequence, const std::string &path );
+
+        // rewrites the file with just the outstanding paths
+        void compact();
+
+    // data
+    private:
+        std::string file_;
+
+        mutable Poco::FastMutex mutex_;
+
+        Poco::SharedPtr<Poco::SharedMemory> memory_;
+        size_t size_;
+        size_t tail_;
+
+        std::map<std::string, State> state_;
+
+        Sequence sequence_;
+
+        bool failing_;
+        Poco::Timestamp replayed_;
+};
+
+#endif // JOBJOURNAL_H
@@ -0,0 +1,158 @@
+/**
+ * \file JobScheduler.h
+ *
+ * \brief - Hands SyncJobs from the monitor to a Queue's workers
+ *
+ * \details
+ * Replaces Poco::PriorityNotificationQueue, where the monitor and every
+ * worker contend on one mutex and every dequeue goes through Poco's
+ * event machinery.
+ *
+ * Producers (the monitor, the reconcile timer) push into bounded
+ * lock-free ingress rings, one per priority class. Only one worker at a
+ * time drains them, interactive first, moving a batch of jobs into its
+ * own deques - again one per class - from which idle workers steal. A
+ * job is only taken off a ring when its deque has room, so nothing
+ * bypasses the deques, and a worker looks for work in priority order:
+ * an interactive job queued behind a bulk storm is taken first, and
+ * before a bulk job in the worker's own deque. Workers only block (on a
+ * condition) once there is nothing left to take.
+ *
+ * A Recorder sees each drained batch before any worker can take a job
+ * from it, so bookkeeping that needs a lock (the Queue's JobJournal)
+ * takes it once a batch rather than once a push.
+ *
+ */
+
+#ifndef JOBSCHEDULER_H
+#define JOBSCHEDULER_H
+
+#include <atomic>
+#include <vector>
+
+#include "Poco/Mutex.h"
+#include "Poco/Condition.h"
+
+#include "SyncJob.h"
+#include "MPSCRing.h"
+
+// Fixed size Chase-Lev deque. The owning worker pushes and pops at the
+// bottom, other workers steal from the top.
+class WorkDeque
+{
+
+    public:
+        // CAPACITY is rounded up to a power of two
+        explicit WorkDeque( size_t capacity );
+        ~WorkDeque();
+
+        // owner only, returns false if the deque is full
+        bool push( SyncJob *job );
+        SyncJob *pop();
+
+        // owner only, how many more push() takes; thieves only make more
+        size_t room() const;
+
+        // any thread
+        SyncJob *steal();
+
+        bool empty() const;
+
+    private:
+        std::atomic<SyncJob *> *jobs_;
+        size_t mask_;
+
+        // thieves and the owner on separate cache lines
+        std::atomic<long> top_;
+        char pad_[64];
+        std::atomic<long> bottom_;
+};
+
+class JobScheduler
+{
+
+    public:
+        // called by the draining worker
+        class Recorder
+        {
+
+            public:
+                virtual ~Recorder() {};
+
+                virtual void drained( SyncJob **jobs, size_t count ) = 0;
+        };
+
+        enum Priority {
+            // single files the user just saved
+            INTERACTIVE,
+            // directory syncs
+            BULK,
+            // periodic reconciliation
+            BACKGROUND,
+
+            PRIORITY_COUNT
+        };
+
+        JobScheduler( int workers, size_t ingressCapacity = 65536, size_t dequeCapacity = 4096, Recorder *recorder = NULL );
+        ~JobScheduler();
+
+        // takes over the caller's reference to JOB, blocks while the
+        // PRIORITY's ingress ring is full
+        void push( SyncJob *job, Priority priority );
+
+        // called by worker WORKER (0 .. workers-1), blocks until there is
+        // a job or the scheduler is stopped, in which case returns NULL.
+        // The caller owns the returned reference.
+        SyncJob *next( int worker );
+
+        // as next(), but returns NULL rather than wait when there is
+        // nothing to take
+        SyncJob *poll( int worker );
+
+        // wakes all waiting workers, next() returns NULL from now on
+        void stop();
+
+        // jobs pushed but not yet taken by a worker
+        int pending() const { return pending_.load( std::memory_order_relaxed ); };
+
+        int workers() const { return workers_; };
+
+    private:
+
+        WorkDeque &deque( int worker, int priority ) { return *deques_[ worker * PRIORITY_COUNT + priority ]; };
+
+        // moves a batch from the ingress rings, in priority order, into
+        // WORKER's deques while they have room. Does nothing if another
+        // worker is already draining.
+        void drain( int worker );
+
+        // non-blocking, NULL if there is nothing anywhere
+        SyncJob *take( int worker );
+
+        bool idle() const;
+
+        // ALL for a batch of work (or shutdown), otherwise a single worker
+        void wake( bool all );
+
+    // data
+    private:
+        // one per Priority, only popped by the worker holding draining_
+        MPSCRing<SyncJob *> *ingress_[ PRIORITY_COUNT ];
+
+        std::atomic<bool> draining_;
+
+        Recorder *recorder_;
+
+        // one deque per worker and Priority
+        std::vector<WorkDeque *> deques_;
+        int workers_;
+
+        std::atomic<int> pending_;
+        std::atomic<int> sleepers_;
+        std::atomic<bool> stopped_;
+
+        Poco::FastMutex sleepMutex_;
+        Poco::Condition sleep_;
+};
+
+#endif // JOBSCHEDULER_H
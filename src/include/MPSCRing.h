@@ -0,0 +1,134 @@
+/**
+ * \file MPSCRing.h
+ *
+ * \brief - Bounded lock-free multi-producer, single-consumer ring
+ *
+ * \details
+ * Vyukov's bounded queue. Any thread may push, only one thread at a
+ * time may pop - the caller has to guarantee that. Push never blocks,
+ * it fails when the ring is full and the caller decides whether to
+ * wait or drop.
+ *
+ * T is copied in and out, keep it small (a pointer or two).
+ *
+ */
+
+#ifndef MPSCRING_H
+#define MPSCRING_H
+
+#include <atomic>
+#include <cstddef>
+
+template <class T>
+class MPSCRing
+{
+
+    public:
+        // CAPACITY is rounded up to a power of two
+        explicit MPSCRing( size_t capacity ) : tail_(0), head_(0)
+        {
+            size_t size = 2;
+
+            while ( size < capacity ) {
+
+                size <<= 1;
+            }
+
+            mask_ = size - 1;
+            cells_ = new Cell[ size ];
+
+            for ( size_t i = 0; i < size; i++ ) {
+
+                cells_[i].sequence.store( i, std::memory_order_relaxed );
+            }
+        };
+
+        ~MPSCRing() { delete [] cells_; };
+
+        // returns false if the ring is full
+        bool push( const T &value )
+        {
+            Cell *cell;
+            size_t pos = tail_.load( std::memory_order_relaxed );
+
+            for ( ;; ) {
+
+                cell = &cells_[ pos & mask_ ];
+
+                size_t seq = cell->sequence.load( std::memory_order_acquire );
+                long diff = (long) seq - (long) pos;
+
+                if ( diff == 0 ) {
+
+                    // the slot is free, claim it
+                    if ( tail_.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) ) {
+
+                        break;
+                    }
+                }
+                else if ( diff < 0 ) {
+
+                    // the consumer has not freed the slot yet - full
+                    return false;
+                }
+                else {
+
+                    pos = tail_.load( std::memory_order_relaxed );
+                }
+            }
+
+            cell->value = value;
+            cell->sequence.store( pos + 1, std::memory_order_release );
+
+            return true;
+        };
+
+        // consumer only, returns false if the ring is empty
+        bool pop( T &value )
+        {
+            size_t pos = head_.load( std::memory_order_relaxed );
+
+            Cell *cell = &cells_[ pos & mask_ ];
+
+            size_t seq = cell->sequence.load( std::memory_order_acquire );
+
+            // empty, or a producer has claimed the slot but not filled it yet
+            if ( (long) seq - (long) ( pos + 1 ) < 0 ) {
+
+                return false;
+            }
+
+            value = cell->value;
+
+            head_.store( pos + 1, std::memory_order_relaxed );
+            cell->sequence.store( pos + mask_ + 1, std::memory_order_release );
+
+            return true;
+        };
+
+        bool empty() const
+        {
+            return head_.load( std::memory_order_acquire ) == tail_.load( std::memory_order_acquire );
+        };
+
+        size_t capacity() const { return mask_ + 1; };
+
+    private:
+        MPSCRing( const MPSCRing & );
+        MPSCRing &operator=( const MPSCRing & );
+
+        struct Cell {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+
+        Cell *cells_;
+        size_t mask_;
+
+        // producers and the consumer on separate cache lines
+        std::atomic<size_t> tail_;
+        char pad_[64];
+        std::atomic<size_t> head_;
+};
+
+#endif // MPSCRING_H
@@ -0,0 +1,168 @@
+/**
+ * \file Mapping.h
+ *
+ * \brief - A source directory and the destination URI(s) it is mirrored to
+ *
+ * \details
+ * The command line defines a single mapping (--src/--dest), a profile
+ * can define any number of them. All mappings share the monitor, the
+ * worker pool and the connections to each host, but each keeps its own
+ * ignore rules and statistics.
+ *
+ * The ignore list applies to the whole tree; an IGNORE_FILE in any
+ * directory adds rules for its subtree. Each directory's rules are read
+ * once and kept until its ignore file changes.
+ *
+ * A mapping can have several destinations. Each destination is served
+ * by the Queue for its host, so a slow host never holds up a fast one.
+ *
+ */
+
+#ifndef MAPPING_H
+#define MAPPING_H
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "Poco/Path.h"
+#include "Poco/URI.h"
+#include "Poco/Glob.h"
+#include "Poco/AtomicCounter.h"
+#include "Poco/Mutex.h"
+#include "Poco/SharedPtr.h"
+#include "Poco/Logger.h"
+
+#include "DirectoryScanner.h"
+#include "RemoteManifest.h"
+#include "JobJournal.h"
+#include "SignatureCache.h"
+#include "IgnoreRules.h"
+
+class Queue;
+
+class Destination
+{
+
+    public:
+        // MANIFEST is the file our model of the remote tree is kept in,
+        // JOURNAL the one changes not yet sent are recorded in, SIGNATURES
+        // the directory for the block checksums of what was sent
+        Destination( int id, const std::string &uri, const std::string &manifest, const std::string &journal, const std::string &signatures );
+        ~Destination();
+
+        int id() const { return id_; };
+
+        const Poco::URI &remote() const { return remote_; };
+
+        const std::string &user() const { return user_; };
+        const std::string &password() const { return password_; };
+
+        // identifies the connection - destinations with the same key share
+        // a Queue, its workers and their sessions
+        std::string hostKey() const;
+
+        Queue *queue() const { return queue_; };
+        void setQueue( Queue *queue ) { queue_ = queue; };
+
+        RemoteManifest &manifest() const { return *manifest_; };
+
+        JobJournal &journal() const { return *journal_; };
+
+        SignatureCache &signatures() const { return *signatures_; };
+
+        // statistics
+        void synced() { synced_++; };
+        void unchanged() { unchanged_++; };
+        void failed() { failed_++; };
+        void deleted( int count );
+
+        void logStatistics( Poco::Logger &logger, const std::string &mapping ) const;
+
+    private:
+
+        int id_;
+
+        Poco::URI remote_;
+
+        std::string user_;
+        std::string password_;
+
+        Queue *queue_;
+
+        RemoteManifest *manifest_;
+        JobJournal *journal_;
+        SignatureCache *signatures_;
+
+        Poco::AtomicCounter synced_;
+        Poco::AtomicCounter unchanged_;
+        Poco::AtomicCounter failed_;
+        Poco::AtomicCounter deleted_;
+};
+
+class Mapping : public ScanFilter
+{
+
+    public:
+        // DEST is a space separated list of URIs
+        Mapping( int id, const std::string &name, const std::string &src, const std::string &dest, const std::string &ignore, const std::string &privateKey );
+        ~Mapping();
+
+        int id() const { return id_; };
+        const std::string &name() const { return name_; };
+
+        // absolute, always ends with a separator
+        const Poco::Path &local() const { return local_; };
+
+        const std::vector<Destination *> &destinations() const { return destinations_; };
+        Destination &destination( int id ) const { return *destinations_[ id ]; };
+
+        std::string privateKey() const;
+
+        // PATH is relative to local()
+        bool ignored( const std::string &path ) const;
+
+        // replaces the ignore list and key file (a reload), jobs already
+        // running keep the old ones. True if the ignore list changed.
+        bool configure( const std::string &ignore, const std::string &privateKey );
+
+        // the IGNORE_FILE in DIR (relative to local(), "" for the top) was
+        // changed or removed, its rules are read again when next needed
+        void ignoreChanged( const std::string &dir );
+
+        // strips local() from an absolute PATH, returns false if PATH is not inside it
+        bool relative( const std::string &path, std::string &relativePath ) const;
+
+        // statistics, per destination counts are kept by each Destination
+        void skipped() { skipped_++; };
+
+        void logStatistics( Poco::Logger &logger ) const;
+
+    private:
+
+        int id_;
+        std::string name_;
+
+        Poco::Path local_;
+
+        std::vector<Destination *> destinations_;
+
+        typedef std::vector<Poco::SharedPtr<Poco::Glob> > Globs;
+
+        // both replaced by configure(), under mutex_
+        std::string privateKey_;
+
+        std::string ignoreList_;
+        Poco::SharedPtr<const Globs> ignore_;
+
+        // the rules of DIR's IGNORE_FILE, NULL if it has none
+        Poco::SharedPtr<IgnoreRules> rules( const std::string &dir ) const;
+
+        // per directory, NULL cached too - most directories have no rules
+        mutable Poco::FastMutex mutex_;
+        mutable std::map<std::string, Poco::SharedPtr<IgnoreRules> > rules_;
+
+        Poco::AtomicCounter skipped_;
+};
+
+#endif // MAPPING_H
@@ -0,0 +1,112 @@
+/**
+ * \file MerkleAudit.h
+ *
+ * \brief - Background check that each destination still matches the source
+ *
+ * \details
+ * Missed events, monitor overflows and edits made on the remote side all
+ * leave the destination different from the source with nothing noticing
+ * until the next restart. The audit finds them cheaply.
+ *
+ * Every directory gets a hash: the MD5 of
+ *
+ *   find . -type f -print0 | LC_ALL=C sort -z | xargs -0 -r md5sum
+ *
+ * run inside it. The local side keeps these up to date from a scan,
+ * only re-reading files whose size or time changed. The remote side
+ * computes the same with standard tools, one directory level per
+ * command. The audit compares the root first and only descends into
+ * directories whose hashes differ, so an unchanged tree costs one line
+ * of output however large it is. Anything that differs gets a repair
+ * sync queued at background priority.
+ *
+ * The audit only runs while the Queue is idle, and pauses between
+ * remote commands and while hashing, so it never holds up a save.
+ *
+ */
+
+#ifndef MERKLEAUDIT_H
+#define MERKLEAUDIT_H
+
+#include <string>
+#include <map>
+
+#include "Poco/Types.h"
+#include "Poco/Timer.h"
+#include "Poco/SharedPtr.h"
+#include "Poco/Logger.h"
+
+#include "DirectoryScanner.h"
+
+class Queue;
+class SyncWorker;
+class Mapping;
+class Destination;
+
+class MerkleAudit
+{
+
+    public:
+        // audits every destination served by QUEUE each INTERVAL seconds
+        MerkleAudit( Queue *queue, long interval );
+        ~MerkleAudit();
+
+    private:
+        struct FileHash {
+            Poco::UInt64 size;
+            Poco::Int64 mtime;
+            std::string md5;        // hex
+        };
+
+        // the local side of one mapping
+        struct Tree {
+            Manifest manifest;
+
+            // keyed by path, kept across audits so only changed files are read
+            std::map<std::string, FileHash> files;
+
+            // directory ("" for the root) to hash
+            std::map<std::string, std::string> dirs;
+        };
+
+        // a remote directory's immediate children: name to type ('f' or 'd') and hash
+        typedef std::map<std::string, std::pair<char, std::string> > Listing;
+
+        void onAudit( Poco::Timer &timer );
+
+        // rescans MAPPING and rebuilds TREE's directory hashes
+        void rehash( const Mapping &mapping, Tree &tree );
+
+        void audit( const Mapping &mapping, Destination &destination, const Tree &tree );
+
+        // compares DIR's children, descends into those that differ
+        void compare( const Mapping &mapping, Destination &destination, const Tree &tree, const std::string &dir, int &repairs );
+
+        bool remoteRoot( const Mapping &mapping, const Destination &destination, std::string &hash );
+        bool remoteListing( const Mapping &mapping, const Destination &destination, const std::string &dir, Listing &listing );
+
+        void repair( const Mapping &mapping, Destination &destination, const std::string &path, bool isDir );
+
+        // waits until the Queue has nothing to do, then a little longer
+        void idle();
+
+        static std::string md5File( const std::string &path );
+
+    // data
+    private:
+        Queue *queue_;
+
+        // runs the remote commands, never takes jobs
+        Poco::SharedPtr<SyncWorker> worker_;
+
+        // keyed by mapping id
+        std::map<int, Tree *> trees_;
+
+        long pace_;
+
+        Poco::Timer timer_;
+
+        Poco::Logger &logger_;
+};
+
+#endif // MERKLEAUDIT_H
@@ -0,0 +1,96 @@
+/**
+ * \file Notifier.h
+ *
+ * \brief - Desktop notifications, gathered and sent off the workers' threads
+ *
+ * \details
+ * Each synced file used to build a Growl object (registering with the
+ * notification server) and send its notification from the worker, so
+ * every transfer waited on a round trip to Growl and a branch switch
+ * put up hundreds of popups.
+ *
+ * Workers now only count their results here, under a lock, and carry
+ * on. The notifier's thread waits WINDOW ms after the first result for
+ * the rest of the burst, then sends one notification for all of them -
+ * the path for a single file, "Updated 143 files, 2 failed" (with the
+ * first few that failed) for more. It registers with Growl once and
+ * keeps the one Growl object for every notification after that.
+ *
+ */
+
+#ifndef NOTIFIER_H
+#define NOTIFIER_H
+
+#include <string>
+#include <vector>
+
+#include "Poco/Runnable.h"
+#include "Poco/Thread.h"
+#include "Poco/Mutex.h"
+#include "Poco/Condition.h"
+#include "Poco/SharedPtr.h"
+#include "Poco/Logger.h"
+
+#if USE_GROWL
+#include "growl.hpp"
+#endif
+
+class Notifier : public Poco::Runnable
+{
+
+    public:
+        // WINDOW in milliseconds
+        Notifier( long window );
+
+        // sends what is still gathered
+        ~Notifier();
+
+        // PATH (relative to its mapping) was sent or could not be, never
+        // waits for a notification to go out
+        void updated( const std::string &path, bool directory );
+        void failed( const std::string &path, bool directory );
+
+        virtual void run();
+
+    private:
+        struct Batch {
+            Batch() : files(0), directories(0), failed(0), directory(false) {};
+
+            int files;
+            int directories;
+            int failed;
+
+            // the only path, when there is just one
+            std::string path;
+            bool directory;
+
+            // the first few that failed
+            std::vector<std::string> failures;
+        };
+
+        void add( const std::string &path, bool directory, bool ok );
+
+        // on the notifier's thread
+        void send( const Batch &batch );
+
+    // data
+    private:
+        long window_;
+
+        Poco::FastMutex mutex_;
+        Poco::Condition ready_;
+
+        Batch batch_;
+        bool stopped_;
+
+        Poco::Thread thread_;
+
+#if USE_GROWL
+        // registered on first use, then kept
+        Poco::SharedPtr<Growl> growl_;
+#endif
+
+        Poco::Logger &logger_;
+};
+
+#endif // NOTIFIER_H
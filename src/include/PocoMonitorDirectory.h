@@ -11,9 +11,12 @@ class PocoMonitorDirectory : MonitorDirectory
 {
     public:
 
-        PocoMonitorDirectory( const std::string &path);
+        PocoMonitorDirectory( const std::string &path, int mapping );
 
     private:
+        // PATH relative to the source of our mapping
+        std::string relative( const std::string &path );
+
         void onItemAdded(const Poco::DirectoryWatcher::DirectoryEvent& ev);
 
         void onItemRemoved(const Poco::DirectoryWatcher::DirectoryEvent& ev);
@@ -26,5 +29,7 @@ class PocoMonitorDirectory : MonitorDirectory
 
         Poco::SharedPtr<Poco::DirectoryWatcher> watcher_;
 
+        int mapping_;
+
 };
 
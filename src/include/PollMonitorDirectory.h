@@ -0,0 +1,134 @@
+/**
+ * \file PollMonitorDirectory.h
+ *
+ * \brief - Monitors every mapping by polling a cache of stat() results
+ *
+ * \details
+ * Inside some containers and VMs, and on network mounts, the kernel
+ * never reports a change. Poco's DirectoryWatcher polls too, but with a
+ * watcher and a thread for every directory, and it drops removals and
+ * moves.
+ *
+ * One thread keeps the last stat() of every entry below each mapping's
+ * source. A directory is only listed again when its own modification
+ * time has moved (something in it was created, removed or renamed); its
+ * files are stat()ed in place, from one open descriptor, to catch writes
+ * and changes of mode. Directories are looked at on their own schedule:
+ * one that just changed again after POLLMIN ms, one that has been quiet
+ * a while less and less often, up to POLLMAX. A round stops after a
+ * slice of work, and the thread then sleeps long enough to stay under
+ * BUDGET percent of a core, so a large tree is polled more slowly rather
+ * than costing more.
+ *
+ * Every change is reported as the other monitors do: created and written
+ * files, changes of mode, removals (a removed directory as a single
+ * path) and new directories. A move shows up as a removal and a
+ * creation, paired by inode for the log. Directories the mapping
+ * ignores, and the sources of nested mappings, are not looked into.
+ *
+ */
+
+#ifndef POLLMONITORDIRECTORY_H
+#define POLLMONITORDIRECTORY_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+#include <sys/types.h>
+
+#include "Poco/Runnable.h"
+#include "Poco/Thread.h"
+#include "Poco/Event.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Logger.h"
+
+#include "MonitorDirectory.h"
+#include "Mapping.h"
+
+class PollMonitorDirectory : public MonitorDirectory, public Poco::Runnable
+{
+    public:
+
+        // POLLMIN and POLLMAX in milliseconds, BUDGET in percent of a core
+        PollMonitorDirectory( const std::vector<Mapping *> &mappings, long pollMin, long pollMax, int budget );
+
+        ~PollMonitorDirectory();
+
+        virtual void run();
+
+    private:
+
+        // a mapping and a directory relative to its source, "" for the top
+        typedef std::pair<int, std::string> Key;
+
+        struct Entry {
+            Poco::Int64 size;
+            Poco::Int64 modified;       // microseconds
+            Poco::UInt64 inode;
+            mode_t mode;
+            bool skipped;               // a directory that is not looked into
+        };
+
+        struct Dir {
+            Poco::Int64 modified;       // of the directory itself
+            std::map<std::string, Entry> entries;
+
+            Poco::Int64 interval;       // ms between looks
+            Poco::Int64 due;            // ms since started_
+        };
+
+        // paths removed and created in one round, by inode
+        typedef std::map<Poco::UInt64, std::string> Moves;
+
+        Poco::Int64 now() const;
+
+        // absolute path of DIR in MAPPING
+        std::string absolute( int mapping, const std::string &dir ) const;
+
+        static std::string join( const std::string &dir, const std::string &name );
+
+        // false for a directory that is ignored or another mapping's source
+        bool watched( int mapping, const std::string &path ) const;
+
+        // reads DIR and everything below it into the cache without
+        // reporting anything, each new directory first looked at after
+        // INTERVAL ms
+        void add( int mapping, const std::string &dir, Poco::Int64 interval );
+
+        // drops DIR and everything below it from the cache
+        void forget( int mapping, const std::string &dir );
+
+        void schedule( const Key &key, Dir &dir, Poco::Int64 due );
+
+        // looks at one directory, true if anything in it changed
+        bool poll( const Key &key, Dir &dir, Moves &removed, Moves &created );
+
+        void reportRemoved( int mapping, const std::string &path, const Entry &entry, Moves &removed );
+        void reportCreated( int mapping, const std::string &path, Entry &entry, Moves &created );
+
+        static void fill( const struct stat &st, Entry &entry );
+
+    // data
+    private:
+
+        std::vector<Mapping *> mappings_;
+
+        // the sources of all mappings, nested ones are left to their own
+        std::set<std::string> roots_;
+
+        Poco::Int64 pollMin_;
+        Poco::Int64 pollMax_;
+        int budget_;
+
+        std::map<Key, Dir> dirs_;
+        std::set<std::pair<Poco::Int64, Key> > schedule_;
+
+        Poco::Timestamp started_;
+
+        Poco::Event stop_;
+        Poco::Thread thread_;
+};
+
+#endif // POLLMONITORDIRECTORY_H
@@ -1,9 +1,24 @@
 
-#include "Poco/PriorityNotificationQueue.h"
 #include "Poco/ThreadPool.h"
 #include "Poco/Thread.h"
 #include "Poco/URI.h"
 #include "Poco/Glob.h"
+#include "Poco/Mutex.h"
+#include "Poco/Timer.h"
+#include "Poco/AtomicCounter.h"
+#include "Poco/Timestamp.h"
+
+#include <set>
+#include <map>
+
+#include "Mapping.h"
+#include "SyncJob.h"
+#include "JobScheduler.h"
+#include "MerkleAudit.h"
+#include "SSHPool.h"
+#include "TransferEngine.h"
+#include "RateLimiter.h"
+#include "AgentClient.h"
 
 #include <rsync/rsync_client.h>
 #include <rsync/rsync_sshio.h>
@@ -12,85 +27,204 @@
 #ifndef QUEUE_H
 #define QUEUE_H
 
-#define MSG_SYNC "SyncMessage"
-#define MSG_FILE_SYNC "FileSyncMessage"
-#define MSG_DIR_SYNC "DirSyncMessage"
+class Queue;
 
-class SyncMessage : public Poco::Notification
+class SyncWorker : public Poco::Runnable 
 {
 
     public:
-        SyncMessage( const std::string &path ) : path_(path), type_(MSG_SYNC) { };
-        SyncMessage( const std::string &path, const std::string &type ) : path_(path), type_(type) { };
+        // INDEX identifies the worker to the Queue's scheduler, 0 .. count-1
+        SyncWorker( const std::string &name, int index, Queue *owner );
 
-        const virtual std::string &path() { return path_; };
-        const virtual std::string type() { return type_; };
+        virtual void run() {} ;
+        virtual std::string name() { return name_; };
 
-    protected:
-        std::string path_;
-        std::string type_;
-};
+        virtual void initialize() {};
 
-class FileSyncMessage : public SyncMessage
-{
+        // run COMMAND on the remote host, in the destination directory,
+        // its standard output goes to OUTPUT if given, otherwise the log
+        virtual bool runRemote( const Mapping &mapping, const Destination &destination, const std::string &command, std::string *output = NULL ) { return false; };
 
-    public:
-        FileSyncMessage( const std::string &path ) : SyncMessage(path, MSG_FILE_SYNC) { };
-};
+        // remove PATHS (relative to the destination) from the remote host
+        bool deleteRemote( const Mapping &mapping, const Destination &destination, const std::set<std::string> &paths );
 
-class DirSyncMessage : public SyncMessage
-{
+        // removes PATHS, already filtered by deleteRemote(), with rm -rf
+        // through runRemote() in batches
+        virtual bool removeRemote( const Mapping &mapping, const Destination &destination, const std::vector<std::string> &paths );
 
-    public:
-        DirSyncMessage( const std::string &path ) : SyncMessage(path, MSG_DIR_SYNC) { };
-};
+        // handles a SyncJob::DELETE_SYNC - removes everything queued for the destination
+        void syncDeletes( const Mapping &mapping, Destination &destination );
 
-class SyncWorker : public Poco::Runnable 
-{
+        // lists every destination served by our Queue into its RemoteManifest,
+        // only the first worker to get here does it
+        void seedManifests();
 
-    public:
-        SyncWorker( const std::string &name, Poco::PriorityNotificationQueue *queue) : name_(name), queue_( queue ), logger_(Poco::Logger::get("SyncWorker")) {} ;
+        // lists DESTINATION again, logs how far it had drifted from the manifest
+        void verifyManifest( const Mapping &mapping, Destination &destination );
 
-        virtual void run() {} ;
-        virtual std::string name() { return name_; };
+        // notes the size and time of JOB's file before anything of it is
+        // read, what transferred() records for it
+        void begin( const Mapping &mapping, SyncJob &job );
 
-        virtual void initialize() {};
+        // true if the manifest says the remote copy of PATH matches the local file
+        bool unchanged( const Mapping &mapping, Destination &destination, const std::string &path );
+
+        // what a file job has to bring over
+        enum Change {
+            UNCHANGED,      // the remote copy is up to date
+            TIMESTAMP,      // only the times moved
+            PERMISSION,     // only the mode or owner moved
+            CONTENT
+        };
+
+        // compares JOB's file with DESTINATION's manifest, taking the monitor's
+        // word (SyncJob::METADATA) and the content hash into account
+        Change classify( const Mapping &mapping, Destination &destination, SyncJob &job );
+
+        // true if the local copy of JOB's file holds the bytes last sent to
+        // DESTINATION, only its times or mode differ. Takes the content
+        // hash into JOB either way.
+        bool identical( const Mapping &mapping, Destination &destination, SyncJob &job );
+
+        // brings the times and mode of JOB's remote copy up to date without
+        // sending its contents, false if that can not be done here and the
+        // file has to be transferred. The worker ends the job.
+        virtual bool sendMetadata( const Mapping &mapping, Destination &destination, SyncJob *job ) { return false; };
+
+        // JOB's file or directory was transferred, bring the manifest up to
+        // date with what it was when the job began(), and the content hash
+        void transferred( const Mapping &mapping, Destination &destination, const SyncJob &job );
+
+        // the time (seconds) the manifest can keep for JOB's file, UNKNOWN
+        // if a write after the job began could have left the same time
+        static Poco::Int64 settled( const SyncJob &job );
+
+        // JOB has been handled, records it in the destination's JobJournal
+        // and replays what is outstanding once a failing destination recovers
+        void completed( const Mapping &mapping, Destination &destination, const SyncJob &job, bool success );
+
+        // the share of our host's bandwidth JOB's transfer draws from
+        static RateLimiter::Class trafficClass( const SyncJob &job );
 
 
     protected:
         std::string name_;
-        Poco::PriorityNotificationQueue *queue_;
 
+        // blocks until there is a job for this worker, NULL on shutdown.
+        // The caller owns the returned reference.
+        SyncJob *next();
 
-        std::vector<Poco::Glob *> ignore_;
+        // the next job if one is waiting, otherwise NULL at once
+        SyncJob *poll();
 
-        Poco::SharedPtr<Poco::URI> remote_;
+        // the Queue for our host
+        Queue *owner_;
+        int index_;
 
     private:
         Poco::Logger &logger_;
 };
 
 
-class Queue : public Poco::PriorityNotificationQueue
+// One Queue per destination host, each with its own workers (but all
+// running in the shared thread pool) so that a slow host never holds up
+// the others.
+class Queue : public JobScheduler::Recorder
 {
 
     public:
-        Queue();
+        Queue( const std::string &name, Poco::ThreadPool &pool );
+
+        const std::string &name() { return name_; };
+
+        // takes over the caller's reference to JOB
+        void enqueue( SyncJob *job, JobScheduler::Priority priority );
+
+        JobScheduler &scheduler() { return *scheduler_; };
+
+        // sessions to our host, only with the acrosync method
+        SSHPool &sessions() { return *sessions_; };
+
+        // runs the rsync processes for our host, only with the rsync method
+        TransferEngine &transfers() { return *transfers_; };
 
-        Poco::PriorityNotificationQueue *queue() { return queue_; };
+        // shares the bandwidth to our host between interactive and bulk jobs
+        RateLimiter &bandwidth() { return *bandwidth_; };
+
+        // the srcsync-agent for DESTINATION, started with COMMAND and ARGS
+        // the first time it is asked for. NULL if it would not start, it is
+        // not tried again for a minute.
+        Poco::SharedPtr<AgentClient> agent( const Mapping &mapping, const Destination &destination, const std::string &command, const std::vector<std::string> &args );
+
+        // progress of this queue alone, jobs being processed and waiting
+        void jobStart() { jobCount_++; };
+        void jobEnd() { jobCount_--; };
+
+        // the worker is done with JOB, it no longer holds replay() back
+        void finished( const SyncJob &job );
+        int jobCount() { return jobCount_.value(); };
+        int pending() { return scheduler_->pending(); };
         
         // rsync library only has a single logger object so this can't be wired into the workers.
         void outputCallback(const char * path, bool isDir, int64_t size, int64_t time, const char * symlink);
         void statusCallback(const char * status);
         void logCallback(const char *id, int level, const char *message);
 
+        // PATH (relative to the MAPPING's source) has been removed
+        void queueDelete( int mapping, int destination, const std::string &path );
+
+        // collects all pending deletes, returns false if there were none
+        bool takeDeletes( int mapping, int destination, std::set<std::string> &paths );
+
+        // queues everything DESTINATION's JobJournal still has outstanding
+        // that is not already queued or in flight, returns how many paths
+        // that was
+        size_t replay( const Mapping &mapping, Destination &destination );
+
     private:
 
+        void onReconcile( Poco::Timer &timer );
+
+        // records the batch's new jobs in their destinations' JobJournals,
+        // one lock per destination rather than one per enqueue()
+        void drained( SyncJob **jobs, size_t count );
+
     // data
     private:
+        std::string name_;
+
         std::vector<SyncWorker *> workers_;
-        Poco::SharedPtr<Poco::PriorityNotificationQueue> queue_;
-        Poco::SharedPtr<Poco::ThreadPool> pool_;
+        Poco::SharedPtr<JobScheduler> scheduler_;
+
+        Poco::SharedPtr<SSHPool> sessions_;
+        Poco::SharedPtr<TransferEngine> transfers_;
+        Poco::SharedPtr<RateLimiter> bandwidth_;
+
+        Poco::FastMutex agentMutex_;
+        // keyed by mapping, destination
+        std::map<std::pair<int, int>, Poco::SharedPtr<AgentClient> > agents_;
+        std::map<std::pair<int, int>, Poco::Timestamp> agentFailed_;
+
+        Poco::AtomicCounter jobCount_;
+
+        // jobs enqueued and not yet finished(), by mapping, destination
+        // and path, so a replay does not send them twice
+        typedef std::pair<std::pair<int, int>, PathTable::Id> Outstanding;
+
+        Poco::FastMutex outstandingMutex_;
+        std::map<Outstanding, int> outstanding_;
+
+        Poco::FastMutex deleteMutex_;
+        // keyed by mapping, destination
+        std::map<std::pair<int, int>, std::set<std::string> > deletes_;
+
+        // periodic directory level sync, catches anything the 
+        // delete fast path (or the monitor) missed
+        Poco::SharedPtr<Poco::Timer> reconcile_;
+
+        // content comparison with each destination, repairs what the
+        // reconciliation can not see (i.e. remote edits)
+        Poco::SharedPtr<MerkleAudit> audit_;
 
         Poco::Logger &logger_;
 };
@@ -0,0 +1,153 @@
+/**
+ * \file RateLimiter.h
+ *
+ * \brief - Shares one host's bandwidth between interactive and bulk transfers
+ *
+ * \details
+ * An initial sync or a branch switch used to fill the uplink, and a file
+ * the user had just saved waited behind it - tens of seconds on a shared
+ * VPN link.
+ *
+ * Two token buckets split the configured rate. The reserved one fills at
+ * the interactive share and only interactive transfers draw from it; the
+ * shared one fills at the rest. Tokens the reserved bucket can not hold
+ * (nobody interactive is sending) overflow into the shared one, so bulk
+ * traffic gets the whole link while the user is not saving anything.
+ * Interactive transfers may borrow from the shared bucket too, and bulk
+ * transfers wait while an interactive one is waiting.
+ *
+ * A transfer reserves what it expects to send as it is admitted, so
+ * transfers started together can not all spend the same tokens, and
+ * settles the difference once it knows what it sent. One that does not
+ * fit is handed over as a Ticket and started by the limiter's own thread
+ * when it does; the worker goes on to its next job rather than sleeping,
+ * so bulk transfers waiting out a debt never keep an interactive job from
+ * being dequeued. A transfer larger than a bucket holds only needs a full
+ * one, and leaves it in debt.
+ *
+ */
+
+#ifndef RATELIMITER_H
+#define RATELIMITER_H
+
+#include <string>
+
+#include <deque>
+
+#include "Poco/Mutex.h"
+#include "Poco/Condition.h"
+#include "Poco/Runnable.h"
+#include "Poco/Thread.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Types.h"
+#include "Poco/Logger.h"
+
+class RateLimiter : public Poco::Runnable
+{
+
+    public:
+        enum Class {
+            // files the user just saved, draw from the reserved share first
+            INTERACTIVE,
+            // directory syncs, reconciliation and audit repairs
+            BULK
+        };
+
+        // what a transfer took from the buckets, handed back to settle()
+        struct Reservation {
+            Reservation() : cls(BULK), bytes(0), shared(true) {};
+
+            Class cls;
+            Poco::Int64 bytes;
+            // drawn from the shared bucket, an interactive transfer may borrow it
+            bool shared;
+        };
+
+        // starts a transfer once its bytes are reserved
+        class Ticket
+        {
+
+            public:
+                Ticket() : waited_(false) {};
+                virtual ~Ticket() {};
+
+                virtual void admitted() = 0;
+
+                // admitted() runs on the limiter's thread, not the caller's
+                bool waited() const { return waited_; };
+
+                // valid from admitted() on
+                const Reservation &reservation() const { return reservation_; };
+
+            private:
+                friend class RateLimiter;
+
+                bool waited_;
+                Reservation reservation_;
+        };
+
+        // RATE in KB/s, 0 for no limit, SHARE is the percentage of it
+        // reserved for interactive transfers
+        RateLimiter( const std::string &name, long rate, int share );
+
+        // tickets still waiting are dropped
+        ~RateLimiter();
+
+        // can be called while transfers are waiting
+        void configure( long rate, int share );
+
+        long rate();
+        int share();
+
+        // reserves BYTES for a transfer of CLASS and starts it with
+        // TICKET, which it takes over. Returns false if the buckets do not
+        // have them yet, the ticket is then admitted once they do,
+        // interactive ones first.
+        bool admit( Class cls, Poco::Int64 bytes, Ticket *ticket );
+
+        // a transfer that made RESERVATION sent SENT, the difference goes
+        // to (or comes from) the bucket it drew from
+        void settle( const Reservation &reservation, Poco::Int64 sent );
+
+        // the most a single transfer of CLASS may use, in KB/s, 0 for no
+        // limit. For transfers (rsync --bwlimit) that pace themselves.
+        long limit( Class cls );
+
+        // admits waiting tickets
+        void run();
+
+    private:
+        // adds the tokens earned since the last refill, caller holds mutex_
+        void refill();
+
+        // takes RESERVATION's bytes from a bucket its class may use if one
+        // has them and notes which, caller holds mutex_. Otherwise the
+        // seconds until one might.
+        bool reserve( Reservation &reservation, double &wait );
+
+    // data
+    private:
+        std::string name_;
+
+        Poco::FastMutex mutex_;
+        Poco::Condition changed_;
+
+        // bytes per second, share_ is 0 .. 1
+        double rate_;
+        double share_;
+
+        // tokens in bytes, negative while in debt
+        double reserved_;
+        double shared_;
+        Poco::Timestamp refilled_;
+
+        // in the order they were held back, by class
+        std::deque<Ticket *> waiting_[2];
+
+        bool stopped_;
+        Poco::Thread thread_;
+
+        Poco::Logger &logger_;
+};
+
+#endif // RATELIMITER_H
@@ -0,0 +1,124 @@
+/**
+ * \file RemoteManifest.h
+ *
+ * \brief - What srcsync believes is on a destination
+ *
+ * \details
+ * srcsync is the only writer to the remote tree, so instead of asking
+ * the remote about every file we keep a model of it: seeded by one
+ * listing when the workers connect, then updated after each successful
+ * transfer or delete. A file whose size and modification time match
+ * the model is not sent again.
+ *
+ * The model is written to the state directory, so a restart starts from
+ * the last known state until the new listing arrives. Drift (i.e.
+ * someone editing the remote copy) is only looked for when the periodic
+ * reconciliation lists the remote again.
+ *
+ * The model also keeps a hash of the contents of each file it sent, so a
+ * file rewritten with the same bytes (a formatter, a checkout of the same
+ * commit) only needs its times and mode brought up to date. A hash
+ * survives a new listing as long as the remote file's size and time have
+ * not moved.
+ *
+ * The listing is "find -printf" output, which needs GNU find on the
+ * remote host. Without it the model is never seeded and every change
+ * is transferred as before.
+ *
+ */
+
+#ifndef REMOTEMANIFEST_H
+#define REMOTEMANIFEST_H
+
+#include <string>
+#include <map>
+
+#include "Poco/Types.h"
+#include "Poco/Mutex.h"
+
+class Manifest;
+
+class RemoteManifest
+{
+
+    public:
+        struct Entry {
+            char type;              // 'f', 'd' or 'l', as find's %y
+            Poco::UInt64 size;
+            Poco::Int64 mtime;      // seconds since the epoch, UNKNOWN if not to be trusted
+            Poco::UInt64 hash;      // XXH64 of the contents sent, 0 if not known
+        };
+
+        // the time of a file that may have been written again, within the
+        // same second, after what was sent was read. Never current.
+        static const Poco::Int64 UNKNOWN = -1;
+
+        // FILE is where the model is persisted
+        RemoteManifest( const std::string &file );
+
+        // the remote command whose output seed() expects, run in the
+        // destination directory
+        static std::string listCommand();
+
+        // replaces the model with LISTING, returns the number of paths
+        // that differed from what we had (drift)
+        int seed( const std::string &listing );
+
+        // true once, for whichever worker should run the initial listing
+        bool claimSeed();
+
+        bool seeded() const;
+
+        // true if the remote copy of PATH is known to have SIZE and MTIME
+        bool current( const std::string &path, Poco::UInt64 size, Poco::Int64 mtime ) const;
+
+        // true if the remote copy of PATH is known to hold the SIZE bytes whose hash is HASH
+        bool sameContent( const std::string &path, Poco::UInt64 size, Poco::UInt64 hash ) const;
+
+        // the model of PATH, false if there is none
+        bool find( const std::string &path, Entry &entry ) const;
+
+        // only the time of PATH was changed, its contents are as they were
+        void touched( const std::string &path, Poco::Int64 mtime );
+
+        // HASH of what was sent, 0 if it is not known
+        void updated( const std::string &path, char type, Poco::UInt64 size, Poco::Int64 mtime, Poco::UInt64 hash = 0 );
+
+        // PATH and everything below it
+        void removed( const std::string &path );
+
+        // DIR (relative, "." for the root) has just been made identical to
+        // LOCAL, by a transfer that started at STARTED (epoch microseconds).
+        // Anything modified since can not be told apart from what was
+        // sent, its time is kept as UNKNOWN.
+        void replace( const std::string &dir, const Manifest &local, Poco::Int64 started );
+
+        size_t size() const;
+
+        // both do nothing without a state file, load() returns false if
+        // there was nothing to load
+        bool load();
+        void save();
+
+    private:
+        // a saved model (HASHED) has each file's hash after its time,
+        // a listing from the remote side does not
+        static void parse( const std::string &listing, size_t start, bool hashed, std::map<std::string, Entry> &entries );
+
+        // removes DIR's contents (not DIR itself), "" for everything
+        void removeBelow( const std::string &dir );
+
+    // data
+    private:
+        std::string file_;
+
+        mutable Poco::FastMutex mutex_;
+
+        std::map<std::string, Entry> entries_;
+
+        bool seeded_;
+        bool seedClaimed_;
+        bool dirty_;
+};
+
+#endif // REMOTEMANIFEST_H
@@ -0,0 +1,90 @@
+/**
+ * \file RingChannel.h
+ *
+ * \brief - Hands log messages to a background thread for output
+ *
+ * \details
+ * Logging threads (workers, the monitor) only copy the message into a
+ * lock-free ring, formatting and the console write happen on the
+ * channel's own thread. When the ring is full messages are dropped
+ * rather than holding up a worker, the number dropped is reported
+ * through the downstream channel once there is room again.
+ *
+ * Properties
+ *
+ *   channel    name of the downstream channel (i.e. a ConsoleChannel
+ *              with a formatter)
+ *   capacity   messages held before dropping, default 8192
+ *
+ */
+
+#ifndef RINGCHANNEL_H
+#define RINGCHANNEL_H
+
+#include <atomic>
+
+#include "Poco/Channel.h"
+#include "Poco/Message.h"
+#include "Poco/AutoPtr.h"
+#include "Poco/Thread.h"
+#include "Poco/Runnable.h"
+#include "Poco/Event.h"
+#include "Poco/Mutex.h"
+#include "Poco/AtomicCounter.h"
+
+#include "MPSCRing.h"
+
+class RingChannel : public Poco::Channel, public Poco::Runnable
+{
+
+    public:
+        RingChannel();
+        RingChannel( Poco::Channel *channel );
+
+        void setChannel( Poco::Channel *channel );
+        Poco::Channel *getChannel() const { return channel_; };
+
+        void open();
+        void close();
+
+        void log( const Poco::Message &msg );
+
+        void setProperty( const std::string &name, const std::string &value );
+        std::string getProperty( const std::string &name ) const;
+
+        // messages lost to a full ring since startup
+        int dropped() const { return dropped_.value(); };
+
+        // registers "RingChannel" with Poco's LoggingFactory so it can be
+        // used from a logging configuration
+        static void registerChannel();
+
+    protected:
+        ~RingChannel();
+
+        void run();
+
+    private:
+        // writes everything queued so far, returns false if there was nothing
+        bool flush();
+
+    // data
+    private:
+        Poco::AutoPtr<Poco::Channel> channel_;
+
+        MPSCRing<Poco::Message *> *ring_;
+
+        Poco::Thread thread_;
+        Poco::FastMutex threadMutex_;
+        std::atomic<bool> running_;
+
+        // set by the output thread before it waits, so loggers only
+        // signal when there is someone to wake
+        std::atomic<bool> sleeping_;
+        Poco::Event wakeup_;
+
+        Poco::AtomicCounter dropped_;
+        int reported_;
+};
+
+#endif // RINGCHANNEL_H
@@ -2,50 +2,132 @@
 #ifndef RSYNCWORKER_H
 #define RSYNCWORKER_H
 
-#include "Poco/PriorityNotificationQueue.h"
-#include "Poco/Process.h"
-#include "Poco/ActiveMethod.h"
-#include "Poco/PipeStream.h"
+#include <map>
+#include <set>
+#include <vector>
 
-#if USE_GROWL
-#include "growl.hpp"
-#endif
+#include "Poco/Process.h"
+#include "Poco/AutoPtr.h"
 
 #include "Queue.h"
+#include "DeltaEngine.h"
 
 class RsyncWorker : public SyncWorker
 {
 
     public:
-        RsyncWorker( const std::string &name, Poco::PriorityNotificationQueue *queue);
+        RsyncWorker( const std::string &name, int index, Queue *owner );
 
         virtual void run();
 
         virtual void initialize();
 
-        Poco::ActiveMethod<bool, Poco::PipeInputStream &, RsyncWorker> readStdOut;
-        Poco::ActiveMethod<bool, Poco::PipeInputStream &, RsyncWorker> readStdErr;
+        virtual bool runRemote( const Mapping &mapping, const Destination &destination, const std::string &command, std::string *output = NULL );
+
+        // held with the rest of the burst, then sent by the destination's
+        // agent if it has one, otherwise as one chmod and touch script
+        // through runRemote()
+        virtual bool sendMetadata( const Mapping &mapping, Destination &destination, SyncJob *job );
+
+        // with the destination's agent if it has one
+        virtual bool removeRemote( const Mapping &mapping, const Destination &destination, const std::vector<std::string> &paths );
 
     private:
+        class RsyncTransfer;
+        class PackTransfer;
+        class AgentTransfer;
+        class MetadataTransfer;
+        class SpawnTicket;
+        class AgentTicket;
+
+        typedef std::vector<Poco::AutoPtr<SyncJob> > Jobs;
 
         Poco::Logger &logger_;
 
-        std::string user_;
-        std::string password_;
-        std::string private_key_;
+        // the ssh control socket shared by all of a destination's transfers,
+        // empty if they each connect
+        std::string controlPath_;
+        int controlPersist_;
+
+        // small changed files wait here, keyed by mapping and destination,
+        // until the burst they came in has been taken off the queue
+        std::map<std::pair<int, int>, Jobs> packs_;
 
-        Poco::Path local_;
+        // files whose times or mode changed, held the same way
+        std::map<std::pair<int, int>, Jobs> metadata_;
 
-#if USE_GROWL
-        Poco::SharedPtr<Growl> growl_;
-#endif
+        // srcsync-agent on the remote hosts, empty if not used
+        std::string agentCommand_;
+
+        // the local tar is GNU tar, which packing needs
+        bool packing_;
 
     protected:
-        
-        bool runRsync( const std::string & src, const std::string & dest );
 
-        bool readOutPipe( Poco::PipeInputStream & );
-        bool readErrPipe( Poco::PipeInputStream & );
+        // starts rsync for JOB on the Queue's TransferEngine, the job is
+        // finished (synced() below) from the engine's completion thread.
+        // SIGNATURE, if any, is kept for the file once it has arrived.
+        void startRsync( const Mapping &mapping, Destination &destination, SyncJob *job, const std::string & src, const std::string & dest, const Poco::SharedPtr<Signature> &signature = Poco::SharedPtr<Signature>() );
+
+        // ssh options for DESTINATION, used by rsync's --rsh and runRemote()
+        void sshArgs( const Mapping &mapping, const Destination &destination, Poco::Process::Args &args );
+
+        // ARG in single quotes, for sh; a quote in ARG becomes ESCAPED
+        static std::string quote( const std::string &arg, const std::string &escaped = "'\\''" );
+
+        // the srcsync-agent for DESTINATION, NULL if there is none
+        Poco::SharedPtr<AgentClient> agent( const Mapping &mapping, const Destination &destination );
+
+        // sends JOB's file with the agent, as a delta from the signature it
+        // was last sent with or whole. False (and nothing sent) if it is not
+        // a regular file small enough, or there is no agent; SIGNATURE is
+        // then the new one if it was made, for rsync to keep.
+        bool sendFile( const Mapping &mapping, Destination &destination, SyncJob *job, Poco::SharedPtr<Signature> &signature );
+
+        // PATH arrived as SIGNATURE describes, NULL if it did not
+        void keep( Destination &destination, const std::string &path, const Signature *signature );
+
+        // adds the small file of JOB to its destination's pack
+        void pack( const Mapping &mapping, Destination &destination, SyncJob *job );
+
+        // sends every pack, a pack of one with rsync
+        void flushPacks();
+
+        // streams JOBS' files to DESTINATION as one tar archive, unpacked
+        // there in a single pass. A BOOTSTRAP job is a directory, all of
+        // it goes. JOBS is left empty.
+        void startPack( const Mapping &mapping, Destination &destination, Jobs &jobs, bool bootstrap );
+
+        // the archive for JOBS has been unpacked, or not. With ARCHIVED
+        // only the jobs whose paths it lists were in it.
+        void packSynced( const Mapping &mapping, Destination &destination, const Jobs &jobs, bool bootstrap, bool success, const std::set<std::string> *archived = NULL );
+
+        // sends every batch of time and mode updates
+        void flushMetadata();
+
+        // sets the times and modes of JOBS' files on DESTINATION; if that
+        // can not be done in place they are sent with rsync. JOBS is left empty.
+        void startMetadata( const Mapping &mapping, Destination &destination, Jobs &jobs );
+
+        // the times and mode of JOB's file have been set, or not
+        void metadataSynced( const Mapping &mapping, Destination &destination, const SyncJob &job, bool success );
+
+        // start the transfer of JOB's path, relative to the mapping's source
+        void syncFile( const Mapping &mapping, Destination &destination, SyncJob *job );
+        void syncDir( const Mapping &mapping, Destination &destination, SyncJob *job );
+
+        // the rsync for JOB has exited
+        void synced( const Mapping &mapping, Destination &destination, const SyncJob &job, bool success );
+
+        // reports the outcome of a transfer
+        void fileSynced( const Mapping &mapping, Destination &destination, const SyncJob &job, bool st );
+        void dirSynced( const Mapping &mapping, Destination &destination, const SyncJob &job, bool st );
+
+        // JOB is no longer in progress
+        void jobEnd( const SyncJob &job );
+
+        void logOutput( const std::string &line );
+        void logError( const std::string &line );
 
 };
 
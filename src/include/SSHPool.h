@@ -0,0 +1,115 @@
+/**
+ * \file SSHPool.h
+ *
+ * \brief - Authenticated SSH sessions to one host, shared by its workers
+ *
+ * \details
+ * Each AcrosyncWorker used to connect its own session when it was
+ * created, so a Queue made its eight handshakes one after another
+ * before anything was synced, and kept every session open for good.
+ *
+ * The pool connects only when a worker needs a session and none is
+ * idle. Several workers can connect at once, so the first sync waits
+ * for a single handshake. A worker borrows a session for one job and
+ * gives it back. Idle sessions get a keepalive (a no-op command, which
+ * also shows whether the connection still works) and are closed once
+ * they have not been used for a while. After a failed connection, new
+ * attempts wait for a backoff that doubles up to a minute.
+ *
+ */
+
+#ifndef SSHPOOL_H
+#define SSHPOOL_H
+
+#include <string>
+#include <deque>
+
+#include "Poco/Mutex.h"
+#include "Poco/Timer.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Logger.h"
+
+#include <rsync/rsync_sshio.h>
+
+class Mapping;
+class Destination;
+
+class SSHPool
+{
+
+    public:
+        // NAME identifies the host in the log, IDLE and KEEPALIVE are in seconds
+        SSHPool( const std::string &name, long idle, long keepalive );
+        ~SSHPool();
+
+        // an idle session if there is one, otherwise a new connection.
+        // Throws if the host can not be reached.
+        rsync::SSHIO *borrow( const Mapping &mapping, const Destination &destination );
+
+        // SSHIO is closed rather than kept if it lost its connection
+        void giveBack( rsync::SSHIO *sshio );
+
+        // sessions open, lent out or idle
+        size_t size();
+
+        // a session for the life of a scope
+        class Lease
+        {
+
+            public:
+                Lease( SSHPool &pool, const Mapping &mapping, const Destination &destination ) : pool_(pool), sshio_( pool.borrow( mapping, destination ) ) {};
+                ~Lease() { pool_.giveBack( sshio_ ); };
+
+                rsync::SSHIO *get() const { return sshio_; };
+                rsync::SSHIO *operator->() const { return sshio_; };
+
+            private:
+                Lease( const Lease & );
+                Lease &operator=( const Lease & );
+
+                SSHPool &pool_;
+                rsync::SSHIO *sshio_;
+        };
+
+    private:
+        struct Idle {
+            rsync::SSHIO *sshio;
+            Poco::Timestamp since;      // given back
+            Poco::Timestamp checked;    // last keepalive
+        };
+
+        rsync::SSHIO *connect( const Mapping &mapping, const Destination &destination );
+
+        // a connection attempt failed, the next one waits longer
+        void failed();
+
+        // closes sessions idle too long, keeps the rest alive
+        void onHousekeeping( Poco::Timer &timer );
+
+        // runs a no-op command on SSHIO
+        static bool alive( rsync::SSHIO *sshio );
+
+    // data
+    private:
+        std::string name_;
+
+        Poco::FastMutex mutex_;
+
+        // most recently used at the back
+        std::deque<Idle> idle_;
+        size_t lent_;
+
+        // microseconds
+        Poco::Timestamp::TimeDiff idleTimeout_;
+        Poco::Timestamp::TimeDiff keepalive_;
+
+        // no connection attempt before retry_, backoff_ is 0 while they succeed
+        Poco::Timestamp retry_;
+        long backoff_;
+
+        Poco::Timer timer_;
+
+        Poco::Logger &logger_;
+};
+
+#endif // SSHPOOL_H
@@ -0,0 +1,113 @@
+/**
+ * \file Settings.h
+ *
+ * \brief - The settings the workers use, as one snapshot that can be replaced
+ *
+ * \details
+ * Workers used to look their settings up in the application's
+ * configuration for every job (the dry run flag several times a
+ * transfer), each lookup a search through the layered configuration and
+ * a string to number conversion, and anything read once in a
+ * constructor could only be changed by restarting - and so doing the
+ * initial synchronization again.
+ *
+ * A Settings is read from the configuration once and never changed.
+ * current() hands out the latest one; reload() reads a new one and swaps
+ * it in place of the old with an atomic store, so the hot paths that
+ * call current() several times a job take no lock. What current()
+ * returns is for the work at hand, not to be kept: a replaced Settings
+ * is freed by the first reload a minute or more later, or by the 17th
+ * after it in a burst of SIGHUPs. The next job picks up the new values.
+ *
+ * What a Queue, its connections or the monitor are built from (the sync
+ * method, worker count, agent command, source and destinations) is not
+ * in here, changing those still needs a restart.
+ *
+ */
+
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <string>
+#include <deque>
+#include <atomic>
+
+#include "Poco/SharedPtr.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Mutex.h"
+#include "Poco/Types.h"
+#include "Poco/Util/AbstractConfiguration.h"
+
+class Settings
+{
+
+    public:
+        Settings( const Poco::Util::AbstractConfiguration &config );
+
+        // the settings in force, read from the application's
+        // configuration the first time
+        static const Settings *current();
+
+        // reads the application's configuration again and makes that the
+        // current settings
+        static const Settings *reload();
+
+        bool dryRun() const { return dryRun_; };
+        int verbose() const { return verbose_; };
+
+        // bandwidth, see RateLimiter
+        int rateLimit() const { return rateLimit_; };
+        int rateInteractive() const { return rateInteractive_; };
+
+        size_t deleteBatch() const { return deleteBatch_; };
+        Poco::UInt64 hashMax() const { return hashMax_; };
+
+        // rsync method
+        Poco::UInt64 packSize() const { return packSize_; };
+        size_t packCount() const { return packCount_; };
+        Poco::UInt64 agentMaxSize() const { return agentMaxSize_; };
+        Poco::UInt64 agentDeltaMax() const { return agentDeltaMax_; };
+
+        // acrosync method
+        int rsyncProtocol() const { return rsyncProtocol_; };
+        int rsyncLogLevel() const { return rsyncLogLevel_; };
+
+        // notifications, the icon as an absolute path (empty for none)
+        const std::string &growlIcon() const { return growlIcon_; };
+        bool growlUpdateDir() const { return growlUpdateDir_; };
+
+    private:
+        bool dryRun_;
+        int verbose_;
+
+        int rateLimit_;
+        int rateInteractive_;
+
+        size_t deleteBatch_;
+        Poco::UInt64 hashMax_;
+
+        Poco::UInt64 packSize_;
+        size_t packCount_;
+        Poco::UInt64 agentMaxSize_;
+        Poco::UInt64 agentDeltaMax_;
+
+        int rsyncProtocol_;
+        int rsyncLogLevel_;
+
+        std::string growlIcon_;
+        bool growlUpdateDir_;
+
+        static std::atomic<const Settings *> current_;
+
+        struct Generation {
+            Poco::SharedPtr<const Settings> settings;
+            Poco::Timestamp replaced;
+        };
+
+        // the current settings last, with those replaced that may still
+        // be in use before them. Only reload() takes the lock.
+        static Poco::FastMutex mutex_;
+        static std::deque<Generation> generations_;
+};
+
+#endif // SETTINGS_H
@@ -0,0 +1,51 @@
+/**
+ * \file SignatureCache.h
+ *
+ * \brief - The Signature of each file as it was last sent to a destination
+ *
+ * \details
+ * One file per path in a directory under the state directory, named after
+ * the XXH64 of the path, so a restart keeps them. Only files of at least
+ * DeltaEngine::MIN_SIZE are kept.
+ *
+ * A signature can be stale - the remote copy changed by someone else, or
+ * by a whole-directory rsync - without anything here knowing. That costs
+ * nothing worse than one failed delta: srcsync-agent refuses a result
+ * whose checksum does not match, and the file is then sent whole.
+ *
+ */
+
+#ifndef SIGNATURECACHE_H
+#define SIGNATURECACHE_H
+
+#include <string>
+
+#include "Poco/Mutex.h"
+
+#include "DeltaEngine.h"
+
+class SignatureCache
+{
+
+    public:
+        // DIR is created when the first signature is kept
+        SignatureCache( const std::string &dir );
+
+        // the signature PATH was last sent with, false if there is none
+        bool get( const std::string &path, Signature &signature );
+
+        void put( const std::string &path, const Signature &signature );
+
+        // never throws
+        void remove( const std::string &path );
+
+    private:
+        std::string file( const std::string &path ) const;
+
+        std::string dir_;
+
+        Poco::FastMutex mutex_;
+        bool created_;
+};
+
+#endif // SIGNATURECACHE_H
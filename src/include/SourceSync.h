@@ -1,11 +1,18 @@
 
 
 #include "Poco/Util/ServerApplication.h"
-#include "Poco/PriorityNotificationQueue.h"
-#include "Poco/NestedDiagnosticContext.h"
 #include "Poco/AtomicCounter.h"
+#include "Poco/ThreadPool.h"
+#include "Poco/Timer.h"
+#include "Poco/Timestamp.h"
+
+#include <map>
 
 #include "Queue.h"
+#include "Mapping.h"
+#include "Debouncer.h"
+#include "Notifier.h"
+#include "Trace.h"
 
 #ifndef SOURCESYNC_H
 #define SOURCESYNC_H
@@ -24,7 +31,22 @@ class SourceSync : public Poco::Util::ServerApplication
 
         int main( const std::vector<std::string> &args );
 
-        Poco::PriorityNotificationQueue *queue() { return queue_->queue(); };
+        // fan PATH (relative to the MAPPING's source) out to each of its destinations
+        void queueFile( int mapping, const std::string &path, JobScheduler::Priority priority = JobScheduler::INTERACTIVE, int flags = SyncJob::NONE );
+        void queueDir( int mapping, const std::string &path, JobScheduler::Priority priority = JobScheduler::INTERACTIVE );
+        void queueDelete( int mapping, const std::string &path );
+
+        // what the monitors report: a changed file is queued once it has
+        // settled (see Debouncer), a removed one unless it never was.
+        // ATTRIBUTES is a change of times, mode or owner only, queued at once.
+        void fileChanged( int mapping, const std::string &path, bool attributes = false );
+        void fileRemoved( int mapping, const std::string &path );
+
+        const std::vector<Mapping *> &mappings() { return mappings_; };
+        Mapping *mapping( int id ) { return mappings_[ id ]; };
+
+        // NULL when notifications are not built in
+        Notifier *notifier() { return notifier_.get(); };
 
         void jobStart() { jobCount_++; };
         void jobEnd() { jobCount_--; };
@@ -39,18 +61,53 @@ class SourceSync : public Poco::Util::ServerApplication
 
         void handleVerbose(const std::string &name, const std::string &value);
 
+        // builds mappings_ from --src/--dest and any loaded profile
+        void loadMappings();
+
+        // one Queue per destination host
+        void createQueues();
+
+        // checks for signals the handlers could only flag
+        void onSignals( Poco::Timer &timer );
+
+        // reads the profile again (SIGHUP, or it was saved) and applies
+        // what can change while running to the workers, mappings and monitor
+        void reload();
+
+        // if PATH is an IGNORE_FILE, drops its cached rules and queues its
+        // directory, so what they now include is sent
+        void ignoreFileChanged( int mapping, const std::string &path );
+
 
     // data    
         
     private:
 
-        Queue *queue_;
+        // keyed by Destination::hostKey()
+        std::map<std::string, Queue *> queues_;
+
+        Poco::SharedPtr<Poco::ThreadPool> pool_;
+
+        Poco::SharedPtr<Poco::Timer> signals_;
+
+        // the profile as last read, reloaded when it changes
+        Poco::Timestamp profileModified_;
+
+        // NULL when changes are queued as they are reported
+        Poco::SharedPtr<Debouncer> debouncer_;
+
+        Poco::SharedPtr<Notifier> notifier_;
+
+        std::vector<Mapping *> mappings_;
 
         Poco::AtomicCounter jobCount_;
 };
 
 extern SourceSync *thisApp;
 
-#define FUNCTIONTRACE Poco::NDCScope _theNdcScope( __PRETTY_FUNCTION__, __LINE__, __FILE__)
+// only build MSG (i.e. the Poco::format() call) when LOGGER will output it
+#define LOG_TRACE( logger, msg )        do { if ( (logger).trace() ) (logger).trace( msg ); } while ( 0 )
+#define LOG_DEBUG( logger, msg )        do { if ( (logger).debug() ) (logger).debug( msg ); } while ( 0 )
+#define LOG_INFORMATION( logger, msg )  do { if ( (logger).information() ) (logger).information( msg ); } while ( 0 )
 
 #endif // SOURCESYNC_H
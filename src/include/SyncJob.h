@@ -0,0 +1,189 @@
+/**
+ * \file SyncJob.h
+ *
+ * \brief - The unit of work passed from the monitor to the workers
+ *
+ * \details
+ * An event storm can queue hundreds of thousands of jobs, so a job is
+ * kept small: the path is interned once in the PathTable and the job
+ * only carries its id, the kind is an enum rather than a string and the
+ * jobs themselves come from a pool instead of the general heap.
+ *
+ * Every destination of a mapping gets its own job, but they all share
+ * the one interned path, which is freed with the last of them.
+ *
+ */
+
+#ifndef SYNCJOB_H
+#define SYNCJOB_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "Poco/Notification.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Mutex.h"
+#include "Poco/Types.h"
+
+// Paths relative to a mapping's source, each stored once however many
+// jobs carry it. Every job holds a reference to its path and the entry
+// is freed, its id reused, once the last of them is released. Looking a
+// path up takes no lock.
+class PathTable
+{
+
+    public:
+        typedef Poco::UInt32 Id;
+
+        static PathTable &instance();
+
+        // holds a reference to PATH for as long as it is in scope, until
+        // the jobs queued with it have taken their own
+        class Ref
+        {
+            public:
+                Ref( const std::string &path ) : id_( PathTable::instance().intern( path ) ) {};
+                ~Ref() { PathTable::instance().release( id_ ); };
+
+                operator Id() const { return id_; };
+
+            private:
+                Ref( const Ref & );
+                Ref &operator=( const Ref & );
+
+                Id id_;
+        };
+
+        // the id of PATH, with one reference for the caller
+        Id intern( const std::string &path );
+
+        void retain( Id id );
+        void release( Id id );
+
+        // only while a reference to ID is held
+        const std::string &path( Id id ) const;
+
+        // for an id that may have been released (the trace), false if it was
+        bool lookup( Id id, std::string &path );
+
+        // paths currently held
+        size_t size();
+
+    private:
+        PathTable();
+
+        enum {
+            CHUNK_BITS = 12,
+            CHUNK_SIZE = 1 << CHUNK_BITS,
+            CHUNK_COUNT = 1 << 16
+        };
+
+        struct Slot {
+            std::atomic<const std::string *> path;
+            std::atomic<Poco::UInt32> refs;
+        };
+
+        Slot &slot( Id id ) const { return chunks_[ id >> CHUNK_BITS ].load( std::memory_order_acquire )[ id & ( CHUNK_SIZE - 1 ) ]; };
+
+        // slots are allocated a chunk at a time and never move, so readers
+        // can index them without the lock
+        std::atomic<Slot *> chunks_[ CHUNK_COUNT ];
+        Id next_;
+
+        // interning and freeing only
+        Poco::FastMutex mutex_;
+
+        std::unordered_map<std::string, Id> ids_;
+        std::vector<Id> free_;
+};
+
+class SyncJob : public Poco::Notification
+{
+
+    public:
+        enum Kind {
+            FILE_SYNC,
+            DIR_SYNC,
+            // deletes are not queued individually, the paths are collected by
+            // Queue::queueDelete() and a single DELETE_SYNC tells a worker to
+            // take everything pending for the destination. The path is unused.
+            DELETE_SYNC
+        };
+
+        enum Flags {
+            NONE = 0,
+            // queued by the periodic reconciliation rather than an event
+            RECONCILE = 1,
+            // the monitor saw the times, mode or owner change, not the contents
+            METADATA = 2,
+            // requeued once its bytes were reserved, see AcrosyncWorker
+            ADMITTED = 4
+        };
+
+        SyncJob( Kind kind, PathTable::Id path, int mapping, int destination, int flags = NONE );
+
+        Kind kind() const { return (Kind) kind_; };
+        const char *kindName() const;
+
+        int flags() const { return flags_; };
+
+        // the JobScheduler::Priority it was queued with
+        int priority() const { return priority_; };
+        void setPriority( int priority ) { priority_ = (Poco::UInt8) priority; };
+
+        PathTable::Id pathId() const { return path_; };
+        const std::string &path() const { return PathTable::instance().path( path_ ); };
+
+        // index into SourceSync::mappings(), path is relative to its source
+        int mapping() const { return mapping_; };
+
+        // index into Mapping::destinations()
+        int destination() const { return destination_; };
+
+        // when the job was created, epoch microseconds
+        Poco::Timestamp::TimeVal queued() const { return queued_; };
+
+        // how long the job has been waiting, in microseconds
+        Poco::Timestamp::TimeDiff waited() const { return Poco::Timestamp().epochMicroseconds() - queued_; };
+
+        // the destination's JobJournal sequence number, 0 until it is recorded
+        Poco::UInt32 journal() const { return journal_; };
+        void setJournal( Poco::UInt32 sequence ) { journal_ = sequence; };
+
+        // XXH64 of the file's contents as the transfer started, 0 if not taken
+        Poco::UInt64 hash() const { return hash_; };
+        void setHash( Poco::UInt64 hash ) { hash_ = hash; };
+
+        // the file as the worker first looked at it and when (epoch
+        // microseconds), what the manifest records once it has been sent.
+        // started() is 0 until then, the rest 0 if there was no file.
+        Poco::Timestamp::TimeVal started() const { return started_; };
+        Poco::UInt64 size() const { return size_; };
+        Poco::Timestamp::TimeVal modified() const { return modified_; };
+        void setStarted( Poco::Timestamp::TimeVal started, Poco::UInt64 size, Poco::Timestamp::TimeVal modified ) { started_ = started; size_ = size; modified_ = modified; };
+
+        // jobs are allocated from a pool shared by all queues
+        static void *operator new( size_t size );
+        static void operator delete( void *p );
+
+    protected:
+        ~SyncJob();
+
+    private:
+        Poco::UInt8 kind_;
+        Poco::UInt8 flags_;
+        Poco::UInt16 mapping_;
+        Poco::UInt16 destination_;
+        Poco::UInt8 priority_;      // fills the padding before path_
+        PathTable::Id path_;
+        Poco::UInt32 journal_;      // fills the padding before queued_
+        Poco::Timestamp::TimeVal queued_;
+        Poco::UInt64 hash_;
+        Poco::Timestamp::TimeVal started_;
+        Poco::UInt64 size_;
+        Poco::Timestamp::TimeVal modified_;
+};
+
+#endif // SYNCJOB_H
@@ -0,0 +1,128 @@
+/**
+ * \file Trace.h
+ *
+ * \brief - Timestamped spans for following a change through srcsync
+ *
+ * \details
+ * Only built with -DUSE_TRACE=ON, otherwise every TRACE_* macro (and
+ * FUNCTIONTRACE) expands to nothing.
+ *
+ * Each thread records into its own fixed size ring of events, so
+ * recording is a clock read and a few stores - no locks, no allocation
+ * after the thread's first event. When the ring wraps the oldest events
+ * are lost.
+ *
+ * The rings are written out as Chrome trace JSON (chrome://tracing or
+ * https://ui.perfetto.dev) when srcsync exits, and whenever it receives
+ * SIGUSR1, if it was started with --trace=FILE.
+ *
+ * NAME and CATEGORY must be string literals (only the pointer is kept).
+ *
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#ifdef USE_TRACE
+
+#include <atomic>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Poco/Types.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Mutex.h"
+
+class Trace
+{
+
+    public:
+        // no path attached to the event
+        static const Poco::UInt32 NO_PATH = 0xffffffff;
+
+        static Poco::Int64 now() { return Poco::Timestamp().epochMicroseconds(); };
+
+        // a span from BEGIN to END (microseconds, as now()), PATH is a PathTable::Id
+        static void span( const char *name, const char *category, Poco::Int64 begin, Poco::Int64 end, Poco::UInt32 path = NO_PATH );
+
+        // a point in time
+        static void instant( const char *name, const char *category, Poco::UInt32 path = NO_PATH );
+
+        // writes every thread's events as Chrome trace JSON
+        static void write( std::ostream &out );
+        static void write( const std::string &file );
+
+        // write to FILE on SIGUSR1 and from stop()
+        static void start( const std::string &file );
+        static void stop();
+
+    private:
+        struct Event {
+            const char *name;
+            const char *category;
+            Poco::Int64 begin;
+            Poco::Int64 duration;   // < 0 for an instant
+            Poco::UInt32 path;
+        };
+
+        // one per thread, only that thread writes to it
+        struct Buffer {
+            Buffer( int id, const std::string &name );
+
+            int id;
+            std::string name;
+
+            std::vector<Event> events;
+
+            // events ever recorded, the ring slot is count % events.size()
+            std::atomic<Poco::UInt64> count;
+        };
+
+        static Buffer &buffer();
+        static void record( const char *name, const char *category, Poco::Int64 begin, Poco::Int64 duration, Poco::UInt32 path );
+
+        // this thread's buffer, created by its first event
+        static thread_local Buffer *current_;
+
+        static Poco::FastMutex mutex_;
+        static std::vector<Buffer *> buffers_;
+};
+
+// records the lifetime of the enclosing scope
+class TraceScope
+{
+
+    public:
+        TraceScope( const char *name, const char *category, Poco::UInt32 path = Trace::NO_PATH ) : name_(name), category_(category), path_(path), begin_( Trace::now() ) {};
+        ~TraceScope() { Trace::span( name_, category_, begin_, Trace::now(), path_ ); };
+
+    private:
+        const char *name_;
+        const char *category_;
+        Poco::UInt32 path_;
+        Poco::Int64 begin_;
+};
+
+#define TRACE_CONCAT2( a, b )   a ## b
+#define TRACE_CONCAT( a, b )    TRACE_CONCAT2( a, b )
+
+#define TRACE_SCOPE( name, category )               TraceScope TRACE_CONCAT( _traceScope, __LINE__ )( name, category )
+#define TRACE_SCOPE_PATH( name, category, path )    TraceScope TRACE_CONCAT( _traceScope, __LINE__ )( name, category, path )
+#define TRACE_MARK( begin )                         Poco::Int64 begin = Trace::now()
+#define TRACE_SPAN( name, category, begin, path )   Trace::span( name, category, begin, Trace::now(), path )
+#define TRACE_INSTANT( name, category, path )       Trace::instant( name, category, path )
+
+#else // USE_TRACE
+
+#define TRACE_SCOPE( name, category )               do { } while ( 0 )
+#define TRACE_SCOPE_PATH( name, category, path )    do { } while ( 0 )
+#define TRACE_MARK( begin )                         do { } while ( 0 )
+#define TRACE_SPAN( name, category, begin, path )   do { } while ( 0 )
+#define TRACE_INSTANT( name, category, path )       do { } while ( 0 )
+
+#endif // USE_TRACE
+
+#define FUNCTIONTRACE TRACE_SCOPE( __FUNCTION__, "function" )
+
+#endif // TRACE_H
@@ -0,0 +1,158 @@
+/**
+ * \file TransferEngine.h
+ *
+ * \brief - Runs many transfer processes from a couple of threads
+ *
+ * \details
+ * An RsyncWorker used to block in handle.wait() for each rsync it
+ * started, with two more pool threads blocked reading its pipes. Every
+ * transfer in flight tied up three threads, so concurrency was bounded
+ * by the thread pool.
+ *
+ * The engine starts a process with non-blocking pipes and returns at
+ * once. One thread waits on every pipe (epoll on Linux, poll elsewhere),
+ * splits the output into lines and reaps the processes as they exit. A
+ * second thread runs the completions, which can be slow (rescanning a
+ * directory for the manifest), so they never hold up the pipes. Hundreds
+ * of transfers in flight cost a pipe pair and a small struct each.
+ *
+ * spawn() blocks while LIMIT processes are running, which pushes back on
+ * the workers instead of queueing processes without bound.
+ *
+ */
+
+#ifndef TRANSFERENGINE_H
+#define TRANSFERENGINE_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+
+#include <sys/types.h>
+
+#include "Poco/Runnable.h"
+#include "Poco/Thread.h"
+#include "Poco/Mutex.h"
+#include "Poco/Condition.h"
+#include "Poco/Semaphore.h"
+#include "Poco/Logger.h"
+
+class TransferEngine
+{
+
+    public:
+        // told about one process, deleted once finished() returns
+        class Transfer
+        {
+
+            public:
+                virtual ~Transfer() {};
+
+                // false hands output() the standard output as it arrives, in
+                // pieces, rather than line by line
+                virtual bool lines() const { return true; };
+
+                // a line of standard output or error, without the newline.
+                // Called on the engine's I/O thread, must not block.
+                virtual void output( const std::string &line ) {};
+                virtual void error( const std::string &line ) {};
+
+                // the process exited with STATUS, -1 if it was killed or never
+                // started. Called on the engine's completion thread.
+                virtual void finished( int status ) = 0;
+        };
+
+        // NAME identifies the engine's threads, LIMIT is the most processes at once
+        TransferEngine( const std::string &name, int limit );
+        ~TransferEngine();
+
+        // starts COMMAND (searched in PATH) with ARGS, takes over TRANSFER.
+        // Blocks while LIMIT processes are already running.
+        void spawn( const std::string &command, const std::vector<std::string> &args, Transfer *transfer );
+
+        // runs COMMAND to completion, returns its exit status. Standard
+        // output goes to OUTPUT, errors are logged.
+        int execute( const std::string &command, const std::vector<std::string> &args, std::string &output );
+
+        // processes running
+        int running();
+
+    private:
+        struct Process {
+            pid_t pid;
+            int out;                // -1 once at EOF
+            int err;
+            std::string outLine;    // partial lines
+            std::string errLine;
+            Transfer *transfer;
+            Poco::Int64 started;    // for the trace
+        };
+
+        class Poller;
+
+        class IOLoop : public Poco::Runnable
+        {
+            public:
+                IOLoop( TransferEngine &engine ) : engine_(engine) {};
+                virtual void run() { engine_.ioLoop(); };
+            private:
+                TransferEngine &engine_;
+        };
+
+        class CompletionLoop : public Poco::Runnable
+        {
+            public:
+                CompletionLoop( TransferEngine &engine ) : engine_(engine) {};
+                virtual void run() { engine_.completionLoop(); };
+            private:
+                TransferEngine &engine_;
+        };
+
+        void ioLoop();
+        void completionLoop();
+
+        // drains FD into LINE, hands each complete line to TRANSFER.
+        // Returns false at EOF.
+        bool drain( int fd, std::string &line, Transfer *transfer, bool error );
+
+        // waits for the exited processes, queues their completions
+        void reap();
+
+        void wake();
+
+    // data
+    private:
+        std::string name_;
+
+        Poco::Semaphore slots_;
+
+        Poco::FastMutex mutex_;
+
+        // started, not yet seen by the I/O thread
+        std::vector<Process *> starting_;
+
+        // I/O thread only
+        std::map<int, Process *> fds_;
+        std::vector<Process *> exiting_;    // both pipes closed
+
+        // status, transfer - for the completion thread
+        Poco::FastMutex completionMutex_;
+        Poco::Condition completionReady_;
+        std::deque<std::pair<int, Transfer *> > completions_;
+
+        int wakeRead_;
+        int wakeWrite_;
+
+        int running_;
+        bool stopping_;
+
+        IOLoop ioLoop_;
+        CompletionLoop completionLoop_;
+        Poco::Thread ioThread_;
+        Poco::Thread completionThread_;
+
+        Poco::Logger &logger_;
+};
+
+#endif // TRANSFERENGINE_H
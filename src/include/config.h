@@ -24,6 +24,21 @@
 #define CONFIG_SYNC_METHOD              APPNAME ".sync-method"   // --method
 #define CONFIG_SYNC_METHOD_ACROSYNC     "acrosync"
 #define CONFIG_SYNC_METHOD_RSYNC        "rsync"
+#define CONFIG_STATE_DIR                APPNAME ".state.dir"      // remote manifests etc, default ~/.srcsync
+#define CONFIG_TRACE                    APPNAME ".trace"    // --trace, only with USE_TRACE
+
+// profiles - each mapping is a group of keys below CONFIG_MAPPING
+//
+//   srcsync.mapping.NAME.src = DIR
+//   srcsync.mapping.NAME.dest = URI
+//   srcsync.mapping.NAME.ignore = GLOBLIST        (defaults to --ignore)
+//   srcsync.mapping.NAME.private-key = KEYFILE    (defaults to --private-key)
+//
+#define CONFIG_MAPPING                  APPNAME ".mapping"
+#define CONFIG_MAPPING_SRC              "src"
+#define CONFIG_MAPPING_DEST             "dest"
+#define CONFIG_MAPPING_IGNORE           "ignore"
+#define CONFIG_MAPPING_KEYFILE          "private-key"
 
 // Queue management
 //
@@ -31,15 +46,48 @@
 #define CONFIG_QUEUE_MIN_THREADS        APPNAME ".queue.thread-min"
 #define CONFIG_QUEUE_MAX_THREADS        APPNAME ".queue.thread-max"
 #define CONFIG_QUEUE_THREAD_IDLE        APPNAME ".queue.thread-idle"
+#define CONFIG_QUEUE_INGRESS            APPNAME ".queue.ingress"        // jobs buffered per host before the monitor waits
+#define CONFIG_QUEUE_INFLIGHT           APPNAME ".queue.inflight"       // rsync method: transfers running at once per host
+#define CONFIG_QUEUE_RECONCILE          APPNAME ".queue.reconcile"      // seconds between full directory syncs, 0 disables
+#define CONFIG_QUEUE_AUDIT              APPNAME ".queue.audit"          // seconds between content audits, 0 disables
+#define CONFIG_QUEUE_AUDIT_PACE         APPNAME ".queue.audit.pace"     // ms the audit waits between steps
+#define CONFIG_QUEUE_DELETE_BATCH       APPNAME ".queue.delete-batch"   // max paths per remote delete command
+#define CONFIG_QUEUE_HASH_MAX           APPNAME ".queue.hash.max"       // bytes, larger files are not hashed to spot rewrites of the same contents
+
+// bandwidth, per destination host
+#define CONFIG_RATE_LIMIT               APPNAME ".rate.limit"           // KB/s, 0 (the default) for no limit
+#define CONFIG_RATE_INTERACTIVE         APPNAME ".rate.interactive"     // percent of the limit reserved for saved files, default 25
 
 // rsync library
 #define CONFIG_RSYNC_LOG_LEVEL          APPNAME ".rsync.log.level"
 #define CONFIG_RSYNC_SSH_KEYFILE        APPNAME ".rsync.ssh.keyfile"
 #define CONFIG_RSYNC_PROTOCOL_VERSION   APPNAME ".rsync.protocol.version"
+#define CONFIG_RSYNC_SSH_IDLE           APPNAME ".rsync.ssh.idle"       // seconds before an unused session is closed
+#define CONFIG_RSYNC_SSH_KEEPALIVE      APPNAME ".rsync.ssh.keepalive"  // seconds between checks of idle sessions, 0 disables
+#define CONFIG_RSYNC_PACK_SIZE          APPNAME ".rsync.pack.size"      // rsync method: changed files up to this many bytes go in one archive, 0 disables
+#define CONFIG_RSYNC_PACK_COUNT         APPNAME ".rsync.pack.count"     // rsync method: most files in one archive
+#define CONFIG_RSYNC_SSH_MULTIPLEX      APPNAME ".rsync.ssh.multiplex"  // rsync method: one ssh connection per destination, default true
+
+// remote helper
+#define CONFIG_AGENT_COMMAND            APPNAME ".agent.command"        // rsync method: srcsync-agent on the remote host, empty (the default) disables
+#define CONFIG_AGENT_MAX_SIZE           APPNAME ".agent.max.size"       // bytes, larger files go by rsync
+#define CONFIG_AGENT_DELTA_MAX          APPNAME ".agent.delta.max"      // bytes, larger files are never sent as a delta
 
 // notifications
 #define CONFIG_GROWL_ICON               APPNAME ".grown.icon"
 #define CONFIG_GROWL_UPDATE_DIR         APPNAME ".grown.update-dir"
+#define CONFIG_GROWL_WINDOW             APPNAME ".grown.window"         // ms results are gathered into one notification, default 1000
+
+// monitor
+#define CONFIG_MONITOR_QUIET            APPNAME ".monitor.quiet"        // ms a file being written must stand still, 0 queues every change at once
+#define CONFIG_MONITOR_QUIET_MAX        APPNAME ".monitor.quiet.max"    // ms, the longest a file that keeps changing is held back
+#define CONFIG_MONITOR_TEMPORARY        APPNAME ".monitor.temporary"    // GLOBLIST of editors' temporary files, never queued at once
+#define MONITOR_TEMPORARY_DEFAULT       "*.swp *.swx *~ .#* *.tmp 4913 *___jb_tmp___ *___jb_old___ .goutputstream-*"
+#define CONFIG_MONITOR_POLL             APPNAME ".monitor.poll"         // poll the sources instead of waiting for the kernel, default false
+#define CONFIG_MONITOR_POLL_MIN         APPNAME ".monitor.poll.min"     // ms between looks at a directory that just changed, default 500
+#define CONFIG_MONITOR_POLL_MAX         APPNAME ".monitor.poll.max"     // ms between looks at a directory that stays quiet, default 10000
+#define CONFIG_MONITOR_POLL_BUDGET      APPNAME ".monitor.poll.budget"  // percent of a core polling may use, default 3
 
 // libfswatch
+#define CONFIG_MONITOR_LATENCY          APPNAME ".monitor.latency"      // seconds events are gathered for before they are reported, default 0.25
 
@@ -0,0 +1,616 @@
+/**
+ * \file srcsync-agent.cc
+ *
+ * \brief - Applies srcsync's changes on the remote host
+ *
+ * \details
+ * Started by srcsync (over ssh) as "srcsync-agent ROOT", where ROOT is
+ * the destination directory. Reads AgentProtocol requests on standard
+ * input and answers each on standard output, in order. Everything that
+ * has arrived is handled before the answers are flushed, so a burst of
+ * requests gets its answers in one write. Exits at end of input.
+ *
+ * Files are written to a temporary name next to them and renamed into
+ * place, so a reader on the remote side never sees half a file.
+ *
+ * Only the standard library and POSIX are used, see AgentProtocol.h.
+ *
+ */
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <csignal>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "AgentProtocol.h"
+#include "Checksum.h"
+
+using namespace Agent;
+
+// thrown by an op, becomes a FAILED answer
+class OpError : public std::runtime_error
+{
+    public:
+        OpError( const std::string &what, int error ) : std::runtime_error( what + ": " + strerror( error ) ) {};
+};
+
+class SyncAgent
+{
+
+    public:
+        SyncAgent( const std::string &root ) : root_(root) {};
+
+        // handles every frame in INPUT, appends the answers to OUTPUT,
+        // returns the bytes used (a partial frame is left)
+        size_t process( const char *input, size_t length, std::string &output );
+
+    private:
+        void handle( uint32_t id, uint8_t op, Reader &args, std::string &output );
+
+        std::string resolve( const std::string &path );
+
+        void makeParents( const std::string &full );
+
+        // writes what WRITE or DELTA produced into FULL
+        int temporary( const std::string &full, std::string &name );
+        void install( int fd, const std::string &temp, const std::string &full, uint32_t mode, int64_t mtime );
+
+        void write( const std::string &path, uint32_t mode, int64_t mtime, const std::string &data );
+        void delta( const std::string &path, uint32_t mode, int64_t mtime, const Delta &delta );
+        void unlink( const std::string &path );
+        void mkdir( const std::string &path, uint32_t mode );
+        void metadata( const std::string &path, uint32_t mode, int64_t mtime );
+        void list( const std::string &path, std::vector<Entry> &entries );
+
+        std::string root_;
+};
+
+static void writeAll( int fd, const char *data, size_t length, const std::string &what )
+{
+    while ( length > 0 ) {
+
+        ssize_t n = ::write( fd, data, length );
+
+        if ( n < 0 ) {
+
+            if ( errno == EINTR ) {
+
+                continue;
+            }
+
+            throw OpError( what, errno );
+        }
+
+        data += n;
+        length -= n;
+    }
+}
+
+static void setTimes( const std::string &full, int64_t mtime )
+{
+    struct timeval times[2];
+
+    times[0].tv_sec = times[1].tv_sec = (time_t) mtime;
+    times[0].tv_usec = times[1].tv_usec = 0;
+
+    if ( utimes( full.c_str(), times ) != 0 ) {
+
+        throw OpError( full, errno );
+    }
+}
+
+std::string SyncAgent::resolve( const std::string &path )
+{
+    if ( path == "." ) {
+
+        return root_;
+    }
+
+    if ( safePath( path ) == false ) {
+
+        throw OpError( path, EPERM );
+    }
+
+    return root_ + "/" + path;
+}
+
+void SyncAgent::makeParents( const std::string &full )
+{
+    size_t slash = full.find( '/', root_.size() + 1 );
+
+    while ( slash != std::string::npos ) {
+
+        std::string dir = full.substr( 0, slash );
+
+        if ( ::mkdir( dir.c_str(), 0755 ) != 0 && errno != EEXIST ) {
+
+            throw OpError( dir, errno );
+        }
+
+        slash = full.find( '/', slash + 1 );
+    }
+}
+
+int SyncAgent::temporary( const std::string &full, std::string &name )
+{
+    makeParents( full );
+
+    size_t slash = full.rfind( '/' );
+
+    name = full.substr( 0, slash + 1 ) + "." + full.substr( slash + 1 ) + ".srcsync.XXXXXX";
+
+    std::vector<char> buffer( name.begin(), name.end() );
+    buffer.push_back( '\0' );
+
+    int fd = mkstemp( &buffer[0] );
+
+    if ( fd < 0 ) {
+
+        throw OpError( full, errno );
+    }
+
+    name = &buffer[0];
+
+    return fd;
+}
+
+void SyncAgent::install( int fd, const std::string &temp, const std::string &full, uint32_t mode, int64_t mtime )
+{
+    try {
+
+        if ( fchmod( fd, mode & 07777 ) != 0 ) {
+
+            throw OpError( full, errno );
+        }
+
+        if ( close( fd ) != 0 ) {
+
+            fd = -1;
+            throw OpError( full, errno );
+        }
+
+        fd = -1;
+
+        if ( mtime != -1 ) {
+
+            setTimes( temp, mtime );
+        }
+
+        if ( rename( temp.c_str(), full.c_str() ) != 0 ) {
+
+            throw OpError( full, errno );
+        }
+    }
+    catch ( ... ) {
+
+        if ( fd >= 0 ) {
+
+            close( fd );
+        }
+
+        ::unlink( temp.c_str() );
+        throw;
+    }
+}
+
+void SyncAgent::write( const std::string &path, uint32_t mode, int64_t mtime, const std::string &data )
+{
+    std::string full = resolve( path );
+    std::string temp;
+
+    int fd = temporary( full, temp );
+
+    try {
+
+        writeAll( fd, data.data(), data.size(), full );
+    }
+    catch ( ... ) {
+
+        close( fd );
+        ::unlink( temp.c_str() );
+        throw;
+    }
+
+    install( fd, temp, full, mode, mtime );
+}
+
+void SyncAgent::delta( const std::string &path, uint32_t mode, int64_t mtime, const Delta &delta )
+{
+    std::string full = resolve( path );
+
+    int base = open( full.c_str(), O_RDONLY );
+
+    if ( base < 0 ) {
+
+        throw OpError( full, errno );
+    }
+
+    std::string temp;
+    int fd = -1;
+
+    try {
+
+        fd = temporary( full, temp );
+
+        std::vector<char> buffer( 256 * 1024 );
+
+        Checksum::XXH64 checksum;
+
+        for ( std::vector<Instruction>::const_iterator it = delta.instructions.begin(); it != delta.instructions.end(); it++ ) {
+
+            if ( it->data.empty() == false ) {
+
+                writeAll( fd, it->data.data(), it->data.size(), full );
+                checksum.update( it->data.data(), it->data.size() );
+                continue;
+            }
+
+            uint64_t offset = it->offset;
+            uint64_t remaining = it->length;
+
+            while ( remaining > 0 ) {
+
+                ssize_t n = pread( base, &buffer[0], std::min( (uint64_t) buffer.size(), remaining ), (off_t) offset );
+
+                if ( n < 0 && errno == EINTR ) {
+
+                    continue;
+                }
+
+                if ( n <= 0 ) {
+
+                    // the remote copy is not the one the delta was made against
+                    throw OpError( full, n < 0 ? errno : ESTALE );
+                }
+
+                writeAll( fd, &buffer[0], n, full );
+                checksum.update( &buffer[0], n );
+
+                offset += n;
+                remaining -= n;
+            }
+        }
+
+        // made against a different copy than the one here
+        if ( checksum.digest() != delta.checksum ) {
+
+            throw OpError( full, ESTALE );
+        }
+    }
+    catch ( ... ) {
+
+        close( base );
+
+        if ( fd >= 0 ) {
+
+            close( fd );
+            ::unlink( temp.c_str() );
+        }
+
+        throw;
+    }
+
+    close( base );
+
+    install( fd, temp, full, mode, mtime );
+}
+
+static int removeEntry( const char *path, const struct stat *, int flag, struct FTW * )
+{
+    return ( flag == FTW_DP ? rmdir( path ) : ::unlink( path ) ) == 0 ? 0 : errno;
+}
+
+void SyncAgent::unlink( const std::string &path )
+{
+    std::string full = resolve( path );
+
+    if ( path == "." ) {
+
+        throw OpError( full, EPERM );
+    }
+
+    struct stat st;
+
+    if ( lstat( full.c_str(), &st ) != 0 ) {
+
+        // already gone is what was asked for
+        if ( errno == ENOENT ) {
+
+            return;
+        }
+
+        throw OpError( full, errno );
+    }
+
+    int error = S_ISDIR( st.st_mode ) ? nftw( full.c_str(), removeEntry, 32, FTW_DEPTH | FTW_PHYS ) : ( ::unlink( full.c_str() ) == 0 ? 0 : errno );
+
+    if ( error != 0 ) {
+
+        throw OpError( full, error > 0 ? error : errno );
+    }
+}
+
+void SyncAgent::mkdir( const std::string &path, uint32_t mode )
+{
+    std::string full = resolve( path );
+
+    makeParents( full );
+
+    if ( ::mkdir( full.c_str(), mode & 07777 ) != 0 ) {
+
+        struct stat st;
+
+        if ( errno != EEXIST || stat( full.c_str(), &st ) != 0 || S_ISDIR( st.st_mode ) == false ) {
+
+            throw OpError( full, errno == EEXIST ? ENOTDIR : errno );
+        }
+
+        if ( chmod( full.c_str(), mode & 07777 ) != 0 ) {
+
+            throw OpError( full, errno );
+        }
+    }
+}
+
+void SyncAgent::metadata( const std::string &path, uint32_t mode, int64_t mtime )
+{
+    std::string full = resolve( path );
+
+    if ( mode != 0 && chmod( full.c_str(), mode & 07777 ) != 0 ) {
+
+        throw OpError( full, errno );
+    }
+
+    if ( mtime != -1 ) {
+
+        setTimes( full, mtime );
+    }
+}
+
+// nftw has no user data
+static std::vector<Entry> *listing;
+static size_t listingRoot;
+
+static int listEntry( const char *path, const struct stat *st, int, struct FTW *ftw )
+{
+    // the directory itself, as find's %P
+    if ( ftw->level == 0 ) {
+
+        return 0;
+    }
+
+    Entry entry;
+
+    entry.path = path + listingRoot;
+    entry.type = S_ISDIR( st->st_mode ) ? 'd' : ( S_ISLNK( st->st_mode ) ? 'l' : 'f' );
+    entry.size = st->st_size;
+    entry.mtime = st->st_mtime;
+
+    listing->push_back( entry );
+
+    return 0;
+}
+
+void SyncAgent::list( const std::string &path, std::vector<Entry> &entries )
+{
+    std::string full = resolve( path );
+
+    listing = &entries;
+    listingRoot = root_.size() + 1;
+
+    if ( nftw( full.c_str(), listEntry, 32, FTW_PHYS ) != 0 ) {
+
+        throw OpError( full, errno );
+    }
+}
+
+void SyncAgent::handle( uint32_t id, uint8_t op, Reader &args, std::string &output )
+{
+    Writer answer( id, OK );
+
+    switch ( op ) {
+
+        case HELLO:
+            if ( args.u32() != VERSION ) {
+
+                throw std::runtime_error( "srcsync-agent speaks a different protocol version" );
+            }
+
+            answer.u32( VERSION );
+            break;
+
+        case WRITE: {
+            std::string path = args.str();
+            uint32_t mode = args.u32();
+            int64_t mtime = args.i64();
+
+            write( path, mode, mtime, args.str() );
+            break;
+        }
+
+        case DELTA: {
+            std::string path = args.str();
+            uint32_t mode = args.u32();
+            int64_t mtime = args.i64();
+            Delta d;
+
+            args.delta( d );
+
+            delta( path, mode, mtime, d );
+            break;
+        }
+
+        case RENAME: {
+            std::string from = resolve( args.str() );
+            std::string to = resolve( args.str() );
+
+            makeParents( to );
+
+            if ( rename( from.c_str(), to.c_str() ) != 0 ) {
+
+                throw OpError( from, errno );
+            }
+            break;
+        }
+
+        case UNLINK:
+            unlink( args.str() );
+            break;
+
+        case MKDIR: {
+            std::string path = args.str();
+
+            mkdir( path, args.u32() );
+            break;
+        }
+
+        case METADATA: {
+            std::string path = args.str();
+            uint32_t mode = args.u32();
+
+            metadata( path, mode, args.i64() );
+            break;
+        }
+
+        case LIST: {
+            std::vector<Entry> entries;
+
+            list( args.str(), entries );
+
+            answer.u32( (uint32_t) entries.size() );
+
+            for ( std::vector<Entry>::const_iterator it = entries.begin(); it != entries.end(); it++ ) {
+
+                answer.entry( *it );
+            }
+            break;
+        }
+
+        default:
+            throw OpError( "unknown op", EINVAL );
+    }
+
+    output += answer.frame();
+}
+
+size_t SyncAgent::process( const char *input, size_t length, std::string &output )
+{
+    size_t used = 0;
+
+    while ( length - used >= HEADER ) {
+
+        uint32_t frame = frameLength( input + used );
+
+        if ( frame > MAX_FRAME || frame < 5 ) {
+
+            throw ProtocolError( "bad frame length" );
+        }
+
+        if ( length - used - HEADER < frame ) {
+
+            break;
+        }
+
+        Reader header( input + used + HEADER, 5 );
+
+        uint32_t id = header.u32();
+        uint8_t op = header.u8();
+
+        Reader args( input + used + HEADER + 5, frame - 5 );
+
+        try {
+
+            handle( id, op, args, output );
+        }
+        catch ( std::runtime_error &ex ) {
+
+            output += Writer( id, FAILED ).str( ex.what() ).frame();
+        }
+
+        used += HEADER + frame;
+    }
+
+    return used;
+}
+
+int main( int argc, char **argv )
+{
+    if ( argc != 2 ) {
+
+        fprintf( stderr, "usage: %s ROOT\n", argv[0] );
+        return 2;
+    }
+
+    std::string root( argv[1] );
+
+    while ( root.size() > 1 && root[ root.size() - 1 ] == '/' ) {
+
+        root.erase( root.size() - 1 );
+    }
+
+    if ( ::mkdir( root.c_str(), 0755 ) != 0 && errno != EEXIST ) {
+
+        perror( root.c_str() );
+        return 1;
+    }
+
+    // srcsync going away shows up as end of input
+    signal( SIGPIPE, SIG_IGN );
+
+    SyncAgent agent( root );
+
+    std::vector<char> input( 1024 * 1024 );
+    size_t filled = 0;
+    std::string output;
+
+    try {
+
+        for ( ;; ) {
+
+            if ( filled == input.size() ) {
+
+                input.resize( std::min( input.size() * 2, (size_t) MAX_FRAME + HEADER ) );
+            }
+
+            ssize_t n = read( 0, &input[filled], input.size() - filled );
+
+            if ( n < 0 && errno == EINTR ) {
+
+                continue;
+            }
+
+            if ( n <= 0 ) {
+
+                break;
+            }
+
+            filled += n;
+
+            size_t used = agent.process( &input[0], filled, output );
+
+            memmove( &input[0], &input[used], filled - used );
+            filled -= used;
+
+            // all that had arrived is answered in one write
+            writeAll( 1, output.data(), output.size(), "standard output" );
+            output.clear();
+        }
+    }
+    catch ( std::runtime_error &ex ) {
+
+        fprintf( stderr, "srcsync-agent: %s\n", ex.what() );
+        return 1;
+    }
+
+    return 0;
+}
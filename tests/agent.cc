@@ -0,0 +1,244 @@
+
+// obtain configuration information.
+#include "Poco/Util/Application.h"
+#include "Poco/FileStream.h"
+#include "Poco/StreamCopier.h"
+
+#include "Poco/File.h"
+#include "Poco/Path.h"
+#include "Poco/Format.h"
+#include "Poco/Timestamp.h"
+
+#include "gtest/gtest.h"
+
+#include "AgentClient.h"
+#include "DeltaEngine.h"
+#include "Checksum.h"
+
+#define po_config Poco::Util::Application::instance().config
+
+// talks to a local srcsync-agent, no ssh involved
+class RemoteAgent : public ::testing::Test {
+
+  protected:
+    RemoteAgent() {
+    };
+
+    virtual ~RemoteAgent() {
+    };
+
+    virtual void SetUp() {
+
+      Poco::Timestamp now;
+
+      root_ = Poco::format("%sagent-%Lu/", Poco::Path::temp(), (Poco::UInt64) now.epochMicroseconds() );
+
+      std::vector<std::string> args;
+
+      args.push_back( root_ );
+
+      client_ = new AgentClient( "test", po_config().getString( "test.agent", "./srcsync-agent" ), args );
+
+      client_->start( 5000 );
+    };
+
+    virtual void TearDown() {
+
+      client_ = NULL;
+
+      Poco::File( root_ ).remove( true );
+    };
+
+    std::string contents( const std::string &path ) {
+
+      std::string data;
+
+      Poco::FileInputStream in( root_ + path );
+
+      Poco::StreamCopier::copyToString( in, data );
+
+      return data;
+    };
+
+    std::string root_;
+    Poco::SharedPtr<AgentClient> client_;
+};
+
+
+TEST_F(RemoteAgent,writeFile)
+{
+    AgentClient::Batch batch;
+
+    client_->write( "a/b/file", "hello", 0640, 1000000000, batch.add() );
+
+    EXPECT_TRUE( batch.wait() ) << batch.error();
+
+    Poco::File file( root_ + "a/b/file" );
+
+    EXPECT_TRUE( file.exists() );
+    EXPECT_EQ( contents( "a/b/file" ), "hello" );
+    EXPECT_EQ( file.getLastModified().epochTime(), 1000000000 );
+}
+
+TEST_F(RemoteAgent,delta)
+{
+    AgentClient::Batch batch;
+
+    client_->write( "file", "0123456789", 0644, -1, batch.add() );
+
+    Agent::Delta delta;
+
+    delta.copy( 0, 4 );
+    delta.literal( "xx", 2 );
+    delta.copy( 6, 4 );
+    delta.checksum = Checksum::xxh64( "0123xx6789", 10 );
+
+    client_->delta( "file", delta, 0644, -1, batch.add() );
+
+    EXPECT_TRUE( batch.wait() ) << batch.error();
+    EXPECT_EQ( contents( "file" ), "0123xx6789" );
+
+    // past the end of the remote copy, which is left alone
+    AgentClient::Batch stale;
+
+    delta.instructions.clear();
+    delta.copy( 8, 4 );
+    delta.checksum = 0;
+
+    client_->delta( "file", delta, 0644, -1, stale.add() );
+
+    EXPECT_FALSE( stale.wait() );
+    EXPECT_EQ( contents( "file" ), "0123xx6789" );
+}
+
+TEST_F(RemoteAgent,deltaFromSignature)
+{
+    std::string before( 1024 * 1024, '\0' );
+
+    for ( size_t i = 0; i < before.size(); i++ ) {
+
+        before[i] = (char) ( ( i * 2654435761u ) >> 13 );
+    }
+
+    AgentClient::Batch batch;
+
+    client_->write( "big", before, 0644, -1, batch.add() );
+
+    EXPECT_TRUE( batch.wait() ) << batch.error();
+
+    Signature base;
+
+    DeltaEngine::sign( before.data(), before.size(), DeltaEngine::blockSize( before.size() ), base );
+
+    // an insert and an overwrite, the rest is found in the remote copy
+    std::string after( before );
+
+    after.insert( 300000, "inserted" );
+    after.replace( 700000, 5, "xxxxx" );
+
+    Signature target;
+
+    DeltaEngine::sign( after.data(), after.size(), base.blockSize, target );
+
+    Agent::Delta delta;
+
+    Poco::UInt64 literal = DeltaEngine::delta( base, target, after.data(), after.size(), delta );
+
+    EXPECT_LT( literal, 3u * base.blockSize );
+
+    AgentClient::Batch applied;
+
+    client_->delta( "big", delta, 0644, -1, applied.add() );
+
+    EXPECT_TRUE( applied.wait() ) << applied.error();
+    EXPECT_TRUE( contents( "big" ) == after );
+
+    // made against a copy that is no longer there
+    AgentClient::Batch stale;
+
+    client_->delta( "big", delta, 0644, -1, stale.add() );
+
+    EXPECT_FALSE( stale.wait() );
+    EXPECT_TRUE( contents( "big" ) == after );
+}
+
+TEST_F(RemoteAgent,renameAndUnlink)
+{
+    AgentClient::Batch batch;
+
+    client_->write( "dir/one", "1", 0644, -1, batch.add() );
+    client_->mkdir( "dir/empty/deeper", 0755, batch.add() );
+    client_->rename( "dir/one", "two", batch.add() );
+    client_->unlink( "dir", batch.add() );
+    client_->unlink( "never-there", batch.add() );
+
+    EXPECT_TRUE( batch.wait() ) << batch.error();
+
+    EXPECT_FALSE( Poco::File( root_ + "dir" ).exists() );
+    EXPECT_EQ( contents( "two" ), "1" );
+}
+
+TEST_F(RemoteAgent,outsideRoot)
+{
+    AgentClient::Batch batch;
+
+    client_->unlink( "../x", batch.add() );
+    client_->write( "/tmp/x", "", 0644, -1, batch.add() );
+
+    EXPECT_FALSE( batch.wait() );
+
+    // still answering
+    AgentClient::Batch after;
+
+    client_->mkdir( "ok", 0755, after.add() );
+
+    EXPECT_TRUE( after.wait() ) << after.error();
+}
+
+TEST_F(RemoteAgent,metadataAndList)
+{
+    AgentClient::Batch batch;
+
+    client_->write( "f", "abc", 0600, -1, batch.add() );
+    client_->mkdir( "d", 0755, batch.add() );
+    client_->metadata( "f", 0, 1234567890, batch.add() );
+
+    EXPECT_TRUE( batch.wait() ) << batch.error();
+
+    std::vector<Agent::Entry> entries;
+    std::string error;
+
+    EXPECT_TRUE( client_->list( ".", entries, error ) ) << error;
+    ASSERT_EQ( entries.size(), 2u );
+
+    for ( size_t i = 0; i < entries.size(); i++ ) {
+
+        if ( entries[i].path == "f" ) {
+
+            EXPECT_EQ( entries[i].type, 'f' );
+            EXPECT_EQ( entries[i].size, 3u );
+            EXPECT_EQ( entries[i].mtime, 1234567890 );
+        }
+        else {
+
+            EXPECT_EQ( entries[i].path, "d" );
+            EXPECT_EQ( entries[i].type, 'd' );
+        }
+    }
+}
+
+TEST_F(RemoteAgent,pipelined)
+{
+    AgentClient::Batch batch;
+
+    // far more than fit in the pipes, none waits for an answer
+    for ( int i = 0; i < 5000; i++ ) {
+
+        client_->write( Poco::format("d%d/f%d", i % 16, i ), std::string( i % 997, 'x' ), 0644, -1, batch.add() );
+    }
+
+    EXPECT_TRUE( batch.wait() ) << batch.error();
+    EXPECT_EQ( client_->inflight(), 0u );
+
+    EXPECT_EQ( contents( "d3/f4995" ).size(), 4995u % 997 );
+}
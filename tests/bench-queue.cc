@@ -0,0 +1,191 @@
+/* Microbenchmark for the job queue
+
+ * Pushes JOBS jobs from a single producer (like the monitor) through
+ * Poco::PriorityNotificationQueue and through JobScheduler, with 1, 8
+ * and 64 workers, and reports jobs per second for each.
+ *
+ *   bench-queue [JOBS]
+*/
+
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+
+#include "Poco/PriorityNotificationQueue.h"
+#include "Poco/Thread.h"
+#include "Poco/Runnable.h"
+#include "Poco/AtomicCounter.h"
+#include "Poco/Stopwatch.h"
+#include "Poco/NumberParser.h"
+#include "Poco/Format.h"
+
+#include "SyncJob.h"
+#include "JobScheduler.h"
+
+static Poco::AtomicCounter done;
+
+class NotificationWorker : public Poco::Runnable
+{
+
+    public:
+        NotificationWorker( Poco::PriorityNotificationQueue &queue ) : queue_(queue) {};
+
+        void run() {
+
+            Poco::AutoPtr<Poco::Notification> n( queue_.waitDequeueNotification() );
+
+            while ( n ) {
+
+                done++;
+
+                n = queue_.waitDequeueNotification();
+            }
+        };
+
+    private:
+        Poco::PriorityNotificationQueue &queue_;
+};
+
+class SchedulerWorker : public Poco::Runnable
+{
+
+    public:
+        SchedulerWorker( JobScheduler &scheduler, int index ) : scheduler_(scheduler), index_(index) {};
+
+        void run() {
+
+            Poco::AutoPtr<SyncJob> job( scheduler_.next( index_ ) );
+
+            while ( job ) {
+
+                done++;
+
+                job = scheduler_.next( index_ );
+            }
+        };
+
+    private:
+        JobScheduler &scheduler_;
+        int index_;
+};
+
+static void waitFor( int jobs )
+{
+    while ( done.value() < jobs ) {
+
+        Poco::Thread::yield();
+    }
+}
+
+static double benchNotificationQueue( int workers, int jobs )
+{
+    Poco::PriorityNotificationQueue queue;
+
+    std::vector<Poco::Thread *> threads;
+    std::vector<NotificationWorker *> runnables;
+
+    done = 0;
+
+    for ( int i = 0; i < workers; i++ ) {
+
+        runnables.push_back( new NotificationWorker( queue ) );
+        threads.push_back( new Poco::Thread );
+        threads.back()->start( *runnables.back() );
+    }
+
+    Poco::Stopwatch sw;
+
+    sw.start();
+
+    PathTable::Ref path( "bench" );
+
+    for ( int i = 0; i < jobs; i++ ) {
+
+        queue.enqueueNotification( new SyncJob( SyncJob::FILE_SYNC, path, 0, 0 ), i % JobScheduler::PRIORITY_COUNT );
+    }
+
+    waitFor( jobs );
+
+    sw.stop();
+
+    queue.wakeUpAll();
+
+    for ( int i = 0; i < workers; i++ ) {
+
+        threads[i]->join();
+
+        delete threads[i];
+        delete runnables[i];
+    }
+
+    return jobs * 1000000.0 / sw.elapsed();
+}
+
+static double benchJobScheduler( int workers, int jobs )
+{
+    JobScheduler scheduler( workers );
+
+    std::vector<Poco::Thread *> threads;
+    std::vector<SchedulerWorker *> runnables;
+
+    done = 0;
+
+    for ( int i = 0; i < workers; i++ ) {
+
+        runnables.push_back( new SchedulerWorker( scheduler, i ) );
+        threads.push_back( new Poco::Thread );
+        threads.back()->start( *runnables.back() );
+    }
+
+    Poco::Stopwatch sw;
+
+    sw.start();
+
+    PathTable::Ref path( "bench" );
+
+    for ( int i = 0; i < jobs; i++ ) {
+
+        scheduler.push( new SyncJob( SyncJob::FILE_SYNC, path, 0, 0 ), (JobScheduler::Priority) ( i % JobScheduler::PRIORITY_COUNT ) );
+    }
+
+    waitFor( jobs );
+
+    sw.stop();
+
+    scheduler.stop();
+
+    for ( int i = 0; i < workers; i++ ) {
+
+        threads[i]->join();
+
+        delete threads[i];
+        delete runnables[i];
+    }
+
+    return jobs * 1000000.0 / sw.elapsed();
+}
+
+int main( int argc, char **argv )
+{
+    int jobs = 1000000;
+
+    if ( argc > 1 ) {
+
+        jobs = Poco::NumberParser::parse( argv[1] );
+    }
+
+    static const int workerCounts[] = { 1, 8, 64 };
+
+    std::cout << Poco::format( "%d jobs, single producer", jobs ) << std::endl;
+    std::cout << "workers  PriorityNotificationQueue      JobScheduler" << std::endl;
+
+    for ( size_t i = 0; i < sizeof(workerCounts) / sizeof(*workerCounts); i++ ) {
+
+        double poco = benchNotificationQueue( workerCounts[i], jobs );
+        double sched = benchJobScheduler( workerCounts[i], jobs );
+
+        std::cout << Poco::format( "%7d  %16.0f jobs/s  %10.0f jobs/s", workerCounts[i], poco, sched ) << std::endl;
+    }
+
+    return 0;
+}
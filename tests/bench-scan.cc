@@ -0,0 +1,65 @@
+/* Microbenchmark for the directory scanner
+
+ * Scans DIR with 1 thread and with the default number of threads and
+ * reports entries per second for each. Run it twice, the first pass
+ * mostly measures the disk rather than the scanner.
+ *
+ *   bench-scan DIR [THREADS]
+*/
+
+#include <iostream>
+
+#include "Poco/Stopwatch.h"
+#include "Poco/NumberParser.h"
+#include "Poco/Format.h"
+#include "Poco/Exception.h"
+
+#include "DirectoryScanner.h"
+
+static void bench( const std::string &dir, int threads )
+{
+    DirectoryScanner scanner( dir, 0, threads );
+    Manifest manifest;
+
+    Poco::Stopwatch sw;
+
+    sw.start();
+
+    scanner.scan( manifest );
+
+    sw.stop();
+
+    std::cout << Poco::format( "%7d  %10z entries  %8.3fs  %10.0f entries/s  %d error(s)",
+            scanner.threads(), manifest.size(), sw.elapsed() / 1000000.0, manifest.size() * 1000000.0 / sw.elapsed(), scanner.errors() ) << std::endl;
+}
+
+int main( int argc, char **argv )
+{
+    if ( argc < 2 ) {
+
+        std::cerr << "usage: bench-scan DIR [THREADS]" << std::endl;
+        return 1;
+    }
+
+    int threads = 0;
+
+    if ( argc > 2 ) {
+
+        threads = Poco::NumberParser::parse( argv[2] );
+    }
+
+    try {
+
+        std::cout << "threads" << std::endl;
+
+        bench( argv[1], 1 );
+        bench( argv[1], threads );
+    }
+    catch ( Poco::Exception &ex ) {
+
+        std::cerr << ex.displayText() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,124 @@
+
+#include <vector>
+
+#include "Poco/FileStream.h"
+#include "Poco/File.h"
+#include "Poco/Path.h"
+#include "Poco/Format.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Thread.h"
+#include "Poco/Mutex.h"
+
+#include "gtest/gtest.h"
+
+#include "Debouncer.h"
+
+// a Debouncer over a scratch directory, remembering what settled
+class Debounce : public ::testing::Test, public Debouncer::Target {
+
+  protected:
+    Debounce() {
+    };
+
+    virtual ~Debounce() {
+    };
+
+    virtual void SetUp() {
+
+      Poco::Timestamp now;
+
+      root_ = Poco::format("%sdebounce-%Lu/", Poco::Path::temp(), (Poco::UInt64) now.epochMicroseconds() );
+
+      Poco::File( root_ ).createDirectories();
+
+      debouncer_ = new Debouncer( *this, 200, 1000, "*.swp" );
+    };
+
+    virtual void TearDown() {
+
+      debouncer_ = NULL;
+
+      Poco::File( root_ ).remove( true );
+    };
+
+    virtual void settled( int mapping, const std::string &path ) {
+
+      Poco::FastMutex::ScopedLock lock( mutex_ );
+
+      settled_.push_back( path );
+    };
+
+    // appends DATA to PATH and reports it
+    void write( const std::string &path, const std::string &data ) {
+
+      {
+        Poco::FileOutputStream out( root_ + path, std::ios::out | std::ios::app );
+
+        out << data;
+      }
+
+      debouncer_->changed( 0, path, root_ + path );
+    };
+
+    size_t count( const std::string &path ) {
+
+      Poco::FastMutex::ScopedLock lock( mutex_ );
+
+      size_t n = 0;
+
+      for ( std::vector<std::string>::iterator it = settled_.begin(); it != settled_.end(); it++ ) {
+
+        n += ( *it == path );
+      }
+
+      return n;
+    };
+
+    std::string root_;
+    Poco::SharedPtr<Debouncer> debouncer_;
+
+    Poco::FastMutex mutex_;
+    std::vector<std::string> settled_;
+};
+
+
+TEST_F(Debounce,singleSaveIsNotDelayed)
+{
+    write( "file", "hello" );
+
+    EXPECT_EQ( count( "file" ), 1 );
+
+    Poco::Thread::sleep( 600 );
+
+    EXPECT_EQ( count( "file" ), 1 );
+}
+
+TEST_F(Debounce,growingFileSettlesOnce)
+{
+    for ( int i = 0; i < 8; i++ ) {
+
+        write( "download", std::string( 4096, 'x' ) );
+
+        Poco::Thread::sleep( 60 );
+    }
+
+    // the first write went at once, the rest wait for the writer to stop
+    EXPECT_EQ( count( "download" ), 1 );
+
+    Poco::Thread::sleep( 1500 );
+
+    EXPECT_EQ( count( "download" ), 2 );
+}
+
+TEST_F(Debounce,temporaryFileNeverQueued)
+{
+    write( "file.swp", "x" );
+
+    Poco::File( root_ + "file.swp" ).remove();
+
+    EXPECT_TRUE( debouncer_->removed( 0, "file.swp" ) );
+
+    Poco::Thread::sleep( 600 );
+
+    EXPECT_EQ( count( "file.swp" ), 0 );
+}
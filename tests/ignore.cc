@@ -0,0 +1,39 @@
+
+#include "gtest/gtest.h"
+
+#include "IgnoreRules.h"
+
+TEST(Ignore,nameMatchesAtAnyDepth)
+{
+    IgnoreRules rules( "# objects\n*.o\n\nbuild/\n" );
+
+    EXPECT_EQ( rules.size(), 2 );
+
+    EXPECT_EQ( rules.match( "main.o" ), IgnoreRules::IGNORE );
+    EXPECT_EQ( rules.match( "lib/util.o" ), IgnoreRules::IGNORE );
+    EXPECT_EQ( rules.match( "lib/build/util.c" ), IgnoreRules::IGNORE );
+    EXPECT_EQ( rules.match( "main.c" ), IgnoreRules::NO_MATCH );
+}
+
+TEST(Ignore,anchoredMatchesFromTheTop)
+{
+    IgnoreRules rules( "/out\ndocs/*.pdf\n" );
+
+    EXPECT_EQ( rules.match( "out" ), IgnoreRules::IGNORE );
+    EXPECT_EQ( rules.match( "out/a.txt" ), IgnoreRules::IGNORE );
+    EXPECT_EQ( rules.match( "lib/out" ), IgnoreRules::NO_MATCH );
+    EXPECT_EQ( rules.match( "docs/guide.pdf" ), IgnoreRules::IGNORE );
+    EXPECT_EQ( rules.match( "lib/docs/guide.pdf" ), IgnoreRules::NO_MATCH );
+}
+
+TEST(Ignore,lastMatchWins)
+{
+    IgnoreRules rules( "*.log\n!keep.log\n" );
+
+    EXPECT_EQ( rules.match( "run.log" ), IgnoreRules::IGNORE );
+    EXPECT_EQ( rules.match( "keep.log" ), IgnoreRules::INCLUDE );
+
+    IgnoreRules reversed( "!keep.log\n*.log\n" );
+
+    EXPECT_EQ( reversed.match( "keep.log" ), IgnoreRules::IGNORE );
+}